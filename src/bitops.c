@@ -1053,7 +1053,7 @@ void bitfieldCommand(client *c) {
                     setSignedBitfield(o->ptr,thisop->offset,
                                       thisop->bits,newval);
                 } else {
-                    addReply(c,shared.nullbulk);
+                    addReply(c,shared.null[c->resp]);
                 }
             } else {
                 uint64_t oldval, newval, wrapped, retval;
@@ -1082,7 +1082,7 @@ void bitfieldCommand(client *c) {
                     setUnsignedBitfield(o->ptr,thisop->offset,
                                         thisop->bits,newval);
                 } else {
-                    addReply(c,shared.nullbulk);
+                    addReply(c,shared.null[c->resp]);
                 }
             }
             changes++;
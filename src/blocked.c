@@ -65,7 +65,9 @@
 
 #include "server.h"
 
-int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb *db, robj *value, int where);
+int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb *db, robj *value);
+long serveClientBlockedOnListPop(client *receiver, robj *o, robj *key, int where, long count);
+void listPropagatePops(redisDb *db, robj *key, int where, long count);
 
 /* Get a timeout value from an object and store it into 'timeout'.
  * The final timeout is always stored as milliseconds as a time where the
@@ -168,6 +170,8 @@ void unblockClient(client *c) {
         unblockClientWaitingReplicas(c);
     } else if (c->btype == BLOCKED_MODULE) {
         unblockClientFromModule(c);
+    } else if (c->btype == BLOCKED_MIGRATE) {
+        unblockClientFromMigrate(c);
     } else {
         serverPanic("Unknown btype in unblockClient().");
     }
@@ -187,11 +191,13 @@ void replyToBlockedClientTimedOut(client *c) {
     if (c->btype == BLOCKED_LIST ||
         c->btype == BLOCKED_ZSET ||
         c->btype == BLOCKED_STREAM) {
-        addReply(c,shared.nullmultibulk);
+        addReply(c,shared.nullarray[c->resp]);
     } else if (c->btype == BLOCKED_WAIT) {
         addReplyLongLong(c,replicationCountAcksByOffset(c->bpop.reploffset));
     } else if (c->btype == BLOCKED_MODULE) {
         moduleBlockedClientTimedOut(c);
+    } else if (c->btype == BLOCKED_MIGRATE) {
+        addReplyError(c,"MIGRATE interrupted, not all the keys were moved");
     } else {
         serverPanic("Unknown btype in replyToBlockedClientTimedOut().");
     }
@@ -283,8 +289,15 @@ void handleClientsBlockedOnKeys(void) {
                 if (de) {
                     list *clients = dictGetVal(de);
                     int numclients = listLength(clients);
-
-                    while(numclients--) {
+                    /* Elements popped for BLPOP, BRPOP and BLMPOP clients
+                     * and not yet propagated, all from the 'popwhere' side:
+                     * they are propagated as a single command, unless a
+                     * BRPOPLPUSH or a pop from the other side is served in
+                     * the middle. */
+                    long popped = 0;
+                    int popwhere = LIST_HEAD;
+
+                    while(numclients-- && listTypeLength(o) != 0) {
                         listNode *clientnode = listFirst(clients);
                         client *receiver = clientnode->value;
 
@@ -297,38 +310,53 @@ void handleClientsBlockedOnKeys(void) {
                         }
 
                         robj *dstkey = receiver->bpop.target;
-                        int where = (receiver->lastcmd &&
-                                     receiver->lastcmd->proc == blpopCommand) ?
-                                     LIST_HEAD : LIST_TAIL;
-                        robj *value = listTypePop(o,where);
-
-                        if (value) {
-                            /* Protect receiver->bpop.target, that will be
-                             * freed by the next unblockClient()
-                             * call. */
-                            if (dstkey) incrRefCount(dstkey);
+                        int where = receiver->bpop.list_where;
+                        long count = receiver->bpop.list_count;
+
+                        if (popped && (dstkey || where != popwhere)) {
+                            listPropagatePops(rl->db,rl->key,popwhere,popped);
+                            popped = 0;
+                        }
+
+                        if (dstkey == NULL) {
                             unblockClient(receiver);
+                            popped += serveClientBlockedOnListPop(receiver,
+                                o,rl->key,where,count);
+                            popwhere = where;
+                            continue;
+                        }
 
-                            if (serveClientBlockedOnList(receiver,
-                                rl->key,dstkey,rl->db,value,
-                                where) == C_ERR)
-                            {
-                                /* If we failed serving the client we need
-                                 * to also undo the POP operation. */
-                                listTypePush(o,value,where);
-                            }
+                        /* BRPOPLPUSH */
+                        robj *value = listTypePop(o,LIST_TAIL);
 
-                            if (dstkey) decrRefCount(dstkey);
-                            decrRefCount(value);
-                        } else {
-                            break;
+                        /* Protect receiver->bpop.target, that will be
+                         * freed by the next unblockClient()
+                         * call. */
+                        incrRefCount(dstkey);
+                        unblockClient(receiver);
+
+                        if (serveClientBlockedOnList(receiver,
+                            rl->key,dstkey,rl->db,value) == C_ERR)
+                        {
+                            /* If we failed serving the client we need
+                             * to also undo the POP operation. */
+                            listTypePush(o,value,LIST_TAIL);
                         }
+
+                        decrRefCount(dstkey);
+                        decrRefCount(value);
                     }
+                    if (popped)
+                        listPropagatePops(rl->db,rl->key,popwhere,popped);
                 }
 
                 if (listTypeLength(o) == 0) {
                     dbDelete(rl->db,rl->key);
                     notifyKeyspaceEvent(NOTIFY_GENERIC,"del",rl->key,rl->db->id);
+                } else {
+                    /* The bytes accounted to the key when the elements were
+                     * pushed no longer include the ones popped. */
+                    memoryPrefixUpdateKey(rl->db,rl->key->ptr);
                 }
                 /* We don't call signalModifiedKey() as it was already called
                  * when an element was pushed on the list. */
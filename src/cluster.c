@@ -31,6 +31,7 @@
 #include "server.h"
 #include "cluster.h"
 #include "endianconv.h"
+#include "lz4.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -449,7 +450,10 @@ void clusterInit(void) {
         server.cluster->stats_bus_messages_sent[i] = 0;
         server.cluster->stats_bus_messages_received[i] = 0;
     }
+    server.cluster->stats_bus_messages_compact_sent = 0;
+    server.cluster->stats_bus_messages_compressed_sent = 0;
     server.cluster->stats_pfail_nodes = 0;
+    server.cluster->slots_to_channels = raxNew();
     memset(server.cluster->slots,0, sizeof(server.cluster->slots));
     clusterCloseAllSlots();
 
@@ -501,10 +505,9 @@ void clusterInit(void) {
         }
     }
 
-    /* The slots -> keys map is a radix tree. Initialize it here. */
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count,0,
-           sizeof(server.cluster->slots_keys_count));
+    /* The slots -> keys map is a set of lists linked through the main
+     * dictionary entries. Initialize the list heads here. */
+    slotToKeyInit();
 
     /* Set myself->port / cport to my listening ports, we'll just need to
      * discover the IP address via MEET messages. */
@@ -594,6 +597,9 @@ clusterLink *createClusterLink(clusterNode *node) {
     link->rcvbuf = sdsempty();
     link->node = node;
     link->fd = -1;
+    link->peer_compact = 0;
+    link->sent_slots = NULL;
+    link->recv_slots = NULL;
     return link;
 }
 
@@ -606,6 +612,8 @@ void freeClusterLink(clusterLink *link) {
     }
     sdsfree(link->sndbuf);
     sdsfree(link->rcvbuf);
+    zfree(link->sent_slots);
+    zfree(link->recv_slots);
     if (link->node)
         link->node->link = NULL;
     close(link->fd);
@@ -718,6 +726,12 @@ clusterNode *createClusterNode(char *nodename, int flags) {
     node->orphaned_time = 0;
     node->repl_offset_time = 0;
     node->repl_offset = 0;
+    /* A new node always counts as changed for the compact gossip. */
+    node->gossip_change_time = node->ctime;
+    node->gossip_flags = flags;
+    memset(node->gossip_ip,0,sizeof(node->gossip_ip));
+    node->gossip_port = 0;
+    node->gossip_cport = 0;
     listSetFreeMethod(node->fail_reports,zfree);
     return node;
 }
@@ -1670,7 +1684,9 @@ int clusterProcessPacket(clusterLink *link) {
 
         explen += sizeof(clusterMsgDataFail);
         if (totlen != explen) return 1;
-    } else if (type == CLUSTERMSG_TYPE_PUBLISH) {
+    } else if (type == CLUSTERMSG_TYPE_PUBLISH ||
+               type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+    {
         uint32_t explen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
 
         explen += sizeof(clusterMsgDataPublish) -
@@ -2040,6 +2056,23 @@ int clusterProcessPacket(clusterLink *link) {
             decrRefCount(channel);
             decrRefCount(message);
         }
+    } else if (type == CLUSTERMSG_TYPE_PUBLISHSHARD) {
+        robj *channel, *message;
+        uint32_t channel_len, message_len;
+
+        if (!sender) return 1;  /* We don't know that node. */
+        if (dictSize(server.pubsubshard_channels)) {
+            channel_len = ntohl(hdr->data.publish.msg.channel_len);
+            message_len = ntohl(hdr->data.publish.msg.message_len);
+            channel = createStringObject(
+                        (char*)hdr->data.publish.msg.bulk_data,channel_len);
+            message = createStringObject(
+                        (char*)hdr->data.publish.msg.bulk_data+channel_len,
+                        message_len);
+            pubsubPublishMessageShard(channel,message);
+            decrRefCount(channel);
+            decrRefCount(message);
+        }
     } else if (type == CLUSTERMSG_TYPE_FAILOVER_AUTH_REQUEST) {
         if (!sender) return 1;  /* We don't know that node. */
         clusterSendFailoverAuthIfNeeded(sender,hdr);
@@ -2136,6 +2169,77 @@ void clusterWriteHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         aeDeleteFileEvent(server.el, link->fd, AE_WRITABLE);
 }
 
+/* Turn the message in link->rcvbuf, that may use the compact encoding
+ * (see clusterSendMessage()), back into a plain CLUSTER_PROTO_VER message
+ * that clusterProcessPacket() can handle, and remember the slots bitmap
+ * of full headers sent by compact peers. Messages with unknown versions are
+ * left untouched, clusterProcessPacket() will discard them.
+ *
+ * Returns C_ERR if the message is malformed. */
+int clusterDecodeMessage(clusterLink *link) {
+    clusterMsg *hdr = (clusterMsg*) link->rcvbuf;
+    uint32_t totlen = ntohl(hdr->totlen);
+    uint16_t ver = ntohs(hdr->ver);
+    size_t slotsoff = offsetof(clusterMsg,myslots);
+    size_t slotslen = sizeof(hdr->myslots);
+
+    if (ver == CLUSTER_PROTO_VER_NOSLOTS) {
+        /* Put back the bitmap we got with the last full header. */
+        if (link->recv_slots == NULL) return C_ERR;
+        sds full = sdsnewlen(NULL,totlen+slotslen);
+        memcpy(full,link->rcvbuf,slotsoff);
+        memcpy(full+slotsoff,link->recv_slots,slotslen);
+        memcpy(full+slotsoff+slotslen,link->rcvbuf+slotsoff,totlen-slotsoff);
+        sdsfree(link->rcvbuf);
+        link->rcvbuf = full;
+        hdr = (clusterMsg*) full;
+        totlen += slotslen;
+        hdr->ver = htons(CLUSTER_PROTO_VER);
+        hdr->totlen = htonl(totlen);
+    } else if (ver == CLUSTER_PROTO_VER) {
+        if (totlen < CLUSTERMSG_MIN_LEN) return C_ERR;
+        if (hdr->mflags[0] & CLUSTERMSG_FLAG0_COMPACT) {
+            if (link->recv_slots == NULL) link->recv_slots = zmalloc(slotslen);
+            memcpy(link->recv_slots,hdr->myslots,slotslen);
+        } else {
+            zfree(link->recv_slots);
+            link->recv_slots = NULL;
+        }
+    } else {
+        return C_OK;
+    }
+    link->peer_compact = (hdr->mflags[0] & CLUSTERMSG_FLAG0_COMPACT) != 0;
+
+    if (hdr->mflags[1] & CLUSTERMSG_FLAG1_COMPRESSED) {
+        unsigned char *data = (unsigned char*) link->rcvbuf+CLUSTERMSG_MIN_LEN;
+        uint32_t datalen, rawlen;
+
+        if (totlen < CLUSTERMSG_MIN_LEN+4) return C_ERR;
+        datalen = totlen-CLUSTERMSG_MIN_LEN-4;
+        memcpy(&rawlen,data,4);
+        rawlen = ntohl(rawlen);
+        /* LZ4 can't expand the data more than 255 times: this also bounds
+         * the buffer we allocate to the size of the received message. */
+        if (rawlen <= datalen || (uint64_t)rawlen > (uint64_t)datalen*255)
+            return C_ERR;
+
+        sds raw = sdsnewlen(NULL,CLUSTERMSG_MIN_LEN+rawlen);
+        memcpy(raw,link->rcvbuf,CLUSTERMSG_MIN_LEN);
+        if (lz4_decompress(data+4,datalen,raw+CLUSTERMSG_MIN_LEN,rawlen)
+            != rawlen)
+        {
+            sdsfree(raw);
+            return C_ERR;
+        }
+        sdsfree(link->rcvbuf);
+        link->rcvbuf = raw;
+        hdr = (clusterMsg*) raw;
+        hdr->mflags[1] &= ~CLUSTERMSG_FLAG1_COMPRESSED;
+        hdr->totlen = htonl(CLUSTERMSG_MIN_LEN+rawlen);
+    }
+    return C_OK;
+}
+
 /* Read data. Try to read the first field of the header first to check the
  * full length of the packet. When a whole packet is in memory this function
  * will call the function to process the packet. And so forth. */
@@ -2161,7 +2265,7 @@ void clusterReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                 /* Perform some sanity check on the message signature
                  * and length. */
                 if (memcmp(hdr->sig,"RCmb",4) != 0 ||
-                    ntohl(hdr->totlen) < CLUSTERMSG_MIN_LEN)
+                    ntohl(hdr->totlen) < CLUSTERMSG_NOSLOTS_MIN_LEN)
                 {
                     serverLog(LL_WARNING,
                         "Bad message length or signature received "
@@ -2192,6 +2296,12 @@ void clusterReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
         /* Total length obtained? Process this packet. */
         if (rcvbuflen >= 8 && rcvbuflen == ntohl(hdr->totlen)) {
+            if (clusterDecodeMessage(link) == C_ERR) {
+                serverLog(LL_WARNING,
+                    "Bad compact message received from Cluster bus.");
+                handleLinkIOError(link);
+                return;
+            }
             if (clusterProcessPacket(link)) {
                 sdsfree(link->rcvbuf);
                 link->rcvbuf = sdsempty();
@@ -2202,17 +2312,125 @@ void clusterReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
-/* Put stuff into the send buffer.
+/* Return the data section of the message 'msg' compressed with LZ4 and
+ * prefixed by its original length, as described by the
+ * CLUSTERMSG_FLAG1_COMPRESSED flag, or NULL if the data is too small to be
+ * worth compressing or does not compress. Only messages of nodes using the
+ * compact encoding are compressed. */
+sds clusterCompressMessageData(unsigned char *msg, size_t msglen) {
+    clusterMsg *hdr = (clusterMsg*) msg;
+    size_t datalen;
+    unsigned int complen;
+    uint32_t rawlen;
+
+    if (!(hdr->mflags[0] & CLUSTERMSG_FLAG0_COMPACT)) return NULL;
+    if (msglen < CLUSTERMSG_MIN_LEN+CLUSTERMSG_COMPRESS_MIN_LEN) return NULL;
+    datalen = msglen-CLUSTERMSG_MIN_LEN;
+    if (datalen > UINT32_MAX) return NULL;
+
+    /* We want to save at least the 4 bytes of the length prefix. */
+    sds data = sdsnewlen(NULL,datalen);
+    complen = lz4_compress(msg+CLUSTERMSG_MIN_LEN,datalen,data+4,datalen-8);
+    if (complen == 0) {
+        sdsfree(data);
+        return NULL;
+    }
+    rawlen = htonl(datalen);
+    memcpy(data,&rawlen,4);
+    sdssetlen(data,complen+4);
+    return data;
+}
+
+/* Queue the message 'msg' on the link, using the compact encoding if the
+ * peer supports it: the myslots field is omitted from the header if the peer
+ * already got the same bitmap on this link (CLUSTER_PROTO_VER_NOSLOTS), and
+ * the data section is replaced by 'compressed' if not NULL (see
+ * clusterCompressMessageData()). */
+void clusterSendEncodedMessage(clusterLink *link, unsigned char *msg,
+                               size_t msglen, sds compressed)
+{
+    clusterMsg *hdr = (clusterMsg*) msg;
+    size_t slotsoff = offsetof(clusterMsg,myslots);
+    size_t slotslen = sizeof(hdr->myslots);
+    int compact = (hdr->mflags[0] & CLUSTERMSG_FLAG0_COMPACT) &&
+                  link->peer_compact && msglen >= CLUSTERMSG_MIN_LEN;
+
+    if (!compact) {
+        /* The peer caches the bitmap of full headers only if we flag
+         * ourselves as compact. */
+        if (hdr->mflags[0] & CLUSTERMSG_FLAG0_COMPACT &&
+            msglen >= CLUSTERMSG_MIN_LEN)
+        {
+            if (link->sent_slots == NULL) link->sent_slots = zmalloc(slotslen);
+            memcpy(link->sent_slots,hdr->myslots,slotslen);
+        } else {
+            zfree(link->sent_slots);
+            link->sent_slots = NULL;
+        }
+        link->sndbuf = sdscatlen(link->sndbuf, msg, msglen);
+        return;
+    }
+
+    int noslots = link->sent_slots &&
+                  memcmp(link->sent_slots,hdr->myslots,slotslen) == 0;
+    if (!noslots && compressed == NULL) {
+        if (link->sent_slots == NULL) link->sent_slots = zmalloc(slotslen);
+        memcpy(link->sent_slots,hdr->myslots,slotslen);
+        link->sndbuf = sdscatlen(link->sndbuf, msg, msglen);
+        return;
+    }
+
+    /* Patch a copy of the header, and write the message in pieces. */
+    union {
+        clusterMsg msg;
+        unsigned char bytes[CLUSTERMSG_MIN_LEN];
+    } copy;
+    size_t datalen = compressed ? sdslen(compressed) :
+                                  msglen-CLUSTERMSG_MIN_LEN;
+    size_t totlen = CLUSTERMSG_MIN_LEN+datalen;
+
+    memcpy(copy.bytes,msg,CLUSTERMSG_MIN_LEN);
+    if (compressed) {
+        copy.msg.mflags[1] |= CLUSTERMSG_FLAG1_COMPRESSED;
+        server.cluster->stats_bus_messages_compressed_sent++;
+    }
+    if (noslots) {
+        copy.msg.ver = htons(CLUSTER_PROTO_VER_NOSLOTS);
+        totlen -= slotslen;
+        server.cluster->stats_bus_messages_compact_sent++;
+    } else {
+        if (link->sent_slots == NULL) link->sent_slots = zmalloc(slotslen);
+        memcpy(link->sent_slots,hdr->myslots,slotslen);
+    }
+    copy.msg.totlen = htonl(totlen);
+
+    if (noslots) {
+        link->sndbuf = sdscatlen(link->sndbuf,copy.bytes,slotsoff);
+        link->sndbuf = sdscatlen(link->sndbuf,copy.bytes+slotsoff+slotslen,
+                                 CLUSTERMSG_MIN_LEN-slotsoff-slotslen);
+    } else {
+        link->sndbuf = sdscatlen(link->sndbuf,copy.bytes,CLUSTERMSG_MIN_LEN);
+    }
+    if (compressed)
+        link->sndbuf = sdscatlen(link->sndbuf,compressed,datalen);
+    else
+        link->sndbuf = sdscatlen(link->sndbuf,msg+CLUSTERMSG_MIN_LEN,datalen);
+}
+
+/* Put stuff into the send buffer, using the compressed data section
+ * 'compressed' (that may be NULL) if the peer supports it.
  *
  * It is guaranteed that this function will never have as a side effect
  * the link to be invalidated, so it is safe to call this function
  * from event handlers that will do stuff with the same link later. */
-void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
+void clusterSendMessageWithData(clusterLink *link, unsigned char *msg,
+                                size_t msglen, sds compressed)
+{
     if (sdslen(link->sndbuf) == 0 && msglen != 0)
         aeCreateFileEvent(server.el,link->fd,AE_WRITABLE|AE_BARRIER,
                     clusterWriteHandler,link);
 
-    link->sndbuf = sdscatlen(link->sndbuf, msg, msglen);
+    clusterSendEncodedMessage(link,msg,msglen,compressed);
 
     /* Populate sent messages stats. */
     clusterMsg *hdr = (clusterMsg*) msg;
@@ -2221,6 +2439,15 @@ void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
         server.cluster->stats_bus_messages_sent[type]++;
 }
 
+/* Put stuff into the send buffer. See clusterSendMessageWithData(). */
+void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
+    sds compressed = NULL;
+
+    if (link->peer_compact) compressed = clusterCompressMessageData(msg,msglen);
+    clusterSendMessageWithData(link,msg,msglen,compressed);
+    sdsfree(compressed);
+}
+
 /* Send a message to all the nodes that are part of the cluster having
  * a connected link.
  *
@@ -2230,6 +2457,8 @@ void clusterSendMessage(clusterLink *link, unsigned char *msg, size_t msglen) {
 void clusterBroadcastMessage(void *buf, size_t len) {
     dictIterator *di;
     dictEntry *de;
+    sds compressed = NULL;
+    int compressed_tried = 0;
 
     di = dictGetSafeIterator(server.cluster->nodes);
     while((de = dictNext(di)) != NULL) {
@@ -2238,9 +2467,32 @@ void clusterBroadcastMessage(void *buf, size_t len) {
         if (!node->link) continue;
         if (node->flags & (CLUSTER_NODE_MYSELF|CLUSTER_NODE_HANDSHAKE))
             continue;
-        clusterSendMessage(node->link,buf,len);
+        /* Compress the message once for all the compact peers. */
+        if (node->link->peer_compact && !compressed_tried) {
+            compressed = clusterCompressMessageData(buf,len);
+            compressed_tried = 1;
+        }
+        clusterSendMessageWithData(node->link,buf,len,
+            node->link->peer_compact ? compressed : NULL);
     }
     dictReleaseIterator(di);
+    sdsfree(compressed);
+}
+
+/* Send a message to the other nodes of our shard: our master, if we are a
+ * replica, and all its replicas. */
+void clusterBroadcastToShard(void *buf, size_t len) {
+    clusterNode *master = nodeIsSlave(myself) ? myself->slaveof : myself;
+    int j;
+
+    if (master == NULL) return;
+    for (j = -1; j < master->numslaves; j++) {
+        clusterNode *node = (j == -1) ? master : master->slaves[j];
+
+        if (node == myself || !node->link) continue;
+        if (node->flags & CLUSTER_NODE_HANDSHAKE) continue;
+        clusterSendMessage(node->link,buf,len);
+    }
 }
 
 /* Build the message header. hdr must point to a buffer at least
@@ -2305,6 +2557,8 @@ void clusterBuildMessageHdr(clusterMsg *hdr, int type) {
     /* Set the message flags. */
     if (nodeIsMaster(myself) && server.cluster->mf_end)
         hdr->mflags[0] |= CLUSTERMSG_FLAG0_PAUSED;
+    if (server.cluster_bus_compact)
+        hdr->mflags[0] |= CLUSTERMSG_FLAG0_COMPACT;
 
     /* Compute the message length for certain messages. For other messages
      * this is up to the caller. */
@@ -2346,6 +2600,26 @@ void clusterSetGossipEntry(clusterMsg *hdr, int i, clusterNode *n) {
     gossip->notused1 = 0;
 }
 
+/* Return non zero if the flags or the address of the node 'n' changed in the
+ * last node_timeout*2 milliseconds, the failure reports validity time.
+ * Nodes using the compact bus encoding gossip mostly about such nodes. */
+int clusterNodeGossipChanged(clusterNode *n) {
+    mstime_t now = mstime();
+
+    if (n->gossip_flags != n->flags ||
+        n->gossip_port != n->port ||
+        n->gossip_cport != n->cport ||
+        memcmp(n->gossip_ip,n->ip,sizeof(n->ip)) != 0)
+    {
+        n->gossip_flags = n->flags;
+        n->gossip_port = n->port;
+        n->gossip_cport = n->cport;
+        memcpy(n->gossip_ip,n->ip,sizeof(n->ip));
+        n->gossip_change_time = now;
+    }
+    return now - n->gossip_change_time <= server.cluster_node_timeout*2;
+}
+
 /* Send a PING or PONG packet to the specified node, making sure to add enough
  * gossip informations. */
 void clusterSendPing(clusterLink *link, int type) {
@@ -2385,7 +2659,13 @@ void clusterSendPing(clusterLink *link, int type) {
      *
      * Since we have non-voting slaves that lower the probability of an entry
      * to feature our node, we set the number of entries per packet as
-     * 10% of the total nodes we have. */
+     * 10% of the total nodes we have.
+     *
+     * Note that failure reports are only generated by nodes in PFAIL state,
+     * that are always added below. So when the compact bus encoding is
+     * used, beyond the first 3 random entries, we only add the nodes whose
+     * state changed recently: the other entries would just tell the receiver
+     * what it already knows. */
     wanted = floor(dictSize(server.cluster->nodes)/10);
     if (wanted < 3) wanted = 3;
     if (wanted > freshnodes) wanted = freshnodes;
@@ -2411,6 +2691,7 @@ void clusterSendPing(clusterLink *link, int type) {
     clusterBuildMessageHdr(hdr,type);
 
     /* Populate the gossip fields */
+    int compact = server.cluster_bus_compact && link->peer_compact;
     int maxiterations = wanted*3;
     while(freshnodes > 0 && gossipcount < wanted && maxiterations--) {
         dictEntry *de = dictGetRandomKey(server.cluster->nodes);
@@ -2438,6 +2719,10 @@ void clusterSendPing(clusterLink *link, int type) {
         /* Do not add a node we already have. */
         if (clusterNodeIsInGossipSection(hdr,gossipcount,this)) continue;
 
+        /* Compact encoding: skip the nodes that did not change. */
+        if (compact && gossipcount >= 3 && !clusterNodeGossipChanged(this))
+            continue;
+
         /* Add it */
         clusterSetGossipEntry(hdr,gossipcount,this);
         freshnodes--;
@@ -2513,10 +2798,13 @@ void clusterBroadcastPong(int target) {
     dictReleaseIterator(di);
 }
 
-/* Send a PUBLISH message.
+/* Send a PUBLISH or PUBLISHSHARD message, according to 'type'.
  *
- * If link is NULL, then the message is broadcasted to the whole cluster. */
-void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
+ * If link is NULL, then the message is broadcasted to the whole cluster,
+ * or only to the nodes of our shard for PUBLISHSHARD messages. */
+void clusterSendPublish(clusterLink *link, robj *channel, robj *message,
+                        uint16_t type)
+{
     unsigned char buf[sizeof(clusterMsg)], *payload;
     clusterMsg *hdr = (clusterMsg*) buf;
     uint32_t totlen;
@@ -2527,7 +2815,7 @@ void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
     channel_len = sdslen(channel->ptr);
     message_len = sdslen(message->ptr);
 
-    clusterBuildMessageHdr(hdr,CLUSTERMSG_TYPE_PUBLISH);
+    clusterBuildMessageHdr(hdr,type);
     totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
     totlen += sizeof(clusterMsgDataPublish) - 8 + channel_len + message_len;
 
@@ -2549,6 +2837,8 @@ void clusterSendPublish(clusterLink *link, robj *channel, robj *message) {
 
     if (link)
         clusterSendMessage(link,payload,totlen);
+    else if (type == CLUSTERMSG_TYPE_PUBLISHSHARD)
+        clusterBroadcastToShard(payload,totlen);
     else
         clusterBroadcastMessage(payload,totlen);
 
@@ -2644,12 +2934,84 @@ int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uin
 /* -----------------------------------------------------------------------------
  * CLUSTER Pub/Sub support
  *
- * For now we do very little, just propagating PUBLISH messages across the whole
- * cluster. In the future we'll try to get smarter and avoiding propagating those
- * messages to hosts without receives for a given channel.
+ * PUBLISH messages are propagated across the whole cluster, since global
+ * channels may have subscribers on every node. Shard channels (SPUBLISH) are
+ * hashed to a slot like keys, so their messages are only propagated inside
+ * the shard serving the slot.
  * -------------------------------------------------------------------------- */
 void clusterPropagatePublish(robj *channel, robj *message) {
-    clusterSendPublish(NULL, channel, message);
+    clusterSendPublish(NULL, channel, message, CLUSTERMSG_TYPE_PUBLISH);
+}
+
+void clusterPropagatePublishShard(robj *channel, robj *message) {
+    clusterSendPublish(NULL, channel, message, CLUSTERMSG_TYPE_PUBLISHSHARD);
+}
+
+/* Compose the key of 'channel' in the slots_to_channels radix tree. */
+static unsigned char *slotToChannelKey(sds channel, unsigned char *buf,
+                                       size_t buflen, size_t *keylen)
+{
+    unsigned int hashslot = keyHashSlot(channel,sdslen(channel));
+    unsigned char *indexed = buf;
+
+    *keylen = sdslen(channel)+2;
+    if (*keylen > buflen) indexed = zmalloc(*keylen);
+    indexed[0] = (hashslot >> 8) & 0xff;
+    indexed[1] = hashslot & 0xff;
+    memcpy(indexed+2,channel,sdslen(channel));
+    return indexed;
+}
+
+/* Remember that the shard channel 'channel' has subscribers. */
+void slotToChannelAdd(sds channel) {
+    unsigned char buf[64], *indexed;
+    size_t keylen;
+
+    indexed = slotToChannelKey(channel,buf,sizeof(buf),&keylen);
+    raxInsert(server.cluster->slots_to_channels,indexed,keylen,NULL,NULL);
+    if (indexed != buf) zfree(indexed);
+}
+
+/* The shard channel 'channel' has no longer subscribers. */
+void slotToChannelDel(sds channel) {
+    unsigned char buf[64], *indexed;
+    size_t keylen;
+
+    indexed = slotToChannelKey(channel,buf,sizeof(buf),&keylen);
+    raxRemove(server.cluster->slots_to_channels,indexed,keylen,NULL);
+    if (indexed != buf) zfree(indexed);
+}
+
+/* Unsubscribe all the clients from the shard channels of 'slot', that this
+ * node is no longer serving. */
+void clusterRemoveChannelsInSlot(unsigned int slot) {
+    unsigned char prefix[2];
+    raxIterator iter;
+    list *channels = listCreate();
+    listNode *ln;
+    listIter li;
+
+    prefix[0] = (slot >> 8) & 0xff;
+    prefix[1] = slot & 0xff;
+
+    /* Collect the channels first: unsubscribing modifies the tree. */
+    raxStart(&iter,server.cluster->slots_to_channels);
+    raxSeek(&iter,">=",prefix,2);
+    while(raxNext(&iter)) {
+        if (iter.key_len < 2 || memcmp(iter.key,prefix,2) != 0) break;
+        listAddNodeTail(channels,createStringObject((char*)iter.key+2,
+                                                    iter.key_len-2));
+    }
+    raxStop(&iter);
+
+    listRewind(channels,&li);
+    while((ln = listNext(&li)) != NULL) {
+        robj *channel = ln->value;
+
+        pubsubShardUnsubscribeAllClients(channel);
+        decrRefCount(channel);
+    }
+    listRelease(channels);
 }
 
 /* -----------------------------------------------------------------------------
@@ -3717,6 +4079,15 @@ int clusterDelSlot(int slot) {
     clusterNode *n = server.cluster->slots[slot];
 
     if (!n) return C_ERR;
+
+    /* Subscribers of the shard channels of the slot, on the master and the
+     * replicas that were serving it, have to subscribe again to the new
+     * owner of the slot. */
+    if (raxSize(server.cluster->slots_to_channels) &&
+        (n == myself || (nodeIsSlave(myself) && myself->slaveof == n)))
+    {
+        clusterRemoveChannelsInSlot(slot);
+    }
     serverAssert(clusterNodeClearSlotBit(n,slot) == 1);
     server.cluster->slots[slot] = NULL;
     return C_OK;
@@ -4099,6 +4470,7 @@ const char *clusterGetMessageTypeString(int type) {
     case CLUSTERMSG_TYPE_UPDATE: return "update";
     case CLUSTERMSG_TYPE_MFSTART: return "mfstart";
     case CLUSTERMSG_TYPE_MODULE: return "module";
+    case CLUSTERMSG_TYPE_PUBLISHSHARD: return "publishshard";
     }
     return "unknown";
 }
@@ -4486,6 +4858,11 @@ NULL
         }
         info = sdscatprintf(info,
             "cluster_stats_messages_sent:%lld\r\n", tot_msg_sent);
+        info = sdscatprintf(info,
+            "cluster_stats_messages_compact_sent:%lld\r\n"
+            "cluster_stats_messages_compressed_sent:%lld\r\n",
+            server.cluster->stats_bus_messages_compact_sent,
+            server.cluster->stats_bus_messages_compressed_sent);
 
         for (int i = 0; i < CLUSTERMSG_TYPE_COUNT; i++) {
             if (server.cluster->stats_bus_messages_received[i] == 0) continue;
@@ -4838,7 +5215,7 @@ void dumpCommand(client *c) {
 
     /* Check if the key is here. */
     if ((o = lookupKeyRead(c->db,c->argv[1])) == NULL) {
-        addReply(c,shared.nullbulk);
+        addReply(c,shared.null[c->resp]);
         return;
     }
 
@@ -4852,6 +5229,13 @@ void dumpCommand(client *c) {
     return;
 }
 
+/* Return the name the value of 'key' is assembled under by RESTORE-CHUNK
+ * in client->restore_chunks: the same key name may be transferred in more
+ * than one DB by the same client. */
+sds restoreChunkName(client *c, robj *key) {
+    return sdscatfmt(sdsempty(),"%i:%S",c->db->id,key->ptr);
+}
+
 /* RESTORE key ttl serialized-value [REPLACE] */
 void restoreCommand(client *c) {
     long long ttl, lfu_freq = -1, lru_idle = -1, lru_clock = -1;
@@ -4925,6 +5309,14 @@ void restoreCommand(client *c) {
     /* Remove the old key if needed. */
     if (replace) dbDelete(c->db,c->argv[1]);
 
+    /* A MIGRATE that gave up sending this key in chunks may leave an
+     * incomplete RESTORE-CHUNK transfer behind: the key is now complete. */
+    if (c->restore_chunks) {
+        sds name = restoreChunkName(c,c->argv[1]);
+        dictDelete(c->restore_chunks,name);
+        sdsfree(name);
+    }
+
     /* Create the key and set the TTL if any */
     dbAdd(c->db,c->argv[1],obj);
     if (ttl) {
@@ -4937,6 +5329,195 @@ void restoreCommand(client *c) {
     server.dirty++;
 }
 
+/* Add the elements of the RESTORE-CHUNK value 'src' to the value being
+ * assembled 'dst'. Both objects are of the same type. */
+void restoreChunkMerge(robj *dst, robj *src) {
+    if (dst->type == OBJ_LIST) {
+        listTypeIterator *li = listTypeInitIterator(src,0,LIST_TAIL);
+        listTypeEntry entry;
+
+        while (listTypeNext(li,&entry)) {
+            robj *value = listTypeGet(&entry);
+            listTypePush(dst,value,LIST_TAIL);
+            decrRefCount(value);
+        }
+        listTypeReleaseIterator(li);
+    } else if (dst->type == OBJ_SET) {
+        setTypeIterator *si = setTypeInitIterator(src);
+        sds ele;
+
+        while ((ele = setTypeNextObject(si)) != NULL) {
+            setTypeAdd(dst,ele);
+            sdsfree(ele);
+        }
+        setTypeReleaseIterator(si);
+    } else if (dst->type == OBJ_ZSET) {
+        dictIterator *di;
+        dictEntry *de;
+
+        if (src->encoding == OBJ_ENCODING_ZIPLIST)
+            zsetConvert(src,server.zset_large_encoding);
+        di = dictGetIterator(((zset*)src->ptr)->dict);
+        while ((de = dictNext(di)) != NULL) {
+            int flags = ZADD_NONE;
+            zsetAdd(dst,zsetDictGetScore(src->ptr,de),
+                    dictGetKey(de),&flags,NULL);
+        }
+        dictReleaseIterator(di);
+    } else if (dst->type == OBJ_HASH) {
+        hashTypeIterator *hi = hashTypeInitIterator(src);
+
+        while (hashTypeNext(hi) != C_ERR) {
+            sds field = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_KEY);
+            sds value = hashTypeCurrentObjectNewSds(hi,OBJ_HASH_VALUE);
+
+            if (dst->encoding == OBJ_ENCODING_ZIPLIST &&
+                (sdslen(field) > server.hash_max_ziplist_value ||
+                 sdslen(value) > server.hash_max_ziplist_value))
+            {
+                hashTypeConvert(dst,OBJ_ENCODING_HT);
+            }
+            hashTypeSet(dst,field,value,
+                        HASH_SET_TAKE_FIELD|HASH_SET_TAKE_VALUE);
+        }
+        hashTypeReleaseIterator(hi);
+    }
+}
+
+/* RESTORE-CHUNK key ttl serialized-value [FIRST] [LAST] [REPLACE]
+ *
+ * Used by MIGRATE to transfer large keys in chunks. Every chunk is a DUMP
+ * payload of a list, set, sorted set or hash holding part of the elements
+ * of the key. The chunks are accumulated in the client structure, starting
+ * from the FIRST one, and only when the LAST chunk is received the key is
+ * created: other clients never observe a partially transferred value.
+ *
+ * The chunks are not propagated. Once the key is complete, it is propagated
+ * to replicas and AOF as a single RESTORE command. */
+void restoreChunkCommand(client *c) {
+    long long ttl;
+    rio payload;
+    int j, type, first = 0, last = 0, replace = 0;
+    robj *obj, *value, **argv;
+    dictEntry *de;
+    sds name;
+
+    /* Parse additional options */
+    for (j = 4; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"first")) {
+            first = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"last")) {
+            last = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"replace")) {
+            replace = 1;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* From now on every error discards the value being assembled, so that
+     * a transfer MIGRATE gave up is never completed by a later chunk. */
+    name = restoreChunkName(c,c->argv[1]);
+
+    /* Make sure this key does not already exist here... */
+    if (!replace && lookupKeyWrite(c->db,c->argv[1]) != NULL) {
+        addReply(c,shared.busykeyerr);
+        goto err;
+    }
+
+    /* Check if the TTL value makes sense */
+    if (getLongLongFromObjectOrReply(c,c->argv[2],&ttl,NULL) != C_OK) {
+        goto err;
+    } else if (ttl < 0) {
+        addReplyError(c,"Invalid TTL value, must be >= 0");
+        goto err;
+    }
+
+    /* Verify RDB version and data checksum. */
+    if (verifyDumpPayload(c->argv[3]->ptr,sdslen(c->argv[3]->ptr)) == C_ERR)
+    {
+        addReplyError(c,"DUMP payload version or checksum are wrong");
+        goto err;
+    }
+
+    rioInitWithBuffer(&payload,c->argv[3]->ptr);
+    if (((type = rdbLoadObjectType(&payload)) == -1) ||
+        ((obj = rdbLoadObject(type,&payload,c->argv[1])) == NULL))
+    {
+        addReplyError(c,"Bad data format");
+        goto err;
+    }
+    if (obj->type != OBJ_LIST && obj->type != OBJ_SET &&
+        obj->type != OBJ_ZSET && obj->type != OBJ_HASH)
+    {
+        decrRefCount(obj);
+        addReplyError(c,"RESTORE-CHUNK only supports lists, sets, "
+                        "sorted sets and hashes");
+        goto err;
+    }
+
+    if (first) {
+        /* Start a new transfer, discarding any incomplete one. */
+        if (c->restore_chunks == NULL)
+            c->restore_chunks = dictCreate(&restoreChunksDictType,NULL);
+        dictDelete(c->restore_chunks,name);
+        dictAdd(c->restore_chunks,sdsdup(name),obj);
+        value = obj;
+    } else {
+        de = c->restore_chunks ? dictFind(c->restore_chunks,name) : NULL;
+        if (de == NULL) {
+            decrRefCount(obj);
+            addReplyError(c,"No RESTORE-CHUNK transfer in progress for "
+                            "this key");
+            goto err;
+        }
+        value = dictGetVal(de);
+        if (value->type != obj->type) {
+            decrRefCount(obj);
+            addReplyError(c,"RESTORE-CHUNK type mismatch");
+            goto err;
+        }
+        restoreChunkMerge(value,obj);
+        decrRefCount(obj);
+    }
+
+    if (!last) {
+        sdsfree(name);
+        addReply(c,shared.ok);
+        return;
+    }
+
+    /* The value is complete: take it out of the client and create the
+     * key, exactly like RESTORE would do. */
+    incrRefCount(value);
+    dictDelete(c->restore_chunks,name);
+    sdsfree(name);
+    if (replace) dbDelete(c->db,c->argv[1]);
+    dbAdd(c->db,c->argv[1],value);
+    if (ttl) setExpire(c,c->db,c->argv[1],ttl+mstime());
+    signalModifiedKey(c->db,c->argv[1]);
+    server.dirty++;
+
+    /* Propagate the whole value as RESTORE ... REPLACE. */
+    createDumpPayload(&payload,value,c->argv[1]);
+    argv = zmalloc(sizeof(robj*)*5);
+    argv[0] = createStringObject("RESTORE",7);
+    argv[1] = c->argv[1];
+    incrRefCount(argv[1]);
+    argv[2] = c->argv[2];
+    incrRefCount(argv[2]);
+    argv[3] = createObject(OBJ_STRING,payload.io.buffer.ptr);
+    argv[4] = createStringObject("REPLACE",7);
+    replaceClientCommandVector(c,5,argv);
+    addReply(c,shared.ok);
+    return;
+
+err:
+    if (c->restore_chunks) dictDelete(c->restore_chunks,name);
+    sdsfree(name);
+}
+
 /* MIGRATE socket cache implementation.
  *
  * We take a map between host:ip and a TCP socket that we used to connect
@@ -4952,6 +5533,28 @@ typedef struct migrateCachedSocket {
     time_t last_use_time;
 } migrateCachedSocket;
 
+/* Connect to the target instance, waiting at most 'timeout' milliseconds.
+ * Returns the socket, or -1 after sending the error to the client. */
+int migrateConnect(client *c, robj *host, robj *port, long timeout) {
+    int fd = anetTcpNonBlockConnect(server.neterr,host->ptr,atoi(port->ptr));
+
+    if (fd == -1) {
+        addReplyErrorFormat(c,"Can't connect to target node: %s",
+            server.neterr);
+        return -1;
+    }
+    anetEnableTcpNoDelay(server.neterr,fd);
+
+    /* Check if it connects within the specified timeout. */
+    if ((aeWait(fd,AE_WRITABLE,timeout) & AE_WRITABLE) == 0) {
+        addReplySds(c,
+            sdsnew("-IOERR error or timeout connecting to the client\r\n"));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 /* Return a migrateCachedSocket containing a TCP socket connected with the
  * target instance, possibly returning a cached one.
  *
@@ -4990,22 +5593,9 @@ migrateCachedSocket* migrateGetSocket(client *c, robj *host, robj *port, long ti
     }
 
     /* Create the socket */
-    fd = anetTcpNonBlockConnect(server.neterr,c->argv[1]->ptr,
-                                atoi(c->argv[2]->ptr));
+    fd = migrateConnect(c,host,port,timeout);
     if (fd == -1) {
         sdsfree(name);
-        addReplyErrorFormat(c,"Can't connect to target node: %s",
-            server.neterr);
-        return NULL;
-    }
-    anetEnableTcpNoDelay(server.neterr,fd);
-
-    /* Check if it connects within the specified timeout. */
-    if ((aeWait(fd,AE_WRITABLE,timeout) & AE_WRITABLE) == 0) {
-        sdsfree(name);
-        addReplySds(c,
-            sdsnew("-IOERR error or timeout connecting to the client\r\n"));
-        close(fd);
         return NULL;
     }
 
@@ -5054,12 +5644,846 @@ void migrateCloseTimedoutSockets(void) {
     dictReleaseIterator(di);
 }
 
+/* Used by MIGRATE SLOT once the target has a copy of every key of the slot:
+ * ask the target to take ownership of the slot, then do the same locally.
+ *
+ * If 'password' is not NULL the connection is authenticated first, since
+ * no key may have been sent on it.
+ *
+ * On error C_ERR is returned and an error is sent to the client. If
+ * 'socket_error' is set, the caller should close the cached socket. */
+int migrateAssignSlotToTarget(client *c, migrateCachedSocket *cs, int slot,
+                              clusterNode *target, char *password,
+                              long timeout, int *socket_error)
+{
+    rio cmd;
+    char buf0[1024], buf[1024];
+    sds query;
+    int retval = C_ERR;
+
+    *socket_error = 0;
+    rioInitWithBuffer(&cmd,sdsempty());
+    if (password) {
+        serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"AUTH",4));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,password,
+            sdslen(password)));
+    }
+    serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',5));
+    serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"CLUSTER",7));
+    serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SETSLOT",7));
+    serverAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,slot));
+    serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"NODE",4));
+    serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,target->name,
+                                                   CLUSTER_NAMELEN));
+    query = cmd.io.buffer.ptr;
+
+    if (syncWrite(cs->fd,query,sdslen(query),timeout) != (ssize_t)sdslen(query) ||
+        (password && syncReadLine(cs->fd,buf0,sizeof(buf0),timeout) <= 0) ||
+        syncReadLine(cs->fd,buf,sizeof(buf),timeout) <= 0)
+    {
+        *socket_error = 1;
+        addReplySds(c,sdsnew("-IOERR error or timeout assigning the hash "
+                             "slot to the target instance\r\n"));
+        goto cleanup;
+    }
+    if ((password && buf0[0] == '-') || buf[0] == '-') {
+        addReplyErrorFormat(c,"Target instance replied with error: %s",
+            (password && buf0[0] == '-') ? buf0+1 : buf+1);
+        goto cleanup;
+    }
+
+    /* The target now owns the slot (and bumped its configEpoch since it
+     * was importing it): we can assign it locally as well. */
+    server.cluster->migrating_slots_to[slot] = NULL;
+    clusterDelSlot(slot);
+    clusterAddSlot(target,slot);
+    clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG|CLUSTER_TODO_UPDATE_STATE);
+    retval = C_OK;
+
+cleanup:
+    sdsfree(query);
+    return retval;
+}
+
+/* -----------------------------------------------------------------------------
+ * Chunked MIGRATE
+ *
+ * Serializing and sending a very large key blocks the server for as long as
+ * the transfer takes. Lists, sets, sorted sets and hashes with more than
+ * server.migrate_chunk_size elements are instead sent as a sequence of
+ * RESTORE-CHUNK commands, each one carrying a DUMP payload of a value of the
+ * same type with the next elements of the key. See restoreChunkCommand().
+ *
+ * The client calling MIGRATE is blocked (BLOCKED_MIGRATE) and a time event
+ * performs one step of every job every millisecond: a step sends
+ * either a batch of small keys or a single chunk, and waits for the replies,
+ * so other clients are served between the steps. Every key is deleted
+ * locally as soon as the target acknowledged it.
+ *
+ * A job uses its own connection, not one of the cached MIGRATE sockets that
+ * could be closed by other MIGRATE commands, and closes it when it
+ * terminates: the target discards the chunks of a key whose transfer was
+ * cut off together with the connection they were received from.
+ *
+ * Keys are not locked while they are sent: if the key is modified between
+ * two chunks, its transfer restarts from the first chunk. After
+ * MIGRATE_CHUNK_MAX_RESTARTS attempts the key is sent with a single RESTORE,
+ * like in the synchronous case, so that MIGRATE always terminates.
+ *
+ * MIGRATE SLOT always uses a job, that copies the slot to the target while
+ * its keys keep being served here, then flips the ownership of the slot
+ * atomically, see migrateJobSlotStep().
+ * -------------------------------------------------------------------------- */
+
+#define MIGRATE_CHUNK_MAX_RESTARTS 3
+#define MIGRATE_SLOT_KEYS_BATCH 1000
+#define MIGRATE_SLOT_MAX_DELTA_BATCHES 100
+
+/* Phases of a MIGRATE SLOT job. */
+#define MIGRATE_SLOT_SNAPSHOT 0 /* Copying the keys of the slot. */
+#define MIGRATE_SLOT_DELTA 1    /* Sending the keys modified meanwhile. */
+#define MIGRATE_SLOT_CLEANUP 2  /* Slot moved, deleting the local keys. */
+
+typedef struct migrateJob {
+    client *c;              /* Client blocked in MIGRATE. */
+    robj *host, *port;      /* Target instance. */
+    sds password;           /* AUTH password, or NULL. */
+    long dbid;              /* Target DB. */
+    long timeout;           /* I/O timeout of every step. */
+    migrateCachedSocket cs; /* Connection owned by the job, fd -1 if none. */
+    int copy, replace;      /* MIGRATE options. */
+    long chunk_size;        /* Elements per chunk, 0 to send keys whole. */
+    long budget;            /* Elements sent per step. */
+    robj **keys;            /* Keys to migrate. */
+    robj **sent;            /* Keys sent in the current step. */
+    unsigned char *sent_del; /* True for the keys of 'sent' sent as DEL. */
+    int max_keys;           /* Size of the arrays above. */
+    int num_keys;
+    int idx;                /* Index of the key we are sending. */
+    int may_retry;          /* Retry once on socket errors, like MIGRATE. */
+    sds error;              /* First error replied by the target, or NULL. */
+    /* State of the chunked transfer of keys[idx]. */
+    int started;            /* True if the first chunk was sent. */
+    robj *val;              /* Value being sent, to detect overwrites. */
+    int modified;           /* The key was modified after the last chunk. */
+    int restarts;           /* Times the transfer of the key restarted. */
+    unsigned long cursor;   /* dictScan() cursor, or list index. */
+    /* State of MIGRATE SLOT. */
+    int slot;               /* Slot to move, or -1. */
+    char target[CLUSTER_NAMELEN]; /* Name of the node the slot goes to. */
+    int phase;              /* MIGRATE_SLOT_SNAPSHOT, _DELTA or _CLEANUP. */
+    dict *dirty;            /* Keys of the slot modified since last sent. */
+    long delta_batches;     /* Batches of modified keys sent so far. */
+    int flip;               /* Sending the last modified keys. */
+    int flushed;            /* The keys were flushed during the job. */
+} migrateJob;
+
+/* Return the number of elements of the object, 1 for strings. */
+unsigned long migrateObjectLength(robj *o) {
+    switch(o->type) {
+    case OBJ_LIST: return listTypeLength(o);
+    case OBJ_SET: return setTypeSize(o);
+    case OBJ_ZSET: return zsetLength(o);
+    case OBJ_HASH: return hashTypeLength(o);
+    case OBJ_STREAM: return ((stream*)o->ptr)->length;
+    default: return 1;
+    }
+}
+
+/* Return true if the object can be sent in chunks. Small encodings are
+ * always sent as a whole. */
+int migrateObjectIsChunkable(robj *o, long chunk_size) {
+    if (chunk_size <= 0 || migrateObjectLength(o) <= (unsigned long)chunk_size)
+        return 0;
+    return (o->type == OBJ_LIST && o->encoding == OBJ_ENCODING_QUICKLIST) ||
+           (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) ||
+           (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                    o->encoding == OBJ_ENCODING_BTREE)) ||
+           (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT);
+}
+
+/* dictScan() callbacks used to collect the elements of a chunk. */
+void migrateScanSetCallback(void *privdata, const dictEntry *de) {
+    setTypeAdd(privdata,dictGetKey(de));
+}
+
+void migrateScanZsetCallback(void *privdata, const dictEntry *de) {
+    void **pd = privdata; /* Chunk and source sorted set. */
+    int flags = ZADD_NONE;
+    zsetAdd(pd[0],zsetDictGetScore(pd[1],(dictEntry*)de),dictGetKey(de),
+            &flags,NULL);
+}
+
+void migrateScanHashCallback(void *privdata, const dictEntry *de) {
+    hashTypeSet(privdata,dictGetKey(de),dictGetVal(de),HASH_SET_COPY);
+}
+
+/* Return a new object of the same type of 'o' with the next chunk of its
+ * elements, resuming from job->cursor. '*last' is set to 1 if there are
+ * no more elements to send after this chunk. */
+robj *migrateNextChunk(migrateJob *job, robj *o, int *last) {
+    unsigned long count = job->chunk_size;
+    robj *chunk;
+
+    if (o->type == OBJ_LIST) {
+        listTypeIterator *li = listTypeInitIterator(o,job->cursor,LIST_TAIL);
+        listTypeEntry entry;
+
+        chunk = createQuicklistObject();
+        quicklistSetOptions(chunk->ptr,server.list_max_ziplist_size,
+                            server.list_compress_depth);
+        while (count-- && listTypeNext(li,&entry)) {
+            robj *value = listTypeGet(&entry);
+            listTypePush(chunk,value,LIST_TAIL);
+            decrRefCount(value);
+            job->cursor++;
+        }
+        listTypeReleaseIterator(li);
+        *last = job->cursor >= listTypeLength(o);
+    } else {
+        dictScanFunction *fn;
+        void *privdata, *zsetpd[2];
+        dict *d;
+
+        if (o->type == OBJ_SET) {
+            chunk = createSetObject();
+            d = o->ptr;
+            fn = migrateScanSetCallback;
+            privdata = chunk;
+        } else if (o->type == OBJ_ZSET) {
+            chunk = createZsetObject();
+            d = ((zset*)o->ptr)->dict;
+            fn = migrateScanZsetCallback;
+            zsetpd[0] = chunk;
+            zsetpd[1] = o->ptr;
+            privdata = zsetpd;
+        } else {
+            chunk = createHashObject();
+            hashTypeConvert(chunk,OBJ_ENCODING_HT);
+            d = o->ptr;
+            fn = migrateScanHashCallback;
+            privdata = chunk;
+        }
+
+        /* Since the key is resent from scratch if modified, elements are
+         * only returned more than once if the dict is rehashed: this is
+         * harmless since chunks are merged by the target. */
+        do {
+            job->cursor = dictScan(d,job->cursor,fn,NULL,privdata);
+        } while (job->cursor && migrateObjectLength(chunk) < count);
+        *last = job->cursor == 0;
+    }
+    return chunk;
+}
+
+/* Close the connection of the job, if any. */
+void migrateJobCloseSocket(migrateJob *job) {
+    if (job->cs.fd == -1) return;
+    close(job->cs.fd);
+    job->cs.fd = -1;
+}
+
+/* Move to the next key of the job. */
+void migrateJobNextKey(migrateJob *job) {
+    job->idx++;
+    job->started = 0;
+    job->modified = 0;
+    job->restarts = 0;
+}
+
+/* Delete a key acknowledged by the target, propagating a DEL. */
+void migrateJobDeleteKey(migrateJob *job, robj *key) {
+    client *c = job->c;
+    robj *argv[2];
+
+    dbDelete(c->db,key);
+    signalModifiedKey(c->db,key);
+    server.dirty++;
+
+    argv[0] = shared.del;
+    argv[1] = key;
+    propagate(server.delCommand,c->db->id,argv,2,
+              PROPAGATE_AOF|PROPAGATE_REPL);
+}
+
+/* Return true if a MIGRATE SLOT job is moving the slot. */
+int migrateSlotJobExists(int slot) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.migrate_jobs,&li);
+    while((ln = listNext(&li))) {
+        migrateJob *job = ln->value;
+        if (job->slot == slot) return 1;
+    }
+    return 0;
+}
+
+/* Called by signalModifiedKey(): flag the jobs that are sending this key,
+ * so that its transfer is restarted, and remember the keys of the slots
+ * being copied by MIGRATE SLOT, so that they are sent again. */
+void migrateJobsSignalModifiedKey(redisDb *db, robj *key) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.migrate_jobs,&li);
+    while((ln = listNext(&li))) {
+        migrateJob *job = ln->value;
+
+        if (job->started && job->c->db == db &&
+            equalStringObjects(key,job->keys[job->idx]))
+        {
+            job->modified = 1;
+        }
+        if (job->dirty && job->phase != MIGRATE_SLOT_CLEANUP &&
+            (int)keyHashSlot(key->ptr,sdslen(key->ptr)) == job->slot &&
+            dictFind(job->dirty,key->ptr) == NULL)
+        {
+            dictAdd(job->dirty,sdsdup(key->ptr),NULL);
+        }
+    }
+}
+
+/* Called by emptyDb() in cluster mode: the keys MIGRATE SLOT copied to the
+ * target were deleted without being signaled one by one. */
+void migrateJobsSignalFlushedDb(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.migrate_jobs,&li);
+    while((ln = listNext(&li))) {
+        migrateJob *job = ln->value;
+        if (job->slot != -1) job->flushed = 1;
+    }
+}
+
+/* Return the node the slot of a MIGRATE SLOT job is migrating to, or NULL
+ * if the slot is no longer migrating to the node the job was started for. */
+clusterNode *migrateJobSlotTarget(migrateJob *job) {
+    clusterNode *target = clusterLookupNode(job->target);
+
+    if (target == NULL ||
+        server.cluster->slots[job->slot] != myself ||
+        server.cluster->migrating_slots_to[job->slot] != target) return NULL;
+    return target;
+}
+
+int migrateJobStep(migrateJob *job);
+
+/* Grow the key arrays of the job to hold at least 'count' keys. */
+void migrateJobReserveKeys(migrateJob *job, unsigned long count) {
+    if (count <= (unsigned long)job->max_keys) return;
+    job->max_keys = count;
+    job->keys = zrealloc(job->keys,sizeof(robj*)*count);
+    job->sent = zrealloc(job->sent,sizeof(robj*)*count);
+    job->sent_del = zrealloc(job->sent_del,count);
+}
+
+/* Return true if the keys of the slot modified since they were sent fit the
+ * budget of a single step. */
+int migrateJobDeltaFits(migrateJob *job) {
+    unsigned long len = 0;
+    dictIterator *di;
+    dictEntry *de;
+
+    if (dictSize(job->dirty) > (unsigned long)job->budget) return 0;
+    di = dictGetIterator(job->dirty);
+    while((de = dictNext(di)) != NULL) {
+        dictEntry *kde = dictFind(job->c->db->dict,dictGetKey(de));
+        len += kde ? migrateObjectLength(dictGetVal(kde)) : 1;
+    }
+    dictReleaseIterator(di);
+    return len <= (unsigned long)job->budget;
+}
+
+/* Make up to 'count' keys modified since they were sent the keys of the
+ * job, removing them from job->dirty. */
+void migrateJobLoadDirty(migrateJob *job, unsigned long count) {
+    dictIterator *di;
+    dictEntry *de;
+
+    migrateJobReserveKeys(job,count);
+    di = dictGetSafeIterator(job->dirty);
+    while((unsigned long)job->num_keys < count &&
+          (de = dictNext(di)) != NULL)
+    {
+        sds key = dictGetKey(de);
+        job->keys[job->num_keys++] = createStringObject(key,sdslen(key));
+        dictDelete(job->dirty,key);
+    }
+    dictReleaseIterator(di);
+}
+
+/* Called when a MIGRATE SLOT job sent all the keys of the current batch.
+ * Nothing is deleted until the ownership of the slot changes, so that all
+ * its keys keep being served here, with no -ASK redirection (see
+ * getNodeByQuery()):
+ *
+ * 1. Snapshot: every key of the slot is copied to the target, walking the
+ *    slot key list in batches of MIGRATE_SLOT_KEYS_BATCH keys.
+ * 2. Delta: the keys of the slot modified after being sent, collected by
+ *    migrateJobsSignalModifiedKey(), are sent again, or deleted from the
+ *    target if they no longer exist here.
+ * 3. Flip: once the modified keys fit a single step, they are all sent and
+ *    CLUSTER SETSLOT NODE follows, without returning to the event loop: no
+ *    write can slip between the last copy and the ownership change.
+ * 4. Cleanup: the local keys, unreachable after the flip because of the
+ *    -MOVED redirection, are deleted in batches, see migrateJobSlotCleanup().
+ *
+ * If the modified keys don't shrink to a single step after
+ * MIGRATE_SLOT_MAX_DELTA_BATCHES batches because of the write load, they
+ * are flipped anyway, blocking while they are sent.
+ *
+ * Returns 1 if the job terminated and the reply was sent to the client,
+ * otherwise 0. */
+int migrateJobSlotStep(migrateJob *job, migrateCachedSocket *cs) {
+    client *c = job->c;
+    clusterNode *target = migrateJobSlotTarget(job);
+    int j, socket_error;
+
+    if (target == NULL) {
+        addReplyErrorFormat(c,"Hash slot %d is no longer migrating to the "
+                              "target node",job->slot);
+        return 1;
+    }
+    for (j = 0; j < job->num_keys; j++) decrRefCount(job->keys[j]);
+    job->num_keys = 0;
+    job->idx = 0;
+
+    if (job->phase == MIGRATE_SLOT_SNAPSHOT) {
+        job->num_keys = getKeysInSlotNext(job->slot,job->keys,
+                                          MIGRATE_SLOT_KEYS_BATCH);
+        if (job->num_keys) return 0;
+        job->phase = MIGRATE_SLOT_DELTA;
+    }
+
+    /* The target has the same keys we have: move the slot. Since the keys
+     * are modified only between two steps, if any key was modified after
+     * the last modified keys were loaded, it was either sent by the last
+     * step or it is in job->dirty. */
+    if (job->flip && dictSize(job->dirty) == 0) {
+        if (migrateAssignSlotToTarget(c,cs,job->slot,target,job->password,
+                                      job->timeout,&socket_error) == C_ERR)
+        {
+            /* The error was already sent to the client. */
+            if (socket_error) migrateJobCloseSocket(job);
+            return 1;
+        }
+        job->phase = MIGRATE_SLOT_CLEANUP;
+        return 0;
+    }
+
+    if (migrateJobDeltaFits(job) ||
+        job->delta_batches >= MIGRATE_SLOT_MAX_DELTA_BATCHES)
+    {
+        job->flip = 1;
+        migrateJobLoadDirty(job,dictSize(job->dirty));
+        return migrateJobStep(job);
+    }
+    job->flip = 0;
+    job->delta_batches++;
+    migrateJobLoadDirty(job,MIGRATE_SLOT_KEYS_BATCH);
+    return 0;
+}
+
+/* Delete a batch of the local keys of the slot a MIGRATE SLOT job moved.
+ * Returns 1 once the slot is empty and the reply was sent to the client,
+ * otherwise 0. */
+int migrateJobSlotCleanup(migrateJob *job) {
+    int j;
+
+    /* Stop if the slot was assigned back to us meanwhile: the keys are
+     * served again. */
+    if (countKeysInSlot(job->slot) == 0 ||
+        server.cluster->slots[job->slot] == myself)
+    {
+        addReply(job->c,shared.ok);
+        return 1;
+    }
+    for (j = 0; j < job->num_keys; j++) decrRefCount(job->keys[j]);
+    job->num_keys = getKeysInSlot(job->slot,job->keys,MIGRATE_SLOT_KEYS_BATCH);
+    for (j = 0; j < job->num_keys; j++)
+        migrateJobDeleteKey(job,job->keys[j]);
+    return 0;
+}
+
+/* Send the next keys, or the next chunk of a large key, to the target and
+ * process the replies. Returns 1 if the job terminated and the reply was
+ * sent to the client, otherwise 0. */
+int migrateJobStep(migrateJob *job) {
+    client *c = job->c;
+    migrateCachedSocket *cs;
+    long budget = job->flip ? LONG_MAX : job->budget;
+    int first_idx = job->idx, num_sent = 0, partial = 0, write_error = 0;
+    int select, step_error = 0, j = 0;
+    rio cmd, payload;
+    char buf0[1024], buf1[1024], buf2[1024];
+
+    if (job->slot != -1) {
+        if (job->phase == MIGRATE_SLOT_CLEANUP)
+            return migrateJobSlotCleanup(job);
+        if (job->flushed) {
+            addReplyErrorFormat(c,"Hash slot %d was flushed during MIGRATE "
+                                  "SLOT, retry MIGRATE",job->slot);
+            return 1;
+        }
+    }
+
+    if (job->cs.fd == -1) {
+        job->cs.fd = migrateConnect(c,job->host,job->port,job->timeout);
+        if (job->cs.fd == -1) return 1; /* Error sent by migrateConnect(). */
+        job->cs.last_dbid = -1;
+    }
+    cs = &job->cs;
+    cs->last_use_time = server.unixtime;
+
+    rioInitWithBuffer(&cmd,sdsempty());
+    if (job->password) {
+        serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"AUTH",4));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,job->password,
+            sdslen(job->password)));
+    }
+    select = cs->last_dbid != job->dbid;
+    if (select) {
+        serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"SELECT",6));
+        serverAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,job->dbid));
+    }
+
+    while (job->idx < job->num_keys && budget > 0) {
+        robj *key = job->keys[job->idx];
+        robj *o = lookupKeyRead(c->db,key);
+        long long ttl = 0, expireat;
+        unsigned long len;
+        int first, last;
+
+        /* The key was overwritten or modified since the last chunk. */
+        if (job->started && (o != job->val || job->modified)) {
+            job->started = 0;
+            job->restarts++;
+        }
+        expireat = o ? getExpire(c->db,key) : -1;
+        if (expireat != -1) {
+            ttl = expireat-mstime();
+            if (ttl < 0) o = NULL;
+            else if (ttl < 1) ttl = 1;
+        }
+        if (o == NULL) {
+            /* A key of the slot MIGRATE SLOT already sent was deleted. */
+            if (job->slot != -1 && job->phase == MIGRATE_SLOT_DELTA) {
+                serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',1));
+                serverAssertWithInfo(c,NULL,
+                    rioWriteBulkString(&cmd,"ASKING",6));
+                serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',2));
+                serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"DEL",3));
+                serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,key->ptr,
+                        sdslen(key->ptr)));
+                job->sent_del[num_sent] = 1;
+                job->sent[num_sent++] = key;
+                budget--;
+            }
+            migrateJobNextKey(job);
+            continue;
+        }
+        len = migrateObjectLength(o);
+
+        if (!migrateObjectIsChunkable(o,job->chunk_size) ||
+            job->restarts >= MIGRATE_CHUNK_MAX_RESTARTS || job->flip)
+        {
+            /* Send the key as a whole, unless it does not fit what is left
+             * of the budget of this step. */
+            if (num_sent && len > (unsigned long)budget) break;
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkCount(&cmd,'*',job->replace ? 5 : 4));
+            if (server.cluster_enabled)
+                serverAssertWithInfo(c,NULL,
+                    rioWriteBulkString(&cmd,"RESTORE-ASKING",14));
+            else
+                serverAssertWithInfo(c,NULL,
+                    rioWriteBulkString(&cmd,"RESTORE",7));
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,key->ptr,
+                    sdslen(key->ptr)));
+            serverAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
+            createDumpPayload(&payload,o,key);
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                                   sdslen(payload.io.buffer.ptr)));
+            sdsfree(payload.io.buffer.ptr);
+            if (job->replace)
+                serverAssertWithInfo(c,NULL,
+                    rioWriteBulkString(&cmd,"REPLACE",7));
+            if (job->dirty) dictDelete(job->dirty,key->ptr);
+            job->sent_del[num_sent] = 0;
+            job->sent[num_sent++] = key;
+            budget -= len;
+            migrateJobNextKey(job);
+            continue;
+        }
+
+        /* Send the next chunk of a large key. */
+        first = !job->started;
+        if (first) {
+            job->started = 1;
+            job->val = o;
+            job->cursor = 0;
+        }
+        job->modified = 0;
+        robj *chunk = migrateNextChunk(job,o,&last);
+        serverAssertWithInfo(c,NULL,rioWriteBulkCount(&cmd,'*',
+            4+first+last+job->replace));
+        serverAssertWithInfo(c,NULL,
+            rioWriteBulkString(&cmd,"RESTORE-CHUNK",13));
+        serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,key->ptr,
+                sdslen(key->ptr)));
+        serverAssertWithInfo(c,NULL,rioWriteBulkLongLong(&cmd,ttl));
+        createDumpPayload(&payload,chunk,key);
+        serverAssertWithInfo(c,NULL,
+            rioWriteBulkString(&cmd,payload.io.buffer.ptr,
+                               sdslen(payload.io.buffer.ptr)));
+        sdsfree(payload.io.buffer.ptr);
+        decrRefCount(chunk);
+        if (first)
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"FIRST",5));
+        if (last)
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"LAST",4));
+        if (job->replace)
+            serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"REPLACE",7));
+        /* The value was not modified since the first chunk was sent. */
+        if (last && job->dirty) dictDelete(job->dirty,key->ptr);
+        job->sent_del[num_sent] = 0;
+        job->sent[num_sent++] = key;
+        if (last) migrateJobNextKey(job);
+        else partial = 1;
+        break; /* A chunk uses the whole budget of the step. */
+    }
+
+    /* Transfer the query to the other node in 64K chunks. */
+    errno = 0;
+    if (num_sent) {
+        sds buf = cmd.io.buffer.ptr;
+        size_t pos = 0, towrite;
+        int nwritten = 0;
+
+        while ((towrite = sdslen(buf)-pos) > 0) {
+            towrite = (towrite > (64*1024) ? (64*1024) : towrite);
+            nwritten = syncWrite(cs->fd,buf+pos,towrite,job->timeout);
+            if (nwritten != (signed)towrite) {
+                write_error = 1;
+                goto socket_err;
+            }
+            pos += nwritten;
+        }
+
+        /* Read the AUTH and SELECT replies if needed. */
+        if (job->password &&
+            syncReadLine(cs->fd,buf0,sizeof(buf0),job->timeout) <= 0)
+            goto socket_err;
+        if (select &&
+            syncReadLine(cs->fd,buf1,sizeof(buf1),job->timeout) <= 0)
+            goto socket_err;
+
+        /* Read the RESTORE replies. */
+        for (j = 0; j < num_sent; j++) {
+            int final = !(partial && j == num_sent-1);
+
+            /* Skip the reply of the ASKING preceding a DEL. */
+            if (job->sent_del[j] &&
+                syncReadLine(cs->fd,buf2,sizeof(buf2),job->timeout) <= 0)
+                goto socket_err;
+            if (syncReadLine(cs->fd,buf2,sizeof(buf2),job->timeout) <= 0)
+                goto socket_err;
+            if ((job->password && buf0[0] == '-') ||
+                (select && buf1[0] == '-') ||
+                buf2[0] == '-')
+            {
+                char *errbuf;
+
+                if (job->password && buf0[0] == '-') errbuf = buf0;
+                else if (select && buf1[0] == '-') errbuf = buf1;
+                else errbuf = buf2;
+                if (!job->error) job->error = sdsnew(errbuf+1);
+                step_error = 1;
+                /* Don't send the rest of a large key the target refused. */
+                if (!final) migrateJobNextKey(job);
+            } else if (final && !job->copy) {
+                migrateJobDeleteKey(job,job->sent[j]);
+            }
+        }
+    }
+    sdsfree(cmd.io.buffer.ptr);
+
+    /* On error assume that last_dbid is no longer valid. If nothing was
+     * sent, SELECT was not sent either. */
+    if (num_sent) cs->last_dbid = step_error ? -1 : job->dbid;
+    job->may_retry = 1;
+
+    if (job->idx < job->num_keys) return 0;
+    if (job->slot != -1 && !job->error)
+        return migrateJobSlotStep(job,cs);
+    if (job->error)
+        addReplyErrorFormat(c,"Target instance replied with error: %s",
+            job->error);
+    else
+        addReply(c,shared.ok);
+    return 1;
+
+/* On socket errors retry the step once with a new connection, unless a
+ * reply was already processed. The target discarded any partially
+ * transferred key together with the connection, so it is sent again. */
+socket_err:
+    sdsfree(cmd.io.buffer.ptr);
+    migrateJobCloseSocket(job);
+    if (j == 0 && errno != ETIMEDOUT && job->may_retry) {
+        job->may_retry = 0;
+        job->idx = first_idx;
+        job->started = 0;
+        return 0;
+    }
+    addReplySds(c,
+        sdscatprintf(sdsempty(),
+            "-IOERR error or timeout %s to target instance\r\n",
+            write_error ? "writing" : "reading"));
+    return 1;
+}
+
+/* Time event driving the MIGRATE jobs, one step of every job each time. */
+int migrateJobsCron(struct aeEventLoop *eventLoop, long long id,
+                    void *clientData)
+{
+    listIter li;
+    listNode *ln;
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    listRewind(server.migrate_jobs,&li);
+    while((ln = listNext(&li))) {
+        migrateJob *job = ln->value;
+
+        /* Unblocking the client frees the job. */
+        if (migrateJobStep(job)) unblockClient(job->c);
+    }
+    if (listLength(server.migrate_jobs) == 0) {
+        server.migrate_jobs_timer = -1;
+        return AE_NOMORE;
+    }
+    /* Run again in a millisecond: returning 0 would make the event loop
+     * poll with a zero timeout, spinning as long as a job exists. */
+    return 1;
+}
+
+/* Block the client and transfer the keys in chunks. The keys are
+ * retained by the job. If 'target' is not NULL the job moves the hash slot
+ * 'slot' instead, and the keys are taken from the slot. */
+void migrateStartJob(client *c, robj **keys, int num_keys, long dbid,
+                     long timeout, int copy, int replace, char *password,
+                     int slot, clusterNode *target)
+{
+    migrateJob *job = zmalloc(sizeof(*job));
+    int j, max_keys = target ? MIGRATE_SLOT_KEYS_BATCH : num_keys;
+
+    /* MIGRATE SLOT copies the keys, sending them again with REPLACE when
+     * they are modified, and deletes them only once the slot moved. */
+    if (target) copy = replace = 1;
+
+    job->c = c;
+    job->host = c->argv[1];
+    job->port = c->argv[2];
+    incrRefCount(job->host);
+    incrRefCount(job->port);
+    job->password = password ? sdsnew(password) : NULL;
+    job->dbid = dbid;
+    job->timeout = timeout;
+    job->cs.fd = -1;
+    job->cs.last_dbid = -1;
+    job->cs.last_use_time = server.unixtime;
+    job->copy = copy;
+    job->replace = replace;
+    job->chunk_size = server.migrate_chunk_size;
+    job->budget = job->chunk_size ? job->chunk_size :
+                                    CONFIG_DEFAULT_MIGRATE_CHUNK_SIZE;
+    job->keys = zmalloc(sizeof(robj*)*max_keys);
+    job->sent = zmalloc(sizeof(robj*)*max_keys);
+    job->sent_del = zmalloc(max_keys);
+    job->max_keys = max_keys;
+    for (j = 0; j < num_keys; j++) {
+        job->keys[j] = keys[j];
+        incrRefCount(keys[j]);
+    }
+    job->num_keys = num_keys;
+    job->idx = 0;
+    job->may_retry = 1;
+    job->error = NULL;
+    job->started = 0;
+    job->val = NULL;
+    job->modified = 0;
+    job->restarts = 0;
+    job->cursor = 0;
+    job->slot = target ? slot : -1;
+    job->phase = MIGRATE_SLOT_SNAPSHOT;
+    job->dirty = NULL;
+    job->delta_batches = 0;
+    job->flip = 0;
+    job->flushed = 0;
+    if (target) {
+        memcpy(job->target,target->name,CLUSTER_NAMELEN);
+        job->dirty = dictCreate(&setDictType,NULL);
+        slotToKeyIterInit(slot);
+    }
+
+    c->bpop.timeout = 0;
+    c->bpop.migrate_job = job;
+    listAddNodeTail(server.migrate_jobs,job);
+    blockClient(c,BLOCKED_MIGRATE);
+    if (server.migrate_jobs_timer == -1)
+        server.migrate_jobs_timer =
+            aeCreateTimeEvent(server.el,0,migrateJobsCron,NULL,NULL);
+}
+
+/* Called by unblockClient(): release the job of the client. */
+void unblockClientFromMigrate(client *c) {
+    migrateJob *job = c->bpop.migrate_job;
+    listNode *ln = listSearchKey(server.migrate_jobs,job);
+    int j;
+
+    serverAssert(ln != NULL);
+    listDelNode(server.migrate_jobs,ln);
+    migrateJobCloseSocket(job);
+    decrRefCount(job->host);
+    decrRefCount(job->port);
+    sdsfree(job->password);
+    sdsfree(job->error);
+    for (j = 0; j < job->num_keys; j++) decrRefCount(job->keys[j]);
+    zfree(job->keys);
+    zfree(job->sent);
+    zfree(job->sent_del);
+    if (job->dirty) {
+        dictRelease(job->dirty);
+        server.cluster->slots_to_keys[job->slot].iter = NULL;
+    }
+    zfree(job);
+    c->bpop.migrate_job = NULL;
+}
+
 /* MIGRATE host port key dbid timeout [COPY | REPLACE | AUTH password]
  *
  * On in the multiple keys form:
  *
  * MIGRATE host port "" dbid timeout [COPY | REPLACE | AUTH password] KEYS key1
- * key2 ... keyN */
+ * key2 ... keyN
+ *
+ * Or, in cluster mode, to move a whole hash slot that was previously set
+ * in MIGRATING state towards the target node:
+ *
+ * MIGRATE host port "" dbid timeout [REPLACE | AUTH password] SLOT slot
+ *
+ * In the SLOT form the client is blocked while the keys of the slot are
+ * copied in steps, like large keys are (see migrateStartJob()), followed by
+ * the keys modified meanwhile. Then the ownership of the slot is moved to
+ * the target with CLUSTER SETSLOT NODE, both on the target and locally,
+ * and the local keys are deleted. REPLACE is implied. */
 void migrateCommand(client *c) {
     migrateCachedSocket *cs;
     int copy = 0, replace = 0, j;
@@ -5078,6 +6502,10 @@ void migrateCommand(client *c) {
     int first_key = 3; /* Argument index of the first key. */
     int num_keys = 1;  /* By default only migrate the 'key' argument. */
 
+    /* To support the SLOT option we need the following additional state. */
+    int slot = -1;              /* Hash slot to migrate, or -1. */
+    clusterNode *target = NULL; /* Node the slot is migrating to. */
+
     /* Parse additional options */
     for (j = 6; j < c->argc; j++) {
         int moreargs = j < c->argc-1;
@@ -5102,6 +6530,24 @@ void migrateCommand(client *c) {
             first_key = j+1;
             num_keys = c->argc - j - 1;
             break; /* All the remaining args are keys. */
+        } else if (!strcasecmp(c->argv[j]->ptr,"slot")) {
+            if (!server.cluster_enabled) {
+                addReplyError(c,"MIGRATE SLOT is only available in "
+                                "cluster mode");
+                return;
+            }
+            if (sdslen(c->argv[3]->ptr) != 0) {
+                addReplyError(c,
+                    "When using MIGRATE SLOT option, the key argument"
+                    " must be set to the empty string");
+                return;
+            }
+            if (!moreargs) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            j++;
+            if ((slot = getSlotOrReply(c,c->argv[j])) == -1) return;
         } else {
             addReply(c,shared.syntaxerr);
             return;
@@ -5116,28 +6562,78 @@ void migrateCommand(client *c) {
     }
     if (timeout <= 0) timeout = 1000;
 
+    if (slot != -1) {
+        if (copy) {
+            addReplyError(c,"MIGRATE SLOT can't be used with COPY");
+            return;
+        }
+        target = server.cluster->migrating_slots_to[slot];
+        if (server.cluster->slots[slot] != myself || target == NULL) {
+            addReplyErrorFormat(c,"Hash slot %d is not in migrating state",
+                slot);
+            return;
+        }
+        if (strcasecmp(target->ip,c->argv[1]->ptr) ||
+            target->port != atoi(c->argv[2]->ptr))
+        {
+            addReplyErrorFormat(c,"Hash slot %d is migrating to %s:%d",
+                slot, target->ip, target->port);
+            return;
+        }
+        if (c->flags & (CLIENT_MULTI|CLIENT_LUA|CLIENT_MODULE)) {
+            addReplyError(c,"MIGRATE SLOT can't be called inside MULTI or "
+                            "scripts");
+            return;
+        }
+        if (migrateSlotJobExists(slot)) {
+            addReplyErrorFormat(c,"MIGRATE SLOT %d is already in progress",
+                slot);
+            return;
+        }
+        migrateStartJob(c,NULL,0,dbid,timeout,0,replace,password,slot,target);
+        return;
+    }
+
     /* Check if the keys are here. If at least one key is to migrate, do it
      * otherwise if all the keys are missing reply with "NOKEY" to signal
      * the caller there was nothing to migrate. We don't return an error in
      * this case, since often this is due to a normal condition like the key
      * expiring in the meantime. */
-    ov = zrealloc(ov,sizeof(robj*)*num_keys);
-    kv = zrealloc(kv,sizeof(robj*)*num_keys);
+    ov = zrealloc(ov,sizeof(robj*)*(num_keys ? num_keys : 1));
+    kv = zrealloc(kv,sizeof(robj*)*(num_keys ? num_keys : 1));
     int oi = 0;
 
     for (j = 0; j < num_keys; j++) {
-        if ((ov[oi] = lookupKeyRead(c->db,c->argv[first_key+j])) != NULL) {
-            kv[oi] = c->argv[first_key+j];
+        robj *key = c->argv[first_key+j];
+        if ((ov[oi] = lookupKeyRead(c->db,key)) != NULL) {
+            kv[oi] = key;
             oi++;
         }
     }
     num_keys = oi;
+
     if (num_keys == 0) {
         zfree(ov); zfree(kv);
         addReplySds(c,sdsnew("+NOKEY\r\n"));
         return;
     }
 
+    /* Large keys are sent in chunks while serving other clients, unless
+     * we can't block the client. */
+    if (server.migrate_chunk_size > 0 &&
+        !(c->flags & (CLIENT_MULTI|CLIENT_LUA|CLIENT_MODULE)))
+    {
+        for (j = 0; j < num_keys; j++)
+            if (migrateObjectIsChunkable(ov[j],server.migrate_chunk_size))
+                break;
+        if (j != num_keys) {
+            migrateStartJob(c,kv,num_keys,dbid,timeout,copy,replace,password,
+                            -1,NULL);
+            zfree(ov); zfree(kv);
+            return;
+        }
+    }
+
 try_again:
     write_error = 0;
 
@@ -5528,8 +7024,12 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
                  * can safely serve the request, otherwise we return a TRYAGAIN
                  * error). To do so we set the importing/migrating state and
                  * increment a counter for every missing key. */
+                /* While MIGRATE SLOT copies the slot, all its keys are
+                 * still here until the ownership flips: serve them, see
+                 * migrateJobSlotStep(). */
                 if (n == myself &&
-                    server.cluster->migrating_slots_to[slot] != NULL)
+                    server.cluster->migrating_slots_to[slot] != NULL &&
+                    !migrateSlotJobExists(slot))
                 {
                     migrating_slot = 1;
                 } else if (server.cluster->importing_slots_from[slot] != NULL) {
@@ -5553,8 +7053,12 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
                 }
             }
 
-            /* Migarting / Improrting slot? Count keys we don't have. */
+            /* Migarting / Improrting slot? Count keys we don't have.
+             * The arguments of the sharded Pub/Sub commands are channels,
+             * not keys: they keep being served by the source node until
+             * the slot ownership changes. */
             if ((migrating_slot || importing_slot) &&
+                !(cmd->flags & CMD_PUBSUB) &&
                 lookupKeyRead(&server.db[0],thiskey) == NULL)
             {
                 missing_keys++;
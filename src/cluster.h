@@ -17,6 +17,7 @@
 #define CLUSTER_DEFAULT_SLAVE_VALIDITY 10 /* Slave max data age factor. */
 #define CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE 1
 #define CLUSTER_DEFAULT_SLAVE_NO_FAILOVER 0 /* Failover by default. */
+#define CLUSTER_DEFAULT_BUS_COMPACT 1 /* Compact bus encoding by default. */
 #define CLUSTER_FAIL_REPORT_VALIDITY_MULT 2 /* Fail report validity. */
 #define CLUSTER_FAIL_UNDO_TIME_MULT 2 /* Undo fail if master is back. */
 #define CLUSTER_FAIL_UNDO_TIME_ADD 10 /* Some additional time. */
@@ -44,6 +45,10 @@ typedef struct clusterLink {
     sds sndbuf;                 /* Packet send buffer */
     sds rcvbuf;                 /* Packet reception buffer */
     struct clusterNode *node;   /* Node related to this link if any, or NULL */
+    int peer_compact;           /* Peer understands the compact encoding. */
+    unsigned char *sent_slots;  /* Last slots bitmap sent on this link, or
+                                   NULL if the peer may not have it. */
+    unsigned char *recv_slots;  /* Last slots bitmap received on this link. */
 } clusterLink;
 
 /* Cluster node flags and macros. */
@@ -98,7 +103,8 @@ typedef struct clusterLink {
 #define CLUSTERMSG_TYPE_UPDATE 7        /* Another node slots configuration */
 #define CLUSTERMSG_TYPE_MFSTART 8       /* Pause clients for manual failover */
 #define CLUSTERMSG_TYPE_MODULE 9        /* Module cluster API message. */
-#define CLUSTERMSG_TYPE_COUNT 10        /* Total number of message types. */
+#define CLUSTERMSG_TYPE_PUBLISHSHARD 10 /* Pub/Sub Publish shard propagation */
+#define CLUSTERMSG_TYPE_COUNT 11        /* Total number of message types. */
 
 /* Flags that a module can set in order to prevent certain Redis Cluster
  * features to be enabled. Useful when implementing a different distributed
@@ -138,8 +144,29 @@ typedef struct clusterNode {
     int cport;                  /* Latest known cluster port of this node. */
     clusterLink *link;          /* TCP/IP link with this node */
     list *fail_reports;         /* List of nodes signaling this as failing */
+    /* Gossip state as last seen by clusterSendPing(), used by the compact
+     * bus encoding to only gossip about nodes that recently changed. */
+    mstime_t gossip_change_time; /* Last time flags or address changed. */
+    int gossip_flags;
+    char gossip_ip[NET_IP_STR_LEN];
+    int gossip_port;
+    int gossip_cport;
 } clusterNode;
 
+/* Redis cluster keeps the keys of every hash slot in a doubly linked list
+ * threaded through the main dictionary entries, using this struct as the
+ * dictEntry metadata (see dbDictType). */
+typedef struct clusterDictEntryMetadata {
+    dictEntry *prev;   /* Prev entry with key in the same slot */
+    dictEntry *next;   /* Next entry with key in the same slot */
+} clusterDictEntryMetadata;
+
+typedef struct slotToKeys {
+    uint64_t count;    /* Number of keys in the slot. */
+    dictEntry *head;   /* The first key-value entry in the slot. */
+    dictEntry *iter;   /* Next entry of getKeysInSlotNext(), or NULL. */
+} slotToKeys;
+
 typedef struct clusterState {
     clusterNode *myself;  /* This node */
     uint64_t currentEpoch;
@@ -150,8 +177,9 @@ typedef struct clusterState {
     clusterNode *migrating_slots_to[CLUSTER_SLOTS];
     clusterNode *importing_slots_from[CLUSTER_SLOTS];
     clusterNode *slots[CLUSTER_SLOTS];
-    uint64_t slots_keys_count[CLUSTER_SLOTS];
-    rax *slots_to_keys;
+    slotToKeys slots_to_keys[CLUSTER_SLOTS];
+    rax *slots_to_channels; /* Shard channels by slot: 2 bytes slot prefix
+                               followed by the channel name. */
     /* The following fields are used to take the slave state on elections. */
     mstime_t failover_auth_time; /* Time of previous or next election. */
     int failover_auth_count;    /* Number of votes received so far. */
@@ -176,6 +204,8 @@ typedef struct clusterState {
     /* Messages received and sent by type. */
     long long stats_bus_messages_sent[CLUSTERMSG_TYPE_COUNT];
     long long stats_bus_messages_received[CLUSTERMSG_TYPE_COUNT];
+    long long stats_bus_messages_compact_sent; /* Sent without slots bitmap. */
+    long long stats_bus_messages_compressed_sent; /* Sent LZ4 compressed. */
     long long stats_pfail_nodes;    /* Number of nodes in PFAIL status,
                                        excluding nodes without address. */
 } clusterState;
@@ -231,7 +261,7 @@ union clusterMsgData {
         clusterMsgDataFail about;
     } fail;
 
-    /* PUBLISH */
+    /* PUBLISH and PUBLISHSHARD */
     struct {
         clusterMsgDataPublish msg;
     } publish;
@@ -248,6 +278,11 @@ union clusterMsgData {
 };
 
 #define CLUSTER_PROTO_VER 1 /* Cluster bus protocol version. */
+#define CLUSTER_PROTO_VER_NOSLOTS 2 /* Same as version 1, but the myslots
+                                       field is omitted from the header: the
+                                       receiver uses the last bitmap it got
+                                       on the same link. Only sent to nodes
+                                       advertising CLUSTERMSG_FLAG0_COMPACT. */
 
 typedef struct {
     char sig[4];        /* Signature "RCmb" (Redis Cluster message bus). */
@@ -275,12 +310,22 @@ typedef struct {
 } clusterMsg;
 
 #define CLUSTERMSG_MIN_LEN (sizeof(clusterMsg)-sizeof(union clusterMsgData))
+#define CLUSTERMSG_NOSLOTS_MIN_LEN (CLUSTERMSG_MIN_LEN-CLUSTER_SLOTS/8)
+#define CLUSTERMSG_COMPRESS_MIN_LEN 1024 /* Don't compress smaller data. */
 
 /* Message flags better specify the packet content or are used to
  * provide some information about the node state. */
 #define CLUSTERMSG_FLAG0_PAUSED (1<<0) /* Master paused for manual failover. */
 #define CLUSTERMSG_FLAG0_FORCEACK (1<<1) /* Give ACK to AUTH_REQUEST even if
                                             master is up. */
+#define CLUSTERMSG_FLAG0_COMPACT (1<<2) /* Sender understands (and would like
+                                           to receive) the compact encoding:
+                                           CLUSTER_PROTO_VER_NOSLOTS headers
+                                           and compressed data. */
+#define CLUSTERMSG_FLAG1_COMPRESSED (1<<0) /* The message data is replaced by
+                                              a 32 bit big endian length of the
+                                              uncompressed data followed by
+                                              the LZ4 compressed data. */
 
 /* ---------------------- API exported outside cluster.c -------------------- */
 clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, int argc, int *hashslot, int *ask);
@@ -33,6 +33,7 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <ctype.h>
 
 /*-----------------------------------------------------------------------------
  * Config file name-value maps.
@@ -51,6 +52,8 @@ configEnum maxmemory_policy_enum[] = {
     {"allkeys-lru",MAXMEMORY_ALLKEYS_LRU},
     {"allkeys-lfu",MAXMEMORY_ALLKEYS_LFU},
     {"allkeys-random",MAXMEMORY_ALLKEYS_RANDOM},
+    {"volatile-tinylfu",MAXMEMORY_VOLATILE_TINYLFU},
+    {"allkeys-tinylfu",MAXMEMORY_ALLKEYS_TINYLFU},
     {"noeviction",MAXMEMORY_NO_EVICTION},
     {NULL, 0}
 };
@@ -91,6 +94,24 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum rdb_compression_codec_enum[] = {
+    {"lzf", RDB_CODEC_LZF},
+    {"lz4", RDB_CODEC_LZ4},
+    {NULL, 0}
+};
+
+configEnum list_compress_codec_enum[] = {
+    {"lzf", QUICKLIST_NODE_ENCODING_LZF},
+    {"lz4", QUICKLIST_NODE_ENCODING_LZ4},
+    {NULL, 0}
+};
+
+configEnum zset_large_encoding_enum[] = {
+    {"skiplist", OBJ_ENCODING_SKIPLIST},
+    {"btree", OBJ_ENCODING_BTREE},
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -132,6 +153,11 @@ const char *evictPolicyToString(void) {
     return configEnumGetNameOrUnknown(maxmemory_policy_enum,server.maxmemory_policy);
 }
 
+/* Used for INFO generation and the RDB header. */
+const char *rdbCompressionCodecToString(int codec) {
+    return configEnumGetNameOrUnknown(rdb_compression_codec_enum,codec);
+}
+
 /*-----------------------------------------------------------------------------
  * Config file parsing
  *----------------------------------------------------------------------------*/
@@ -155,6 +181,24 @@ void resetServerSaveParams(void) {
     server.saveparamslen = 0;
 }
 
+/* Return the memory-prefixes as a space separated list, quoting the
+ * prefixes that could not be parsed back otherwise. */
+sds getMemoryPrefixesConfig(void) {
+    sds buf = sdsempty();
+
+    for (int j = 0; j < server.memory_prefixes_count; j++) {
+        sds prefix = server.memory_prefixes[j];
+        int quote = sdslen(prefix) == 0;
+
+        for (size_t i = 0; i < sdslen(prefix) && !quote; i++)
+            if (!isprint((unsigned char)prefix[i]) || isspace((unsigned char)prefix[i]) ||
+                prefix[i] == '"' || prefix[i] == '\'') quote = 1;
+        if (j) buf = sdscatlen(buf," ",1);
+        buf = quote ? sdscatrepr(buf,prefix,sdslen(prefix)) : sdscatsds(buf,prefix);
+    }
+    return buf;
+}
+
 void queueLoadModule(sds path, sds *argv, int argc) {
     int i;
     struct moduleLoadQueueEntry *loadmod;
@@ -254,6 +298,8 @@ void loadServerConfigFromString(char *config) {
             } else if (argc == 2 && !strcasecmp(argv[1],"")) {
                 resetServerSaveParams();
             }
+        } else if (!strcasecmp(argv[0],"memory-prefixes")) {
+            memoryPrefixesSet(argv+1,argc-1);
         } else if (!strcasecmp(argv[0],"dir") && argc == 2) {
             if (chdir(argv[1]) == -1) {
                 serverLog(LL_WARNING,"Can't chdir to '%s': %s",
@@ -344,6 +390,28 @@ void loadServerConfigFromString(char *config) {
                 err = "lfu-decay-time must be 0 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"tinylfu-window") && argc == 2) {
+            server.tinylfu_window = atoi(argv[1]);
+            if (server.tinylfu_window < 0 || server.tinylfu_window > 100) {
+                err = "tinylfu-window must be between 0 and 100";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-low-watermark") && argc == 2) {
+            server.maxmemory_low_watermark = atoi(argv[1]);
+            if (server.maxmemory_low_watermark < 1 ||
+                server.maxmemory_low_watermark > 100)
+            {
+                err = "maxmemory-low-watermark must be between 1 and 100";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-high-watermark") && argc == 2) {
+            server.maxmemory_high_watermark = atoi(argv[1]);
+            if (server.maxmemory_high_watermark < 1 ||
+                server.maxmemory_high_watermark > 100)
+            {
+                err = "maxmemory-high-watermark must be between 1 and 100";
+                goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"slaveof") ||
                     !strcasecmp(argv[0],"replicaof")) && argc == 3) {
             slaveof_linenum = linenum;
@@ -420,6 +488,13 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-compression-codec") && argc == 2) {
+            server.rdb_compression_codec =
+                configEnumGetValue(rdb_compression_codec_enum,argv[1]);
+            if (server.rdb_compression_codec == INT_MIN) {
+                err = "argument must be 'lzf' or 'lz4'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbchecksum") && argc == 2) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -580,6 +655,20 @@ void loadServerConfigFromString(char *config) {
                 err = "active-defrag-max-scan-fields must be positive";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"hotkeys-sample-rate") && argc == 2) {
+            server.hotkeys_sample_rate = atoi(argv[1]);
+            if (server.hotkeys_sample_rate < 0) {
+                err = "hotkeys-sample-rate can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hotkeys-size") && argc == 2) {
+            server.hotkeys_size = atoi(argv[1]);
+            if (server.hotkeys_size < 1 ||
+                server.hotkeys_size > CONFIG_HOTKEYS_SIZE_MAX)
+            {
+                err = "hotkeys-size must be between 1 and 1024";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
             server.hash_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
@@ -588,6 +677,14 @@ void loadServerConfigFromString(char *config) {
             server.stream_node_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"stream-node-max-entries") && argc == 2) {
             server.stream_node_max_entries = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"tracking-table-max-keys") &&
+                   argc == 2)
+        {
+            long long max_keys = atoll(argv[1]);
+            if (max_keys < 0) {
+                err = "Invalid tracking-table-max-keys value"; goto loaderr;
+            }
+            server.tracking_table_max_keys = max_keys;
         } else if (!strcasecmp(argv[0],"list-max-ziplist-entries") && argc == 2){
             /* DEAD OPTION */
         } else if (!strcasecmp(argv[0],"list-max-ziplist-value") && argc == 2) {
@@ -596,12 +693,27 @@ void loadServerConfigFromString(char *config) {
             server.list_max_ziplist_size = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"list-compress-depth") && argc == 2) {
             server.list_compress_depth = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-compress-codec") && argc == 2) {
+            server.list_compress_codec =
+                configEnumGetValue(list_compress_codec_enum,argv[1]);
+            if (server.list_compress_codec == INT_MIN) {
+                err = "argument must be 'lzf' or 'lz4'";
+                goto loaderr;
+            }
+            quicklistSetCompressCodec(server.list_compress_codec);
         } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
             server.set_max_intset_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
             server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
             server.zset_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"zset-large-encoding") && argc == 2) {
+            server.zset_large_encoding =
+                configEnumGetValue(zset_large_encoding_enum,argv[1]);
+            if (server.zset_large_encoding == INT_MIN) {
+                err = "argument must be 'skiplist' or 'btree'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
             server.hll_sparse_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"rename-command") && argc == 3) {
@@ -692,10 +804,25 @@ void loadServerConfigFromString(char *config) {
                 err = "argument must be 'yes' or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"cluster-bus-compact") && argc == 2) {
+            server.cluster_bus_compact = yesnotoi(argv[1]);
+            if (server.cluster_bus_compact == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"migrate-chunk-size") && argc == 2) {
+            server.migrate_chunk_size = strtol(argv[1],NULL,10);
+            if (server.migrate_chunk_size < 0) {
+                err = "Invalid migrate-chunk-size value"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"lua-time-limit") && argc == 2) {
             server.lua_time_limit = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"lua-replicate-commands") && argc == 2) {
             server.lua_always_replicate_commands = yesnotoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"lua-persist-scripts") && argc == 2) {
+            if ((server.lua_persist_scripts = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slowlog-log-slower-than") &&
                    argc == 2)
         {
@@ -1000,6 +1127,13 @@ void configSetCommand(client *c) {
             appendServerSaveParams(seconds, changes);
         }
         sdsfreesplitres(v,vlen);
+    } config_set_special_field("memory-prefixes") {
+        int vlen;
+        sds *v = sdssplitargs(o->ptr,&vlen);
+
+        if (v == NULL) goto badfmt;
+        memoryPrefixesSet(v,vlen);
+        sdsfreesplitres(v,vlen);
     } config_set_special_field("dir") {
         if (chdir((char*)o->ptr) == -1) {
             addReplyErrorFormat(c,"Changing directory: %s", strerror(errno));
@@ -1066,6 +1200,8 @@ void configSetCommand(client *c) {
      * config_set_bool_field(name,var). */
     } config_set_bool_field(
       "rdbcompression", server.rdb_compression) {
+    } config_set_bool_field(
+      "lua-persist-scripts", server.lua_persist_scripts) {
     } config_set_bool_field(
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
@@ -1076,6 +1212,8 @@ void configSetCommand(client *c) {
       "cluster-slave-no-failover",server.cluster_slave_no_failover) {
     } config_set_bool_field(
       "cluster-replica-no-failover",server.cluster_slave_no_failover) {
+    } config_set_bool_field(
+      "cluster-bus-compact",server.cluster_bus_compact) {
     } config_set_bool_field(
       "aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync) {
     } config_set_bool_field(
@@ -1140,6 +1278,12 @@ void configSetCommand(client *c) {
       "lfu-log-factor",server.lfu_log_factor,0,INT_MAX) {
     } config_set_numerical_field(
       "lfu-decay-time",server.lfu_decay_time,0,INT_MAX) {
+    } config_set_numerical_field(
+      "tinylfu-window",server.tinylfu_window,0,100) {
+    } config_set_numerical_field(
+      "maxmemory-low-watermark",server.maxmemory_low_watermark,1,100) {
+    } config_set_numerical_field(
+      "maxmemory-high-watermark",server.maxmemory_high_watermark,1,100) {
     } config_set_numerical_field(
       "timeout",server.maxidletime,0,INT_MAX) {
     } config_set_numerical_field(
@@ -1154,6 +1298,12 @@ void configSetCommand(client *c) {
       "active-defrag-cycle-max",server.active_defrag_cycle_max,1,99) {
     } config_set_numerical_field(
       "active-defrag-max-scan-fields",server.active_defrag_max_scan_fields,1,LONG_MAX) {
+    } config_set_numerical_field(
+      "hotkeys-sample-rate",server.hotkeys_sample_rate,0,INT_MAX) {
+        server.hotkeys_countdown = server.hotkeys_sample_rate;
+    } config_set_numerical_field(
+      "hotkeys-size",server.hotkeys_size,1,CONFIG_HOTKEYS_SIZE_MAX) {
+        hotkeysReset();
     } config_set_numerical_field(
       "auto-aof-rewrite-percentage",server.aof_rewrite_perc,0,INT_MAX){
     } config_set_numerical_field(
@@ -1164,6 +1314,8 @@ void configSetCommand(client *c) {
       "stream-node-max-bytes",server.stream_node_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
       "stream-node-max-entries",server.stream_node_max_entries,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "tracking-table-max-keys",server.tracking_table_max_keys,0,LLONG_MAX) {
     } config_set_numerical_field(
       "list-max-ziplist-size",server.list_max_ziplist_size,INT_MIN,INT_MAX) {
     } config_set_numerical_field(
@@ -1178,6 +1330,8 @@ void configSetCommand(client *c) {
       "hll-sparse-max-bytes",server.hll_sparse_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",server.lua_time_limit,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "migrate-chunk-size",server.migrate_chunk_size,0,LONG_MAX) {
     } config_set_numerical_field(
       "slowlog-log-slower-than",server.slowlog_log_slower_than,-1,LLONG_MAX) {
     } config_set_numerical_field(
@@ -1267,6 +1421,13 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+    } config_set_enum_field(
+      "rdb-compression-codec",server.rdb_compression_codec,rdb_compression_codec_enum) {
+    } config_set_enum_field(
+      "zset-large-encoding",server.zset_large_encoding,zset_large_encoding_enum) {
+    } config_set_enum_field(
+      "list-compress-codec",server.list_compress_codec,list_compress_codec_enum) {
+        quicklistSetCompressCodec(server.list_compress_codec);
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1348,6 +1509,9 @@ void configGetCommand(client *c) {
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
+    config_get_numerical_field("tinylfu-window",server.tinylfu_window);
+    config_get_numerical_field("maxmemory-low-watermark",server.maxmemory_low_watermark);
+    config_get_numerical_field("maxmemory-high-watermark",server.maxmemory_high_watermark);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("active-defrag-threshold-lower",server.active_defrag_threshold_lower);
     config_get_numerical_field("active-defrag-threshold-upper",server.active_defrag_threshold_upper);
@@ -1355,6 +1519,8 @@ void configGetCommand(client *c) {
     config_get_numerical_field("active-defrag-cycle-min",server.active_defrag_cycle_min);
     config_get_numerical_field("active-defrag-cycle-max",server.active_defrag_cycle_max);
     config_get_numerical_field("active-defrag-max-scan-fields",server.active_defrag_max_scan_fields);
+    config_get_numerical_field("hotkeys-sample-rate",server.hotkeys_sample_rate);
+    config_get_numerical_field("hotkeys-size",server.hotkeys_size);
     config_get_numerical_field("auto-aof-rewrite-percentage",
             server.aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
@@ -1367,6 +1533,8 @@ void configGetCommand(client *c) {
             server.stream_node_max_bytes);
     config_get_numerical_field("stream-node-max-entries",
             server.stream_node_max_entries);
+    config_get_numerical_field("tracking-table-max-keys",
+            server.tracking_table_max_keys);
     config_get_numerical_field("list-max-ziplist-size",
             server.list_max_ziplist_size);
     config_get_numerical_field("list-compress-depth",
@@ -1380,6 +1548,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("hll-sparse-max-bytes",
             server.hll_sparse_max_bytes);
     config_get_numerical_field("lua-time-limit",server.lua_time_limit);
+    config_get_numerical_field("migrate-chunk-size",server.migrate_chunk_size);
     config_get_numerical_field("slowlog-log-slower-than",
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
@@ -1421,6 +1590,8 @@ void configGetCommand(client *c) {
             server.cluster_slave_no_failover);
     config_get_bool_field("cluster-replica-no-failover",
             server.cluster_slave_no_failover);
+    config_get_bool_field("cluster-bus-compact",
+            server.cluster_bus_compact);
     config_get_bool_field("no-appendfsync-on-rewrite",
             server.aof_no_fsync_on_rewrite);
     config_get_bool_field("slave-serve-stale-data",
@@ -1439,6 +1610,7 @@ void configGetCommand(client *c) {
             server.stop_writes_on_bgsave_err);
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
+    config_get_bool_field("lua-persist-scripts", server.lua_persist_scripts);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
     config_get_bool_field("activerehashing", server.activerehashing);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
@@ -1477,6 +1649,12 @@ void configGetCommand(client *c) {
             server.supervised_mode,supervised_mode_enum);
     config_get_enum_field("appendfsync",
             server.aof_fsync,aof_fsync_enum);
+    config_get_enum_field("rdb-compression-codec",
+            server.rdb_compression_codec,rdb_compression_codec_enum);
+    config_get_enum_field("zset-large-encoding",
+            server.zset_large_encoding,zset_large_encoding_enum);
+    config_get_enum_field("list-compress-codec",
+            server.list_compress_codec,list_compress_codec_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
 
@@ -1513,6 +1691,14 @@ void configGetCommand(client *c) {
         sdsfree(buf);
         matches++;
     }
+    if (stringmatch(pattern,"memory-prefixes",1)) {
+        sds buf = getMemoryPrefixesConfig();
+
+        addReplyBulkCString(c,"memory-prefixes");
+        addReplyBulkCString(c,buf);
+        sdsfree(buf);
+        matches++;
+    }
     if (stringmatch(pattern,"client-output-buffer-limit",1)) {
         sds buf = sdsempty();
         int j;
@@ -1571,7 +1757,7 @@ void configGetCommand(client *c) {
         sdsfree(aux);
         matches++;
     }
-    setDeferredMultiBulkLength(c,replylen,matches*2);
+    setDeferredMapLen(c,replylen,matches);
 }
 
 /*-----------------------------------------------------------------------------
@@ -1888,6 +2074,19 @@ void rewriteConfigSaveOption(struct rewriteConfigState *state) {
     rewriteConfigMarkAsProcessed(state,"save");
 }
 
+/* Rewrite the memory-prefixes option. */
+void rewriteConfigMemoryPrefixesOption(struct rewriteConfigState *state) {
+    if (server.memory_prefixes_count == 0) {
+        rewriteConfigMarkAsProcessed(state,"memory-prefixes");
+        return;
+    }
+    sds line = sdsnew("memory-prefixes ");
+    sds prefixes = getMemoryPrefixesConfig();
+    line = sdscatsds(line,prefixes);
+    sdsfree(prefixes);
+    rewriteConfigRewriteLine(state,"memory-prefixes",line,1);
+}
+
 /* Rewrite the dir option, always using absolute paths.*/
 void rewriteConfigDirOption(struct rewriteConfigState *state) {
     char cwd[1024];
@@ -2137,9 +2336,11 @@ int rewriteConfig(char *path) {
     rewriteConfigStringOption(state,"syslog-ident",server.syslog_ident,CONFIG_DEFAULT_SYSLOG_IDENT);
     rewriteConfigSyslogfacilityOption(state);
     rewriteConfigSaveOption(state);
+    rewriteConfigMemoryPrefixesOption(state);
     rewriteConfigNumericalOption(state,"databases",server.dbnum,CONFIG_DEFAULT_DBNUM);
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",server.rdb_compression_codec,rdb_compression_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
@@ -2169,12 +2370,17 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",server.lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
+    rewriteConfigNumericalOption(state,"tinylfu-window",server.tinylfu_window,CONFIG_DEFAULT_TINYLFU_WINDOW);
+    rewriteConfigNumericalOption(state,"maxmemory-low-watermark",server.maxmemory_low_watermark,CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK);
+    rewriteConfigNumericalOption(state,"maxmemory-high-watermark",server.maxmemory_high_watermark,CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-upper",server.active_defrag_threshold_upper,CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER);
     rewriteConfigBytesOption(state,"active-defrag-ignore-bytes",server.active_defrag_ignore_bytes,CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES);
     rewriteConfigNumericalOption(state,"active-defrag-cycle-min",server.active_defrag_cycle_min,CONFIG_DEFAULT_DEFRAG_CYCLE_MIN);
     rewriteConfigNumericalOption(state,"active-defrag-cycle-max",server.active_defrag_cycle_max,CONFIG_DEFAULT_DEFRAG_CYCLE_MAX);
     rewriteConfigNumericalOption(state,"active-defrag-max-scan-fields",server.active_defrag_max_scan_fields,CONFIG_DEFAULT_DEFRAG_MAX_SCAN_FIELDS);
+    rewriteConfigNumericalOption(state,"hotkeys-sample-rate",server.hotkeys_sample_rate,CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE);
+    rewriteConfigNumericalOption(state,"hotkeys-size",server.hotkeys_size,CONFIG_DEFAULT_HOTKEYS_SIZE);
     rewriteConfigYesNoOption(state,"appendonly",server.aof_state != AOF_OFF,0);
     rewriteConfigStringOption(state,"appendfilename",server.aof_filename,CONFIG_DEFAULT_AOF_FILENAME);
     rewriteConfigEnumOption(state,"appendfsync",server.aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
@@ -2182,13 +2388,16 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
+    rewriteConfigYesNoOption(state,"lua-persist-scripts",server.lua_persist_scripts,CONFIG_DEFAULT_LUA_PERSIST_SCRIPTS);
     rewriteConfigYesNoOption(state,"cluster-enabled",server.cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     rewriteConfigYesNoOption(state,"cluster-require-full-coverage",server.cluster_require_full_coverage,CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE);
     rewriteConfigYesNoOption(state,"cluster-replica-no-failover",server.cluster_slave_no_failover,CLUSTER_DEFAULT_SLAVE_NO_FAILOVER);
+    rewriteConfigYesNoOption(state,"cluster-bus-compact",server.cluster_bus_compact,CLUSTER_DEFAULT_BUS_COMPACT);
     rewriteConfigNumericalOption(state,"cluster-node-timeout",server.cluster_node_timeout,CLUSTER_DEFAULT_NODE_TIMEOUT);
     rewriteConfigNumericalOption(state,"cluster-migration-barrier",server.cluster_migration_barrier,CLUSTER_DEFAULT_MIGRATION_BARRIER);
     rewriteConfigNumericalOption(state,"cluster-replica-validity-factor",server.cluster_slave_validity_factor,CLUSTER_DEFAULT_SLAVE_VALIDITY);
+    rewriteConfigNumericalOption(state,"migrate-chunk-size",server.migrate_chunk_size,CONFIG_DEFAULT_MIGRATE_CHUNK_SIZE);
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
@@ -2197,11 +2406,14 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"hash-max-ziplist-value",server.hash_max_ziplist_value,OBJ_HASH_MAX_ZIPLIST_VALUE);
     rewriteConfigNumericalOption(state,"stream-node-max-bytes",server.stream_node_max_bytes,OBJ_STREAM_NODE_MAX_BYTES);
     rewriteConfigNumericalOption(state,"stream-node-max-entries",server.stream_node_max_entries,OBJ_STREAM_NODE_MAX_ENTRIES);
+    rewriteConfigNumericalOption(state,"tracking-table-max-keys",server.tracking_table_max_keys,CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS);
     rewriteConfigNumericalOption(state,"list-max-ziplist-size",server.list_max_ziplist_size,OBJ_LIST_MAX_ZIPLIST_SIZE);
     rewriteConfigNumericalOption(state,"list-compress-depth",server.list_compress_depth,OBJ_LIST_COMPRESS_DEPTH);
+    rewriteConfigEnumOption(state,"list-compress-codec",server.list_compress_codec,list_compress_codec_enum,OBJ_LIST_COMPRESS_CODEC);
     rewriteConfigNumericalOption(state,"set-max-intset-entries",server.set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",server.zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
+    rewriteConfigEnumOption(state,"zset-large-encoding",server.zset_large_encoding,zset_large_encoding_enum,OBJ_ZSET_LARGE_ENCODING);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
     rewriteConfigYesNoOption(state,"activedefrag",server.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
@@ -170,7 +170,29 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+/* Slicing-by-8 tables: crc64_slice_tab[k][n] is the CRC of the byte 'n'
+ * followed by 'k' zero bytes, so that eight input bytes can be folded into
+ * the CRC with eight independent table lookups instead of eight dependent
+ * ones. Table 0 is crc64_tab itself. Populated by crc64_init(). */
+static uint64_t crc64_slice_tab[8][256];
+static int crc64_slice_ready = 0;
+
+void crc64_init(void) {
+    int j, k;
+
+    for (j = 0; j < 256; j++) crc64_slice_tab[0][j] = crc64_tab[j];
+    for (k = 1; k < 8; k++) {
+        for (j = 0; j < 256; j++) {
+            uint64_t v = crc64_slice_tab[k-1][j];
+            crc64_slice_tab[k][j] = crc64_tab[(uint8_t)v] ^ (v >> 8);
+        }
+    }
+    crc64_slice_ready = 1;
+}
+
+/* Byte at a time implementation, used for the unaligned tail and when the
+ * slicing tables were not initialized. */
+static uint64_t crc64_bytewise(uint64_t crc, const unsigned char *s, uint64_t l) {
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,16 +202,98 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    if (crc64_slice_ready) {
+        while (l >= 8) {
+            /* Little endian load regardless of the host byte order, the
+             * compiler turns it into a single load on x86 / ARM. */
+            crc ^= (uint64_t)s[0] | ((uint64_t)s[1] << 8) |
+                   ((uint64_t)s[2] << 16) | ((uint64_t)s[3] << 24) |
+                   ((uint64_t)s[4] << 32) | ((uint64_t)s[5] << 40) |
+                   ((uint64_t)s[6] << 48) | ((uint64_t)s[7] << 56);
+            crc = crc64_slice_tab[7][(uint8_t)crc] ^
+                  crc64_slice_tab[6][(uint8_t)(crc >> 8)] ^
+                  crc64_slice_tab[5][(uint8_t)(crc >> 16)] ^
+                  crc64_slice_tab[4][(uint8_t)(crc >> 24)] ^
+                  crc64_slice_tab[3][(uint8_t)(crc >> 32)] ^
+                  crc64_slice_tab[2][(uint8_t)(crc >> 40)] ^
+                  crc64_slice_tab[1][(uint8_t)(crc >> 48)] ^
+                  crc64_slice_tab[0][crc >> 56];
+            s += 8;
+            l -= 8;
+        }
+    }
+    return crc64_bytewise(crc, s, l);
+}
+
 /* Test main */
-#ifdef REDIS_TEST
+#if defined(REDIS_TEST) || defined(CRC64_BENCHMARK_MAIN)
 #include <stdio.h>
+#include <stdlib.h>
 
 #define UNUSED(x) (void)(x)
 int crc64Test(int argc, char *argv[]) {
     UNUSED(argc);
     UNUSED(argv);
+    unsigned char buf[4096];
+    int j, errors = 0;
+
+    crc64_init();
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+    if (crc64(0,(unsigned char*)"123456789",9) != UINT64_C(0xe9c6d914c4b8d9ca))
+        errors++;
+
+    /* The sliced implementation must match the byte at a time one for
+     * every length and alignment, and when chaining calls. */
+    for (j = 0; j < (int)sizeof(buf); j++) buf[j] = rand();
+    for (j = 0; j < 1000; j++) {
+        uint64_t off = rand() % 64, len = rand() % (sizeof(buf) - 64);
+        uint64_t split = len ? rand() % len : 0;
+        uint64_t expected = crc64_bytewise(0, buf+off, len);
+        uint64_t crc = crc64(crc64(0, buf+off, split), buf+off+split, len-split);
+        if (crc != expected) {
+            printf("crc64 mismatch: len %llu offset %llu\n",
+                (unsigned long long) len, (unsigned long long) off);
+            errors++;
+            break;
+        }
+    }
+    printf("[crc64]: %s\n", errors ? "FAILED" : "OK");
+    return errors;
+}
+#endif
+
+#ifdef CRC64_BENCHMARK_MAIN
+#include <sys/time.h>
+
+static long long crc64BenchUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+#define crc64BenchRun(name, fn) do { \
+    long long start = crc64BenchUstime(), elapsed; \
+    uint64_t crc = 0; \
+    for (j = 0; j < loops; j++) crc = fn(crc, buf, len); \
+    elapsed = crc64BenchUstime() - start; \
+    printf("%-10s %016llx %8.2f MB/sec\n", name, (unsigned long long) crc, \
+        (double)len*loops/elapsed); \
+} while(0)
+
+/* Usage: crc64-benchmark [size in bytes] [loops] */
+int main(int argc, char **argv) {
+    uint64_t len = argc > 1 ? strtoull(argv[1], NULL, 10) : 64*1024*1024;
+    int loops = argc > 2 ? atoi(argv[2]) : 10, j;
+    unsigned char *buf = malloc(len);
+
+    if (crc64Test(argc, argv) != 0) return 1;
+    for (j = 0; j < (int)len; j++) buf[j] = rand();
+    crc64BenchRun("bytewise", crc64_bytewise);
+    crc64BenchRun("slice-by-8", crc64);
+    free(buf);
     return 0;
 }
 #endif
@@ -62,6 +62,12 @@ void updateLFU(robj *val) {
 robj *lookupKey(redisDb *db, robj *key, int flags) {
     /** 从key-value字典表中查找key */
     dictEntry *de = dictFind(db->dict, key->ptr);
+
+    /* TinyLFU tracks the frequency of every requested key, misses
+     * included, so that keys not in memory build up history as well. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_TINYLFU &&
+        !(flags & LOOKUP_NOTOUCH))
+        tinylfuRecordAccess(key->ptr);
     if (de) {
         // value对象
         robj *val = dictGetVal(de);
@@ -207,13 +213,15 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  */
 void dbAdd(redisDb *db, robj *key, robj *val) {
     sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    dictEntry *de = dictAddRaw(db->dict, copy, NULL);
 
-    serverAssertWithInfo(NULL, key, retval == DICT_OK);
+    serverAssertWithInfo(NULL, key, de != NULL);
+    dictSetVal(db->dict, de, val);
+    memoryPrefixUpdateKey(db, copy);
     if (val->type == OBJ_LIST ||
         val->type == OBJ_ZSET)
         signalKeyAsReady(db, key);
-    if (server.cluster_enabled) slotToKeyAdd(key);
+    if (server.cluster_enabled) slotToKeyAddEntry(de);
 }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -238,6 +246,7 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
     }
 
     dictFreeVal(db->dict, &auxentry);
+    memoryPrefixUpdateKey(db, key->ptr);
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -307,8 +316,11 @@ int dbSyncDelete(redisDb *db, robj *key) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
     if (dictSize(db->expires) > 0) dictDelete(db->expires, key->ptr);
-    if (dictDelete(db->dict, key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) slotToKeyDel(key);
+    memoryPrefixRemoveKey(db, key->ptr);
+    dictEntry *de = dictUnlink(db->dict, key->ptr);
+    if (de) {
+        if (server.cluster_enabled) slotToKeyDelEntry(de);
+        dictFreeUnlinkedEntry(db->dict, de);
         return 1;
     } else {
         return 0;
@@ -396,16 +408,14 @@ long long emptyDb(int dbnum, int flags, void(callback)(void *)) {
         if (async) {
             emptyDbAsync(&server.db[j]);
         } else {
+            memoryPrefixResetDb(&server.db[j]);
             dictEmpty(server.db[j].dict, callback);
             dictEmpty(server.db[j].expires, callback);
         }
     }
     if (server.cluster_enabled) {
-        if (async) {
-            slotToKeyFlushAsync();
-        } else {
-            slotToKeyFlush();
-        }
+        slotToKeyFlush();
+        if (listLength(server.migrate_jobs)) migrateJobsSignalFlushedDb();
     }
     if (dbnum == -1) flushSlaveKeysWithExpireList();
     return removed;
@@ -429,10 +439,14 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db, key);
+    if (listLength(server.migrate_jobs)) migrateJobsSignalModifiedKey(db, key);
+    trackingInvalidateKey(server.current_client, key);
+    memoryPrefixUpdateKey(db, key->ptr);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    trackingInvalidateKeysOnFlush(dbid);
 }
 
 /*-----------------------------------------------------------------------------
@@ -560,7 +574,7 @@ void randomkeyCommand(client *c) {
     robj *key;
 
     if ((key = dbRandomKey(c->db)) == NULL) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
         return;
     }
 
@@ -617,7 +631,8 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey, sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double *) dictGetVal(de), 0);
+        val = createStringObjectFromLongDouble(
+                zsetDictGetScore(o->ptr, (dictEntry *) de), 0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -644,6 +659,14 @@ int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor) {
     return C_OK;
 }
 
+/* SSCAN cursors of roaring encoded sets have the top bit set, which a
+ * dictScan() cursor never has, so a cursor that outlives a conversion
+ * between the two encodings is detected and the scan restarts from the
+ * first element. The other bits hold the next element to return, biased
+ * flipping the sign bit (see roaring.c) and halved: resuming from the even
+ * value below may return one element twice, which SCAN allows. */
+#define SCAN_ROARING_CURSOR (1UL<<(sizeof(unsigned long)*8-1))
+
 /* This command implements SCAN, HSCAN and SSCAN commands.
  * If object 'o' is passed, then it must be a Hash or Set object, otherwise
  * if 'o' is NULL the command will operate on the dictionary associated with
@@ -708,7 +731,11 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
-     * cursor to zero to signal the end of the iteration. */
+     * cursor to zero to signal the end of the iteration.
+     *
+     * Roaring encoded sets are the exception: they can be huge, but their
+     * elements are visited in order, so the cursor is the next element to
+     * return, see SCAN_ROARING_CURSOR. */
 
     /* Handle the case of a hash table. */
     ht = NULL;
@@ -719,7 +746,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                       o->encoding == OBJ_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -727,6 +755,10 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     if (ht) {
         void *privdata[2];
+
+        /* A cursor returned while the set was roaring encoded: restart. */
+        if (o && o->type == OBJ_SET && (cursor & SCAN_ROARING_CURSOR))
+            cursor = 0;
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
          * sparsely populated) we avoid to block too much time at the cost
@@ -743,6 +775,29 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         } while (cursor &&
                  maxiterations-- &&
                  listLength(keys) < (unsigned long) count);
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterator ri;
+        int64_t ll;
+
+        /* A zero cursor, or one returned while the set was encoded as a
+         * hash table, starts from the first element. */
+        roaringInitIterator(&ri, o->ptr);
+        if (cursor & SCAN_ROARING_CURSOR) {
+            uint64_t u = (uint64_t)(cursor & ~SCAN_ROARING_CURSOR) << 1;
+            roaringIteratorSeek(&ri, (int64_t)(u ^ (1ULL<<63)));
+        }
+        cursor = 0;
+        while (roaringNext(&ri, &ll)) {
+            /* With 32 bit cursors we can't resume: return everything. */
+            if (sizeof(cursor) == 8 &&
+                listLength(keys) >= (unsigned long) count)
+            {
+                cursor = SCAN_ROARING_CURSOR |
+                         (((uint64_t)ll ^ (1ULL<<63)) >> 1);
+                break;
+            }
+            listAddNodeTail(keys, createStringObjectFromLongLong(ll));
+        }
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -846,11 +901,10 @@ void lastsaveCommand(client *c) {
     addReplyLongLong(c, server.lastsave);
 }
 
-void typeCommand(client *c) {
-    robj *o;
+/* Return the name of the type of the object, as reported by TYPE. */
+char *getObjectTypeName(robj *o) {
     char *type;
 
-    o = lookupKeyReadWithFlags(c->db, c->argv[1], LOOKUP_NOTOUCH);
     if (o == NULL) {
         type = "none";
     } else {
@@ -883,7 +937,14 @@ void typeCommand(client *c) {
                 break;
         }
     }
-    addReplyStatus(c, type);
+    return type;
+}
+
+void typeCommand(client *c) {
+    robj *o;
+
+    o = lookupKeyReadWithFlags(c->db, c->argv[1], LOOKUP_NOTOUCH);
+    addReplyStatus(c, getObjectTypeName(o));
 }
 
 void shutdownCommand(client *c) {
@@ -1057,10 +1118,14 @@ int dbSwapDatabases(int id1, int id2) {
      * remain in the same DB they were. */
     db1->dict = db2->dict;
     db1->expires = db2->expires;
+    db1->prefix_sizes = db2->prefix_sizes;
+    db1->prefix_stats = db2->prefix_stats;
     db1->avg_ttl = db2->avg_ttl;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
+    db2->prefix_sizes = aux.prefix_sizes;
+    db2->prefix_stats = aux.prefix_stats;
     db2->avg_ttl = aux.avg_ttl;
 
     /* Now we need to handle clients blocked on lists: as an effect
@@ -1272,6 +1337,7 @@ int expireIfNeeded(redisDb *db, robj *key) {
     propagateExpire(db, key, server.lazyfree_lazy_expire);
     notifyKeyspaceEvent(NOTIFY_EXPIRED,
                         "expired", key, db->id);
+    trackingInvalidateKey(NULL, key);
     return server.lazyfree_lazy_expire ? dbAsyncDelete(db, key) :
            dbSyncDelete(db, key);
 }
@@ -1395,6 +1461,30 @@ int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
     return keys;
 }
 
+/* Helper function to extract keys from the following commands:
+ * LMPOP <num-keys> <key> <key> ... <key> LEFT|RIGHT [COUNT <count>]
+ * BLMPOP <timeout> <num-keys> <key> <key> ... <key> LEFT|RIGHT [COUNT ...] */
+int *lmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys) {
+    int i, num, first, *keys;
+
+    first = (cmd->proc == blmpopCommand) ? 3 : 2;
+    num = atoi(argv[first-1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with syntax error. */
+    if (num < 1 || num > (argc - first - 1)) {
+        *numkeys = 0;
+        return NULL;
+    }
+
+    keys = zmalloc(sizeof(int) * num);
+    *numkeys = num;
+
+    /* Add all key positions for argv[first...n] to keys[] */
+    for (i = 0; i < num; i++) keys[i] = first + i;
+
+    return keys;
+}
+
 /* Helper function to extract keys from the SORT command.
  *
  * SORT <sort-key> ... STORE <store-key> ...
@@ -1452,7 +1542,8 @@ int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkey
     first = 3;
     num = 1;
 
-    /* But check for the extended one with the KEYS option. */
+    /* But check for the extended one with the KEYS option, or the SLOT
+     * one, that has no key arguments at all. */
     if (argc > 6) {
         for (i = 6; i < argc; i++) {
             if (!strcasecmp(argv[i]->ptr, "keys") &&
@@ -1461,6 +1552,11 @@ int *migrateGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkey
                 num = argc - first;
                 break;
             }
+            if (!strcasecmp(argv[i]->ptr, "slot") &&
+                sdslen(argv[3]->ptr) == 0) {
+                num = 0;
+                break;
+            }
         }
     }
 
@@ -1555,84 +1651,148 @@ int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
  * while rehashing the cluster and in other conditions when we need to
- * understand if we have keys for a given hash slot. */
-void slotToKeyUpdateKey(robj *key, int add) {
-    unsigned int hashslot = keyHashSlot(key->ptr, sdslen(key->ptr));
-    unsigned char buf[64];
-    unsigned char *indexed = buf;
-    size_t keylen = sdslen(key->ptr);
-
-    server.cluster->slots_keys_count[hashslot] += add ? 1 : -1;
-    if (keylen + 2 > 64) indexed = zmalloc(keylen + 2);
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    memcpy(indexed + 2, key->ptr, keylen);
-    if (add) {
-        raxInsert(server.cluster->slots_to_keys, indexed, keylen + 2, NULL, NULL);
-    } else {
-        raxRemove(server.cluster->slots_to_keys, indexed, keylen + 2, NULL);
+ * understand if we have keys for a given hash slot.
+ *
+ * The keys of every slot are kept in a doubly linked list threaded through
+ * the main dictionary entries (see clusterDictEntryMetadata), so there is
+ * no additional allocation per key and walking a slot is O(keys in slot). */
+static inline clusterDictEntryMetadata *dictEntryClusterMetadata(dictEntry *de) {
+    return (clusterDictEntryMetadata *) dictMetadata(de);
+}
+
+void slotToKeyInit(void) {
+    memset(server.cluster->slots_to_keys, 0,
+           sizeof(server.cluster->slots_to_keys));
+}
+
+/* Link the key-value entry into the list of its hash slot. */
+void slotToKeyAddEntry(dictEntry *entry) {
+    sds key = dictGetKey(entry);
+    unsigned int hashslot = keyHashSlot(key, sdslen(key));
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+
+    slot->count++;
+
+    /* Insert entry before the first element in the list. */
+    dictEntry *first = slot->head;
+    dictEntryClusterMetadata(entry)->next = first;
+    if (first != NULL) {
+        serverAssert(dictEntryClusterMetadata(first)->prev == NULL);
+        dictEntryClusterMetadata(first)->prev = entry;
     }
-    if (indexed != buf) zfree(indexed);
+    serverAssert(dictEntryClusterMetadata(entry)->prev == NULL);
+    slot->head = entry;
 }
 
-void slotToKeyAdd(robj *key) {
-    slotToKeyUpdateKey(key, 1);
+/* Unlink the key-value entry from the list of its hash slot. It must be
+ * called before the entry is released. */
+void slotToKeyDelEntry(dictEntry *entry) {
+    sds key = dictGetKey(entry);
+    unsigned int hashslot = keyHashSlot(key, sdslen(key));
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+
+    slot->count--;
+
+    /* Connect previous and next entries to each other. */
+    dictEntry *next = dictEntryClusterMetadata(entry)->next;
+    dictEntry *prev = dictEntryClusterMetadata(entry)->prev;
+    if (slot->iter == entry) slot->iter = next;
+    if (next != NULL) {
+        dictEntryClusterMetadata(next)->prev = prev;
+    }
+    if (prev != NULL) {
+        dictEntryClusterMetadata(prev)->next = next;
+    } else {
+        /* The removed entry was the first in the list. */
+        serverAssert(slot->head == entry);
+        slot->head = next;
+    }
 }
 
-void slotToKeyDel(robj *key) {
-    slotToKeyUpdateKey(key, 0);
+/* Updates neighbour entries when an entry has been replaced (e.g. reallocated
+ * during active defrag). */
+void slotToKeyReplaceEntry(dictEntry *entry) {
+    dictEntry *next = dictEntryClusterMetadata(entry)->next;
+    dictEntry *prev = dictEntryClusterMetadata(entry)->prev;
+    sds key = dictGetKey(entry);
+    unsigned int hashslot = keyHashSlot(key, sdslen(key));
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+
+    /* The neighbours still point to the old entry. */
+    dictEntry *old = prev ? dictEntryClusterMetadata(prev)->next : slot->head;
+    if (slot->iter == old) slot->iter = entry;
+    if (next != NULL) {
+        dictEntryClusterMetadata(next)->prev = entry;
+    }
+    if (prev != NULL) {
+        dictEntryClusterMetadata(prev)->next = entry;
+    } else {
+        /* The replaced entry was the first in the list. */
+        slot->head = entry;
+    }
 }
 
+/* Empties the slot to key lists. The entries themselves are released
+ * together with the main dictionary. */
 void slotToKeyFlush(void) {
-    raxFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = raxNew();
-    memset(server.cluster->slots_keys_count, 0,
-           sizeof(server.cluster->slots_keys_count));
+    slotToKeyInit();
 }
 
 /* Pupulate the specified array of objects with keys in the specified slot.
  * New objects are returned to represent keys, it's up to the caller to
  * decrement the reference count to release the keys names. */
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
-    raxIterator iter;
-    int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter, server.cluster->slots_to_keys);
-    raxSeek(&iter, ">=", indexed, 2);
-    while (count-- && raxNext(&iter)) {
-        if (iter.key[0] != indexed[0] || iter.key[1] != indexed[1]) break;
-        keys[j++] = createStringObject((char *) iter.key + 2, iter.key_len - 2);
+    unsigned int j = 0;
+
+    dictEntry *de = server.cluster->slots_to_keys[hashslot].head;
+    while (de != NULL && j < count) {
+        sds key = dictGetKey(de);
+        keys[j++] = createStringObject(key, sdslen(key));
+        de = dictEntryClusterMetadata(de)->next;
+    }
+    return j;
+}
+
+/* Start an iteration of the keys of the specified hash slot, see
+ * getKeysInSlotNext(). Only one iteration per slot can be in progress. */
+void slotToKeyIterInit(unsigned int hashslot) {
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+    slot->iter = slot->head;
+}
+
+/* Like getKeysInSlot(), but returns the next keys of the iteration started
+ * by slotToKeyIterInit(), or 0 once it is over. The iteration survives keys
+ * being deleted, and keys added after it started are not returned, since
+ * they are linked at the head of the list. */
+unsigned int getKeysInSlotNext(unsigned int hashslot, robj **keys, unsigned int count) {
+    slotToKeys *slot = &server.cluster->slots_to_keys[hashslot];
+    unsigned int j = 0;
+
+    while (slot->iter != NULL && j < count) {
+        sds key = dictGetKey(slot->iter);
+        keys[j++] = createStringObject(key, sdslen(key));
+        slot->iter = dictEntryClusterMetadata(slot->iter)->next;
     }
-    raxStop(&iter);
     return j;
 }
 
 /* Remove all the keys in the specified hash slot.
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot) {
-    raxIterator iter;
-    int j = 0;
-    unsigned char indexed[2];
-
-    indexed[0] = (hashslot >> 8) & 0xff;
-    indexed[1] = hashslot & 0xff;
-    raxStart(&iter, server.cluster->slots_to_keys);
-    while (server.cluster->slots_keys_count[hashslot]) {
-        raxSeek(&iter, ">=", indexed, 2);
-        raxNext(&iter);
-
-        robj *key = createStringObject((char *) iter.key + 2, iter.key_len - 2);
+    unsigned int j = 0;
+
+    dictEntry *de = server.cluster->slots_to_keys[hashslot].head;
+    while (de != NULL) {
+        sds sdskey = dictGetKey(de);
+        de = dictEntryClusterMetadata(de)->next;
+        robj *key = createStringObject(sdskey, sdslen(sdskey));
         dbDelete(&server.db[0], key);
         decrRefCount(key);
         j++;
     }
-    raxStop(&iter);
     return j;
 }
 
 unsigned int countKeysInSlot(unsigned int hashslot) {
-    return server.cluster->slots_keys_count[hashslot];
+    return server.cluster->slots_to_keys[hashslot].count;
 }
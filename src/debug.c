@@ -177,16 +177,17 @@ void xorObjectDigest(redisDb *db, robj *keyobj, unsigned char *digest, robj *o)
                 xorDigest(digest,eledigest,20);
                 zzlNext(zl,&eptr,&sptr);
             }
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                   o->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = o->ptr;
             dictIterator *di = dictGetIterator(zs->dict);
             dictEntry *de;
 
             while((de = dictNext(di)) != NULL) {
                 sds sdsele = dictGetKey(de);
-                double *score = dictGetVal(de);
+                double score = zsetDictGetScore(zs,de);
 
-                snprintf(buf,sizeof(buf),"%.17g",*score);
+                snprintf(buf,sizeof(buf),"%.17g",score);
                 memset(eledigest,0,20);
                 mixDigest(eledigest,sdsele,sdslen(sdsele));
                 mixDigest(eledigest,buf,strlen(buf));
@@ -314,6 +315,7 @@ void debugCommand(client *c) {
 "OBJECT <key> -- Show low level info about key and associated value.",
 "PANIC -- Crash the server simulating a panic.",
 "POPULATE <count> [prefix] [size] -- Create <count> string keys named key:<num>. If a prefix is specified is used instead of the 'key' prefix.",
+"PROTOCOL <type> -- Reply with a test value of the specified type. <type> can be: string, integer, double, null, array, set, map, push, true, false.",
 "RELOAD -- Save the RDB on disk and reload it back in memory.",
 "RESTART -- Graceful restart: save config, db, restart.",
 "SDSLEN <key> -- Show low level SDS string info representing key and value.",
@@ -597,6 +599,7 @@ NULL
         /* Get the hash table reference from the object, if possible. */
         switch (o->encoding) {
         case OBJ_ENCODING_SKIPLIST:
+        case OBJ_ENCODING_BTREE:
             {
                 zset *zs = o->ptr;
                 ht = zs->dict;
@@ -624,6 +627,45 @@ NULL
     {
         stringmatchlen_fuzz_test();
         addReplyStatus(c,"Apparently Redis did not crash: test passed");
+    } else if (!strcasecmp(c->argv[1]->ptr,"protocol") && c->argc == 3) {
+        /* DEBUG PROTOCOL [string|integer|double|null|array|set|map|push|
+         *                 true|false] */
+        char *name = c->argv[2]->ptr;
+        if (!strcasecmp(name,"string")) {
+            addReplyBulkCString(c,"Hello World");
+        } else if (!strcasecmp(name,"integer")) {
+            addReplyLongLong(c,12345);
+        } else if (!strcasecmp(name,"double")) {
+            addReplyDouble(c,3.141);
+        } else if (!strcasecmp(name,"null")) {
+            addReplyNull(c);
+        } else if (!strcasecmp(name,"array")) {
+            addReplyMultiBulkLen(c,3);
+            for (int j = 0; j < 3; j++) addReplyLongLong(c,j);
+        } else if (!strcasecmp(name,"set")) {
+            addReplySetLen(c,3);
+            for (int j = 0; j < 3; j++) addReplyLongLong(c,j);
+        } else if (!strcasecmp(name,"map")) {
+            addReplyMapLen(c,3);
+            for (int j = 0; j < 3; j++) {
+                addReplyLongLong(c,j);
+                addReplyBool(c, j == 1);
+            }
+        } else if (!strcasecmp(name,"push")) {
+            addReplyPushLen(c,2);
+            addReplyBulkCString(c,"server-cpu-usage");
+            addReplyLongLong(c,42);
+            /* Push replies are not synchronous replies, so we emit also a
+             * normal reply in order for blocking clients just discarding the
+             * push reply, to actually consume the reply and continue. */
+            addReplyBulkCString(c,"Some real reply following the push reply");
+        } else if (!strcasecmp(name,"true")) {
+            addReplyBool(c,1);
+        } else if (!strcasecmp(name,"false")) {
+            addReplyBool(c,0);
+        } else {
+            addReplyError(c,"Wrong protocol type name. Please use one of the following: string|integer|double|null|array|set|map|push|true|false");
+        }
     } else {
         addReplySubcommandSyntaxError(c);
         return;
@@ -690,6 +732,8 @@ void serverLogObjectDebugInfo(const robj *o) {
         serverLog(LL_WARNING,"Sorted set size: %d", (int) zsetLength(o));
         if (o->encoding == OBJ_ENCODING_SKIPLIST)
             serverLog(LL_WARNING,"Skiplist level: %d", (int) ((const zset*)o->ptr)->zsl->level);
+        else if (o->encoding == OBJ_ENCODING_BTREE)
+            serverLog(LL_WARNING,"Btree level: %d", (int) ((const zset*)o->ptr)->zbt->level);
     }
 }
 
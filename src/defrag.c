@@ -49,6 +49,111 @@ int je_get_defrag_hint(void* ptr, int *bin_util, int *run_util);
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref);
 dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, uint64_t hash, long *defragged);
 
+/* The fragmentation jemalloc reports is the sum of the free regions of all
+ * the small size classes ("bins"), plus the unused space of large extents.
+ * Usually only a few bins are responsible for most of it, so instead of
+ * trying to move every pointer we have, the scan only targets the bins that
+ * are sparse enough to be worth compacting: the allocations of the other
+ * bins are skipped without even asking jemalloc for a hint (which takes the
+ * bin lock).
+ *
+ * defrag_bin_targeted is indexed by size class >> 3 (the quantum redis
+ * configures jemalloc with), and is refreshed once per second from the
+ * per bin statistics by defragUpdateBins(). */
+static unsigned char *defrag_bin_targeted = NULL;
+static size_t defrag_bin_max_size = 0;
+static long long defrag_moved_bytes = 0; /* Bytes moved since startup. */
+static int defrag_dictentry_targeted = 0; /* dictEntry size class targeted? */
+static int defrag_keyspace_entry_targeted = 0; /* Same for the keyspace. */
+
+/* A bin is targeted when its own fragmentation is above the lower
+ * threshold, and it holds at least 1/DEFRAG_BIN_MIN_SHARE of the bytes
+ * wasted in all the bins. */
+#define DEFRAG_BIN_MIN_SHARE 100
+
+/* Return true if allocations of the given usable size live in a bin the
+ * current scan targets. */
+static inline int defragSizeTargeted(size_t size) {
+    return size <= defrag_bin_max_size && defrag_bin_targeted[(size+7)>>3];
+}
+
+/* Read the per bin utilization from jemalloc and recompute which bins are
+ * targeted. The caller is expected to have refreshed the jemalloc stats
+ * epoch already (getAllocatorFragmentation() does it). */
+void defragUpdateBins(void) {
+    size_t size_mib[4], nregs_mib[4], curregs_mib[6], curslabs_mib[6];
+    size_t bin_miblen = 4, stats_miblen = 6;
+    size_t sz, total_waste = 0, targeted_waste = 0;
+    unsigned nbins, j;
+    int targeted = 0;
+
+    sz = sizeof(nbins);
+    if (je_mallctl("arenas.nbins", &nbins, &sz, NULL, 0) ||
+        je_mallctlnametomib("arenas.bin.0.size", size_mib, &bin_miblen) ||
+        je_mallctlnametomib("arenas.bin.0.nregs", nregs_mib, &bin_miblen) ||
+        je_mallctlnametomib("stats.arenas.0.bins.0.curregs", curregs_mib, &stats_miblen) ||
+        je_mallctlnametomib("stats.arenas.0.bins.0.curslabs", curslabs_mib, &stats_miblen))
+    {
+        nbins = 0;
+    }
+    curregs_mib[2] = curslabs_mib[2] = MALLCTL_ARENAS_ALL;
+
+    size_t *sizes = zmalloc(sizeof(size_t)*(nbins+1));
+    size_t *waste = zmalloc(sizeof(size_t)*(nbins+1));
+    int *sparse = zmalloc(sizeof(int)*(nbins+1));
+    for (j = 0; j < nbins; j++) {
+        size_t curregs = 0, curslabs = 0, avail;
+        uint32_t nregs = 0;
+
+        sizes[j] = 0;
+        size_mib[2] = nregs_mib[2] = j;
+        curregs_mib[4] = curslabs_mib[4] = j;
+        sz = sizeof(size_t);
+        je_mallctlbymib(size_mib, bin_miblen, &sizes[j], &sz, NULL, 0);
+        je_mallctlbymib(curregs_mib, stats_miblen, &curregs, &sz, NULL, 0);
+        je_mallctlbymib(curslabs_mib, stats_miblen, &curslabs, &sz, NULL, 0);
+        sz = sizeof(nregs);
+        je_mallctlbymib(nregs_mib, bin_miblen, &nregs, &sz, NULL, 0);
+
+        avail = (size_t)nregs*curslabs;
+        waste[j] = avail > curregs ? (avail-curregs)*sizes[j] : 0;
+        total_waste += waste[j];
+        /* A bin with a single slab has nothing to be compacted into. */
+        sparse[j] = curslabs > 1 && curregs &&
+            ((float)avail/curregs)*100 - 100 >= server.active_defrag_threshold_lower;
+    }
+
+    if (nbins && sizes[nbins-1] != defrag_bin_max_size) {
+        defrag_bin_max_size = sizes[nbins-1];
+        zfree(defrag_bin_targeted);
+        defrag_bin_targeted = zmalloc((defrag_bin_max_size>>3)+1);
+    }
+    if (defrag_bin_targeted)
+        memset(defrag_bin_targeted,0,(defrag_bin_max_size>>3)+1);
+    for (j = 0; j < nbins; j++) {
+        if (!sparse[j] || waste[j]*DEFRAG_BIN_MIN_SHARE < total_waste)
+            continue;
+        defrag_bin_targeted[(sizes[j]+7)>>3] = 1;
+        targeted_waste += waste[j];
+        targeted++;
+    }
+    zfree(sizes);
+    zfree(waste);
+    zfree(sparse);
+
+    /* Hash table entries are the most common allocation we have, and all
+     * share the same size class: when it isn't targeted the bucket callbacks
+     * can skip the whole chain without looking at every entry. */
+    defrag_dictentry_targeted = defragSizeTargeted(je_nallocx(sizeof(dictEntry),0));
+    /* Keyspace entries may carry metadata (the slot to keys links in cluster
+     * mode), so they can be in a bigger size class. */
+    defrag_keyspace_entry_targeted = defragSizeTargeted(
+        je_nallocx(sizeof(dictEntry)+dictMetadataSize(server.db[0].dict),0));
+
+    server.active_defrag_targeted_bins = targeted;
+    server.active_defrag_targeted_frag_bytes = targeted_waste;
+}
+
 /* Defrag helper for generic allocations.
  *
  * returns NULL in case the allocatoin wasn't moved.
@@ -58,6 +163,13 @@ void* activeDefragAlloc(void *ptr) {
     int bin_util, run_util;
     size_t size;
     void *newptr;
+    /* allocations of bins that are not fragmented (and large allocations,
+     * which jemalloc can't give a hint for anyway) are not worth a look. */
+    size = zmalloc_size(ptr);
+    if (!defragSizeTargeted(size)) {
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
     if(!je_get_defrag_hint(ptr, &bin_util, &run_util)) {
         server.stat_active_defrag_misses++;
         return NULL;
@@ -72,10 +184,10 @@ void* activeDefragAlloc(void *ptr) {
     /* move this allocation to a new allocation.
      * make sure not to use the thread cache. so that we don't get back the same
      * pointers we try to free */
-    size = zmalloc_size(ptr);
     newptr = zmalloc_no_tcache(size);
     memcpy(newptr, ptr, size);
     zfree_no_tcache(ptr);
+    defrag_moved_bytes += size;
     return newptr;
 }
 
@@ -254,6 +366,12 @@ long activeDefragZsetEntry(zset *zs, dictEntry *de) {
     sds sdsele = dictGetKey(de);
     if ((newsds = activeDefragSds(sdsele)))
         defragged++, de->key = newsds;
+    if (zs->zbt) {
+        /* Btree nodes are defragged as a whole by defragZsetBtree(), here
+         * we just need to update the references to the moved string. */
+        if (newsds) zbtReplaceEle(zs->zbt, dictGetDoubleVal(de), sdsele, newsds);
+        return defragged;
+    }
     newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
     if (newscore) {
         dictSetVal(zs->dict, de, newscore);
@@ -413,7 +531,9 @@ long activeDefragQuickListNodes(quicklist *ql) {
     long defragged = 0;
     unsigned char *newzl;
     while (node) {
-        if ((newnode = activeDefragAlloc(node))) {
+        /* Nodes in the decompress cache are referenced by it, and will be
+         * compressed again soon anyway: leave them where they are. */
+        if (!node->recompress && (newnode = activeDefragAlloc(node))) {
             if (newnode->prev)
                 newnode->prev->next = newnode;
             else
@@ -440,6 +560,117 @@ void defragLater(redisDb *db, dictEntry *kde) {
     listAddNodeTail(db->defrag_later, key);
 }
 
+/* Defrag the nodes of the btree subtree 'node' at 'level', whose first
+ * element has rank 'base', fixing the leaf links. Leaves before rank
+ * 'start' were visited by a previous call and are skipped, as the inner
+ * nodes entered before it. At most '*budget' leaves are visited, and
+ * '*next' is set to the rank following the last visited leaf. Returns the
+ * new pointer of the node if it was moved, NULL otherwise. */
+void *defragZbtRange(zbtree *zbt, void *node, int level, unsigned long base,
+                     unsigned long start, unsigned long *next, long *budget,
+                     long *defragged)
+{
+    void *newnode = NULL;
+    unsigned int j;
+
+    if (base >= start && (newnode = activeDefragAlloc(node)))
+        (*defragged)++, node = newnode;
+    if (level == 1) {
+        zbtLeaf *leaf = node;
+        if (newnode) {
+            if (leaf->prev) leaf->prev->next = leaf; else zbt->head = leaf;
+            if (leaf->next) leaf->next->prev = leaf; else zbt->tail = leaf;
+        }
+        (*budget)--;
+        *next = base + leaf->count;
+        server.stat_active_defrag_scanned++;
+    } else {
+        zbtInner *inner = node;
+        for (j = 0; j < inner->count && *budget > 0; j++) {
+            if (base + inner->size[j] > start) {
+                void *newchild = defragZbtRange(zbt, inner->child[j], level-1,
+                                                base, start, next, budget,
+                                                defragged);
+                if (newchild) inner->child[j] = newchild;
+            }
+            base += inner->size[j];
+        }
+    }
+    return newnode;
+}
+
+/* Defrag the btree nodes starting from the leaf holding the element of rank
+ * '*rank', visiting at most 'budget' leaves. '*rank' is updated to where the
+ * next call should resume, and is >= the tree length once done. Ranks may
+ * shift if the tree is modified between two calls: some leaves are then
+ * skipped or visited again, which is harmless. */
+long defragZbtNodes(zbtree *zbt, unsigned long *rank, long budget) {
+    long defragged = 0;
+    unsigned long next = *rank;
+    void *newroot;
+
+    if ((newroot = defragZbtRange(zbt, zbt->root, zbt->level, 0, *rank,
+                                  &next, &budget, &defragged)))
+        zbt->root = newroot;
+    *rank = next;
+    return defragged;
+}
+
+/* Like defragZbtRange() for the container tree of a roaring set, where
+ * ranks are element ranks: the data of the containers of every visited
+ * leaf is defragged as well. */
+void *defragRoaringRange(roaring *r, void *node, int level, uint64_t base,
+                         uint64_t start, uint64_t *next, long *budget,
+                         long *defragged)
+{
+    void *newnode = NULL, *newptr;
+    uint32_t j;
+
+    if (base >= start && (newnode = activeDefragAlloc(node)))
+        (*defragged)++, node = newnode;
+    if (level == 1) {
+        roaringLeaf *leaf = node;
+        if (newnode) {
+            if (leaf->prev) leaf->prev->next = leaf; else r->head = leaf;
+            if (leaf->next) leaf->next->prev = leaf; else r->tail = leaf;
+        }
+        for (j = 0; j < leaf->count; j++) {
+            if ((newptr = activeDefragAlloc(leaf->c[j].data)))
+                (*defragged)++, leaf->c[j].data = newptr;
+            base += leaf->c[j].card;
+        }
+        (*budget)--;
+        *next = base;
+        server.stat_active_defrag_scanned++;
+    } else {
+        roaringInner *inner = node;
+        for (j = 0; j < inner->count && *budget > 0; j++) {
+            if (base + inner->card[j] > start) {
+                void *newchild = defragRoaringRange(r, inner->child[j],
+                                                    level-1, base, start,
+                                                    next, budget, defragged);
+                if (newchild) inner->child[j] = newchild;
+            }
+            base += inner->card[j];
+        }
+    }
+    return newnode;
+}
+
+/* Defrag the nodes of a roaring set starting from the leaf holding the
+ * element of rank '*rank', like defragZbtNodes(). */
+long defragRoaringNodes(roaring *r, uint64_t *rank, long budget) {
+    long defragged = 0;
+    uint64_t next = *rank;
+    void *newroot;
+
+    if ((newroot = defragRoaringRange(r, r->root, r->level, 0, *rank,
+                                      &next, &budget, &defragged)))
+        r->root = newroot;
+    *rank = next;
+    return defragged;
+}
+
 long scanLaterList(robj *ob) {
     quicklist *ql = ob->ptr;
     if (ob->type != OBJ_LIST || ob->encoding != OBJ_ENCODING_QUICKLIST)
@@ -460,13 +691,33 @@ void scanLaterZsetCallback(void *privdata, const dictEntry *_de) {
     server.stat_active_defrag_scanned++;
 }
 
+/* Btree sorted sets scan their dict first, then their nodes: the cursor of
+ * the second phase is the rank of the next leaf with this flag set, which
+ * a dictScan() cursor never has. */
+#define DEFRAG_ZBT_NODES_CURSOR (1UL<<(sizeof(unsigned long)*8-1))
+#define DEFRAG_ZBT_LEAVES_PER_STEP 16
+
 long scanLaterZset(robj *ob, unsigned long *cursor) {
-    if (ob->type != OBJ_ZSET || ob->encoding != OBJ_ENCODING_SKIPLIST)
+    if (ob->type != OBJ_ZSET || (ob->encoding != OBJ_ENCODING_SKIPLIST &&
+                                 ob->encoding != OBJ_ENCODING_BTREE)) {
+        *cursor = 0;
         return 0;
+    }
     zset *zs = (zset*)ob->ptr;
+    if (*cursor & DEFRAG_ZBT_NODES_CURSOR) {
+        unsigned long rank = *cursor & ~DEFRAG_ZBT_NODES_CURSOR;
+        long defragged = 0;
+        if (ob->encoding == OBJ_ENCODING_BTREE)
+            defragged = defragZbtNodes(zs->zbt, &rank, DEFRAG_ZBT_LEAVES_PER_STEP);
+        *cursor = (ob->encoding == OBJ_ENCODING_BTREE && rank < zs->zbt->length) ?
+                  (rank | DEFRAG_ZBT_NODES_CURSOR) : 0;
+        return defragged;
+    }
     dict *d = zs->dict;
     scanLaterZsetData data = {zs, 0};
     *cursor = dictScan(d, *cursor, scanLaterZsetCallback, defragDictBucketCallback, &data);
+    if (*cursor == 0 && ob->encoding == OBJ_ENCODING_BTREE)
+        *cursor = DEFRAG_ZBT_NODES_CURSOR;
     return data.defragged;
 }
 
@@ -479,8 +730,19 @@ void scanLaterSetCallback(void *privdata, const dictEntry *_de) {
     server.stat_active_defrag_scanned++;
 }
 
+/* Roaring sets are visited a few leaves at a time: the cursor is the rank
+ * of the next element to visit. */
+#define DEFRAG_ROARING_LEAVES_PER_STEP 16
+
 long scanLaterSet(robj *ob, unsigned long *cursor) {
     long defragged = 0;
+    if (ob->type == OBJ_SET && ob->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = ob->ptr;
+        uint64_t rank = *cursor;
+        defragged = defragRoaringNodes(r, &rank, DEFRAG_ROARING_LEAVES_PER_STEP);
+        *cursor = rank < r->card ? rank : 0;
+        return defragged;
+    }
     if (ob->type != OBJ_SET || ob->encoding != OBJ_ENCODING_HT)
         return 0;
     dict *d = ob->ptr;
@@ -556,6 +818,38 @@ long defragZsetSkiplist(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+/* Like for the skiplist, large btrees are handled later: both the nodes
+ * and the elements, see scanLaterZset(). */
+long defragZsetBtree(redisDb *db, dictEntry *kde) {
+    robj *ob = dictGetVal(kde);
+    long defragged = 0;
+    zset *zs = (zset*)ob->ptr;
+    zset *newzs;
+    zbtree *newzbt;
+    dict *newdict;
+    dictEntry *de;
+    serverAssert(ob->type == OBJ_ZSET && ob->encoding == OBJ_ENCODING_BTREE);
+    if ((newzs = activeDefragAlloc(zs)))
+        defragged++, ob->ptr = zs = newzs;
+    if ((newzbt = activeDefragAlloc(zs->zbt)))
+        defragged++, zs->zbt = newzbt;
+    if (zsetLength(ob) > server.active_defrag_max_scan_fields)
+        defragLater(db, kde);
+    else {
+        unsigned long rank = 0;
+        defragged += defragZbtNodes(zs->zbt, &rank, LONG_MAX);
+        dictIterator *di = dictGetIterator(zs->dict);
+        while((de = dictNext(di)) != NULL) {
+            defragged += activeDefragZsetEntry(zs, de);
+        }
+        dictReleaseIterator(di);
+    }
+    if ((newdict = activeDefragAlloc(zs->dict)))
+        defragged++, zs->dict = newdict;
+    defragged += dictDefragTables(zs->dict);
+    return defragged;
+}
+
 long defragHash(redisDb *db, dictEntry *kde) {
     long defragged = 0;
     robj *ob = dictGetVal(kde);
@@ -592,6 +886,25 @@ long defragSet(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+/* Defrag a roaring set: the set itself, the tree nodes and the data of
+ * every container. Sets with many containers are deferred, and visited a
+ * few leaves at a time by scanLaterSet(). */
+long defragRoaring(redisDb *db, dictEntry *kde) {
+    long defragged = 0;
+    robj *ob = dictGetVal(kde);
+    roaring *r, *newr;
+    uint64_t rank = 0;
+
+    if ((newr = activeDefragAlloc(ob->ptr)))
+        defragged++, ob->ptr = newr;
+    r = ob->ptr;
+    if (r->len > server.active_defrag_max_scan_fields)
+        defragLater(db, kde);
+    else
+        defragged += defragRoaringNodes(r, &rank, LONG_MAX);
+    return defragged;
+}
+
 /* Defrag callback for radix tree iterator, called for each node,
  * used in order to defrag the nodes allocations. */
 int defragRaxNode(raxNode **noderef) {
@@ -731,6 +1044,8 @@ void* defragStreamConsumerGroup(raxIterator *ri, void *privdata, long *defragged
         *defragged += defragRadixTree(&cg->consumers, 0, defragStreamConsumer, cg);
     if (cg->pel)
         *defragged += defragRadixTree(&cg->pel, 0, NULL, NULL);
+    if (cg->pel_by_time)
+        *defragged += defragRadixTree(&cg->pel_by_time, 0, NULL, NULL);
     return NULL;
 }
 
@@ -778,6 +1093,10 @@ long defragKey(redisDb *db, dictEntry *de) {
         uint64_t hash = dictGetHash(db->dict, de->key);
         replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
     }
+    if (dictSize(db->prefix_sizes)) {
+        uint64_t hash = dictGetHash(db->dict, de->key);
+        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->prefix_sizes, keysds, newsds, hash, &defragged);
+    }
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
@@ -804,6 +1123,8 @@ long defragKey(redisDb *db, dictEntry *de) {
             intset *newis, *is = ob->ptr;
             if ((newis = activeDefragAlloc(is)))
                 defragged++, ob->ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_ROARING) {
+            defragged += defragRoaring(db, de);
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -813,6 +1134,8 @@ long defragKey(redisDb *db, dictEntry *de) {
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
             defragged += defragZsetSkiplist(db, de);
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
+            defragged += defragZsetBtree(db, de);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -851,6 +1174,7 @@ void defragScanCallback(void *privdata, const dictEntry *de) {
  * used in order to defrag the dictEntry allocations. */
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     UNUSED(privdata); /* NOTE: this function is also used by both activeDefragCycle and scanLaterHash, etc. don't use privdata */
+    if (!defrag_dictentry_targeted) return;
     while(*bucketref) {
         dictEntry *de = *bucketref, *newde;
         if ((newde = activeDefragAlloc(de))) {
@@ -860,6 +1184,22 @@ void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     }
 }
 
+/* Like defragDictBucketCallback(), but for the main keyspace dictionary:
+ * in cluster mode its entries are also linked in the slot to keys lists,
+ * that must be updated when an entry is moved. */
+void defragKeyspaceBucketCallback(void *privdata, dictEntry **bucketref) {
+    UNUSED(privdata);
+    if (!defrag_keyspace_entry_targeted) return;
+    while(*bucketref) {
+        dictEntry *de = *bucketref, *newde;
+        if ((newde = activeDefragAlloc(de))) {
+            *bucketref = newde;
+            if (server.cluster_enabled) slotToKeyReplaceEntry(newde);
+        }
+        bucketref = &(*bucketref)->next;
+    }
+}
+
 /* Utility function to get the fragmentation ratio from jemalloc.
  * It is critical to do that by comparing only heap maps that belong to
  * jemalloc, and skip ones the jemalloc keeps as spare. Since we use this
@@ -999,10 +1339,21 @@ void computeDefragCycles() {
     float frag_pct = getAllocatorFragmentation(&frag_bytes);
     /* If we're not already running, and below the threshold, exit. */
     if (!server.active_defrag_running) {
-        if(frag_pct < server.active_defrag_threshold_lower || frag_bytes < server.active_defrag_ignore_bytes)
+        if(frag_pct < server.active_defrag_threshold_lower || frag_bytes < server.active_defrag_ignore_bytes) {
+            server.active_defrag_targeted_bins = 0;
+            server.active_defrag_targeted_frag_bytes = 0;
             return;
+        }
     }
 
+    /* Find out which bins the fragmentation comes from. If none of them is
+     * worth compacting (the overhead is in large allocations, or in the slabs
+     * jemalloc currently allocates from), moving pointers can't help, so
+     * don't start a scan. A running scan notices it and stops early. */
+    defragUpdateBins();
+    if (!server.active_defrag_targeted_bins)
+        return;
+
     /* Calculate the adaptive aggressiveness of the defrag */
     int cpu_pct = INTERPOLATE(frag_pct,
             server.active_defrag_threshold_lower,
@@ -1019,8 +1370,9 @@ void computeDefragCycles() {
     {
         server.active_defrag_running = cpu_pct;
         serverLog(LL_VERBOSE,
-            "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, cpu=%d%%",
-            frag_pct, frag_bytes, cpu_pct);
+            "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, cpu=%d%%, targeted_bins=%d (%zu bytes)",
+            frag_pct, frag_bytes, cpu_pct, server.active_defrag_targeted_bins,
+            server.active_defrag_targeted_frag_bytes);
     }
 }
 
@@ -1032,13 +1384,16 @@ void activeDefragCycle(void) {
     static unsigned long cursor = 0;
     static redisDb *db = NULL;
     static long long start_scan, start_stat;
+    static size_t start_frag_bytes;
     unsigned int iterations = 0;
     unsigned long long prev_defragged = server.stat_active_defrag_hits;
     unsigned long long prev_scanned = server.stat_active_defrag_scanned;
     long long start, timelimit, endtime;
+    long long start_moved = defrag_moved_bytes;
     mstime_t latency;
     int quit = 0;
 
+    server.stat_active_defrag_cycle_moved_bytes = 0;
     if (server.aof_child_pid!=-1 || server.rdb_child_pid!=-1)
         return; /* Defragging memory while there's a fork will just do damage. */
 
@@ -1050,6 +1405,15 @@ void activeDefragCycle(void) {
     if (!server.active_defrag_running)
         return;
 
+    /* The bins we were after were already compacted (or freed by the
+     * workload): finish the big keys of the current db and wrap up the scan
+     * instead of walking the rest of the keyspace for nothing. */
+    if (db && !server.active_defrag_targeted_bins) {
+        serverLog(LL_VERBOSE, "No fragmented bins left, ending active defrag early");
+        cursor = 0;
+        current_db = server.dbnum-1;
+    }
+
     /* See activeExpireCycle for how timelimit is handled. */
     start = ustime();
     timelimit = 1000000*server.active_defrag_running/server.hz/100;
@@ -1074,9 +1438,12 @@ void activeDefragCycle(void) {
                 long long now = ustime();
                 size_t frag_bytes;
                 float frag_pct = getAllocatorFragmentation(&frag_bytes);
+                server.stat_active_defrag_scan_reclaimed_bytes =
+                    start_frag_bytes > frag_bytes ? start_frag_bytes - frag_bytes : 0;
                 serverLog(LL_VERBOSE,
-                    "Active defrag done in %dms, reallocated=%d, frag=%.0f%%, frag_bytes=%zu",
-                    (int)((now - start_scan)/1000), (int)(server.stat_active_defrag_hits - start_stat), frag_pct, frag_bytes);
+                    "Active defrag done in %dms, reallocated=%d, frag=%.0f%%, frag_bytes=%zu, reclaimed=%lld",
+                    (int)((now - start_scan)/1000), (int)(server.stat_active_defrag_hits - start_stat), frag_pct, frag_bytes,
+                    server.stat_active_defrag_scan_reclaimed_bytes);
 
                 start_scan = now;
                 current_db = -1;
@@ -1093,6 +1460,7 @@ void activeDefragCycle(void) {
                 /* Start a scan from the first database. */
                 start_scan = ustime();
                 start_stat = server.stat_active_defrag_hits;
+                getAllocatorFragmentation(&start_frag_bytes);
             }
 
             db = &server.db[current_db];
@@ -1106,7 +1474,7 @@ void activeDefragCycle(void) {
                 break; /* this will exit the function and we'll continue on the next cycle */
             }
 
-            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            cursor = dictScan(db->dict, cursor, defragScanCallback, defragKeyspaceBucketCallback, db);
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehasing),
@@ -1127,6 +1495,7 @@ void activeDefragCycle(void) {
         } while(cursor && !quit);
     } while(!quit);
 
+    server.stat_active_defrag_cycle_moved_bytes = defrag_moved_bytes - start_moved;
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("active-defrag-cycle",latency);
 }
@@ -360,7 +360,11 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing) {
      * more frequently. */
     // 字典表在rehash，则将新键值对插入到table[1]中
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
+    size_t metasize = dictMetadataSize(d);
+    entry = zmalloc(sizeof(*entry) + metasize);
+    if (metasize > 0) {
+        memset(dictMetadata(entry), 0, metasize);
+    }
     // 头插
     entry->next = ht->table[index];
     ht->table[index] = entry;
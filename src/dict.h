@@ -53,7 +53,13 @@ typedef struct dictEntry {
         double d;
     } v;
     struct dictEntry *next;
+    void *metadata[];           /* An arbitrary number of bytes (starting at a
+                                 * pointer-aligned address) of size as returned
+                                 * by dictType's dictEntryMetadataBytes(). */
 } dictEntry;
+
+struct dict;
+
 // Hash表类型, 其实就是自定义了一些hash表的特性
 typedef struct dictType {
     uint64_t (*hashFunction)(const void *key);  // hash算法
@@ -62,6 +68,9 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2); // key比较算法
     void (*keyDestructor)(void *privdata, void *key); // key destroy算法
     void (*valDestructor)(void *privdata, void *obj); // value destroy算法
+    /* Allow a dictEntry to carry extra caller-defined metadata. The
+     * extra memory is initialized to 0 when a dictEntry is allocated. */
+    size_t (*dictEntryMetadataBytes)(struct dict *d);
 } dictType;
 
 /* This is our hash table structure. Every dictionary has two of this as we
@@ -138,6 +147,10 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
         (d)->type->keyCompare((d)->privdata, key1, key2) : \
         (key1) == (key2))
 
+#define dictMetadata(entry) (&(entry)->metadata)
+#define dictMetadataSize(d) ((d)->type->dictEntryMetadataBytes \
+                             ? (d)->type->dictEntryMetadataBytes(d) : 0)
+
 #define dictHashKey(d, key) (d)->type->hashFunction(key)
 #define dictGetKey(he) ((he)->key)
 #define dictGetVal(he) ((he)->v.val)
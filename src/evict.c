@@ -60,6 +60,17 @@ struct evictionPoolEntry {
 
 static struct evictionPoolEntry *EvictionPoolLRU;
 
+/* Count-min sketch used by the TinyLFU policies, see the TinyLFU section
+ * below for more information. */
+#define TINYLFU_DEPTH 4
+#define TINYLFU_WIDTH (1<<16)   /* Counters per row, must be a power of 2. */
+#define TINYLFU_SAMPLE_FACTOR 10
+#define TINYLFU_MAX_COUNT 15
+
+static uint8_t *TinyLFUSketch;   /* Two 4 bit counters per byte. */
+static unsigned long TinyLFUAccesses; /* Accesses since the last aging. */
+static unsigned long TinyLFUDecisions; /* Admission decisions taken. */
+
 /* ----------------------------------------------------------------------------
  * Implementation of eviction, aging and LRU
  * --------------------------------------------------------------------------*/
@@ -184,7 +195,13 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
         /* Calculate the idle time according to the policy. This is called
          * idle just because the code initially handled LRU, but is in fact
          * just a score where an higher score means better candidate. */
-        if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+            /* Less frequent keys first, and the least recently used among
+             * keys with the same frequency. */
+            unsigned long long freq = tinylfuEstimate(key);
+            idle = ((TINYLFU_MAX_COUNT-freq) << 48) |
+                   (estimateObjectIdleTime(o) & ((1ULL<<48)-1));
+        } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
             idle = estimateObjectIdleTime(o);
         } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
             /* When we use an LRU policy, we sort the keys by idle time
@@ -341,6 +358,126 @@ unsigned long LFUDecrAndReturn(robj *o) {
     return counter;
 }
 
+/* ----------------------------------------------------------------------------
+ * TinyLFU admission and eviction.
+ *
+ * The per-object LFU counter above saturates quickly and decays with a
+ * resolution of minutes, so a single scan over many cold keys is enough to
+ * push the hot set out of memory. The TinyLFU policies instead estimate the
+ * access frequency of every requested key name (including misses, so keys
+ * that are not in memory accumulate history as well) in a count-min sketch
+ * shared by all the databases:
+ *
+ *   - TINYLFU_DEPTH rows of TINYLFU_WIDTH 4 bit saturating counters.
+ *   - Every access increments the counters of the key in every row, the
+ *     estimate is the minimum across the rows.
+ *   - After TINYLFU_SAMPLE_FACTOR*TINYLFU_WIDTH accesses all the counters
+ *     are halved, so that the history ages and the sketch adapts to
+ *     changes in the access pattern.
+ *
+ * Victims are selected with the usual eviction pool, ordered by estimated
+ * frequency first and by idle time among keys of the same frequency. Then,
+ * when the eviction is caused by a write (server.tinylfu_candidate), the
+ * victim is only evicted if the keys of the incoming command are estimated
+ * to be at least as frequent as the victim: otherwise the write is refused
+ * with an OOM error and the hot key stays in memory.
+ *
+ * To give bursts of brand new keys the chance to build up some history,
+ * a small admission window (tinylfu-window, as percentage of the admission
+ * decisions) lets writes in without comparing frequencies.
+ * --------------------------------------------------------------------------*/
+
+/* Return the counter index of 'hash' in the specified sketch row. The
+ * TINYLFU_DEPTH indexes are derived from the two halves of a single
+ * 64 bit hash. */
+static unsigned long tinylfuIndex(uint64_t hash, int row) {
+    uint32_t h1 = hash, h2 = hash >> 32;
+    return (unsigned long)row*TINYLFU_WIDTH +
+           ((h1 + (uint32_t)row*h2) & (TINYLFU_WIDTH-1));
+}
+
+static unsigned int tinylfuGetCounter(unsigned long idx) {
+    return (TinyLFUSketch[idx>>1] >> ((idx&1)*4)) & 0xf;
+}
+
+/* Halve all the counters of the sketch. */
+static void tinylfuAge(void) {
+    size_t j, bytes = (size_t)TINYLFU_DEPTH*TINYLFU_WIDTH/2;
+    for (j = 0; j < bytes; j++)
+        TinyLFUSketch[j] = (TinyLFUSketch[j] >> 1) & 0x77;
+    TinyLFUAccesses = 0;
+}
+
+/* Record an access to the key named 'key' in the frequency sketch. The
+ * sketch is allocated the first time a TinyLFU policy uses it. */
+void tinylfuRecordAccess(sds key) {
+    uint64_t hash = dictGenHashFunction(key,sdslen(key));
+    int j;
+
+    if (TinyLFUSketch == NULL)
+        TinyLFUSketch = zcalloc((size_t)TINYLFU_DEPTH*TINYLFU_WIDTH/2);
+    for (j = 0; j < TINYLFU_DEPTH; j++) {
+        unsigned long idx = tinylfuIndex(hash,j);
+        if (tinylfuGetCounter(idx) < TINYLFU_MAX_COUNT)
+            TinyLFUSketch[idx>>1] += 1 << ((idx&1)*4);
+    }
+    if (++TinyLFUAccesses >= (unsigned long)TINYLFU_SAMPLE_FACTOR*TINYLFU_WIDTH)
+        tinylfuAge();
+}
+
+/* Return the estimated access frequency of the key named 'key', from 0
+ * to TINYLFU_MAX_COUNT. */
+unsigned int tinylfuEstimate(sds key) {
+    uint64_t hash;
+    unsigned int min = TINYLFU_MAX_COUNT;
+    int j;
+
+    if (TinyLFUSketch == NULL) return 0;
+    hash = dictGenHashFunction(key,sdslen(key));
+    for (j = 0; j < TINYLFU_DEPTH; j++) {
+        unsigned int count = tinylfuGetCounter(tinylfuIndex(hash,j));
+        if (count < min) min = count;
+    }
+    return min;
+}
+
+/* Return the estimated frequency of the keys the command of client 'c' is
+ * going to write, counting the current request as well: this is the
+ * frequency compared against the victim by the admission policy. When
+ * 'record' is true the access is also recorded in the sketch, since the
+ * command is about to be refused and the lookup will never happen. */
+static unsigned int tinylfuCandidateFrequency(client *c, int record) {
+    int j, numkeys, *keys;
+    unsigned int freq = 0;
+
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        sds key = c->argv[keys[j]]->ptr;
+        unsigned int f = tinylfuEstimate(key);
+        if (f > freq) freq = f;
+        if (record) tinylfuRecordAccess(key);
+    }
+    getKeysFreeResult(keys);
+    return freq < TINYLFU_MAX_COUNT ? freq+1 : freq;
+}
+
+/* Return non zero if the current write should be allowed to evict a key
+ * with estimated frequency 'victim_freq'. 'candidate_freq' caches the
+ * frequency of the incoming keys across calls, and should be initialized
+ * to -1 by the caller. */
+static int tinylfuAdmit(unsigned int victim_freq, long *candidate_freq) {
+    client *c = server.tinylfu_candidate;
+
+    if (c == NULL) return 1;
+    if (*candidate_freq == -1) *candidate_freq = tinylfuCandidateFrequency(c,0);
+    if (victim_freq <= (unsigned long)*candidate_freq) return 1;
+    if ((TinyLFUDecisions++ % 100) < (unsigned long)server.tinylfu_window)
+        return 1;
+    tinylfuCandidateFrequency(c,1);
+    server.stat_tinylfu_rejected++;
+    return 0;
+}
+
 /* ----------------------------------------------------------------------------
  * The external API for eviction: freeMemroyIfNeeded() is called by the
  * server when there is data to add in order to make space if needed.
@@ -392,8 +529,12 @@ size_t freeMemoryGetNotCountedMemory(void) {
  *              memory currently used. May be > 1 if we are over the memory
  *              limit.
  *              (Populated both for C_ERR and C_OK)
+ *
+ * getMemoryStateForLimit() checks the memory used against 'limit' instead,
+ * that is used by the background eviction to target the low watermark.
+ * The 'level' is always relative to maxmemory.
  */
-int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *level) {
+static int getMemoryStateForLimit(unsigned long long limit, size_t *total, size_t *logical, size_t *tofree, float *level) {
     size_t mem_reported, mem_used, mem_tofree;
 
     /* Check if we are over the memory usage limit. If we are not, no need
@@ -402,7 +543,7 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
     if (total) *total = mem_reported;
 
     /* We may return ASAP if there is no need to compute the level. */
-    int return_ok_asap = !server.maxmemory || mem_reported <= server.maxmemory;
+    int return_ok_asap = !server.maxmemory || mem_reported <= limit;
     if (return_ok_asap && !level) return C_OK;
 
     /* Remove the size of slaves output buffers and AOF buffer from the
@@ -423,10 +564,10 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
     if (return_ok_asap) return C_OK;
 
     /* Check if we are still over the memory limit. */
-    if (mem_used <= server.maxmemory) return C_OK;
+    if (mem_used <= limit) return C_OK;
 
     /* Compute how much memory we need to free. */
-    mem_tofree = mem_used - server.maxmemory;
+    mem_tofree = mem_used - limit;
 
     if (logical) *logical = mem_used;
     if (tofree) *tofree = mem_tofree;
@@ -434,6 +575,10 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
     return C_ERR;
 }
 
+int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *level) {
+    return getMemoryStateForLimit(server.maxmemory,total,logical,tofree,level);
+}
+
 /* This function is periodically called to see if there is memory to free
  * according to the current "maxmemory" settings. In case we are over the
  * memory limit, the function will try to free some memory to return back
@@ -443,31 +588,51 @@ int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *lev
  * were over the limit, but the attempt to free memory was successful.
  * Otehrwise if we are over the memory limit, but not enough memory
  * was freed to return back under the limit, the function returns C_ERR. */
+static int performEvictions(unsigned long long limit, long long timelimit);
+
 int freeMemoryIfNeeded(void) {
     /* By default replicas should ignore maxmemory
      * and just be masters exact copies. */
     if (server.masterhost && server.repl_slave_ignore_maxmemory) return C_OK;
 
-    size_t mem_reported, mem_tofree, mem_freed;
-    mstime_t latency, eviction_latency;
-    long long delta;
-    int slaves = listLength(server.slaves);
-
     /* When clients are paused the dataset should be static not just from the
      * POV of clients not being able to write, but also from the POV of
      * expires and evictions of keys not being performed. */
     if (clientsArePaused()) return C_OK;
-    if (getMaxmemoryState(&mem_reported,NULL,&mem_tofree,NULL) == C_OK)
+    return performEvictions(server.maxmemory,0);
+}
+
+/* Evict keys according to the maxmemory policy until the memory used is
+ * back under 'limit' bytes. Returns C_OK if the memory used is (or was
+ * brought) under the limit, C_ERR otherwise.
+ *
+ * When 'timelimit' is zero this is the synchronous eviction performed
+ * before commands by freeMemoryIfNeeded(). Otherwise this is a step of the
+ * background eviction: it stops after 'timelimit' microseconds, returning
+ * C_ERR if the limit was not reached yet, and the evicted values are always
+ * released via dbAsyncDelete(), so that big values are freed by the lazyfree
+ * thread. */
+static int performEvictions(unsigned long long limit, long long timelimit) {
+    size_t mem_reported, mem_tofree, mem_freed;
+    mstime_t latency, eviction_latency;
+    long long delta, start = timelimit ? ustime() : 0;
+    long candidate_freq = -1;
+    int slaves = listLength(server.slaves), keys_freed = 0;
+    int background = timelimit != 0;
+    int lazy = background || server.lazyfree_lazy_eviction;
+
+    if (getMemoryStateForLimit(limit,&mem_reported,NULL,&mem_tofree,NULL) == C_OK)
         return C_OK;
 
     mem_freed = 0;
+    if (!background) server.stat_sync_eviction_cycles++;
 
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         goto cant_free; /* We need to free memory, but policy forbids. */
 
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, i, keys_freed = 0;
+        int j, k, i;
         static unsigned int next_db = 0;
         sds bestkey = NULL;
         int bestdbid;
@@ -549,11 +714,21 @@ int freeMemoryIfNeeded(void) {
             }
         }
 
+        /* TinyLFU admission: don't let a write evict a key that is
+         * accessed more frequently than the keys being written. */
+        if (bestkey && server.maxmemory_policy & MAXMEMORY_FLAG_TINYLFU &&
+            !tinylfuAdmit(tinylfuEstimate(bestkey),&candidate_freq))
+        {
+            latencyEndMonitor(latency);
+            latencyAddSampleIfNeeded("eviction-cycle",latency);
+            goto cant_free;
+        }
+
         /* Finally remove the selected key. */
         if (bestkey) {
             db = server.db+bestdbid;
             robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
+            propagateExpire(db,keyobj,lazy);
             /* We compute the amount of memory freed by db*Delete() alone.
              * It is possible that actually the memory needed to propagate
              * the DEL in AOF and replication link is greater than the one
@@ -564,7 +739,7 @@ int freeMemoryIfNeeded(void) {
              * we only care about memory used by the key space. */
             delta = (long long) zmalloc_used_memory();
             latencyStartMonitor(eviction_latency);
-            if (server.lazyfree_lazy_eviction)
+            if (lazy)
                 dbAsyncDelete(db,keyobj);
             else
                 dbSyncDelete(db,keyobj);
@@ -574,8 +749,12 @@ int freeMemoryIfNeeded(void) {
             delta -= (long long) zmalloc_used_memory();
             mem_freed += delta;
             server.stat_evictedkeys++;
+            if (background) server.stat_background_evictedkeys++;
             notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
                 keyobj, db->id);
+            trackingInvalidateKey(NULL,keyobj);
+            if (listLength(server.migrate_jobs))
+                migrateJobsSignalModifiedKey(db,keyobj);
             decrRefCount(keyobj);
             keys_freed++;
 
@@ -592,25 +771,33 @@ int freeMemoryIfNeeded(void) {
              * memory, since the "mem_freed" amount is computed only
              * across the dbAsyncDelete() call, while the thread can
              * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
-                if (getMaxmemoryState(NULL,NULL,NULL,NULL) == C_OK) {
+            if (lazy && !(keys_freed % 16)) {
+                if (getMemoryStateForLimit(limit,NULL,NULL,NULL,NULL) == C_OK) {
                     /* Let's satisfy our stop condition. */
                     mem_freed = mem_tofree;
                 }
             }
+
+            /* The background eviction works in small steps, in order to
+             * don't block the server. */
+            if (background && !(keys_freed % 16) &&
+                ustime()-start > timelimit) break;
         }
 
-        if (!keys_freed) {
+        if (!bestkey) {
             latencyEndMonitor(latency);
-            latencyAddSampleIfNeeded("eviction-cycle",latency);
+            if (!background)
+                latencyAddSampleIfNeeded("eviction-cycle",latency);
             goto cant_free; /* nothing to free... */
         }
     }
     latencyEndMonitor(latency);
+    if (background) return mem_freed >= mem_tofree ? C_OK : C_ERR;
     latencyAddSampleIfNeeded("eviction-cycle",latency);
     return C_OK;
 
 cant_free:
+    if (background) return C_ERR;
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
@@ -633,3 +820,44 @@ int freeMemoryIfNeededAndSafe(void) {
     if (server.lua_timedout || server.loading) return C_OK;
     return freeMemoryIfNeeded();
 }
+
+/* ----------------------------------------------------------------------------
+ * Background eviction.
+ *
+ * When the memory used crosses the high watermark (a percentage of
+ * maxmemory), keys are evicted proactively from serverCron() and
+ * beforeSleep() in small time bounded steps, until the memory used goes
+ * back under the low watermark. This way writes rarely find the server over
+ * maxmemory, and don't have to pay for a synchronous eviction of many keys.
+ * How often this still happens is reported by the sync_eviction_cycles
+ * INFO field and by the eviction-cycle latency event.
+ * --------------------------------------------------------------------------*/
+
+/* Return 'percent' percent of maxmemory, in bytes. */
+static unsigned long long maxmemoryPercentage(int percent) {
+    return server.maxmemory/100*percent + server.maxmemory%100*percent/100;
+}
+
+void backgroundEvictionCycle(void) {
+    static int active = 0; /* Evicting until the low watermark is reached. */
+    int low = server.maxmemory_low_watermark;
+    int high = server.maxmemory_high_watermark;
+
+    if (!server.maxmemory || low >= 100 ||
+        server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
+    {
+        active = 0;
+        return;
+    }
+    if (server.masterhost && server.repl_slave_ignore_maxmemory) return;
+    if (server.lua_timedout || server.loading || clientsArePaused()) return;
+
+    if (high < low) high = low;
+    if (!active) {
+        if (getMemoryStateForLimit(maxmemoryPercentage(high),
+                                   NULL,NULL,NULL,NULL) == C_OK) return;
+        active = 1;
+    }
+    if (performEvictions(maxmemoryPercentage(low),
+                         EVICTION_BACKGROUND_STEP_USEC) == C_OK) active = 0;
+}
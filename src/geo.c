@@ -279,6 +279,23 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
                 == C_ERR) sdsfree(ele);
             ln = ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        int valid;
+
+        valid = zbtFirstInRange(zs->zbt, &range, &cur, NULL);
+        while (valid) {
+            zbtEntry *e = zbtCursorEntry(&cur);
+            /* Abort when the element is no longer in range. */
+            if (!zslValueLteMax(e->score, &range))
+                break;
+
+            sds ele = sdsdup(e->ele);
+            if (geoAppendIfWithinRadius(ga,lon,lat,radius,e->score,ele)
+                == C_ERR) sdsfree(ele);
+            valid = zbtNext(&cur);
+        }
     }
     return ga->used - origincount;
 }
@@ -643,15 +660,13 @@ void georadiusGeneric(client *c, int flags) {
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
             geoPoint *gp = ga->array+i;
             gp->dist /= conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
             size_t elelen = sdslen(gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            znode = zslInsert(zs->zsl,score,gp->member);
-            serverAssert(dictAdd(zs->dict,gp->member,&znode->score) == DICT_OK);
+            zsetInsertNew(zs,score,gp->member);
             gp->member = NULL;
         }
 
@@ -710,7 +725,7 @@ void geohashCommand(client *c) {
     for (j = 2; j < c->argc; j++) {
         double score;
         if (!zobj || zsetScore(zobj, c->argv[j]->ptr, &score) == C_ERR) {
-            addReply(c,shared.nullbulk);
+            addReply(c,shared.null[c->resp]);
         } else {
             /* The internal format we use for geocoding is a bit different
              * than the standard, since we use as initial latitude range
@@ -721,7 +736,7 @@ void geohashCommand(client *c) {
             /* Decode... */
             double xy[2];
             if (!decodeGeohash(score,xy)) {
-                addReply(c,shared.nullbulk);
+                addReply(c,shared.null[c->resp]);
                 continue;
             }
 
@@ -763,12 +778,12 @@ void geoposCommand(client *c) {
     for (j = 2; j < c->argc; j++) {
         double score;
         if (!zobj || zsetScore(zobj, c->argv[j]->ptr, &score) == C_ERR) {
-            addReply(c,shared.nullmultibulk);
+            addReply(c,shared.nullarray[c->resp]);
         } else {
             /* Decode... */
             double xy[2];
             if (!decodeGeohash(score,xy)) {
-                addReply(c,shared.nullmultibulk);
+                addReply(c,shared.nullarray[c->resp]);
                 continue;
             }
             addReplyMultiBulkLen(c,2);
@@ -797,7 +812,7 @@ void geodistCommand(client *c) {
 
     /* Look up the requested zset */
     robj *zobj = NULL;
-    if ((zobj = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk))
+    if ((zobj = lookupKeyReadOrReply(c, c->argv[1], shared.null[c->resp]))
         == NULL || checkType(c, zobj, OBJ_ZSET)) return;
 
     /* Get the scores. We need both otherwise NULL is returned. */
@@ -805,13 +820,13 @@ void geodistCommand(client *c) {
     if (zsetScore(zobj, c->argv[2]->ptr, &score1) == C_ERR ||
         zsetScore(zobj, c->argv[3]->ptr, &score2) == C_ERR)
     {
-        addReply(c,shared.nullbulk);
+        addReply(c,shared.null[c->resp]);
         return;
     }
 
     /* Decode & compute the distance. */
     if (!decodeGeohash(score1,xyxy) || !decodeGeohash(score2,xyxy+2))
-        addReply(c,shared.nullbulk);
+        addReply(c,shared.null[c->resp]);
     else
         addReplyDoubleDistance(c,
             geohashGetDistance(xyxy[0],xyxy[1],xyxy[2],xyxy[3]) / to_meter);
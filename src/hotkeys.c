@@ -0,0 +1,407 @@
+/* Sampled hot keys and big keys detection.
+ *
+ * When hotkeys-sample-rate is N > 0, on average one command out of N is
+ * sampled by call(): for every key the command accesses we record one
+ * operation, the bytes of the reply it produced and, for write commands,
+ * the bytes of its arguments. The operations are counted in a fixed size
+ * "space saving" top-K sketch (Metwally et al.): when a key that is not
+ * tracked is seen and the table is full, it takes the place of the key with
+ * the smallest count, inheriting its count as the possible overestimation
+ * error. Hot keys stay in the table, while the count of cold keys only
+ * grows by the error they inherited.
+ *
+ * The keys written by sampled commands are also measured (with the same
+ * estimation MEMORY USAGE performs), and the biggest ones are remembered in
+ * a second table of the same size.
+ *
+ * Counters are scaled by the sample rate, so they estimate the real number
+ * of operations and bytes. The result is reported by the HOTKEYS command
+ * and by the "hotkeys" INFO section.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+typedef struct hotkeyEntry {
+    sds key;
+    int dbid;
+    unsigned long long ops;         /* Estimated operations (upper bound). */
+    unsigned long long ops_error;   /* Max overestimation of 'ops'. */
+    unsigned long long bytes_read;  /* Estimated reply bytes. */
+    unsigned long long bytes_written; /* Estimated argument bytes written. */
+    size_t size;                    /* Big keys: memory used by the key. */
+    const char *type;               /* Big keys: type of the value. */
+} hotkeyEntry;
+
+/* A table of at most server.hotkeys_size entries, indexed by (db, key). */
+typedef struct hotkeysTable {
+    dict *index;            /* hotkeyEntry -> NULL. */
+    hotkeyEntry **entries;  /* Unordered. */
+    int len;
+} hotkeysTable;
+
+static hotkeysTable HotKeys, BigKeys;
+
+static uint64_t hotkeyHash(const void *key) {
+    const hotkeyEntry *he = key;
+    return dictGenHashFunction(he->key, sdslen(he->key)) + he->dbid;
+}
+
+static int hotkeyCompare(void *privdata, const void *key1, const void *key2) {
+    const hotkeyEntry *a = key1, *b = key2;
+    UNUSED(privdata);
+    return a->dbid == b->dbid && sdslen(a->key) == sdslen(b->key) &&
+           memcmp(a->key, b->key, sdslen(a->key)) == 0;
+}
+
+/* The entries are owned by the tables, not by the index. */
+dictType hotkeyDictType = {
+        hotkeyHash,                 /* hash function */
+        NULL,                       /* key dup */
+        NULL,                       /* val dup */
+        hotkeyCompare,              /* key compare */
+        NULL,                       /* key destructor */
+        NULL                        /* val destructor */
+};
+
+static void hotkeysTableInit(hotkeysTable *t) {
+    t->index = dictCreate(&hotkeyDictType, NULL);
+    t->entries = zmalloc(sizeof(hotkeyEntry *) * server.hotkeys_size);
+    t->len = 0;
+}
+
+static void hotkeysTableFree(hotkeysTable *t) {
+    for (int j = 0; j < t->len; j++) {
+        sdsfree(t->entries[j]->key);
+        zfree(t->entries[j]);
+    }
+    dictRelease(t->index);
+    zfree(t->entries);
+}
+
+static hotkeyEntry *hotkeysTableFind(hotkeysTable *t, int dbid, sds key) {
+    hotkeyEntry probe = {.key = key, .dbid = dbid};
+    dictEntry *de = dictFind(t->index, &probe);
+    return de ? dictGetKey(de) : NULL;
+}
+
+/* Add a new zeroed entry for the key. The caller must make sure there is
+ * room in the table. */
+static hotkeyEntry *hotkeysTableAdd(hotkeysTable *t, int dbid, sds key) {
+    hotkeyEntry *he = zcalloc(sizeof(*he));
+    he->key = sdsdup(key);
+    he->dbid = dbid;
+    t->entries[t->len++] = he;
+    dictAdd(t->index, he, NULL);
+    return he;
+}
+
+/* Let the entry at position 'j' track a different key: the counters are
+ * left untouched for the caller to update. */
+static hotkeyEntry *hotkeysTableReplace(hotkeysTable *t, int j, int dbid, sds key) {
+    hotkeyEntry *he = t->entries[j];
+    dictDelete(t->index, he);
+    sdsfree(he->key);
+    he->key = sdsdup(key);
+    he->dbid = dbid;
+    dictAdd(t->index, he, NULL);
+    return he;
+}
+
+static void hotkeysTableDel(hotkeysTable *t, hotkeyEntry *he) {
+    for (int j = 0; j < t->len; j++) {
+        if (t->entries[j] != he) continue;
+        t->entries[j] = t->entries[--t->len];
+        break;
+    }
+    dictDelete(t->index, he);
+    sdsfree(he->key);
+    zfree(he);
+}
+
+void hotkeysInit(void) {
+    hotkeysTableInit(&HotKeys);
+    hotkeysTableInit(&BigKeys);
+    server.hotkeys_countdown = server.hotkeys_sample_rate;
+}
+
+/* Forget everything. Also called when hotkeys-size changes. */
+void hotkeysReset(void) {
+    if (HotKeys.index == NULL) return; /* Loading the config file. */
+    hotkeysTableFree(&HotKeys);
+    hotkeysTableFree(&BigKeys);
+    hotkeysInit();
+    server.stat_hotkeys_sampled = 0;
+}
+
+/* Pick how many commands to skip before sampling again. The interval is
+ * randomized around the sample rate so that periodic patterns in the
+ * traffic don't make us sample always the same commands. */
+static void hotkeysScheduleNextSample(void) {
+    long long rate = server.hotkeys_sample_rate;
+    server.hotkeys_countdown = rate > 1 ? 1 + (random() % (2*rate-1)) : rate;
+}
+
+/* Record a sampled operation against a key, see the top comment. */
+static void hotkeysRecordOp(int dbid, sds key, unsigned long long weight,
+                            size_t bytes_read, size_t bytes_written) {
+    hotkeyEntry *he = hotkeysTableFind(&HotKeys, dbid, key);
+
+    if (he == NULL) {
+        if (HotKeys.len < server.hotkeys_size) {
+            he = hotkeysTableAdd(&HotKeys, dbid, key);
+        } else {
+            int min = 0;
+            for (int j = 1; j < HotKeys.len; j++)
+                if (HotKeys.entries[j]->ops < HotKeys.entries[min]->ops) min = j;
+            he = hotkeysTableReplace(&HotKeys, min, dbid, key);
+            he->ops_error = he->ops;
+            he->bytes_read = he->bytes_written = 0;
+        }
+    }
+    he->ops += weight;
+    he->bytes_read += bytes_read * weight;
+    he->bytes_written += bytes_written * weight;
+}
+
+/* Measure a key written by a sampled command, and remember it if it is one
+ * of the biggest we saw. */
+static void hotkeysRecordWrite(int dbid, sds key) {
+    hotkeyEntry *he = hotkeysTableFind(&BigKeys, dbid, key);
+    dictEntry *de = dictFind(server.db[dbid].dict, key);
+
+    if (de == NULL) {
+        if (he) hotkeysTableDel(&BigKeys, he);
+        return;
+    }
+    size_t size = dbEntryComputeSize(de);
+    if (he == NULL) {
+        if (BigKeys.len < server.hotkeys_size) {
+            he = hotkeysTableAdd(&BigKeys, dbid, key);
+        } else {
+            int min = 0;
+            for (int j = 1; j < BigKeys.len; j++)
+                if (BigKeys.entries[j]->size < BigKeys.entries[min]->size) min = j;
+            if (BigKeys.entries[min]->size >= size) return;
+            he = hotkeysTableReplace(&BigKeys, min, dbid, key);
+        }
+    }
+    he->size = size;
+    he->type = getObjectTypeName(dictGetVal(de));
+}
+
+/* Called by call() before executing a command chosen for sampling: remember
+ * the keys the command is going to access (the command may rewrite its
+ * argument vector), and how much it writes. */
+void hotkeysSampleBefore(client *c, hotkeysSample *hs) {
+    int *keyidx, numkeys, j, k;
+
+    hotkeysScheduleNextSample();
+    hs->numkeys = 0;
+    hs->dbid = c->db->id;
+    hs->write = (c->cmd->flags & CMD_WRITE) != 0;
+    hs->bytes_written = 0;
+    hs->reply_bytes = server.stat_reply_bytes;
+
+    keyidx = getKeysFromCommand(c->cmd, c->argv, c->argc, &numkeys);
+    if (numkeys == 0) {
+        getKeysFreeResult(keyidx);
+        return;
+    }
+    hs->keys = zmalloc(sizeof(robj *) * numkeys);
+    for (j = 0; j < numkeys; j++)
+        hs->keys[j] = getDecodedObject(c->argv[keyidx[j]]);
+    hs->numkeys = numkeys;
+
+    /* The bytes written are the ones of the arguments that are not keys
+     * (nor the command name). */
+    if (hs->write) {
+        for (j = 1, k = 0; j < c->argc; j++) {
+            if (k < numkeys && keyidx[k] == j) {
+                k++;
+                continue;
+            }
+            hs->bytes_written += stringObjectLen(c->argv[j]);
+        }
+    }
+    getKeysFreeResult(keyidx);
+}
+
+/* Called by call() after the sampled command was executed. */
+void hotkeysSampleAfter(client *c, hotkeysSample *hs) {
+    size_t bytes_read = server.stat_reply_bytes - hs->reply_bytes;
+    UNUSED(c);
+
+    server.stat_hotkeys_sampled++;
+    for (int j = 0; j < hs->numkeys; j++) {
+        sds key = hs->keys[j]->ptr;
+        /* Sampling may have been just disabled by the command itself. */
+        if (server.hotkeys_sample_rate == 0) {
+            decrRefCount(hs->keys[j]);
+            continue;
+        }
+        hotkeysRecordOp(hs->dbid, key, server.hotkeys_sample_rate,
+                        bytes_read, hs->bytes_written);
+        if (hs->write) hotkeysRecordWrite(hs->dbid, key);
+        decrRefCount(hs->keys[j]);
+    }
+    if (hs->numkeys) zfree(hs->keys);
+}
+
+static int hotkeysCompareOps(const void *a, const void *b) {
+    const hotkeyEntry *ha = *(hotkeyEntry **) a, *hb = *(hotkeyEntry **) b;
+    if (ha->ops == hb->ops) return 0;
+    return ha->ops > hb->ops ? -1 : 1;
+}
+
+static int hotkeysCompareSize(const void *a, const void *b) {
+    const hotkeyEntry *ha = *(hotkeyEntry **) a, *hb = *(hotkeyEntry **) b;
+    if (ha->size == hb->size) return 0;
+    return ha->size > hb->size ? -1 : 1;
+}
+
+/* Return the entries of the table sorted by the given comparator. Big keys
+ * that were deleted (or moved) since they were measured are dropped
+ * first. The caller should zfree() the returned array. */
+static hotkeyEntry **hotkeysSorted(hotkeysTable *t,
+                                   int (*cmp)(const void *, const void *)) {
+    if (t == &BigKeys) {
+        for (int j = 0; j < t->len; j++) {
+            hotkeyEntry *he = t->entries[j];
+            if (dictFind(server.db[he->dbid].dict, he->key) == NULL) {
+                hotkeysTableDel(t, he);
+                j--;
+            }
+        }
+    }
+    hotkeyEntry **sorted = zmalloc(sizeof(hotkeyEntry *) * (t->len + 1));
+    memcpy(sorted, t->entries, sizeof(hotkeyEntry *) * t->len);
+    qsort(sorted, t->len, sizeof(hotkeyEntry *), cmp);
+    return sorted;
+}
+
+/* Add the "hotkeys" INFO section fields, with the top 'count' keys of
+ * each table. */
+sds genHotkeysInfoString(sds info, int count) {
+    hotkeyEntry **sorted;
+    int j;
+
+    info = sdscatprintf(info,
+        "hotkeys_sample_rate:%d\r\n"
+        "hotkeys_sampled_commands:%lld\r\n"
+        "hotkeys_tracked_keys:%d\r\n",
+        server.hotkeys_sample_rate,
+        server.stat_hotkeys_sampled,
+        HotKeys.len);
+
+    sorted = hotkeysSorted(&HotKeys, hotkeysCompareOps);
+    for (j = 0; j < HotKeys.len && j < count; j++) {
+        hotkeyEntry *he = sorted[j];
+        info = sdscatprintf(info,
+            "hotkey_%d:db=%d,ops=%llu,ops_error=%llu,bytes_read=%llu,bytes_written=%llu,key=",
+            j, he->dbid, he->ops, he->ops_error, he->bytes_read, he->bytes_written);
+        info = sdscatrepr(info, he->key, sdslen(he->key));
+        info = sdscatlen(info, "\r\n", 2);
+    }
+    zfree(sorted);
+
+    sorted = hotkeysSorted(&BigKeys, hotkeysCompareSize);
+    for (j = 0; j < BigKeys.len && j < count; j++) {
+        hotkeyEntry *he = sorted[j];
+        info = sdscatprintf(info, "bigkey_%d:db=%d,type=%s,bytes=%zu,key=",
+            j, he->dbid, he->type, he->size);
+        info = sdscatrepr(info, he->key, sdslen(he->key));
+        info = sdscatlen(info, "\r\n", 2);
+    }
+    zfree(sorted);
+    return info;
+}
+
+/* HOTKEYS GET [<count>]
+ * HOTKEYS BIGKEYS [<count>]
+ * HOTKEYS RESET */
+void hotkeysCommand(client *c) {
+    long count = 10;
+
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "help")) {
+        const char *help[] = {
+"GET [<count>] -- Return the <count> most accessed keys (default 10).",
+"BIGKEYS [<count>] -- Return the <count> biggest keys seen on write (default 10).",
+"RESET -- Forget the keys seen so far.",
+"Keys are sampled only when hotkeys-sample-rate is greater than zero.",
+NULL
+        };
+        addReplyHelp(c, help);
+    } else if ((!strcasecmp(c->argv[1]->ptr, "get") ||
+                !strcasecmp(c->argv[1]->ptr, "bigkeys")) && c->argc <= 3) {
+        int big = !strcasecmp(c->argv[1]->ptr, "bigkeys");
+        hotkeysTable *t = big ? &BigKeys : &HotKeys;
+        hotkeyEntry **sorted;
+
+        if (c->argc == 3) {
+            if (getLongFromObjectOrReply(c, c->argv[2], &count, NULL) != C_OK)
+                return;
+            if (count < 0) {
+                addReplyError(c, "count should be greater than or equal to 0");
+                return;
+            }
+        }
+        sorted = hotkeysSorted(t, big ? hotkeysCompareSize : hotkeysCompareOps);
+        if (count > t->len) count = t->len;
+        addReplyMultiBulkLen(c, count);
+        for (int j = 0; j < count; j++) {
+            hotkeyEntry *he = sorted[j];
+            addReplyMapLen(c, big ? 4 : 6);
+            addReplyBulkCString(c, "key");
+            addReplyBulkCBuffer(c, he->key, sdslen(he->key));
+            addReplyBulkCString(c, "db");
+            addReplyLongLong(c, he->dbid);
+            if (big) {
+                addReplyBulkCString(c, "type");
+                addReplyBulkCString(c, he->type);
+                addReplyBulkCString(c, "bytes");
+                addReplyLongLong(c, he->size);
+            } else {
+                addReplyBulkCString(c, "ops");
+                addReplyLongLong(c, he->ops);
+                addReplyBulkCString(c, "ops-error");
+                addReplyLongLong(c, he->ops_error);
+                addReplyBulkCString(c, "bytes-read");
+                addReplyLongLong(c, he->bytes_read);
+                addReplyBulkCString(c, "bytes-written");
+                addReplyLongLong(c, he->bytes_written);
+            }
+        }
+        zfree(sorted);
+    } else if (!strcasecmp(c->argv[1]->ptr, "reset") && c->argc == 2) {
+        hotkeysReset();
+        addReply(c, shared.ok);
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
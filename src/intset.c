@@ -281,6 +281,112 @@ size_t intsetBlobLen(intset *is) {
     return sizeof(intset)+intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
 }
 
+/* Return the position of the first element >= value in the positions
+ * [from,len) of the intset, or len if there is no such element.
+ *
+ * This is an exponential (galloping) search: we probe from+1, from+2,
+ * from+4, ... until an element >= value is found, and then perform a
+ * binary search in the last interval. The cost is logarithmic in the
+ * distance from 'from' instead of the set size, so walking a set in
+ * ascending order this way costs at most as much as a linear merge. */
+static uint32_t intsetGallop(intset *is, uint32_t from, uint32_t len,
+                             uint8_t enc, int64_t value) {
+    uint32_t lo = from, hi, step = 1;
+
+    if (lo >= len || _intsetGetEncoded(is,lo,enc) >= value) return lo;
+
+    /* From now on the element at 'lo' is always < value. */
+    while(1) {
+        hi = lo+step;
+        if (hi >= len) {
+            hi = len;
+            break;
+        }
+        if (_intsetGetEncoded(is,hi,enc) >= value) break;
+        lo = hi;
+        step <<= 1;
+    }
+    while(hi-lo > 1) {
+        uint32_t mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,enc) >= value)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return hi;
+}
+
+/* Return a new intset with the elements that are members of all the 'num'
+ * intsets in 'sets'.
+ *
+ * Since the intsets are sorted arrays, instead of looking up every element
+ * of the smallest set in all the other sets, we walk all the sets in
+ * parallel keeping a cursor for every set. The algorithm used to advance a
+ * cursor depends on the relative size of the set: sets of a size similar to
+ * the smallest one are merged linearly, while for larger sets, where many
+ * elements are skipped at every step, we gallop. When a set has no element
+ * equal to the current candidate, the next candidate is the first element of
+ * the smallest set not smaller than the element found there, so big runs of
+ * non matching elements are skipped as well. */
+intset *intsetIntersect(intset **sets, uint32_t num) {
+    uint32_t j, s = 0, p = 0, slen, count = 0;
+    uint32_t *pos;
+    uint8_t senc, *gallop;
+    intset *small, *res;
+
+    for (j = 1; j < num; j++)
+        if (intsetLen(sets[j]) < intsetLen(sets[s])) s = j;
+    small = sets[s];
+    slen = intsetLen(small);
+    senc = intrev32ifbe(small->encoding);
+
+    /* The result is a subset of the smallest set, so its encoding and
+     * length are enough to contain it. */
+    res = zmalloc(sizeof(intset)+(size_t)slen*senc);
+    res->encoding = small->encoding;
+    res->length = 0;
+    pos = zcalloc(sizeof(uint32_t)*num);
+    gallop = zmalloc(num);
+    for (j = 0; j < num; j++)
+        gallop[j] = intsetLen(sets[j]) >=
+                    (uint64_t)slen*INTSET_INTERSECT_GALLOP_RATIO;
+
+    while(p < slen) {
+        int64_t value = _intsetGetEncoded(small,p,senc), cur = value;
+
+        for (j = 0; j < num; j++) {
+            intset *is = sets[j];
+            uint32_t len = intrev32ifbe(is->length);
+            uint8_t enc = intrev32ifbe(is->encoding);
+
+            if (j == s) continue;
+            if (gallop[j]) {
+                pos[j] = intsetGallop(is,pos[j],len,enc,value);
+            } else {
+                while(pos[j] < len &&
+                      _intsetGetEncoded(is,pos[j],enc) < value) pos[j]++;
+            }
+            /* No more elements >= value: nothing else can match. */
+            if (pos[j] == len) goto done;
+            cur = _intsetGetEncoded(is,pos[j],enc);
+            if (cur != value) break;
+        }
+
+        if (j == num) {
+            _intsetSet(res,count++,value);
+            p++;
+        } else {
+            p = intsetGallop(small,p+1,slen,senc,cur);
+        }
+    }
+
+done:
+    zfree(pos);
+    zfree(gallop);
+    res->length = intrev32ifbe(count);
+    return intsetResize(res,count);
+}
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include <time.h>
@@ -471,6 +577,55 @@ int intsetTest(int argc, char **argv) {
                num,size,usec()-start);
     }
 
+    printf("Intersection: "); {
+        intset *sets[3], *inter;
+        int64_t v;
+        for (i = 0; i < 3; i++) sets[i] = createSet(10+i*5,1000*(i*10+1));
+        /* Common elements of mixed encodings. */
+        for (i = 0; i < 3; i++) {
+            sets[i] = intsetAdd(sets[i],-4294967295,NULL);
+            sets[i] = intsetAdd(sets[i],0,NULL);
+            sets[i] = intsetAdd(sets[i],65535,NULL);
+        }
+        inter = intsetIntersect(sets,3);
+        checkConsistency(inter);
+        assert(intsetFind(inter,-4294967295));
+        assert(intsetFind(inter,0));
+        assert(intsetFind(inter,65535));
+        for (i = 0; i < (int)intsetLen(sets[0]); i++) {
+            intsetGet(sets[0],i,&v);
+            assert(intsetFind(inter,v) ==
+                   (intsetFind(sets[1],v) && intsetFind(sets[2],v)));
+        }
+        zfree(inter);
+        for (i = 0; i < 3; i++) zfree(sets[i]);
+        ok();
+    }
+
+    printf("Stress intersection: "); {
+        intset *sets[5], *inter;
+        long long start;
+        uint32_t j, found = 0;
+        int64_t v;
+        int k;
+
+        for (i = 0; i < 5; i++) sets[i] = createSet(20,50000*(i+1));
+        start = usec();
+        for (j = 0; j < intsetLen(sets[0]); j++) {
+            intsetGet(sets[0],j,&v);
+            for (k = 1; k < 5; k++) if (!intsetFind(sets[k],v)) break;
+            if (k == 5) found++;
+        }
+        printf("\n  lookups: %u elements, %lldusec\n",found,usec()-start);
+        start = usec();
+        inter = intsetIntersect(sets,5);
+        printf("  intersection: %u elements, %lldusec\n",
+               intsetLen(inter),usec()-start);
+        assert(intsetLen(inter) == found);
+        zfree(inter);
+        for (i = 0; i < 5; i++) zfree(sets[i]);
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
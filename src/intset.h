@@ -32,6 +32,10 @@
 #define __INTSET_H
 #include <stdint.h>
 
+/* intsetIntersect() gallops over sets at least this many times bigger than
+ * the smallest set, and merges linearly the others. */
+#define INTSET_INTERSECT_GALLOP_RATIO 8
+
 typedef struct intset {
     uint32_t encoding;
     uint32_t length;
@@ -46,6 +50,7 @@ int64_t intsetRandom(intset *is);
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(const intset *is);
 size_t intsetBlobLen(intset *is);
+intset *intsetIntersect(intset **sets, uint32_t num);
 
 #ifdef REDIS_TEST
 int intsetTest(int argc, char *argv[]);
@@ -0,0 +1,254 @@
+/* LZ4 block format compressor / decompressor.
+ *
+ * A sequence in the LZ4 block format is:
+ *
+ * [token][literal length+][literals][offset][match length+]
+ *
+ * The token high nibble is the number of literals, the low nibble is the
+ * match length minus MINMATCH. A nibble of 15 means that more length bytes
+ * follow, each one added to the length, until a byte different than 255 is
+ * found. The offset is a 16 bit little endian back reference. The last
+ * sequence of a block only contains literals.
+ *
+ * The format requires the last LASTLITERALS bytes to be literals, and the
+ * last match to start at least MFLIMIT bytes before the end of the block.
+ *
+ * This file is released under the BSD license, see the COPYING file. */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+#define LZ4_MINMATCH 4
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG 12
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_LOG)
+#define LZ4_RUN_MASK 15
+#define LZ4_ML_MASK 15
+
+static inline uint32_t lz4Read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4Hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Emit the extra bytes of a length that did not fit the token nibble.
+ * Returns the new output pointer, or NULL if there is no space. */
+static inline unsigned char *lz4WriteLen(unsigned char *op,
+                                         unsigned char *oend, size_t len) {
+    while (len >= 255) {
+        if (op >= oend) return NULL;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend) return NULL;
+    *op++ = (unsigned char) len;
+    return op;
+}
+
+/* Emit a sequence of 'litlen' literals starting at 'lit', followed (if
+ * matchlen is not zero) by a match at distance 'offset'. Returns the new
+ * output pointer, or NULL if the output buffer is too small. */
+static unsigned char *lz4EmitSequence(unsigned char *op, unsigned char *oend,
+                                      const unsigned char *lit, size_t litlen,
+                                      size_t offset, size_t matchlen) {
+    unsigned char *token;
+
+    if (op >= oend) return NULL;
+    token = op++;
+    if (litlen >= LZ4_RUN_MASK) {
+        *token = LZ4_RUN_MASK << 4;
+        if ((op = lz4WriteLen(op, oend, litlen - LZ4_RUN_MASK)) == NULL)
+            return NULL;
+    } else {
+        *token = (unsigned char) (litlen << 4);
+    }
+    if ((size_t) (oend - op) < litlen) return NULL;
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if (matchlen == 0) return op; /* Last literals only sequence. */
+
+    if (oend - op < 2) return NULL;
+    *op++ = (unsigned char) (offset & 0xff);
+    *op++ = (unsigned char) (offset >> 8);
+    matchlen -= LZ4_MINMATCH;
+    if (matchlen >= LZ4_ML_MASK) {
+        *token |= LZ4_ML_MASK;
+        if ((op = lz4WriteLen(op, oend, matchlen - LZ4_ML_MASK)) == NULL)
+            return NULL;
+    } else {
+        *token |= (unsigned char) matchlen;
+    }
+    return op;
+}
+
+unsigned int lz4_compress(const void *const in_data, unsigned int in_len,
+                          void *out_data, unsigned int out_len) {
+    const unsigned char *in = in_data;
+    unsigned char *op = out_data;
+    unsigned char *oend = op + out_len;
+    uint32_t htab[LZ4_HASH_SIZE];
+    size_t ip = 0, anchor = 0, searches = 0;
+
+    memset(htab, 0, sizeof(htab));
+
+    /* Inputs too small to hold a match are stored as a single literal run. */
+    if (in_len > LZ4_MFLIMIT) {
+        size_t mflimit = in_len - LZ4_MFLIMIT;
+        size_t matchlimit = in_len - LZ4_LASTLITERALS;
+
+        while (ip < mflimit) {
+            uint32_t seq = lz4Read32(in + ip);
+            uint32_t h = lz4Hash(seq);
+            size_t ref = htab[h];
+
+            htab[h] = (uint32_t) ip;
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE ||
+                lz4Read32(in + ref) != seq)
+            {
+                /* No match: skip faster over incompressible data. */
+                ip += 1 + (searches++ >> 6);
+                continue;
+            }
+            searches = 0;
+
+            /* Extend the match backward, then forward. */
+            size_t matchlen = LZ4_MINMATCH;
+            while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+                ip--;
+                ref--;
+                matchlen++;
+            }
+            while (ip + matchlen < matchlimit &&
+                   in[ref + matchlen] == in[ip + matchlen])
+                matchlen++;
+
+            op = lz4EmitSequence(op, oend, in + anchor, ip - anchor,
+                                 ip - ref, matchlen);
+            if (op == NULL) return 0;
+            ip += matchlen;
+            anchor = ip;
+
+            /* Index the position just before the next search point, it
+             * is cheap and improves the ratio on repetitive inputs. */
+            if (ip < mflimit)
+                htab[lz4Hash(lz4Read32(in + ip - 2))] = (uint32_t) (ip - 2);
+        }
+    }
+
+    op = lz4EmitSequence(op, oend, in + anchor, in_len - anchor, 0, 0);
+    if (op == NULL) return 0;
+    return (unsigned int) (op - (unsigned char *) out_data);
+}
+
+unsigned int lz4_decompress(const void *const in_data, unsigned int in_len,
+                            void *out_data, unsigned int out_len) {
+    const unsigned char *ip = in_data;
+    const unsigned char *iend = ip + in_len;
+    unsigned char *out = out_data;
+    unsigned char *op = out;
+    unsigned char *oend = out + out_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        size_t litlen = token >> 4;
+        size_t matchlen, offset;
+        unsigned char s;
+
+        if (litlen == LZ4_RUN_MASK) {
+            do {
+                if (ip >= iend) return 0;
+                s = *ip++;
+                litlen += s;
+            } while (s == 255);
+        }
+        if ((size_t) (iend - ip) < litlen || (size_t) (oend - op) < litlen)
+            return 0;
+        memcpy(op, ip, litlen);
+        op += litlen;
+        ip += litlen;
+        if (ip == iend) break; /* Last sequence has no match part. */
+
+        if (iend - ip < 2) return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - out)) return 0;
+
+        matchlen = token & LZ4_ML_MASK;
+        if (matchlen == LZ4_ML_MASK) {
+            do {
+                if (ip >= iend) return 0;
+                s = *ip++;
+                matchlen += s;
+            } while (s == 255);
+        }
+        matchlen += LZ4_MINMATCH;
+        if ((size_t) (oend - op) < matchlen) return 0;
+
+        const unsigned char *ref = op - offset;
+        if (offset >= matchlen) {
+            memcpy(op, ref, matchlen);
+            op += matchlen;
+        } else {
+            /* Overlapping copy, used to encode runs. */
+            while (matchlen--) *op++ = *ref++;
+        }
+    }
+    return (unsigned int) (op - out);
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+#define UNUSED(x) (void)(x)
+int lz4Test(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    unsigned char in[8192], comp[8192 + 64], out[8192];
+    unsigned int clen, dlen;
+    int j, errors = 0;
+
+    /* Repetitive text. */
+    for (j = 0; j < (int) sizeof(in); j++) in[j] = "foobar:1234 "[j % 12];
+    clen = lz4_compress(in, sizeof(in), comp, sizeof(comp));
+    dlen = lz4_decompress(comp, clen, out, sizeof(out));
+    printf("[lz4]: repetitive %u -> %u bytes\n", (unsigned) sizeof(in), clen);
+    if (clen == 0 || clen >= sizeof(in) / 4 || dlen != sizeof(in) ||
+        memcmp(in, out, sizeof(in)) != 0) errors++;
+
+    /* Random data is not compressible. */
+    for (j = 0; j < (int) sizeof(in); j++) in[j] = rand() & 0xff;
+    clen = lz4_compress(in, sizeof(in), comp, sizeof(comp));
+    dlen = lz4_decompress(comp, clen, out, sizeof(out));
+    printf("[lz4]: random %u -> %u bytes\n", (unsigned) sizeof(in), clen);
+    if (clen == 0 || dlen != sizeof(in) || memcmp(in, out, sizeof(in)) != 0)
+        errors++;
+    if (lz4_compress(in, sizeof(in), comp, sizeof(in) - 4) != 0) errors++;
+
+    /* Mixed random lengths round trip. */
+    for (int i = 0; i < 1000; i++) {
+        unsigned int len = rand() % sizeof(in);
+        int alphabet = 1 + rand() % 32;
+        for (j = 0; j < (int) len; j++) in[j] = 'a' + rand() % alphabet;
+        clen = lz4_compress(in, len, comp, sizeof(comp));
+        dlen = lz4_decompress(comp, clen, out, sizeof(out));
+        if ((len && clen == 0) || dlen != len || memcmp(in, out, len) != 0) {
+            errors++;
+            break;
+        }
+        /* Truncated input must never be decoded past the output buffer. */
+        if (clen > 1) lz4_decompress(comp, clen - 1, out, len);
+    }
+
+    printf("[lz4]: %s\n", errors ? "FAILED" : "OK");
+    return errors;
+}
+#endif
@@ -0,0 +1,29 @@
+/* LZ4 block format compressor / decompressor.
+ *
+ * This is a small, self contained implementation of the LZ4 *block* format
+ * (no frame format, no dictionaries, no checksums) so that the output can
+ * be decoded by any standard LZ4_decompress_safe() implementation and vice
+ * versa. Compression ratio is similar to LZF, while decompression is
+ * considerably faster, which is what matters most when loading an RDB file
+ * or accessing compressed data.
+ *
+ * The API mimics lzf.h: both functions return the number of bytes written
+ * into 'out_data', or 0 if the output buffer is too small or, for the
+ * decompressor, if the input is corrupted.
+ *
+ * This file is released under the BSD license, see the COPYING file. */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+unsigned int lz4_compress(const void *const in_data, unsigned int in_len,
+                          void *out_data, unsigned int out_len);
+
+unsigned int lz4_decompress(const void *const in_data, unsigned int in_len,
+                            void *out_data, unsigned int out_len);
+
+#ifdef REDIS_TEST
+int lz4Test(int argc, char *argv[]);
+#endif
+
+#endif
@@ -166,6 +166,7 @@ struct RedisModuleKey {
     uint32_t zstart;        /* Start pos for positional ranges. */
     uint32_t zend;          /* End pos for positional ranges. */
     void *zcurrent;         /* Zset iterator current node. */
+    zbtCursor zcur;         /* Btree position, zcurrent points here. */
     int zer;                /* Zset iterator end reached flag
                                (true if end was reached). */
 };
@@ -1301,7 +1302,7 @@ int RM_ReplyWithString(RedisModuleCtx *ctx, RedisModuleString *str) {
 int RM_ReplyWithNull(RedisModuleCtx *ctx) {
     client *c = moduleGetReplyClient(ctx);
     if (c == NULL) return REDISMODULE_OK;
-    addReply(c,shared.nullbulk);
+    addReply(c,shared.null[c->resp]);
     return REDISMODULE_OK;
 }
 
@@ -2106,6 +2107,11 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInRange(zsl,zrs) :
                                 zslLastInRange(zsl,zrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = key->value->ptr;
+        int valid = first ? zbtFirstInRange(zs->zbt,zrs,&key->zcur,NULL) :
+                            zbtLastInRange(zs->zbt,zrs,&key->zcur,NULL);
+        key->zcurrent = valid ? &key->zcur : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2170,6 +2176,11 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInLexRange(zsl,zlrs) :
                                 zslLastInLexRange(zsl,zlrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = key->value->ptr;
+        int valid = first ? zbtFirstInLexRange(zs->zbt,zlrs,&key->zcur,NULL) :
+                            zbtLastInLexRange(zs->zbt,zlrs,&key->zcur,NULL);
+        key->zcurrent = valid ? &key->zcur : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2220,6 +2231,10 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
         zskiplistNode *ln = key->zcurrent;
         if (score) *score = ln->score;
         str = createStringObject(ln->ele,sdslen(ln->ele));
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtEntry *e = zbtCursorEntry(&key->zcur);
+        if (score) *score = e->score;
+        str = createStringObject(e->ele,sdslen(e->ele));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2285,6 +2300,28 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
             key->zcurrent = next;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtCursor next = key->zcur;
+        if (!zbtNext(&next)) {
+            key->zer = 1;
+            return 0;
+        } else {
+            /* Are we still within the range? */
+            zbtEntry *e = zbtCursorEntry(&next);
+            if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+                !zslValueLteMax(e->score,&key->zrs))
+            {
+                key->zer = 1;
+                return 0;
+            } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
+                if (!zslLexValueLteMax(e->ele,&key->zlrs)) {
+                    key->zer = 1;
+                    return 0;
+                }
+            }
+            key->zcur = next;
+            return 1;
+        }
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2348,6 +2385,28 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
             key->zcurrent = prev;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtCursor prev = key->zcur;
+        if (!zbtPrev(&prev)) {
+            key->zer = 1;
+            return 0;
+        } else {
+            /* Are we still within the range? */
+            zbtEntry *e = zbtCursorEntry(&prev);
+            if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+                !zslValueGteMin(e->score,&key->zrs))
+            {
+                key->zer = 1;
+                return 0;
+            } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
+                if (!zslLexValueGteMin(e->ele,&key->zlrs)) {
+                    key->zer = 1;
+                    return 0;
+                }
+            }
+            key->zcur = prev;
+            return 1;
+        }
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -5445,26 +5504,32 @@ NULL
             addReplyErrorFormat(c,"Error unloading module: %s",errmsg);
         }
     } else if (!strcasecmp(subcmd,"list") && c->argc == 2) {
-        dictIterator *di = dictGetIterator(modules);
-        dictEntry *de;
-
-        addReplyMultiBulkLen(c,dictSize(modules));
-        while ((de = dictNext(di)) != NULL) {
-            sds name = dictGetKey(de);
-            struct RedisModule *module = dictGetVal(de);
-            addReplyMultiBulkLen(c,4);
-            addReplyBulkCString(c,"name");
-            addReplyBulkCBuffer(c,name,sdslen(name));
-            addReplyBulkCString(c,"ver");
-            addReplyLongLong(c,module->ver);
-        }
-        dictReleaseIterator(di);
+        addReplyLoadedModules(c);
     } else {
         addReplySubcommandSyntaxError(c);
         return;
     }
 }
 
+/* Reply with the list of the loaded modules, as a map of name and version
+ * for every module. Used by MODULE LIST and HELLO. */
+void addReplyLoadedModules(client *c) {
+    dictIterator *di = dictGetIterator(modules);
+    dictEntry *de;
+
+    addReplyMultiBulkLen(c,dictSize(modules));
+    while ((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        struct RedisModule *module = dictGetVal(de);
+        addReplyMapLen(c,2);
+        addReplyBulkCString(c,"name");
+        addReplyBulkCBuffer(c,name,sdslen(name));
+        addReplyBulkCString(c,"ver");
+        addReplyLongLong(c,module->ver);
+    }
+    dictReleaseIterator(di);
+}
+
 /* Return the number of registered modules. */
 size_t moduleCount(void) {
     return dictSize(modules);
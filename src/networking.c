@@ -135,6 +135,7 @@ client *createClient(int fd) {
     c->sentlen = 0;
     c->flags = 0;
     c->ctime = c->lastinteraction = server.unixtime;
+    c->resp = 2;
     c->authenticated = 0;
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
@@ -154,17 +155,25 @@ client *createClient(int fd) {
     c->bpop.timeout = 0;
     c->bpop.keys = dictCreate(&objectKeyHeapPointerValueDictType, NULL);
     c->bpop.target = NULL;
+    c->bpop.list_where = LIST_HEAD;
+    c->bpop.list_count = 0;
     c->bpop.xread_group = NULL;
     c->bpop.xread_consumer = NULL;
     c->bpop.xread_group_noack = 0;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
+    c->bpop.migrate_job = NULL;
     c->woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType, NULL);
     c->pubsub_patterns = listCreate();
+    c->pubsubshard_channels = dictCreate(&objectKeyPointerValueDictType, NULL);
     c->peerid = NULL;
     c->client_list_node = NULL;
+    c->restore_chunks = NULL;
+    c->client_tracking_flags = 0;
+    c->client_tracking_redirection = 0;
+    c->client_tracking_prefixes = NULL;
     listSetFreeMethod(c->pubsub_patterns, decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns, listMatchObjects);
     /** 将client加入到客户端链表中 */
@@ -253,6 +262,17 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
 
+    /* The Lua client has no socket: its replies are pushed on the Lua stack
+     * by the direct reply path when possible, otherwise accumulated into the
+     * reusable server.lua_reply arena, that the scripting engine converts
+     * into Lua values and clears after every redis.call(). */
+    if (c->flags & CLIENT_LUA) {
+        if (luaDirectReplyProto(s, len) == C_OK) return C_OK;
+        server.lua_reply = sdscatlen(server.lua_reply, s, len);
+        server.stat_reply_bytes += len;
+        return C_OK;
+    }
+
     /* If there already are entries in the reply list, we cannot
      * add anything more to the static buffer. */
     if (listLength(c->reply) > 0) return C_ERR;
@@ -262,11 +282,13 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 
     memcpy(c->buf + c->bufpos, s, len);
     c->bufpos += len;
+    server.stat_reply_bytes += len;
     return C_OK;
 }
 
 void _addReplyStringToList(client *c, const char *s, size_t len) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    server.stat_reply_bytes += len;
 
     listNode *ln = listLast(c->reply);
     clientReplyBlock *tail = ln ? listNodeValue(ln) : NULL;
@@ -362,6 +384,8 @@ void addReplyString(client *c, const char *s, size_t len) {
  * code provided is used, otherwise the string "-ERR " for the generic
  * error code is automatically added. */
 void addReplyErrorLength(client *c, const char *s, size_t len) {
+    if (c->flags & CLIENT_LUA && luaDirectReplyError(s, len) == C_OK) return;
+
     /* If the string already starts with "-..." then the error code
      * is provided by the caller. Otherwise we use "-ERR". */
     if (!len || s[0] != '-') addReplyString(c, "-ERR ", 5);
@@ -409,6 +433,7 @@ void addReplyErrorFormat(client *c, const char *fmt, ...) {
 }
 
 void addReplyStatusLength(client *c, const char *s, size_t len) {
+    if (c->flags & CLIENT_LUA && luaDirectReplyStatus(s, len) == C_OK) return;
     addReplyString(c, "+", 1);
     addReplyString(c, s, len);
     addReplyString(c, "\r\n", 2);
@@ -434,20 +459,40 @@ void *addDeferredMultiBulkLength(client *c) {
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != C_OK) return NULL;
+    /* For the Lua client the placeholder is just the arena offset where the
+     * length will be inserted, biased by one so that it is never NULL.
+     * Deferred lengths are not handled by the direct reply path. */
+    if (c->flags & CLIENT_LUA) {
+        luaDirectReplyStop();
+        return (void *) (uintptr_t) (sdslen(server.lua_reply) + 1);
+    }
     listAddNodeTail(c->reply, NULL); /* NULL is our placeholder. */
     return listLast(c->reply);
 }
 
-/* Populate the length object and try gluing it to the next chunk. */
-void setDeferredMultiBulkLength(client *c, void *node, long length) {
+/* Populate the length object and try gluing it to the next chunk. The
+ * 'prefix' is the aggregate type byte: '*' for arrays, '%' for maps and
+ * '~' for sets. */
+void setDeferredAggregateLen(client *c, void *node, long length, char prefix) {
     listNode *ln = (listNode *) node;
     clientReplyBlock *next;
     char lenstr[128];
-    size_t lenstr_len = sprintf(lenstr, "*%ld\r\n", length);
+    size_t lenstr_len = sprintf(lenstr, "%c%ld\r\n", prefix, length);
 
     /* Abort when *node is NULL: when the client should not accept writes
      * we return NULL in addDeferredMultiBulkLength() */
     if (node == NULL) return;
+    if (c->flags & CLIENT_LUA) {
+        size_t offset = (uintptr_t) node - 1;
+        size_t tail = sdslen(server.lua_reply) - offset;
+
+        server.lua_reply = sdsMakeRoomFor(server.lua_reply, lenstr_len);
+        memmove(server.lua_reply + offset + lenstr_len,
+                server.lua_reply + offset, tail + 1); /* Include the null term. */
+        memcpy(server.lua_reply + offset, lenstr, lenstr_len);
+        sdsIncrLen(server.lua_reply, lenstr_len);
+        return;
+    }
     serverAssert(!listNodeValue(ln));
 
     /* Normally we fill this dummy NULL node, added by addDeferredMultiBulkLength(),
@@ -480,28 +525,61 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
-/* Add a double as a bulk reply */
+void setDeferredMultiBulkLength(client *c, void *node, long length) {
+    setDeferredAggregateLen(c, node, length, '*');
+}
+
+/* Like setDeferredMultiBulkLength() but for a map of 'length' field-value
+ * pairs: RESP2 clients get a flat array of twice the elements. */
+void setDeferredMapLen(client *c, void *node, long length) {
+    int prefix = c->resp == 2 ? '*' : '%';
+    if (c->resp == 2) length *= 2;
+    setDeferredAggregateLen(c, node, length, prefix);
+}
+
+void setDeferredSetLen(client *c, void *node, long length) {
+    int prefix = c->resp == 2 ? '*' : '~';
+    setDeferredAggregateLen(c, node, length, prefix);
+}
+
+/* Add a double as a bulk reply, or as a native double with RESP3. */
 void addReplyDouble(client *c, double d) {
     char dbuf[128], sbuf[128];
     int dlen, slen;
     if (isinf(d)) {
         /* Libc in odd systems (Hi Solaris!) will format infinite in a
          * different way, so better to handle it in an explicit way. */
-        addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
+        if (c->resp == 2) {
+            addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
+        } else {
+            addReplyString(c, d > 0 ? ",inf\r\n" : ",-inf\r\n",
+                           d > 0 ? 6 : 7);
+        }
     } else {
         dlen = snprintf(dbuf, sizeof(dbuf), "%.17g", d);
-        slen = snprintf(sbuf, sizeof(sbuf), "$%d\r\n%s\r\n", dlen, dbuf);
+        if (c->resp == 2)
+            slen = snprintf(sbuf, sizeof(sbuf), "$%d\r\n%s\r\n", dlen, dbuf);
+        else
+            slen = snprintf(sbuf, sizeof(sbuf), ",%s\r\n", dbuf);
         addReplyString(c, sbuf, slen);
     }
 }
 
 /* Add a long double as a bulk reply, but uses a human readable formatting
  * of the double instead of exposing the crude behavior of doubles to the
- * dear user. */
+ * dear user. RESP3 clients get it as a native double. */
 void addReplyHumanLongDouble(client *c, long double d) {
-    robj *o = createStringObjectFromLongDouble(d, 1);
-    addReplyBulk(c, o);
-    decrRefCount(o);
+    if (c->resp == 2) {
+        robj *o = createStringObjectFromLongDouble(d, 1);
+        addReplyBulk(c, o);
+        decrRefCount(o);
+    } else {
+        char buf[MAX_LONG_DOUBLE_CHARS];
+        int len = ld2string(buf, sizeof(buf), d, 1);
+        addReplyString(c, ",", 1);
+        addReplyString(c, buf, len);
+        addReplyString(c, "\r\n", 2);
+    }
 }
 
 /* Add a long long as integer reply or bulk len / multi bulk count.
@@ -519,6 +597,12 @@ void addReplyLongLongWithPrefix(client *c, long long ll, char prefix) {
     } else if (prefix == '$' && ll < OBJ_SHARED_BULKHDR_LEN && ll >= 0) {
         addReply(c, shared.bulkhdr[ll]);
         return;
+    } else if (prefix == '%' && ll < OBJ_SHARED_BULKHDR_LEN && ll >= 0) {
+        addReply(c, shared.maphdr[ll]);
+        return;
+    } else if (prefix == '~' && ll < OBJ_SHARED_BULKHDR_LEN && ll >= 0) {
+        addReply(c, shared.sethdr[ll]);
+        return;
     }
 
     buf[0] = prefix;
@@ -544,6 +628,45 @@ void addReplyMultiBulkLen(client *c, long length) {
         addReplyLongLongWithPrefix(c, length, '*');
 }
 
+/* RESP3 aggregate types. With RESP2 clients maps are emitted as flat arrays
+ * of field-value pairs, and sets and push messages as plain arrays. */
+void addReplyMapLen(client *c, long length) {
+    if (c->resp == 2)
+        addReplyMultiBulkLen(c, length * 2);
+    else
+        addReplyLongLongWithPrefix(c, length, '%');
+}
+
+void addReplySetLen(client *c, long length) {
+    if (c->resp == 2)
+        addReplyMultiBulkLen(c, length);
+    else
+        addReplyLongLongWithPrefix(c, length, '~');
+}
+
+void addReplyPushLen(client *c, long length) {
+    if (c->resp == 2)
+        addReplyMultiBulkLen(c, length);
+    else
+        addReplyLongLongWithPrefix(c, length, '>');
+}
+
+void addReplyNull(client *c) {
+    addReply(c, shared.null[c->resp]);
+}
+
+void addReplyNullArray(client *c) {
+    addReply(c, shared.nullarray[c->resp]);
+}
+
+/* Booleans are integer replies with RESP2. */
+void addReplyBool(client *c, int b) {
+    if (c->resp == 2)
+        addReply(c, b ? shared.cone : shared.czero);
+    else
+        addReplyString(c, b ? "#t\r\n" : "#f\r\n", 4);
+}
+
 /* Create the length prefix of a bulk reply, example: $2234 */
 void addReplyBulkLen(client *c, robj *obj) {
     size_t len;
@@ -572,6 +695,15 @@ void addReplyBulkLen(client *c, robj *obj) {
 
 /* Add a Redis Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj) {
+    if (c->flags & CLIENT_LUA) {
+        if (sdsEncodedObject(obj)) {
+            if (luaDirectReplyBulk(obj->ptr, sdslen(obj->ptr)) == C_OK) return;
+        } else {
+            char buf[32];
+            size_t len = ll2string(buf, sizeof(buf), (long) obj->ptr);
+            if (luaDirectReplyBulk(buf, len) == C_OK) return;
+        }
+    }
     addReplyBulkLen(c, obj);
     addReply(c, obj);
     addReply(c, shared.crlf);
@@ -579,6 +711,7 @@ void addReplyBulk(client *c, robj *obj) {
 
 /* Add a C buffer as bulk reply */
 void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
+    if (c->flags & CLIENT_LUA && luaDirectReplyBulk(p, len) == C_OK) return;
     addReplyLongLongWithPrefix(c, len, '$');
     addReplyString(c, p, len);
     addReply(c, shared.crlf);
@@ -586,6 +719,10 @@ void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
 
 /* Add sds to reply (takes ownership of sds and frees it) */
 void addReplyBulkSds(client *c, sds s) {
+    if (c->flags & CLIENT_LUA && luaDirectReplyBulk(s, sdslen(s)) == C_OK) {
+        sdsfree(s);
+        return;
+    }
     addReplyLongLongWithPrefix(c, sdslen(s), '$');
     addReplySds(c, s);
     addReply(c, shared.crlf);
@@ -594,7 +731,7 @@ void addReplyBulkSds(client *c, sds s) {
 /* Add a C null term string as bulk reply */
 void addReplyBulkCString(client *c, const char *s) {
     if (s == NULL) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     } else {
         addReplyBulkCBuffer(c, s, strlen(s));
     }
@@ -922,9 +1059,14 @@ void freeClient(client *c) {
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c, 0);
     pubsubUnsubscribeAllPatterns(c, 0);
+    pubsubUnsubscribeShardAllChannels(c, 0);
     dictRelease(c->pubsub_channels);
+    dictRelease(c->pubsubshard_channels);
     listRelease(c->pubsub_patterns);
 
+    /* Stop tracking the keys of this client for client side caching. */
+    if (c->flags & CLIENT_TRACKING) disableTracking(c);
+
     /* Free data structures. */
     listRelease(c->reply);
     freeClientArgv(c);
@@ -971,6 +1113,7 @@ void freeClient(client *c) {
     zfree(c->argv);
     freeClientMultiState(c);
     sdsfree(c->peerid);
+    if (c->restore_chunks) dictRelease(c->restore_chunks);
     zfree(c);
 }
 
@@ -1164,6 +1307,12 @@ void resetClient(client *c) {
     if (!(c->flags & CLIENT_MULTI) && prevcmd != askingCommand)
         c->flags &= ~CLIENT_ASKING;
 
+    /* We do the same for the CACHING command as well. It also affects
+     * the next command or transaction executed, in a way very similar
+     * to ASKING. */
+    if (!(c->flags & CLIENT_MULTI) && prevcmd != clientCommand)
+        c->client_tracking_flags &= ~TRACKING_CACHING;
+
     /* Remove the CLIENT_REPLY_SKIP flag if any so that the reply
      * to the next command will be sent, but set the flag if the command
      * we just processed was "CLIENT REPLY SKIP". */
@@ -1709,6 +1858,8 @@ sds catClientInfoString(sds s, client *client) {
     if (client->flags & CLIENT_MASTER) *p++ = 'M';
     if (client->flags & CLIENT_PUBSUB) *p++ = 'P';
     if (client->flags & CLIENT_MULTI) *p++ = 'x';
+    if (client->flags & CLIENT_TRACKING) *p++ = 't';
+    if (client->client_tracking_flags & TRACKING_BROKEN_REDIR) *p++ = 'R';
     if (client->flags & CLIENT_BLOCKED) *p++ = 'b';
     if (client->flags & CLIENT_DIRTY_CAS) *p++ = 'd';
     if (client->flags & CLIENT_CLOSE_AFTER_REPLY) *p++ = 'c';
@@ -1762,6 +1913,38 @@ sds getAllClientsInfoString(int type) {
     return o;
 }
 
+/* Set the name of the client 'c' to 'name', or remove the current name if
+ * 'name' is empty. Returns C_ERR, replying with an error to the client, if
+ * the name contains invalid characters. */
+int clientSetNameOrReply(client *c, robj *name) {
+    int j, len = sdslen(name->ptr);
+    char *p = name->ptr;
+
+    /* Setting the client name to an empty string actually removes
+     * the current name. */
+    if (len == 0) {
+        if (c->name) decrRefCount(c->name);
+        c->name = NULL;
+        return C_OK;
+    }
+
+    /* Otherwise check if the charset is ok. We need to do this otherwise
+     * CLIENT LIST format will break. You should always be able to
+     * split by space to get the different fields. */
+    for (j = 0; j < len; j++) {
+        if (p[j] < '!' || p[j] > '~') { /* ASCII is assumed. */
+            addReplyError(c,
+                          "Client names cannot contain spaces, "
+                          "newlines or special characters.");
+            return C_ERR;
+        }
+    }
+    if (c->name) decrRefCount(c->name);
+    c->name = name;
+    incrRefCount(c->name);
+    return C_OK;
+}
+
 void clientCommand(client *c) {
     listNode *ln;
     listIter li;
@@ -1782,6 +1965,9 @@ void clientCommand(client *c) {
                 "reply (on|off|skip)    -- Control the replies sent to the current connection.",
                 "setname <name>         -- Assign the name <name> to the current connection.",
                 "unblock <clientid> [TIMEOUT|ERROR] -- Unblock the specified blocked client.",
+                "tracking (on|off) [REDIRECT <id>] [BCAST] [PREFIX first] [PREFIX second] [OPTIN] [OPTOUT] [NOLOOP] -- Enable client keys tracking for client side caching.",
+                "caching (yes|no)       -- Enable/Disable tracking of the keys for next command in OPTIN/OPTOUT mode.",
+                "getredir               -- Return the client ID we are redirecting to when tracking is enabled.",
                 NULL
         };
         addReplyHelp(c, help);
@@ -1939,38 +2125,13 @@ void clientCommand(client *c) {
             addReply(c, shared.czero);
         }
     } else if (!strcasecmp(c->argv[1]->ptr, "setname") && c->argc == 3) {
-        int j, len = sdslen(c->argv[2]->ptr);
-        char *p = c->argv[2]->ptr;
-
-        /* Setting the client name to an empty string actually removes
-         * the current name. */
-        if (len == 0) {
-            if (c->name) decrRefCount(c->name);
-            c->name = NULL;
+        if (clientSetNameOrReply(c, c->argv[2]) == C_OK)
             addReply(c, shared.ok);
-            return;
-        }
-
-        /* Otherwise check if the charset is ok. We need to do this otherwise
-         * CLIENT LIST format will break. You should always be able to
-         * split by space to get the different fields. */
-        for (j = 0; j < len; j++) {
-            if (p[j] < '!' || p[j] > '~') { /* ASCII is assumed. */
-                addReplyError(c,
-                              "Client names cannot contain spaces, "
-                              "newlines or special characters.");
-                return;
-            }
-        }
-        if (c->name) decrRefCount(c->name);
-        c->name = c->argv[2];
-        incrRefCount(c->name);
-        addReply(c, shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr, "getname") && c->argc == 2) {
         if (c->name)
             addReplyBulk(c, c->name);
         else
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
     } else if (!strcasecmp(c->argv[1]->ptr, "pause") && c->argc == 3) {
         long long duration;
 
@@ -1979,12 +2140,254 @@ void clientCommand(client *c) {
             return;
         pauseClients(duration);
         addReply(c, shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr, "tracking") && c->argc >= 3) {
+        /* CLIENT TRACKING (on|off) [REDIRECT <id>] [BCAST] [PREFIX first]
+         *                          [PREFIX second] [OPTIN] [OPTOUT] [NOLOOP]... */
+        long long redir = 0;
+        int options = 0;
+        robj **prefix = NULL;
+        size_t numprefix = 0;
+
+        /* Parse the options. */
+        for (int j = 3; j < c->argc; j++) {
+            int moreargs = (c->argc-1) - j;
+
+            if (!strcasecmp(c->argv[j]->ptr, "redirect") && moreargs) {
+                j++;
+                if (redir != 0) {
+                    addReplyError(c, "A client can only redirect to a single "
+                                     "other client");
+                    zfree(prefix);
+                    return;
+                }
+
+                if (getLongLongFromObjectOrReply(c, c->argv[j], &redir, NULL) !=
+                    C_OK)
+                {
+                    zfree(prefix);
+                    return;
+                }
+                /* We will require the client with the specified ID to exist
+                 * right now, even if it is possible that it gets disconnected
+                 * later. Still a valid sanity check. */
+                if (lookupClientByID(redir) == NULL) {
+                    addReplyError(c, "The client ID you want redirect to "
+                                     "does not exist");
+                    zfree(prefix);
+                    return;
+                }
+            } else if (!strcasecmp(c->argv[j]->ptr, "bcast")) {
+                options |= TRACKING_BCAST;
+            } else if (!strcasecmp(c->argv[j]->ptr, "optin")) {
+                options |= TRACKING_OPTIN;
+            } else if (!strcasecmp(c->argv[j]->ptr, "optout")) {
+                options |= TRACKING_OPTOUT;
+            } else if (!strcasecmp(c->argv[j]->ptr, "noloop")) {
+                options |= TRACKING_NOLOOP;
+            } else if (!strcasecmp(c->argv[j]->ptr, "prefix") && moreargs) {
+                j++;
+                prefix = zrealloc(prefix, sizeof(robj*) * (numprefix+1));
+                prefix[numprefix++] = c->argv[j];
+            } else {
+                zfree(prefix);
+                addReply(c, shared.syntaxerr);
+                return;
+            }
+        }
+
+        /* Options are ok: enable or disable the tracking for this client. */
+        if (!strcasecmp(c->argv[2]->ptr, "on")) {
+            /* Before enabling tracking, make sure options are compatible
+             * among each other and with the current state of the client. */
+            if (!(options & TRACKING_BCAST) && numprefix) {
+                addReplyError(c,
+                    "PREFIX option requires BCAST mode to be enabled");
+                zfree(prefix);
+                return;
+            }
+
+            if (c->flags & CLIENT_TRACKING) {
+                int oldbcast = !!(c->client_tracking_flags & TRACKING_BCAST);
+                int newbcast = !!(options & TRACKING_BCAST);
+                if (oldbcast != newbcast) {
+                    addReplyError(c,
+                        "You can't switch BCAST mode on/off before disabling "
+                        "tracking for this client, and then re-enabling it with "
+                        "a different mode.");
+                    zfree(prefix);
+                    return;
+                }
+            }
+
+            if (options & TRACKING_BCAST &&
+                options & (TRACKING_OPTIN|TRACKING_OPTOUT))
+            {
+                addReplyError(c,
+                    "OPTIN and OPTOUT are not compatible with BCAST");
+                zfree(prefix);
+                return;
+            }
+
+            if (options & TRACKING_OPTIN && options & TRACKING_OPTOUT) {
+                addReplyError(c,
+                    "You can't use both OPTIN and OPTOUT");
+                zfree(prefix);
+                return;
+            }
+
+            if (options & TRACKING_BCAST &&
+                !checkPrefixCollisionsOrReply(c, prefix, numprefix))
+            {
+                zfree(prefix);
+                return;
+            }
+
+            enableTracking(c, redir, options, prefix, numprefix);
+        } else if (!strcasecmp(c->argv[2]->ptr, "off")) {
+            disableTracking(c);
+        } else {
+            zfree(prefix);
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+        zfree(prefix);
+        addReply(c, shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr, "caching") && c->argc >= 3) {
+        if (!(c->flags & CLIENT_TRACKING)) {
+            addReplyError(c, "CLIENT CACHING can be called only when the "
+                             "client is in tracking mode with OPTIN or "
+                             "OPTOUT mode enabled");
+            return;
+        }
+
+        char *opt = c->argv[2]->ptr;
+        if (!strcasecmp(opt, "yes")) {
+            if (c->client_tracking_flags & TRACKING_OPTIN) {
+                c->client_tracking_flags |= TRACKING_CACHING;
+            } else {
+                addReplyError(c, "CLIENT CACHING YES is only valid when tracking "
+                                 "is enabled in OPTIN mode.");
+                return;
+            }
+        } else if (!strcasecmp(opt, "no")) {
+            if (c->client_tracking_flags & TRACKING_OPTOUT) {
+                c->client_tracking_flags |= TRACKING_CACHING;
+            } else {
+                addReplyError(c, "CLIENT CACHING NO is only valid when tracking "
+                                 "is enabled in OPTOUT mode.");
+                return;
+            }
+        } else {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+
+        /* Common reply for when we succeeded. */
+        addReply(c, shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr, "getredir") && c->argc == 2) {
+        /* CLIENT GETREDIR */
+        if (c->flags & CLIENT_TRACKING) {
+            if (c->client_tracking_flags & TRACKING_BROKEN_REDIR)
+                addReplyLongLong(c, -2);
+            else
+                addReplyLongLong(c, c->client_tracking_redirection);
+        } else {
+            addReplyLongLong(c, -1);
+        }
     } else {
         addReplyErrorFormat(c, "Unknown subcommand or wrong number of arguments for '%s'. Try CLIENT HELP",
                             (char *) c->argv[1]->ptr);
     }
 }
 
+/* HELLO [<protocol-version> [AUTH <username> <password>] [SETNAME <name>]]
+ *
+ * Switch the connection to the specified protocol version (2 or 3),
+ * optionally authenticating and setting the connection name, and reply with
+ * a map of information about the server. There are no users other than
+ * "default" in this server: AUTH just checks the password set by
+ * requirepass. */
+void helloCommand(client *c) {
+    long long ver = 0;
+    int next_arg = 1;
+
+    if (c->argc >= 2) {
+        if (getLongLongFromObjectOrReply(c, c->argv[next_arg++], &ver,
+            "Protocol version is not an integer or out of range") != C_OK) {
+            return;
+        }
+
+        if (ver < 2 || ver > 3) {
+            addReplyError(c, "-NOPROTO unsupported protocol version");
+            return;
+        }
+    }
+
+    for (int j = next_arg; j < c->argc; j++) {
+        int moreargs = (c->argc-1) - j;
+        const char *opt = c->argv[j]->ptr;
+        if (!strcasecmp(opt, "AUTH") && moreargs >= 2) {
+            char *username = c->argv[j+1]->ptr;
+            char *password = c->argv[j+2]->ptr;
+            j += 2;
+            if (!server.requirepass) {
+                addReplyError(c, "Client sent AUTH, but no password is set");
+                return;
+            }
+            if (strcasecmp(username, "default") ||
+                time_independent_strcmp(password, server.requirepass))
+            {
+                c->authenticated = 0;
+                addReplyError(c, "-WRONGPASS invalid username-password pair");
+                return;
+            }
+            c->authenticated = 1;
+        } else if (!strcasecmp(opt, "SETNAME") && moreargs) {
+            if (clientSetNameOrReply(c, c->argv[j+1]) == C_ERR) return;
+            j++;
+        } else {
+            addReplyErrorFormat(c, "Syntax error in HELLO option '%s'", opt);
+            return;
+        }
+    }
+
+    /* At this point we need to be authenticated to continue. */
+    if (server.requirepass && !c->authenticated) {
+        addReplyError(c, "-NOAUTH HELLO must be called with the client already "
+                         "authenticated, otherwise the HELLO AUTH <user> <pass> "
+                         "option can be used to authenticate the client and "
+                         "select the RESP protocol version at the same time");
+        return;
+    }
+
+    /* Let's switch to the specified RESP mode. */
+    if (ver) c->resp = ver;
+    addReplyMapLen(c, 7);
+
+    addReplyBulkCString(c, "server");
+    addReplyBulkCString(c, "redis");
+
+    addReplyBulkCString(c, "version");
+    addReplyBulkCString(c, REDIS_VERSION);
+
+    addReplyBulkCString(c, "proto");
+    addReplyLongLong(c, c->resp);
+
+    addReplyBulkCString(c, "id");
+    addReplyLongLong(c, c->id);
+
+    addReplyBulkCString(c, "mode");
+    if (server.sentinel_mode) addReplyBulkCString(c, "sentinel");
+    else if (server.cluster_enabled) addReplyBulkCString(c, "cluster");
+    else addReplyBulkCString(c, "standalone");
+
+    addReplyBulkCString(c, "role");
+    addReplyBulkCString(c, server.masterhost ? "replica" : "master");
+
+    addReplyBulkCString(c, "modules");
+    addReplyLoadedModules(c);
+}
+
 /* This callback is bound to POST and "Host:" command names. Those are not
  * really commands, but are used in security attacks in order to talk to
  * Redis instances via HTTP, with a technique called "cross protocol scripting"
@@ -243,6 +243,13 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+robj *createRoaringObject(void) {
+    roaring *r = roaringNew();
+    robj *o = createObject(OBJ_SET, r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createHashObject(void) {
     unsigned char *zl = ziplistNew();
     robj *o = createObject(OBJ_HASH, zl);
@@ -255,9 +262,14 @@ robj *createZsetObject(void) {
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType, NULL);
-    zs->zsl = zslCreate();
+    zs->zsl = NULL;
+    zs->zbt = NULL;
+    if (server.zset_large_encoding == OBJ_ENCODING_BTREE)
+        zs->zbt = zbtCreate();
+    else
+        zs->zsl = zslCreate();
     o = createObject(OBJ_ZSET, zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = server.zset_large_encoding;
     return o;
 }
 
@@ -304,6 +316,9 @@ void freeSetObject(robj *o) {
         case OBJ_ENCODING_INTSET:
             zfree(o->ptr);
             break;
+        case OBJ_ENCODING_ROARING:
+            roaringFree(o->ptr);
+            break;
         default:
             serverPanic("Unknown set encoding type");
     }
@@ -318,6 +333,12 @@ void freeZsetObject(robj *o) {
             zslFree(zs->zsl);
             zfree(zs);
             break;
+        case OBJ_ENCODING_BTREE:
+            zs = o->ptr;
+            dictRelease(zs->dict);
+            zbtFree(zs->zbt);
+            zfree(zs);
+            break;
         case OBJ_ENCODING_ZIPLIST:
             zfree(o->ptr);
             break;
@@ -776,8 +797,12 @@ char *strEncoding(int encoding) {
             return "ziplist";
         case OBJ_ENCODING_INTSET:
             return "intset";
+        case OBJ_ENCODING_ROARING:
+            return "roaring";
         case OBJ_ENCODING_SKIPLIST:
             return "skiplist";
+        case OBJ_ENCODING_BTREE:
+            return "btree";
         case OBJ_ENCODING_EMBSTR:
             return "embstr";
         default:
@@ -839,11 +864,12 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklist *ql = o->ptr;
             quicklistNode *node = ql->head;
             asize = sizeof(*o) + sizeof(quicklist);
-            do {
+            while (node != NULL && samples < sample_size) {
                 elesize += sizeof(quicklistNode) + ziplistBlobLen(node->zl);
                 samples++;
-            } while ((node = node->next) && samples < sample_size);
-            asize += (double) elesize / samples * ql->len;
+                node = node->next;
+            }
+            if (samples) asize += (double) elesize / samples * ql->len;
         } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
             asize = sizeof(*o) + ziplistBlobLen(o->ptr);
         } else {
@@ -864,6 +890,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = o->ptr;
             asize = sizeof(*o) + sizeof(*is) + is->encoding * is->length;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            asize = sizeof(*o) + roaringMemUsage(o->ptr);
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -884,6 +912,21 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 znode = znode->level[0].forward;
             }
             if (samples) asize += (double) elesize / samples * dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            d = ((zset *) o->ptr)->dict;
+            zbtree *zbt = ((zset *) o->ptr)->zbt;
+            zbtCursor cur;
+            int valid = zbtFirst(zbt, &cur);
+            asize = sizeof(*o) + sizeof(zset) + sizeof(dict) +
+                    (sizeof(struct dictEntry *) * dictSlots(d)) +
+                    zbtMemUsage(zbt);
+            while (valid && samples < sample_size) {
+                elesize += sdsAllocSize(zbtCursorEntry(&cur)->ele);
+                elesize += sizeof(struct dictEntry);
+                samples++;
+                valid = zbtNext(&cur);
+            }
+            if (samples) asize += (double) elesize / samples * dictSize(d);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -948,6 +991,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 streamCG *cg = ri.data;
                 asize += sizeof(*cg);
                 asize += streamRadixTreeMemoryUsage(cg->pel);
+                asize += streamRadixTreeMemoryUsage(cg->pel_by_time);
                 asize += sizeof(streamNACK) * raxSize(cg->pel);
 
                 /* For each consumer we also need to add the basic data
@@ -1279,6 +1323,137 @@ void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
     }
 }
 
+/* ====================== Memory accounting per key prefix ================== */
+
+/* When memory-prefixes is configured, the memory used by the keys starting
+ * with each of the prefixes is maintained incrementally, so that MEMORY
+ * PREFIXES can tell which tenant is using the memory without scanning the
+ * keyspace.
+ *
+ * Every DB keeps the bytes accounted to each tracked key in db->prefix_sizes
+ * (the key sds is shared with the main dictionary, like in db->expires),
+ * so that when a key is modified or deleted the old figure can be removed
+ * from the totals of its group. */
+
+/* raxWalkPrefixes() callback: the prefixes are visited by increasing
+ * length, so the last one is the longest. */
+static void memoryPrefixMatch(void *data, size_t prefixlen, void *privdata) {
+    UNUSED(prefixlen);
+    *(int*)privdata = (int)(long)data - 1;
+}
+
+/* Return the group of the longest configured prefix the key starts with,
+ * or -1 if the key is not tracked. The prefixes are indexed in a radix
+ * tree, so this costs a single lookup of the key whatever the number of
+ * prefixes. */
+static int memoryPrefixGroup(sds key) {
+    int group = -1;
+
+    if (server.memory_prefixes_index)
+        raxWalkPrefixes(server.memory_prefixes_index, (unsigned char*)key,
+                        sdslen(key), memoryPrefixMatch, &group);
+    return group;
+}
+
+/* The bytes used by the key found at 'de' in a db dict: the ones MEMORY
+ * USAGE reports with the default number of samples. */
+size_t dbEntryComputeSize(dictEntry *de) {
+    return objectComputeSize(dictGetVal(de), OBJ_COMPUTE_SIZE_DEF_SAMPLES) +
+           sdsAllocSize(dictGetKey(de)) + sizeof(dictEntry);
+}
+
+/* Account the key found at 'de' to its group, replacing the bytes
+ * accounted to it so far if any. */
+static void memoryPrefixAccount(redisDb *db, dictEntry *de, int group) {
+    memoryPrefixStats *st = db->prefix_stats + group;
+    dictEntry *existing, *pe;
+    size_t size = dbEntryComputeSize(de);
+
+    pe = dictAddRaw(db->prefix_sizes, dictGetKey(de), &existing);
+    if (pe) {
+        st->keys++;
+    } else {
+        pe = existing;
+        st->bytes -= dictGetUnsignedIntegerVal(pe);
+    }
+    dictSetUnsignedIntegerVal(pe, size);
+    st->bytes += size;
+}
+
+/* Called every time a key is created or modified: recompute the memory
+ * used by the key, if it belongs to a memory-prefixes group. */
+void memoryPrefixUpdateKey(redisDb *db, sds key) {
+    if (!server.memory_prefixes_count) return;
+    int group = memoryPrefixGroup(key);
+    if (group == -1) return;
+
+    dictEntry *de = dictFind(db->dict, key);
+    if (de)
+        memoryPrefixAccount(db, de, group);
+    else
+        memoryPrefixRemoveKey(db, key);
+}
+
+/* Called before a key is removed from the main dictionary (while its sds
+ * is still valid) to remove it from the totals of its group. */
+void memoryPrefixRemoveKey(redisDb *db, sds key) {
+    if (dictSize(db->prefix_sizes) == 0) return;
+    dictEntry *pe = dictUnlink(db->prefix_sizes, key);
+    if (pe == NULL) return;
+
+    memoryPrefixStats *st = db->prefix_stats + memoryPrefixGroup(key);
+    st->keys--;
+    st->bytes -= dictGetUnsignedIntegerVal(pe);
+    dictFreeUnlinkedEntry(db->prefix_sizes, pe);
+}
+
+/* Called before the DB is emptied. */
+void memoryPrefixResetDb(redisDb *db) {
+    dictEmpty(db->prefix_sizes, NULL);
+    if (server.memory_prefixes_count)
+        memset(db->prefix_stats, 0,
+               sizeof(memoryPrefixStats) * server.memory_prefixes_count);
+}
+
+/* Set the memory-prefixes groups. The prefixes are copied. If the DBs are
+ * already initialized the whole keyspace is accounted again, which is
+ * O(N) but only happens when the configuration changes. */
+void memoryPrefixesSet(sds *prefixes, int count) {
+    for (int j = 0; j < server.memory_prefixes_count; j++)
+        sdsfree(server.memory_prefixes[j]);
+    zfree(server.memory_prefixes);
+    if (server.memory_prefixes_index) raxFree(server.memory_prefixes_index);
+    server.memory_prefixes = count ? zmalloc(sizeof(sds) * count) : NULL;
+    server.memory_prefixes_index = count ? raxNew() : NULL;
+    for (int j = 0; j < count; j++) {
+        server.memory_prefixes[j] = sdsdup(prefixes[j]);
+        /* A prefix listed twice belongs to its first group. */
+        raxTryInsert(server.memory_prefixes_index,
+                     (unsigned char*)prefixes[j], sdslen(prefixes[j]),
+                     (void*)(long)(j+1), NULL);
+    }
+    server.memory_prefixes_count = count;
+    if (server.db == NULL) return; /* Loading the config file. */
+
+    for (int dbid = 0; dbid < server.dbnum; dbid++) {
+        redisDb *db = server.db + dbid;
+        dictIterator *di;
+        dictEntry *de;
+
+        zfree(db->prefix_stats);
+        db->prefix_stats = count ? zmalloc(sizeof(memoryPrefixStats) * count) : NULL;
+        memoryPrefixResetDb(db);
+        if (!count) continue;
+
+        di = dictGetIterator(db->dict);
+        while ((de = dictNext(di)) != NULL) {
+            int group = memoryPrefixGroup(dictGetKey(de));
+            if (group != -1) memoryPrefixAccount(db, de, group);
+        }
+        dictReleaseIterator(di);
+    }
+}
+
 /* ======================= The OBJECT and MEMORY commands =================== */
 
 /* This is a helper function for the OBJECT command. We need to lookup keys
@@ -1312,17 +1487,17 @@ void objectCommand(client *c) {
         };
         addReplyHelp(c, help);
     } else if (!strcasecmp(c->argv[1]->ptr, "refcount") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
         addReplyLongLong(c, o->refcount);
     } else if (!strcasecmp(c->argv[1]->ptr, "encoding") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
         addReplyBulkCString(c, strEncoding(o->encoding));
     } else if (!strcasecmp(c->argv[1]->ptr, "idletime") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
         if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
@@ -1332,9 +1507,14 @@ void objectCommand(client *c) {
         }
         addReplyLongLong(c, estimateObjectIdleTime(o) / 1000);
     } else if (!strcasecmp(c->argv[1]->ptr, "freq") && c->argc == 3) {
-        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk))
+        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.null[c->resp]))
             == NULL)
             return;
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_TINYLFU) {
+            /* TinyLFU estimates the frequency by key name. */
+            addReplyLongLong(c, tinylfuEstimate(c->argv[2]->ptr));
+            return;
+        }
         if (!(server.maxmemory_policy & MAXMEMORY_FLAG_LFU)) {
             addReplyError(c,
                           "An LFU maxmemory policy is not selected, access frequency not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
@@ -1359,6 +1539,7 @@ void memoryCommand(client *c) {
         const char *help[] = {
                 "DOCTOR - Return memory problems reports.",
                 "MALLOC-STATS -- Return internal statistics report from the memory allocator.",
+                "PREFIXES -- Return the keys and bytes used by the keys of each memory-prefixes group.",
                 "PURGE -- Attempt to purge dirty pages for reclamation by the allocator.",
                 "STATS -- Return information about the memory usage of the server.",
                 "USAGE <key> [SAMPLES <count>] -- Return memory in bytes used by <key> and its value. Nested values are sampled up to <count> times (default: 5).",
@@ -1386,7 +1567,7 @@ void memoryCommand(client *c) {
             }
         }
         if ((de = dictFind(c->db->dict, c->argv[2]->ptr)) == NULL) {
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
             return;
         }
         size_t usage = objectComputeSize(dictGetVal(de), samples);
@@ -1487,6 +1668,22 @@ void memoryCommand(client *c) {
         addReplyLongLong(c, mh->total_frag_bytes);
 
         freeMemoryOverheadData(mh);
+    } else if (!strcasecmp(c->argv[1]->ptr, "prefixes") && c->argc == 2) {
+        addReplyMapLen(c, server.memory_prefixes_count);
+        for (int j = 0; j < server.memory_prefixes_count; j++) {
+            unsigned long long keys = 0, bytes = 0;
+            for (int dbid = 0; dbid < server.dbnum; dbid++) {
+                keys += server.db[dbid].prefix_stats[j].keys;
+                bytes += server.db[dbid].prefix_stats[j].bytes;
+            }
+            addReplyBulkCBuffer(c, server.memory_prefixes[j],
+                                sdslen(server.memory_prefixes[j]));
+            addReplyMapLen(c, 2);
+            addReplyBulkCString(c, "keys");
+            addReplyLongLong(c, keys);
+            addReplyBulkCString(c, "bytes");
+            addReplyLongLong(c, bytes);
+        }
     } else if (!strcasecmp(c->argv[1]->ptr, "malloc-stats") && c->argc == 2) {
 #if defined(USE_JEMALLOC)
         sds info = sdsempty();
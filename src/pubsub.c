@@ -29,6 +29,46 @@
 
 #include "server.h"
 
+/* Global channels (SUBSCRIBE / PUBLISH) and shard channels (SSUBSCRIBE /
+ * SPUBLISH) share the same implementation, but live in different namespaces
+ * and use different reply types. Shard channels are hashed to a cluster slot
+ * like keys, and messages are only delivered inside the shard (the master
+ * and its replicas) serving the slot. */
+typedef struct pubsubtype {
+    int shard;
+    dict *(*clientPubSubChannels)(client *c);
+    int (*subscriptionCount)(client *c);
+    dict **serverPubSubChannels;
+    robj **subscribeMsg;
+    robj **unsubscribeMsg;
+    robj **messageBulk;
+} pubsubtype;
+
+int clientSubscriptionsCount(client *c);
+int clientShardSubscriptionsCount(client *c);
+dict *getClientPubSubChannels(client *c);
+dict *getClientPubSubShardChannels(client *c);
+
+pubsubtype pubSubType = {
+    .shard = 0,
+    .clientPubSubChannels = getClientPubSubChannels,
+    .subscriptionCount = clientSubscriptionsCount,
+    .serverPubSubChannels = &server.pubsub_channels,
+    .subscribeMsg = &shared.subscribebulk,
+    .unsubscribeMsg = &shared.unsubscribebulk,
+    .messageBulk = &shared.messagebulk,
+};
+
+pubsubtype pubSubShardType = {
+    .shard = 1,
+    .clientPubSubChannels = getClientPubSubShardChannels,
+    .subscriptionCount = clientShardSubscriptionsCount,
+    .serverPubSubChannels = &server.pubsubshard_channels,
+    .subscribeMsg = &shared.ssubscribebulk,
+    .unsubscribeMsg = &shared.sunsubscribebulk,
+    .messageBulk = &shared.smessagebulk,
+};
+
 /*-----------------------------------------------------------------------------
  * Pubsub low level API
  *----------------------------------------------------------------------------*/
@@ -47,45 +87,128 @@ int listMatchPubsubPattern(void *a, void *b) {
            (equalStringObjects(pa->pattern,pb->pattern));
 }
 
+/* Return the length of the literal prefix of the glob-style pattern 'p',
+ * that is, the part before the first special character. Every string
+ * matching the pattern starts with this prefix. */
+size_t pubsubPatternPrefixLen(sds p) {
+    size_t len = sdslen(p), j;
+
+    for (j = 0; j < len; j++) {
+        if (p[j] == '*' || p[j] == '?' || p[j] == '[' || p[j] == '\\')
+            break;
+    }
+    return j;
+}
+
+/* Add the pattern to server.pubsub_patterns_index. Patterns are grouped by
+ * literal prefix, so that publishing only needs to look at the patterns
+ * whose prefix is a prefix of the channel. Patterns starting with a special
+ * character share the empty prefix, that works as a fallback list. */
+void pubsubPatternIndexAdd(pubsubPattern *pat) {
+    list *l = raxFind(server.pubsub_patterns_index,
+                      (unsigned char*)pat->pattern->ptr,pat->prefixlen);
+
+    if (l == raxNotFound) {
+        l = listCreate();
+        listSetMatchMethod(l,listMatchPubsubPattern);
+        raxInsert(server.pubsub_patterns_index,
+                  (unsigned char*)pat->pattern->ptr,pat->prefixlen,l,NULL);
+    }
+    listAddNodeTail(l,pat);
+}
+
+/* Remove the pattern from server.pubsub_patterns_index. */
+void pubsubPatternIndexDel(pubsubPattern *pat) {
+    list *l = raxFind(server.pubsub_patterns_index,
+                      (unsigned char*)pat->pattern->ptr,pat->prefixlen);
+    listNode *ln;
+
+    serverAssert(l != raxNotFound);
+    ln = listSearchKey(l,pat);
+    serverAssert(ln != NULL);
+    listDelNode(l,ln);
+    if (listLength(l) == 0) {
+        raxRemove(server.pubsub_patterns_index,
+                  (unsigned char*)pat->pattern->ptr,pat->prefixlen,NULL);
+        listRelease(l);
+    }
+}
+
 /* Return the number of channels + patterns a client is subscribed to. */
 int clientSubscriptionsCount(client *c) {
     return dictSize(c->pubsub_channels)+
            listLength(c->pubsub_patterns);
 }
 
+/* Return the number of shard channels a client is subscribed to. */
+int clientShardSubscriptionsCount(client *c) {
+    return dictSize(c->pubsubshard_channels);
+}
+
+/* Return the number of channels + patterns + shard channels a client is
+ * subscribed to: the client stays in Pub/Sub context while non zero. */
+int clientTotalPubSubSubscriptionCount(client *c) {
+    return clientSubscriptionsCount(c)+clientShardSubscriptionsCount(c);
+}
+
+dict *getClientPubSubChannels(client *c) {
+    return c->pubsub_channels;
+}
+
+dict *getClientPubSubShardChannels(client *c) {
+    return c->pubsubshard_channels;
+}
+
+/* Send the subscribe / unsubscribe confirmation for 'channel' (that may be
+ * NULL) to the client. Like the messages, this is an out of band push
+ * reply for RESP3 clients. */
+void addReplyPubsubSubscription(client *c, robj *channel, robj *msg,
+                                int count)
+{
+    addReplyPushLen(c,3);
+    addReply(c,msg);
+    if (channel)
+        addReplyBulk(c,channel);
+    else
+        addReply(c,shared.null[c->resp]);
+    addReplyLongLong(c,count);
+}
+
 /* Subscribe a client to a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was already subscribed to that channel. */
-int pubsubSubscribeChannel(client *c, robj *channel) {
+int pubsubSubscribeChannel(client *c, robj *channel, pubsubtype type) {
     dictEntry *de;
     list *clients = NULL;
     int retval = 0;
 
     /* Add the channel to the client -> channels hash table */
-    if (dictAdd(c->pubsub_channels,channel,NULL) == DICT_OK) {
+    if (dictAdd(type.clientPubSubChannels(c),channel,NULL) == DICT_OK) {
         retval = 1;
         incrRefCount(channel);
         /* Add the client to the channel -> list of clients hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type.serverPubSubChannels,channel);
         if (de == NULL) {
             clients = listCreate();
-            dictAdd(server.pubsub_channels,channel,clients);
+            dictAdd(*type.serverPubSubChannels,channel,clients);
             incrRefCount(channel);
+            if (type.shard && server.cluster_enabled)
+                slotToChannelAdd(channel->ptr);
         } else {
             clients = dictGetVal(de);
         }
         listAddNodeTail(clients,c);
     }
     /* Notify the client */
-    addReply(c,shared.mbulkhdr[3]);
-    addReply(c,shared.subscribebulk);
-    addReplyBulk(c,channel);
-    addReplyLongLong(c,clientSubscriptionsCount(c));
+    addReplyPubsubSubscription(c,channel,*type.subscribeMsg,
+                               type.subscriptionCount(c));
     return retval;
 }
 
 /* Unsubscribe a client from a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was not subscribed to the specified channel. */
-int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
+int pubsubUnsubscribeChannel(client *c, robj *channel, int notify,
+                             pubsubtype type)
+{
     dictEntry *de;
     list *clients;
     listNode *ln;
@@ -94,10 +217,10 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
     /* Remove the channel from the client -> channels hash table */
     incrRefCount(channel); /* channel may be just a pointer to the same object
                             we have in the hash tables. Protect it... */
-    if (dictDelete(c->pubsub_channels,channel) == DICT_OK) {
+    if (dictDelete(type.clientPubSubChannels(c),channel) == DICT_OK) {
         retval = 1;
         /* Remove the client from the channel -> clients list hash table */
-        de = dictFind(server.pubsub_channels,channel);
+        de = dictFind(*type.serverPubSubChannels,channel);
         serverAssertWithInfo(c,NULL,de != NULL);
         clients = dictGetVal(de);
         ln = listSearchKey(clients,c);
@@ -107,22 +230,45 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify) {
             /* Free the list and associated hash entry at all if this was
              * the latest client, so that it will be possible to abuse
              * Redis PUBSUB creating millions of channels. */
-            dictDelete(server.pubsub_channels,channel);
+            dictDelete(*type.serverPubSubChannels,channel);
+            if (type.shard && server.cluster_enabled)
+                slotToChannelDel(channel->ptr);
         }
     }
     /* Notify the client */
-    if (notify) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.unsubscribebulk);
-        addReplyBulk(c,channel);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-
-    }
+    if (notify)
+        addReplyPubsubSubscription(c,channel,*type.unsubscribeMsg,
+                                   type.subscriptionCount(c));
     decrRefCount(channel); /* it is finally safe to release it */
     return retval;
 }
 
+/* Unsubscribe all the clients subscribed to the shard channel 'channel',
+ * notifying them. Used when this node stops serving the slot of the
+ * channel: clients may subscribe again, and will be redirected to the new
+ * owner of the slot. */
+void pubsubShardUnsubscribeAllClients(robj *channel) {
+    list *clients = dictFetchValue(server.pubsubshard_channels,channel);
+    listNode *ln;
+    listIter li;
+
+    if (clients == NULL) return;
+    incrRefCount(channel); /* The dict entry may own the last reference. */
+    listRewind(clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        client *c = ln->value;
+
+        dictDelete(c->pubsubshard_channels,channel);
+        addReplyPubsubSubscription(c,channel,shared.sunsubscribebulk,
+                                   clientShardSubscriptionsCount(c));
+        if (clientTotalPubSubSubscriptionCount(c) == 0)
+            c->flags &= ~CLIENT_PUBSUB;
+    }
+    dictDelete(server.pubsubshard_channels,channel);
+    if (server.cluster_enabled) slotToChannelDel(channel->ptr);
+    decrRefCount(channel);
+}
+
 /* Subscribe a client to a pattern. Returns 1 if the operation succeeded, or 0 if the client was already subscribed to that pattern. */
 int pubsubSubscribePattern(client *c, robj *pattern) {
     int retval = 0;
@@ -135,13 +281,13 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
         pat = zmalloc(sizeof(*pat));
         pat->pattern = getDecodedObject(pattern);
         pat->client = c;
+        pat->prefixlen = pubsubPatternPrefixLen(pat->pattern->ptr);
         listAddNodeTail(server.pubsub_patterns,pat);
+        pubsubPatternIndexAdd(pat);
     }
     /* Notify the client */
-    addReply(c,shared.mbulkhdr[3]);
-    addReply(c,shared.psubscribebulk);
-    addReplyBulk(c,pattern);
-    addReplyLongLong(c,clientSubscriptionsCount(c));
+    addReplyPubsubSubscription(c,pattern,shared.psubscribebulk,
+                               clientSubscriptionsCount(c));
     return retval;
 }
 
@@ -159,44 +305,51 @@ int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
         pat.client = c;
         pat.pattern = pattern;
         ln = listSearchKey(server.pubsub_patterns,&pat);
+        pubsubPatternIndexDel(ln->value);
         listDelNode(server.pubsub_patterns,ln);
     }
     /* Notify the client */
-    if (notify) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.punsubscribebulk);
-        addReplyBulk(c,pattern);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-    }
+    if (notify)
+        addReplyPubsubSubscription(c,pattern,shared.punsubscribebulk,
+                                   clientSubscriptionsCount(c));
     decrRefCount(pattern);
     return retval;
 }
 
-/* Unsubscribe from all the channels. Return the number of channels the
- * client was subscribed to. */
-int pubsubUnsubscribeAllChannels(client *c, int notify) {
-    dictIterator *di = dictGetSafeIterator(c->pubsub_channels);
+/* Unsubscribe from all the channels of the given type. Return the number of
+ * channels the client was subscribed to. */
+int pubsubUnsubscribeAllChannelsInternal(client *c, int notify,
+                                         pubsubtype type)
+{
+    dictIterator *di = dictGetSafeIterator(type.clientPubSubChannels(c));
     dictEntry *de;
     int count = 0;
 
     while((de = dictNext(di)) != NULL) {
         robj *channel = dictGetKey(de);
 
-        count += pubsubUnsubscribeChannel(c,channel,notify);
+        count += pubsubUnsubscribeChannel(c,channel,notify,type);
     }
     /* We were subscribed to nothing? Still reply to the client. */
-    if (notify && count == 0) {
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.unsubscribebulk);
-        addReply(c,shared.nullbulk);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-    }
+    if (notify && count == 0)
+        addReplyPubsubSubscription(c,NULL,*type.unsubscribeMsg,
+                                   type.subscriptionCount(c));
     dictReleaseIterator(di);
     return count;
 }
 
+/* Unsubscribe from all the channels. Return the number of channels the
+ * client was subscribed to. */
+int pubsubUnsubscribeAllChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsInternal(c,notify,pubSubType);
+}
+
+/* Unsubscribe from all the shard channels. Return the number of shard
+ * channels the client was subscribed to. */
+int pubsubUnsubscribeShardAllChannels(client *c, int notify) {
+    return pubsubUnsubscribeAllChannelsInternal(c,notify,pubSubShardType);
+}
+
 /* Unsubscribe from all the patterns. Return the number of patterns the
  * client was subscribed from. */
 int pubsubUnsubscribeAllPatterns(client *c, int notify) {
@@ -210,26 +363,22 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
 
         count += pubsubUnsubscribePattern(c,pattern,notify);
     }
-    if (notify && count == 0) {
-        /* We were subscribed to nothing? Still reply to the client. */
-        addReply(c,shared.mbulkhdr[3]);
-        addReply(c,shared.punsubscribebulk);
-        addReply(c,shared.nullbulk);
-        addReplyLongLong(c,dictSize(c->pubsub_channels)+
-                       listLength(c->pubsub_patterns));
-    }
+    /* We were subscribed to nothing? Still reply to the client. */
+    if (notify && count == 0)
+        addReplyPubsubSubscription(c,NULL,shared.punsubscribebulk,
+                                   clientSubscriptionsCount(c));
     return count;
 }
 
-/* Publish a message */
-int pubsubPublishMessage(robj *channel, robj *message) {
+/* Send 'message' to the clients subscribed to 'channel' in the namespace
+ * of the given type. Return the number of clients that received it. */
+int pubsubPublishMessageToChannel(robj *channel, robj *message,
+                                  pubsubtype type)
+{
     int receivers = 0;
     dictEntry *de;
-    listNode *ln;
-    listIter li;
 
-    /* Send to clients listening for that channel */
-    de = dictFind(server.pubsub_channels,channel);
+    de = dictFind(*type.serverPubSubChannels,channel);
     if (de) {
         list *list = dictGetVal(de);
         listNode *ln;
@@ -239,33 +388,74 @@ int pubsubPublishMessage(robj *channel, robj *message) {
         while ((ln = listNext(&li)) != NULL) {
             client *c = ln->value;
 
-            addReply(c,shared.mbulkhdr[3]);
-            addReply(c,shared.messagebulk);
+            addReplyPushLen(c,3);
+            addReply(c,*type.messageBulk);
             addReplyBulk(c,channel);
             addReplyBulk(c,message);
             receivers++;
         }
     }
-    /* Send to clients listening to matching channels */
-    if (listLength(server.pubsub_patterns)) {
-        listRewind(server.pubsub_patterns,&li);
-        channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-            pubsubPattern *pat = ln->value;
-
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
-                addReply(pat->client,shared.mbulkhdr[4]);
-                addReply(pat->client,shared.pmessagebulk);
-                addReplyBulk(pat->client,pat->pattern);
-                addReplyBulk(pat->client,channel);
-                addReplyBulk(pat->client,message);
-                receivers++;
-            }
+    return receivers;
+}
+
+/* Publish a message to a shard channel. */
+int pubsubPublishMessageShard(robj *channel, robj *message) {
+    return pubsubPublishMessageToChannel(channel,message,pubSubShardType);
+}
+
+typedef struct pubsubPatternMatchCtx {
+    robj *channel;      /* Decoded channel name. */
+    robj *message;
+    int receivers;
+} pubsubPatternMatchCtx;
+
+/* raxWalkPrefixes() callback: 'l' is the list of patterns having as literal
+ * prefix the first 'prefixlen' bytes of the channel. Since the prefix is
+ * already known to match, only the rest of the pattern is checked. */
+void pubsubMatchPatternList(void *l, size_t prefixlen, void *privdata) {
+    pubsubPatternMatchCtx *ctx = privdata;
+    sds channel = ctx->channel->ptr;
+    listNode *ln;
+    listIter li;
+
+    listRewind(l,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        pubsubPattern *pat = ln->value;
+        sds pattern = pat->pattern->ptr;
+
+        if (stringmatchlen(pattern+prefixlen,sdslen(pattern)-prefixlen,
+                           channel+prefixlen,sdslen(channel)-prefixlen,0))
+        {
+            addReplyPushLen(pat->client,4);
+            addReply(pat->client,shared.pmessagebulk);
+            addReplyBulk(pat->client,pat->pattern);
+            addReplyBulk(pat->client,ctx->channel);
+            addReplyBulk(pat->client,ctx->message);
+            ctx->receivers++;
         }
-        decrRefCount(channel);
+    }
+}
+
+/* Publish a message */
+int pubsubPublishMessage(robj *channel, robj *message) {
+    int receivers;
+
+    /* Send to clients listening for that channel */
+    receivers = pubsubPublishMessageToChannel(channel,message,pubSubType);
+    /* Send to clients listening to matching channels: only the patterns
+     * whose literal prefix is a prefix of the channel can match. */
+    if (listLength(server.pubsub_patterns)) {
+        pubsubPatternMatchCtx ctx;
+
+        ctx.channel = getDecodedObject(channel);
+        ctx.message = message;
+        ctx.receivers = 0;
+        raxWalkPrefixes(server.pubsub_patterns_index,
+                        (unsigned char*)ctx.channel->ptr,
+                        sdslen(ctx.channel->ptr),
+                        pubsubMatchPatternList,&ctx);
+        decrRefCount(ctx.channel);
+        receivers += ctx.receivers;
     }
     return receivers;
 }
@@ -278,7 +468,7 @@ void subscribeCommand(client *c) {
     int j;
 
     for (j = 1; j < c->argc; j++)
-        pubsubSubscribeChannel(c,c->argv[j]);
+        pubsubSubscribeChannel(c,c->argv[j],pubSubType);
     c->flags |= CLIENT_PUBSUB;
 }
 
@@ -289,9 +479,10 @@ void unsubscribeCommand(client *c) {
         int j;
 
         for (j = 1; j < c->argc; j++)
-            pubsubUnsubscribeChannel(c,c->argv[j],1);
+            pubsubUnsubscribeChannel(c,c->argv[j],1,pubSubType);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalPubSubSubscriptionCount(c) == 0)
+        c->flags &= ~CLIENT_PUBSUB;
 }
 
 void psubscribeCommand(client *c) {
@@ -311,7 +502,8 @@ void punsubscribeCommand(client *c) {
         for (j = 1; j < c->argc; j++)
             pubsubUnsubscribePattern(c,c->argv[j],1);
     }
-    if (clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+    if (clientTotalPubSubSubscriptionCount(c) == 0)
+        c->flags &= ~CLIENT_PUBSUB;
 }
 
 void publishCommand(client *c) {
@@ -323,6 +515,83 @@ void publishCommand(client *c) {
     addReplyLongLong(c,receivers);
 }
 
+/* SSUBSCRIBE shardchannel [shardchannel ...]
+ *
+ * In cluster mode all the channels must hash to the same slot, served by
+ * this node or by its master (for READONLY clients of a replica), exactly
+ * like the keys of a multi key command. */
+void ssubscribeCommand(client *c) {
+    int j;
+
+    for (j = 1; j < c->argc; j++)
+        pubsubSubscribeChannel(c,c->argv[j],pubSubShardType);
+    c->flags |= CLIENT_PUBSUB;
+}
+
+void sunsubscribeCommand(client *c) {
+    if (c->argc == 1) {
+        pubsubUnsubscribeShardAllChannels(c,1);
+    } else {
+        int j;
+
+        for (j = 1; j < c->argc; j++)
+            pubsubUnsubscribeChannel(c,c->argv[j],1,pubSubShardType);
+    }
+    if (clientTotalPubSubSubscriptionCount(c) == 0)
+        c->flags &= ~CLIENT_PUBSUB;
+}
+
+/* SPUBLISH shardchannel message
+ *
+ * Unlike PUBLISH, in cluster mode the message is only propagated to the
+ * nodes serving the slot of the channel, instead of to the whole cluster. */
+void spublishCommand(client *c) {
+    int receivers = pubsubPublishMessageShard(c->argv[1],c->argv[2]);
+    if (server.cluster_enabled)
+        clusterPropagatePublishShard(c->argv[1],c->argv[2]);
+    else
+        forceCommandPropagation(c,PROPAGATE_REPL);
+    addReplyLongLong(c,receivers);
+}
+
+/* Reply with the channels of 'channels' matching the pattern 'pat', or all
+ * the channels if 'pat' is NULL. */
+void addReplyPubsubChannels(client *c, dict *channels, sds pat) {
+    dictIterator *di = dictGetIterator(channels);
+    dictEntry *de;
+    long mblen = 0;
+    void *replylen;
+
+    replylen = addDeferredMultiBulkLength(c);
+    while((de = dictNext(di)) != NULL) {
+        robj *cobj = dictGetKey(de);
+        sds channel = cobj->ptr;
+
+        if (!pat || stringmatchlen(pat, sdslen(pat),
+                                   channel, sdslen(channel),0))
+        {
+            addReplyBulk(c,cobj);
+            mblen++;
+        }
+    }
+    dictReleaseIterator(di);
+    setDeferredMultiBulkLength(c,replylen,mblen);
+}
+
+/* Reply with the number of subscribers of every channel in argv, looking
+ * them up in 'channels'. */
+void addReplyPubsubNumSub(client *c, dict *channels, robj **argv, int argc) {
+    int j;
+
+    addReplyMapLen(c,argc);
+    for (j = 0; j < argc; j++) {
+        list *l = dictFetchValue(channels,argv[j]);
+
+        addReplyBulk(c,argv[j]);
+        addReplyLongLong(c,l ? listLength(l) : 0);
+    }
+}
+
 /* PUBSUB command for Pub/Sub introspection. */
 void pubsubCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
@@ -330,6 +599,8 @@ void pubsubCommand(client *c) {
 "CHANNELS [<pattern>] -- Return the currently active channels matching a pattern (default: all).",
 "NUMPAT -- Return number of subscriptions to patterns.",
 "NUMSUB [channel-1 .. channel-N] -- Returns the number of subscribers for the specified channels (excluding patterns, default: none).",
+"SHARDCHANNELS [<pattern>] -- Return the currently active shard channels matching a pattern (default: all).",
+"SHARDNUMSUB [shardchannel-1 .. shardchannel-N] -- Returns the number of subscribers for the specified shard channels (default: none).",
 NULL
         };
         addReplyHelp(c, help);
@@ -338,36 +609,20 @@ NULL
     {
         /* PUBSUB CHANNELS [<pattern>] */
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
-        dictIterator *di = dictGetIterator(server.pubsub_channels);
-        dictEntry *de;
-        long mblen = 0;
-        void *replylen;
-
-        replylen = addDeferredMultiBulkLength(c);
-        while((de = dictNext(di)) != NULL) {
-            robj *cobj = dictGetKey(de);
-            sds channel = cobj->ptr;
-
-            if (!pat || stringmatchlen(pat, sdslen(pat),
-                                       channel, sdslen(channel),0))
-            {
-                addReplyBulk(c,cobj);
-                mblen++;
-            }
-        }
-        dictReleaseIterator(di);
-        setDeferredMultiBulkLength(c,replylen,mblen);
+        addReplyPubsubChannels(c,server.pubsub_channels,pat);
     } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
         /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
-        int j;
-
-        addReplyMultiBulkLen(c,(c->argc-2)*2);
-        for (j = 2; j < c->argc; j++) {
-            list *l = dictFetchValue(server.pubsub_channels,c->argv[j]);
-
-            addReplyBulk(c,c->argv[j]);
-            addReplyLongLong(c,l ? listLength(l) : 0);
-        }
+        addReplyPubsubNumSub(c,server.pubsub_channels,c->argv+2,c->argc-2);
+    } else if (!strcasecmp(c->argv[1]->ptr,"shardchannels") &&
+        (c->argc == 2 || c->argc == 3))
+    {
+        /* PUBSUB SHARDCHANNELS [<pattern>] */
+        sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
+        addReplyPubsubChannels(c,server.pubsubshard_channels,pat);
+    } else if (!strcasecmp(c->argv[1]->ptr,"shardnumsub") && c->argc >= 2) {
+        /* PUBSUB SHARDNUMSUB [ShardChannel_1 ... ShardChannel_N] */
+        addReplyPubsubNumSub(c,server.pubsubshard_channels,c->argv+2,
+                             c->argc-2);
     } else if (!strcasecmp(c->argv[1]->ptr,"numpat") && c->argc == 2) {
         /* PUBSUB NUMPAT */
         addReplyLongLong(c,listLength(server.pubsub_patterns));
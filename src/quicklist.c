@@ -34,6 +34,7 @@
 #include "ziplist.h"
 #include "util.h" /* for ll2string */
 #include "lzf.h"
+#include "lz4.h"
 
 #if defined(REDIS_TEST) || defined(REDIS_TEST_VERBOSE)
 #include <stdio.h> /* for printf (debug printing), snprintf (genstr) */
@@ -58,6 +59,11 @@ static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
  * resulted in a larger size than the original data. */
 #define MIN_COMPRESS_IMPROVE 8
 
+/* Encoding used to compress nodes: QUICKLIST_NODE_ENCODING_LZF or LZ4. Nodes
+ * remember their own encoding, so changing it only affects nodes compressed
+ * from now on. */
+static int compress_codec = QUICKLIST_NODE_ENCODING_LZF;
+
 /* If not verbose testing, remove all debug printing. */
 #ifndef REDIS_TEST_VERBOSE
 #define D(...)
@@ -104,6 +110,7 @@ quicklist *quicklistCreate(void) {
     quicklist->count = 0;
     quicklist->compress = 0;
     quicklist->fill = -2;
+    quicklist->cache = NULL;
     return quicklist;
 }
 
@@ -134,6 +141,11 @@ void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
     quicklistSetCompressDepth(quicklist, depth);
 }
 
+/* Set the codec used to compress nodes of every quicklist. */
+void quicklistSetCompressCodec(int encoding) {
+    compress_codec = encoding;
+}
+
 /* Create a new quicklist with some default parameters. */
 quicklist *quicklistNew(int fill, int compress) {
     quicklist *quicklist = quicklistCreate();
@@ -154,6 +166,8 @@ REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
     node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
     node->recompress = 0;
+    node->incompressible = 0;
+    node->dirty = 0;
     return node;
 }
 
@@ -178,6 +192,11 @@ void quicklistRelease(quicklist *quicklist) {
         quicklist->len--;
         current = next;
     }
+    if (quicklist->cache) {
+        for (int j = 0; j < quicklist->cache->len; j++)
+            zfree(quicklist->cache->lzf[j]);
+        zfree(quicklist->cache);
+    }
     zfree(quicklist);
 }
 
@@ -189,36 +208,139 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
     node->attempted_compress = 1;
 #endif
 
-    /* Don't bother compressing small values */
-    if (node->sz < MIN_COMPRESS_BYTES)
+    /* Don't bother compressing small values, nor ziplists that already
+     * failed to compress and were not modified since then. */
+    if (node->sz < MIN_COMPRESS_BYTES || node->incompressible)
         return 0;
 
     quicklistLZF *lzf = zmalloc(sizeof(*lzf) + node->sz);
 
+    if (compress_codec == QUICKLIST_NODE_ENCODING_LZ4)
+        lzf->sz = lz4_compress(node->zl, node->sz, lzf->compressed, node->sz);
+    else
+        lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz);
+
     /* Cancel if compression fails or doesn't compress small enough */
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
-                                 node->sz)) == 0) ||
-        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+    if (lzf->sz == 0 || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
         /* lzf_compress aborts/rejects compression if value not compressable. */
         zfree(lzf);
+        node->incompressible = 1;
         return 0;
     }
     lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
     zfree(node->zl);
     node->zl = (unsigned char *) lzf;
-    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->encoding = compress_codec;
     node->recompress = 0;
     return 1;
 }
 
+/* Return the position of 'node' in the decompress cache of 'quicklist'. The
+ * node must be in the cache, that is, have the 'recompress' flag set. */
+REDIS_STATIC int quicklistCacheFind(const quicklist *quicklist,
+                                    quicklistNode *node) {
+    quicklistDecompressCache *cache = quicklist->cache;
+    int j;
+
+    for (j = 0; j < cache->len; j++)
+        if (cache->node[j] == node) break;
+    return j;
+}
+
+/* Remove the entry at position 'j' of the decompress cache, returning the
+ * compressed data of the node and storing its encoding in '*encoding'. */
+REDIS_STATIC quicklistLZF *quicklistCacheDel(const quicklist *quicklist, int j,
+                                             int *encoding) {
+    quicklistDecompressCache *cache = quicklist->cache;
+    quicklistLZF *lzf = cache->lzf[j];
+
+    cache->node[j]->recompress = 0;
+    *encoding = cache->encoding[j];
+    cache->len--;
+    memmove(cache->node+j, cache->node+j+1,
+            (cache->len-j)*sizeof(cache->node[0]));
+    memmove(cache->lzf+j, cache->lzf+j+1, (cache->len-j)*sizeof(cache->lzf[0]));
+    memmove(cache->encoding+j, cache->encoding+j+1, cache->len-j);
+    return lzf;
+}
+
+/* Remove a node decompressed for usage from the decompress cache, dropping
+ * its compressed data: the node stays uncompressed. */
+REDIS_STATIC void quicklistCacheForget(const quicklist *quicklist,
+                                       quicklistNode *node) {
+    int encoding;
+    zfree(quicklistCacheDel(quicklist, quicklistCacheFind(quicklist, node),
+                            &encoding));
+}
+
+/* Remove a node decompressed for usage from the decompress cache and compress
+ * it again. If the ziplist was not modified we just put back the compressed
+ * data we saved when decompressing it. */
+REDIS_STATIC void quicklistCacheEvict(const quicklist *quicklist,
+                                      quicklistNode *node) {
+    int encoding;
+    quicklistLZF *lzf = quicklistCacheDel(
+        quicklist, quicklistCacheFind(quicklist, node), &encoding);
+
+    if (node->dirty) {
+        zfree(lzf);
+        __quicklistCompressNode(node);
+    } else {
+#ifdef REDIS_TEST
+        node->attempted_compress = 1;
+#endif
+        zfree(node->zl);
+        node->zl = (unsigned char *) lzf;
+        node->encoding = encoding;
+    }
+}
+
+/* Move a node in the decompress cache to the most recently used position, so
+ * that it is not evicted while the caller is using it. */
+REDIS_STATIC void quicklistCacheTouch(const quicklist *quicklist,
+                                      quicklistNode *node) {
+    quicklistDecompressCache *cache = quicklist->cache;
+    int encoding, j = quicklistCacheFind(quicklist, node);
+    quicklistLZF *lzf;
+
+    if (j == cache->len-1) return;
+    lzf = quicklistCacheDel(quicklist, j, &encoding);
+    cache->node[cache->len] = node;
+    cache->lzf[cache->len] = lzf;
+    cache->encoding[cache->len] = encoding;
+    cache->len++;
+    node->recompress = 1;
+}
+
 /* Compress only uncompressed nodes. */
-#define quicklistCompressNode(_node)                                           \
+#define quicklistCompressNode(_ql, _node)                                      \
     do {                                                                       \
         if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
-            __quicklistCompressNode((_node));                                  \
+            if ((_node)->recompress)                                           \
+                quicklistCacheEvict((_ql), (_node));                           \
+            else                                                               \
+                __quicklistCompressNode((_node));                              \
         }                                                                      \
     } while (0)
 
+/* Return a buffer with the decompressed ziplist of 'node', or NULL if the
+ * compressed data is corrupted. The node is not modified. */
+REDIS_STATIC unsigned char *quicklistDecompressData(quicklistNode *node) {
+    unsigned char *decompressed = zmalloc(node->sz);
+    quicklistLZF *lzf = (quicklistLZF *) node->zl;
+    unsigned int len;
+
+    if (node->encoding == QUICKLIST_NODE_ENCODING_LZ4)
+        len = lz4_decompress(lzf->compressed, lzf->sz, decompressed, node->sz);
+    else
+        len = lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz);
+    if (len != node->sz) {
+        zfree(decompressed);
+        return NULL;
+    }
+    return decompressed;
+}
+
 /* Uncompress the ziplist in 'node' and update encoding details.
  * Returns 1 on successful decode, 0 on failure to decode. */
 REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
@@ -226,39 +348,78 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
     node->attempted_compress = 0;
 #endif
 
-    void *decompressed = zmalloc(node->sz);
-    quicklistLZF *lzf = (quicklistLZF *) node->zl;
-    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+    unsigned char *decompressed = quicklistDecompressData(node);
+    if (decompressed == NULL) {
         /* Someone requested decompress, but we can't decompress.  Not good. */
-        zfree(decompressed);
         return 0;
     }
-    zfree(lzf);
+    zfree(node->zl);
     node->zl = decompressed;
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
     return 1;
 }
 
-/* Decompress only compressed nodes. */
-#define quicklistDecompressNode(_node)                                         \
+/* Uncompress the ziplist in 'node' for usage, keeping the compressed data in
+ * the decompress cache of 'quicklist' (evicting the least recently used node
+ * if the cache is full).
+ * Returns 1 on successful decode, 0 on failure to decode. */
+REDIS_STATIC int __quicklistDecompressNodeForUse(const quicklist *quicklist,
+                                                 quicklistNode *node) {
+    quicklistDecompressCache *cache = quicklist->cache;
+
+#ifdef REDIS_TEST
+    node->attempted_compress = 0;
+#endif
+
+    unsigned char *decompressed = quicklistDecompressData(node);
+    if (decompressed == NULL)
+        return 0;
+
+    /* The cache is not part of the logical state of the quicklist, so it is
+     * created on demand even for read only accesses. */
+    if (cache == NULL) {
+        cache = zmalloc(sizeof(*cache));
+        cache->len = 0;
+        ((struct quicklist *) quicklist)->cache = cache;
+    }
+    if (cache->len == QUICKLIST_DECOMPRESS_CACHE_SIZE)
+        quicklistCacheEvict(quicklist, cache->node[0]);
+
+    cache->node[cache->len] = node;
+    cache->lzf[cache->len] = (quicklistLZF *) node->zl;
+    cache->encoding[cache->len] = node->encoding;
+    cache->len++;
+    node->zl = decompressed;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    node->recompress = 1;
+    node->dirty = 0;
+    return 1;
+}
+
+/* Decompress only compressed nodes. Nodes in the decompress cache are
+ * removed from it, since they must stay uncompressed from now on. */
+#define quicklistDecompressNode(_ql, _node)                                    \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+        if ((_node) && (_node)->encoding != QUICKLIST_NODE_ENCODING_RAW) {     \
             __quicklistDecompressNode((_node));                                \
+        } else if ((_node) && (_node)->recompress) {                           \
+            quicklistCacheForget((_ql), (_node));                              \
         }                                                                      \
     } while (0)
 
 /* Force node to not be immediately re-compresable */
-#define quicklistDecompressNodeForUse(_node)                                   \
+#define quicklistDecompressNodeForUse(_ql, _node)                              \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
-            __quicklistDecompressNode((_node));                                \
-            (_node)->recompress = 1;                                           \
+        if ((_node) && (_node)->encoding != QUICKLIST_NODE_ENCODING_RAW) {     \
+            __quicklistDecompressNodeForUse((_ql), (_node));                   \
+        } else if ((_node) && (_node)->recompress) {                           \
+            quicklistCacheTouch((_ql), (_node));                               \
         }                                                                      \
     } while (0)
 
-/* Extract the raw LZF data from this quicklistNode.
- * Pointer to LZF data is assigned to '*data'.
- * Return value is the length of compressed LZF data. */
+/* Extract the raw LZF or LZ4 data from this quicklistNode.
+ * Pointer to the compressed data is assigned to '*data'.
+ * Return value is the length of compressed data. */
 size_t quicklistGetLzf(const quicklistNode *node, void **data) {
     quicklistLZF *lzf = (quicklistLZF *) node->zl;
     *data = lzf->compressed;
@@ -283,26 +444,26 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
     /* Optimized cases for small depth counts */
     if (quicklist->compress == 1) {
         quicklistNode *h = quicklist->head, *t = quicklist->tail;
-        quicklistDecompressNode(h);
-        quicklistDecompressNode(t);
+        quicklistDecompressNode(quicklist, h);
+        quicklistDecompressNode(quicklist, t);
         if (h != node && t != node)
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         return;
     } else if (quicklist->compress == 2) {
         quicklistNode *h = quicklist->head, *hn = h->next, *hnn = hn->next;
         quicklistNode *t = quicklist->tail, *tp = t->prev, *tpp = tp->prev;
-        quicklistDecompressNode(h);
-        quicklistDecompressNode(hn);
-        quicklistDecompressNode(t);
-        quicklistDecompressNode(tp);
+        quicklistDecompressNode(quicklist, h);
+        quicklistDecompressNode(quicklist, hn);
+        quicklistDecompressNode(quicklist, t);
+        quicklistDecompressNode(quicklist, tp);
         if (h != node && hn != node && t != node && tp != node) {
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         }
         if (hnn != t) {
-            quicklistCompressNode(hnn);
+            quicklistCompressNode(quicklist, hnn);
         }
         if (tpp != h) {
-            quicklistCompressNode(tpp);
+            quicklistCompressNode(quicklist, tpp);
         }
         return;
     }
@@ -316,8 +477,8 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
     int depth = 0;
     int in_depth = 0;
     while (depth++ < quicklist->compress) {
-        quicklistDecompressNode(forward);
-        quicklistDecompressNode(reverse);
+        quicklistDecompressNode(quicklist, forward);
+        quicklistDecompressNode(quicklist, reverse);
 
         if (forward == node || reverse == node)
             in_depth = 1;
@@ -330,28 +491,29 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
     }
 
     if (!in_depth)
-        quicklistCompressNode(node);
+        quicklistCompressNode(quicklist, node);
 
     if (depth > 2) {
         /* At this point, forward and reverse are one node beyond depth */
-        quicklistCompressNode(forward);
-        quicklistCompressNode(reverse);
+        quicklistCompressNode(quicklist, forward);
+        quicklistCompressNode(quicklist, reverse);
     }
 }
 // 压缩节点_node
+/* Nodes decompressed for usage are left in the decompress cache, and get
+ * compressed again when evicted from it. */
 #define quicklistCompress(_ql, _node)                                          \
     do {                                                                       \
-        if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
-        else                                                                   \
+        if (!(_node)->recompress)                                              \
             __quicklistCompress((_ql), (_node));                               \
     } while (0)
 
-/* If we previously used quicklistDecompressNodeForUse(), just recompress. */
+/* If we previously used quicklistDecompressNodeForUse(), just recompress.
+ * That happens lazily, when the node is evicted from the decompress cache. */
 #define quicklistRecompressOnly(_ql, _node)                                    \
     do {                                                                       \
-        if ((_node)->recompress)                                               \
-            quicklistCompressNode((_node));                                    \
+        (void) (_ql);                                                          \
+        (void) (_node);                                                        \
     } while (0)
 
 /* Insert 'new_node' after 'old_node' if 'after' is 1.
@@ -491,9 +653,14 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
         return 0;
 }
 
+/* Called every time the ziplist of a node is modified: the compressed data
+ * saved by the decompress cache is stale now, and it is worth trying again
+ * to compress the node even if it failed the last time. */
 #define quicklistNodeUpdateSz(node)                                            \
     do {                                                                       \
         (node)->sz = ziplistBlobLen((node)->zl);                               \
+        (node)->dirty = 1;                                                     \
+        (node)->incompressible = 0;                                            \
     } while (0)
 
 /* Add new entry to head node of quicklist.
@@ -628,6 +795,8 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
 
     quicklist->count -= node->count;
 
+    if (node->recompress)
+        quicklistCacheForget(quicklist, node);
     zfree(node->zl);
     zfree(node);
     quicklist->len--;
@@ -728,8 +897,8 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist,
                                                    quicklistNode *b) {
     D("Requested merge (a,b) (%u, %u)", a->count, b->count);
 
-    quicklistDecompressNode(a);
-    quicklistDecompressNode(b);
+    quicklistDecompressNode(quicklist, a);
+    quicklistDecompressNode(quicklist, b);
     if ((ziplistMerge(&a->zl, &b->zl))) {
         /* We merged ziplists! Now remove the unused quicklistNode. */
         quicklistNode *keep = NULL, *nokeep = NULL;
@@ -906,7 +1075,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     /* Now determine where and how to insert the new element */
     if (!full && after) {
         D("Not full, inserting after current position.");
-        quicklistDecompressNodeForUse(node);
+        quicklistDecompressNodeForUse(quicklist, node);
         unsigned char *next = ziplistNext(node->zl, entry->zi);
         if (next == NULL) {
             node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
@@ -918,7 +1087,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         quicklistRecompressOnly(quicklist, node);
     } else if (!full && !after) {
         D("Not full, inserting before current position.");
-        quicklistDecompressNodeForUse(node);
+        quicklistDecompressNodeForUse(quicklist, node);
         node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
         node->count++;
         quicklistNodeUpdateSz(node);
@@ -928,7 +1097,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
          *   - insert entry at head of next node. */
         D("Full and tail, but next isn't full; inserting next node head");
         new_node = node->next;
-        quicklistDecompressNodeForUse(new_node);
+        quicklistDecompressNodeForUse(quicklist, new_node);
         new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_HEAD);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
@@ -938,7 +1107,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
          *   - insert entry at tail of previous node. */
         D("Full and head, but prev isn't full, inserting prev node tail");
         new_node = node->prev;
-        quicklistDecompressNodeForUse(new_node);
+        quicklistDecompressNodeForUse(quicklist, new_node);
         new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
@@ -957,7 +1126,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         /* else, node is full we need to split it. */
         /* covers both after and !after cases */
         D("\tsplitting node...");
-        quicklistDecompressNodeForUse(node);
+        quicklistDecompressNodeForUse(quicklist, node);
         new_node = _quicklistSplitNode(node, entry->offset, after);
         new_node->zl = ziplistPush(new_node->zl, value, sz,
                                    after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
@@ -1050,7 +1219,7 @@ int quicklistDelRange(quicklist *quicklist, const long start,
         if (delete_entire_node) {
             __quicklistDelNode(quicklist, node);
         } else {
-            quicklistDecompressNodeForUse(node);
+            quicklistDecompressNodeForUse(quicklist, node);
             node->zl = ziplistDeleteRange(node->zl, entry.offset, del);
             quicklistNodeUpdateSz(node);
             node->count -= del;
@@ -1166,7 +1335,7 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
 
     if (!iter->zi) {
         /* If !zi, use current index. */
-        quicklistDecompressNodeForUse(iter->current);
+        quicklistDecompressNodeForUse(iter->quicklist, iter->current);
         iter->zi = ziplistIndex(iter->current->zl, iter->offset);
     } else {
         /* else, use existing iterator offset and get prev/next as necessary. */
@@ -1222,13 +1391,23 @@ quicklist *quicklistDup(quicklist *orig) {
     for (quicklistNode *current = orig->head; current;
          current = current->next) {
         quicklistNode *node = quicklistCreateNode();
+        int encoding = current->encoding;
+        quicklistLZF *lzf = NULL;
+
+        if (encoding != QUICKLIST_NODE_ENCODING_RAW) {
+            lzf = (quicklistLZF *) current->zl;
+        } else if (current->recompress && !current->dirty) {
+            /* Copy the nodes in the decompress cache compressed. */
+            int j = quicklistCacheFind(orig, current);
+            lzf = orig->cache->lzf[j];
+            encoding = orig->cache->encoding[j];
+        }
 
-        if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
-            quicklistLZF *lzf = (quicklistLZF *) current->zl;
+        if (lzf) {
             size_t lzf_sz = sizeof(*lzf) + lzf->sz;
             node->zl = zmalloc(lzf_sz);
-            memcpy(node->zl, current->zl, lzf_sz);
-        } else if (current->encoding == QUICKLIST_NODE_ENCODING_RAW) {
+            memcpy(node->zl, lzf, lzf_sz);
+        } else {
             node->zl = zmalloc(current->sz);
             memcpy(node->zl, current->zl, current->sz);
         }
@@ -1236,7 +1415,7 @@ quicklist *quicklistDup(quicklist *orig) {
         node->count = current->count;
         copy->count += node->count;
         node->sz = current->sz;
-        node->encoding = current->encoding;
+        node->encoding = encoding;
 
         _quicklistInsertNodeAfter(copy, copy->tail, node);
     }
@@ -1301,7 +1480,7 @@ int quicklistIndex(const quicklist *quicklist, const long long idx,
         entry->offset = (-index) - 1 + accum;
     }
 
-    quicklistDecompressNodeForUse(entry->node);
+    quicklistDecompressNodeForUse(quicklist, entry->node);
     entry->zi = ziplistIndex(entry->node->zl, entry->offset);
     ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
     /* The caller will use our result, so we don't re-compress here.
@@ -1451,6 +1630,7 @@ void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
 /* The rest of this file is test cases and test helpers. */
 #ifdef REDIS_TEST
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/time.h>
 
 #define assert(_e)                                                             \
@@ -1621,8 +1801,8 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
                     errors++;
                 }
             } else {
-                if (node->encoding != QUICKLIST_NODE_ENCODING_LZF &&
-                    !node->attempted_compress) {
+                if (!quicklistNodeIsCompressed(node) &&
+                    !node->attempted_compress && !node->recompress) {
                     yell("Incorrect non-compression: node %d is NOT "
                          "compressed at depth %d ((%u, %u); total "
                          "nodes: %u; size: %u; recompress: %d; attempted: %d)",
@@ -2656,7 +2836,7 @@ int quicklistTest(int argc, char *argv[]) {
                                     node->sz);
                             }
                         } else {
-                            if (node->encoding != QUICKLIST_NODE_ENCODING_LZF) {
+                            if (!quicklistNodeIsCompressed(node)) {
                                 ERR("Incorrect non-compression: node %d is NOT "
                                     "compressed at depth %d ((%u, %u); total "
                                     "nodes: %u; size: %u; attempted: %d)",
@@ -2670,6 +2850,71 @@ int quicklistTest(int argc, char *argv[]) {
             }
         }
     }
+
+    TEST("LZ4 compression and decompress cache") {
+        quicklistSetCompressCodec(QUICKLIST_NODE_ENCODING_LZ4);
+        quicklist *ql = quicklistNew(-2, 1);
+        for (int i = 0; i < 5000; i++)
+            quicklistPushTail(ql, genstr("hello", i), 32);
+        if (ql->head->next->encoding != QUICKLIST_NODE_ENCODING_LZ4)
+            ERR("Interior node not LZ4 compressed: %d",
+                ql->head->next->encoding);
+
+        /* Read every node of the list twice, in both directions. */
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 5000; i += 50) {
+                quicklistEntry entry;
+                long idx = round ? -i-1 : i;
+                int want = round ? 4999-i : i;
+                quicklistIndex(ql, idx, &entry);
+                if (strncmp((char *)entry.value, genstr("hello", want), 32))
+                    ERR("Value at %d mismatch: %.*s", want, entry.sz,
+                        entry.value);
+            }
+        }
+        if (ql->cache == NULL || ql->cache->len > QUICKLIST_DECOMPRESS_CACHE_SIZE)
+            ERR("Decompress cache not bounded: %d",
+                ql->cache ? ql->cache->len : -1);
+        ql_verify(ql, ql->len, 5000, ql->head->count, ql->tail->count);
+
+        /* Modify a node in the cache, and force its eviction reading other
+         * nodes: it must be compressed again with its new content. */
+        quicklistEntry entry;
+        quicklistReplaceAtIndex(ql, 2500, "modified", 8);
+        quicklistIndex(ql, 2500, &entry);
+        quicklistNode *modified = entry.node;
+        for (int i = 0; i < 5000; i += 50)
+            quicklistIndex(ql, i, &entry);
+        if (modified->recompress || !quicklistNodeIsCompressed(modified))
+            ERR("Modified node not compressed after eviction: %d",
+                modified->encoding);
+        quicklistIndex(ql, 2500, &entry);
+        if (entry.sz != 8 || strncmp((char *)entry.value, "modified", 8))
+            ERR("Modified value lost: %.*s", entry.sz, entry.value);
+        quicklistIndex(ql, 2501, &entry);
+        if (strncmp((char *)entry.value, genstr("hello", 2501), 32))
+            ERR("Value after modified one mismatch: %.*s", entry.sz,
+                entry.value);
+        quicklistRelease(ql);
+        quicklistSetCompressCodec(QUICKLIST_NODE_ENCODING_LZF);
+    }
+
+    TEST("Incompressible nodes are not compressed again") {
+        quicklist *ql = quicklistNew(-2, 1);
+        char buf[32];
+        for (int i = 0; i < 2000; i++) {
+            for (int j = 0; j < 32; j++) buf[j] = rand() & 0xff;
+            quicklistPushTail(ql, buf, 32);
+        }
+        for (quicklistNode *node = ql->head->next; node != ql->tail;
+             node = node->next) {
+            if (quicklistNodeIsCompressed(node) || !node->incompressible)
+                ERR("Node with random data not marked incompressible: %d",
+                    node->encoding);
+        }
+        quicklistRelease(ql);
+    }
+
     long long stop = mstime();
 
     printf("\n");
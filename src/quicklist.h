@@ -36,11 +36,16 @@
 /* quicklistNode is a 32 byte struct describing a ziplist for a quicklist.
  * We use bit fields keep the quicklistNode at 32 bytes.
  * count: 16 bits, max 65536 (max zl bytes is 65k, so max count actually < 32k).
- * encoding: 2 bits, RAW=1, LZF=2.
+ * encoding: 2 bits, RAW=1, LZF=2, LZ4=3.
  * container: 2 bits, NONE=1, ZIPLIST=2.
- * recompress: 1 bit, bool, true if node is temporarry decompressed for usage.
+ * recompress: 1 bit, bool, true if node is temporarry decompressed for usage
+ *             and is held by the quicklist decompress cache.
  * attempted_compress: 1 bit, boolean, used for verifying during testing.
- * extra: 10 bits, free for future use; pads out the remainder of 32 bits */
+ * incompressible: 1 bit, bool, true if the last compression attempt failed
+ *                 and the ziplist was not modified since then.
+ * dirty: 1 bit, bool, true if the ziplist was modified after the node was
+ *        decompressed for usage.
+ * extra: 8 bits, free for future use; pads out the remainder of 32 bits */
 /**
  * 快速链表节点 结构体
  */
@@ -50,16 +55,19 @@ typedef struct quicklistNode {
     unsigned char *zl;           // 指向ziplist的指针 或者指向quicklistLZF的指针
     unsigned int sz;             /* ziplist size in bytes */   // ziplist的字节大小
     unsigned int count : 16;     /* count of items in ziplist */ // ziplist中元素的个数
-    unsigned int encoding : 2;   /* RAW==1 or LZF==2 */  // 是否压缩ziplist数据  1 不压缩  2 使用LZF压缩算法
+    unsigned int encoding : 2;   /* RAW==1, LZF==2 or LZ4==3 */  // 是否压缩ziplist数据  1 不压缩  2 使用LZF压缩算法  3 使用LZ4压缩算法
     unsigned int container : 2;  /* NONE==1 or ZIPLIST==2 */
     unsigned int recompress : 1; /* was this node previous compressed? */  //当我们使用类似lindex这样的命令查看了某一项本来压缩的数据时，需要把数据暂时解压，这时就设置recompress=1做一个标记，等有机会再把数据重新压缩。
     unsigned int attempted_compress : 1; /* node can't compress; too small */ // 这个值只对Redis的自动化测试程序有用
-    unsigned int extra : 10; /* more bits to steal for future usage */
+    unsigned int incompressible : 1; /* don't retry compressing until modified */
+    unsigned int dirty : 1;      /* modified while decompressed for usage */
+    unsigned int extra : 8; /* more bits to steal for future usage */
 } quicklistNode;
 
 /* quicklistLZF is a 4+N byte struct holding 'sz' followed by 'compressed'.
  * 'sz' is byte length of 'compressed' field.
- * 'compressed' is LZF data with total (compressed) length 'sz'
+ * 'compressed' is LZF or LZ4 data (according to the node encoding) with
+ * total (compressed) length 'sz'
  * NOTE: uncompressed length is stored in quicklistNode->sz.
  * When quicklistNode->zl is compressed, node->zl points to a quicklistLZF */
 typedef struct quicklistLZF {
@@ -67,12 +75,29 @@ typedef struct quicklistLZF {
     char compressed[];
 } quicklistLZF;
 
-/* quicklist is a 40 byte struct (on 64-bit systems) describing a quicklist.
+/* Max number of nodes a quicklist keeps decompressed after reading them. */
+#define QUICKLIST_DECOMPRESS_CACHE_SIZE 4
+
+/* Nodes decompressed for usage (LINDEX, LRANGE, LSET, ...) are not compressed
+ * again as soon as the operation is done: they stay in a small per quicklist
+ * LRU cache together with their compressed data, so that accessing them again
+ * costs nothing. When a node is evicted its original compressed data is put
+ * back, unless the ziplist was modified meanwhile and must be compressed
+ * again. Slot 0 is the least recently used. */
+typedef struct quicklistDecompressCache {
+    quicklistNode *node[QUICKLIST_DECOMPRESS_CACHE_SIZE];
+    quicklistLZF *lzf[QUICKLIST_DECOMPRESS_CACHE_SIZE];
+    unsigned char encoding[QUICKLIST_DECOMPRESS_CACHE_SIZE];
+    unsigned char len;
+} quicklistDecompressCache;
+
+/* quicklist is a 48 byte struct (on 64-bit systems) describing a quicklist.
  * 'count' is the number of total entries.
  * 'len' is the number of quicklist nodes.
  * 'compress' is: -1 if compression disabled, otherwise it's the number
  *                of quicklistNodes to leave uncompressed at ends of quicklist.
- * 'fill' is the user-requested (or default) fill factor. */
+ * 'fill' is the user-requested (or default) fill factor.
+ * 'cache' holds the nodes decompressed for usage, NULL until needed. */
 /**
  * 快速链表
  */
@@ -83,6 +108,7 @@ typedef struct quicklist {
     unsigned long len;          /* number of quicklistNodes */  // quicklistNode的个数
     int fill : 16;              /* fill factor for individual nodes */ // ziplist大小设置，存放list-max-ziplist-size参数的值。
     unsigned int compress : 16; /* depth of end nodes not to compress;0=off */ // 节点压缩深度设置，存放list-compress-depth参数的值。
+    quicklistDecompressCache *cache;
 } quicklist;
 
 typedef struct quicklistIter {
@@ -109,6 +135,7 @@ typedef struct quicklistEntry {
 /* quicklist node encodings */
 #define QUICKLIST_NODE_ENCODING_RAW 1
 #define QUICKLIST_NODE_ENCODING_LZF 2
+#define QUICKLIST_NODE_ENCODING_LZ4 3
 
 /* quicklist compression disable */
 #define QUICKLIST_NOCOMPRESS 0
@@ -118,7 +145,7 @@ typedef struct quicklistEntry {
 #define QUICKLIST_NODE_CONTAINER_ZIPLIST 2
 
 #define quicklistNodeIsCompressed(node)                                        \
-    ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+    ((node)->encoding != QUICKLIST_NODE_ENCODING_RAW)
 
 /* Prototypes */
 quicklist *quicklistCreate(void);
@@ -126,6 +153,7 @@ quicklist *quicklistNew(int fill, int compress);
 void quicklistSetCompressDepth(quicklist *quicklist, int depth);
 void quicklistSetFill(quicklist *quicklist, int fill);
 void quicklistSetOptions(quicklist *quicklist, int fill, int depth);
+void quicklistSetCompressCodec(int encoding);
 void quicklistRelease(quicklist *quicklist);
 int quicklistPushHead(quicklist *quicklist, void *value, const size_t sz);
 int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);
@@ -924,6 +924,38 @@ void *raxFind(rax *rax, unsigned char *s, size_t len) {
     return raxGetData(h);
 }
 
+/* Call 'fn' for every key of the radix tree that is a prefix of the string
+ * 's' of length 'len' (the empty key and 's' itself included), in order of
+ * increasing length, passing the key associated data, the key length and
+ * 'privdata'. The cost is the one of a single lookup of 's'. The callback
+ * must not modify the tree. */
+void raxWalkPrefixes(rax *rax, unsigned char *s, size_t len, void (*fn)(void *data, size_t keylen, void *privdata), void *privdata) {
+    raxNode *h = rax->head;
+    size_t i = 0; /* Position in the string. */
+    size_t j;     /* Child to follow. */
+
+    while(1) {
+        /* Here 'h' represents exactly the first 'i' bytes of 's'. */
+        if (h->iskey) fn(raxGetData(h),i,privdata);
+        if (h->size == 0 || i == len) break;
+
+        unsigned char *v = h->data;
+        if (h->iscompr) {
+            if (len-i < h->size || memcmp(v,s+i,h->size) != 0) break;
+            i += h->size;
+            j = 0;
+        } else {
+            for (j = 0; j < h->size; j++) {
+                if (v[j] == s[i]) break;
+            }
+            if (j == h->size) break;
+            i++;
+        }
+        raxNode **children = raxNodeFirstChildPtr(h);
+        memcpy(&h,children+j,sizeof(h));
+    }
+}
+
 /* Return the memory address where the 'parent' node stores the specified
  * 'child' pointer, so that the caller can update the pointer with another
  * one if needed. The function assumes it will find a match, otherwise the
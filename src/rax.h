@@ -206,6 +206,7 @@ void raxStop(raxIterator *it);
 int raxEOF(raxIterator *it);
 void raxShow(rax *rax);
 uint64_t raxSize(rax *rax);
+void raxWalkPrefixes(rax *rax, unsigned char *s, size_t len, void (*fn)(void *data, size_t keylen, void *privdata), void *privdata);
 unsigned long raxTouch(raxNode *n);
 void raxSetDebugMsg(int onoff);
 
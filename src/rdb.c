@@ -315,13 +315,15 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value, enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* Save an already compressed blob using the string encoding 'enc'
+ * (RDB_ENC_LZF or RDB_ENC_LZ4). */
+ssize_t rdbSaveCompressedBlob(rio *rdb, int enc, void *data,
+                              size_t compress_len, size_t original_len) {
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL << 6) | RDB_ENC_LZF;
+    byte = (RDB_ENCVAL << 6) | enc;
     if ((n = rdbWriteRaw(rdb, &byte, 1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -340,28 +342,45 @@ ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                       size_t original_len) {
+    return rdbSaveCompressedBlob(rdb, RDB_ENC_LZF, data, compress_len,
+                                 original_len);
+}
+
+/* Try to compress the string with the configured rdb-compression-codec.
+ * Returns the number of bytes written, 0 if the string could not be
+ * compressed enough to be worth it, or -1 on write error. */
+ssize_t rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
     size_t comprlen, outlen;
     void *out;
+    int enc;
 
     /* We require at least four bytes compression for this to be worth it */
     if (len <= 4) return 0;
     outlen = len - 4;
     if ((out = zmalloc(outlen + 1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    if (server.rdb_compression_codec == RDB_CODEC_LZ4) {
+        enc = RDB_ENC_LZ4;
+        comprlen = lz4_compress(s, len, out, outlen);
+    } else {
+        enc = RDB_ENC_LZF;
+        comprlen = lzf_compress(s, len, out, outlen);
+    }
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, enc, out, comprlen, len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
- * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+/* Load an LZF or LZ4 compressed string in RDB format, according to the
+ * string encoding 'enc'. The returned value changes according to 'flags'.
+ * For more info check the rdbGenericLoadStringObject() function. */
+void *rdbLoadCompressedStringObject(rio *rdb, int enc, int flags,
+                                    size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
@@ -382,7 +401,12 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb, c, clen) == 0) goto err;
-    if (lzf_decompress(c, clen, val, len) == 0) {
+    if (enc == RDB_ENC_LZ4) {
+        if (lz4_decompress(c, clen, val, len) != len) {
+            if (rdbCheckMode) rdbCheckSetError("Invalid LZ4 compressed string");
+            goto err;
+        }
+    } else if (lzf_decompress(c, clen, val, len) == 0) {
         if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
         goto err;
     }
@@ -417,10 +441,10 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
-     * aaaaaaaaaaaaaaaaaa so skip it */
+    /* Try LZF / LZ4 compression - under 20 bytes it's unable to compress
+     * even aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb, s, len);
+        n = rdbSaveCompressedStringObject(rdb, s, len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -495,7 +519,8 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
             case RDB_ENC_INT32:
                 return rdbLoadIntegerObject(rdb, len, flags, lenptr);
             case RDB_ENC_LZF:
-                return rdbLoadLzfStringObject(rdb, flags, lenptr);
+            case RDB_ENC_LZ4:
+                return rdbLoadCompressedStringObject(rdb, len, flags, lenptr);
             default:
                 rdbExitReportCorruptRDB("Unknown RDB string encoding type %d", len);
         }
@@ -642,6 +667,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         case OBJ_SET:
             if (o->encoding == OBJ_ENCODING_INTSET)
                 return rdbSaveType(rdb, RDB_TYPE_SET_INTSET);
+            else if (o->encoding == OBJ_ENCODING_ROARING)
+                return rdbSaveType(rdb, RDB_TYPE_SET_ROARING);
             else if (o->encoding == OBJ_ENCODING_HT)
                 return rdbSaveType(rdb, RDB_TYPE_SET);
             else
@@ -649,7 +676,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         case OBJ_ZSET:
             if (o->encoding == OBJ_ENCODING_ZIPLIST)
                 return rdbSaveType(rdb, RDB_TYPE_ZSET_ZIPLIST);
-            else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+            else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                     o->encoding == OBJ_ENCODING_BTREE)
                 return rdbSaveType(rdb, RDB_TYPE_ZSET_2);
             else
                 serverPanic("Unknown sorted set encoding");
@@ -779,7 +807,9 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb, data, compress_len, node->sz)) == -1) return -1;
+                    int enc = node->encoding == QUICKLIST_NODE_ENCODING_LZ4 ?
+                              RDB_ENC_LZ4 : RDB_ENC_LZF;
+                    if ((n = rdbSaveCompressedBlob(rdb, enc, data, compress_len, node->sz)) == -1) return -1;
                     nwritten += n;
                 } else {
                     if ((n = rdbSaveRawString(rdb, node->zl, node->sz)) == -1) return -1;
@@ -818,6 +848,14 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
 
             if ((n = rdbSaveRawString(rdb, o->ptr, l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            size_t l;
+            unsigned char *blob = roaringSerialize(o->ptr, &l);
+
+            n = rdbSaveRawString(rdb, blob, l);
+            zfree(blob);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
@@ -853,6 +891,29 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
                 nwritten += n;
                 zn = zn->backward;
             }
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zbtree *zbt = ((zset *) o->ptr)->zbt;
+            zbtCursor cur;
+            int valid;
+
+            if ((n = rdbSaveLen(rdb, zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Same format and order of the skiplist: loading from the
+             * greatest to the smallest element fills the tree leaves. */
+            valid = zbtLast(zbt, &cur);
+            while (valid) {
+                zbtEntry *e = zbtCursorEntry(&cur);
+                if ((n = rdbSaveRawString(rdb,
+                                          (unsigned char *) e->ele, sdslen(e->ele))) == -1) {
+                    return -1;
+                }
+                nwritten += n;
+                if ((n = rdbSaveBinaryDoubleValue(rdb, e->score)) == -1)
+                    return -1;
+                nwritten += n;
+                valid = zbtPrev(&cur);
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1097,6 +1158,9 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
             return -1;
     }
     if (rdbSaveAuxFieldStrInt(rdb, "aof-preamble", aof_preamble) == -1) return -1;
+    if (rdbSaveAuxFieldStrStr(rdb, "compression", server.rdb_compression ?
+        (char *) rdbCompressionCodecToString(server.rdb_compression_codec) :
+        "none") == -1) return -1;
     return 1;
 }
 
@@ -1209,8 +1273,9 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     /* If we are storing the replication information on disk, persist
      * the script cache as well: on successful PSYNC after a restart, we need
      * to be able to process any EVALSHA inside the replication backlog the
-     * master will send us. */
-    if (rsi && dictSize(server.lua_scripts)) {
+     * master will send us. With lua-persist-scripts the scripts are always
+     * saved, so that EVALSHA keeps working after a restart. */
+    if ((rsi || server.lua_persist_scripts) && dictSize(server.lua_scripts)) {
         di = dictGetIterator(server.lua_scripts);
         while ((de = dictNext(di)) != NULL) {
             robj *body = dictGetVal(de);
@@ -1460,13 +1525,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
         /* Read Set value */
         if ((len = rdbLoadLen(rdb, NULL)) == RDB_LENERR) return NULL;
 
-        /* Use a regular set when there are too many entries. */
+        /* Use a roaring set when there are too many entries: it gets
+         * converted into a regular set as soon as we find an element that
+         * is not an integer. */
         if (len > server.set_max_intset_entries) {
-            o = createSetObject();
-            /* It's faster to expand the dict to the right size asap in order
-             * to avoid rehashing */
-            if (len > DICT_HT_INITIAL_SIZE)
-                dictExpand(o->ptr, len);
+            o = createRoaringObject();
         } else {
             o = createIntsetObject();
         }
@@ -1480,12 +1543,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
                 == NULL)
                 return NULL;
 
-            if (o->encoding == OBJ_ENCODING_INTSET) {
+            if (o->encoding != OBJ_ENCODING_HT) {
                 /* Fetch integer value from element. */
                 if (isSdsRepresentableAsLongLong(sdsele, &llval) == C_OK) {
-                    o->ptr = intsetAdd(o->ptr, llval, NULL);
+                    setTypeAddInteger(o, llval);
                 } else {
                     setTypeConvert(o, OBJ_ENCODING_HT);
+                    /* It's faster to expand the dict to the right size
+                     * asap in order to avoid rehashing */
                     dictExpand(o->ptr, len);
                 }
             }
@@ -1530,8 +1595,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl, score, sdsele);
-            dictAdd(zs->dict, sdsele, &znode->score);
+            if (zs->zbt) {
+                dictEntry *de = dictAddRaw(zs->dict, sdsele, NULL);
+                if (de == NULL) rdbExitReportCorruptRDB("Duplicate zset element");
+                dictSetDoubleVal(de, score);
+                zbtInsert(zs->zbt, score, sdsele);
+            } else {
+                znode = zslInsert(zs->zsl, score, sdsele);
+                dictAdd(zs->dict, sdsele, &znode->score);
+            }
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
@@ -1670,13 +1742,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
                 if (intsetLen(o->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(o, OBJ_ENCODING_HT);
+                    setTypeConvert(o, OBJ_ENCODING_ROARING);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
                 o->type = OBJ_ZSET;
                 o->encoding = OBJ_ENCODING_ZIPLIST;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o, OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(o, server.zset_large_encoding);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
                 o->type = OBJ_HASH;
@@ -1688,6 +1760,21 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
                 rdbExitReportCorruptRDB("Unknown RDB encoding type %d", rdbtype);
                 break;
         }
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        size_t blen;
+        unsigned char *blob;
+        roaring *r;
+
+        blob = rdbGenericLoadStringObject(rdb, RDB_LOAD_PLAIN, &blen);
+        if (blob == NULL) return NULL;
+        r = roaringDeserialize(blob, blen);
+        zfree(blob);
+        if (r == NULL || roaringCard(r) == 0)
+            rdbExitReportCorruptRDB("Invalid roaring set");
+        o = createObject(OBJ_SET, r);
+        o->encoding = OBJ_ENCODING_ROARING;
+        if (roaringCard(r) <= server.set_max_intset_entries)
+            setTypeConvert(o, OBJ_ENCODING_INTSET);
     } else if (rdbtype == RDB_TYPE_STREAM_LISTPACKS) {
         o = createStreamObject();
         stream *s = o->ptr;
@@ -1766,6 +1853,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
                 if (!raxInsert(cgroup->pel, rawid, sizeof(rawid), nack, NULL))
                     rdbExitReportCorruptRDB("Duplicated gobal PEL entry "
                                             "loading stream consumer group");
+                streamIndexNACK(cgroup, rawid, nack);
             }
 
             /* Now that we loaded our global PEL, we need to load the
@@ -2013,13 +2101,15 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
                 }
             } else if (!strcasecmp(auxkey->ptr, "repl-offset")) {
                 if (rsi) rsi->repl_offset = strtoll(auxval->ptr, NULL, 10);
+            } else if (!strcasecmp(auxkey->ptr, "compression")) {
+                /* Informative only: every compressed string carries its
+                 * own encoding type, so nothing to configure here. */
+                serverLog(LL_VERBOSE, "RDB compression codec: %s",
+                          (char *) auxval->ptr);
             } else if (!strcasecmp(auxkey->ptr, "lua")) {
-                /* Load the script back in memory. */
-                if (luaCreateFunction(NULL, server.lua, auxval) == NULL) {
-                    rdbExitReportCorruptRDB(
-                            "Can't load Lua script from RDB file! "
-                            "BODY: %s", auxval->ptr);
-                }
+                /* Load the script back in the scripts cache. It is compiled
+                 * the first time it gets called. */
+                luaRegisterScript(auxval);
             } else {
                 /* We ignore fields we don't understand, as by AUX field
                  * contract. */
@@ -85,7 +85,8 @@ char *rdb_type_string[] = {
     "zset-ziplist",
     "hash-ziplist",
     "quicklist",
-    "stream"
+    "stream",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
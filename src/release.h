@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "8f7a61c9"
+#define REDIS_GIT_DIRTY "0"
+#define REDIS_BUILD_ID "vm-1792329881"
@@ -0,0 +1,1511 @@
+/* Compressed sets of 64 bit integers, using the "roaring bitmaps" design.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Every element is split into its 48 high bits, selecting a container, and
+ * its 16 low bits, stored inside the container. Before splitting, elements
+ * are "biased" flipping the sign bit, so that the unsigned order of the
+ * biased values is the same as the signed order of the elements, and the
+ * containers (sorted by key) can be visited in ascending order.
+ *
+ * Each container uses the smallest of three representations:
+ *
+ * ARRAY:  a sorted array of up to ROARING_ARRAY_MAX 16 bit values.
+ * BITMAP: a bitmap of 65536 bits (8k bytes), used for denser containers.
+ * RUN:    a sorted array of runs of consecutive values, stored as pairs of
+ *         16 bit values (start, length-1). Used when the values are
+ *         mostly contiguous, like IDs allocated sequentially.
+ *
+ * Array containers become bitmaps when they grow over ROARING_ARRAY_MAX
+ * elements, and bitmaps go back to arrays when they shrink to half that
+ * size (so that adding and removing an element around the limit does not
+ * convert the container every time). Whether a RUN container would be
+ * smaller is checked when an array becomes a bitmap and then every
+ * ROARING_ARRAY_MAX additions to a bitmap, while RUN containers are
+ * converted to one of the other types as soon as they are no longer the
+ * smallest representation. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024   /* 65536 bits. */
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS*8)
+
+#define roaringBias(v) ((uint64_t)(v) ^ (1ULL<<63))
+#define roaringUnbias(u) ((int64_t)((u) ^ (1ULL<<63)))
+#define roaringValue(c,low) roaringUnbias(((c)->key << 16) | (low))
+
+/* ----------------------------- Array containers --------------------------- */
+
+/* Binary search 'value' in the sorted array 'a' of 'len' elements. Returns
+ * 1 if found, 0 otherwise. In both cases '*pos' is set to the position of
+ * the value or where it should be inserted. */
+static int arraySearch(const uint16_t *a, uint32_t len, uint16_t value,
+                       uint32_t *pos) {
+    uint32_t lo = 0, hi = len;
+
+    while(lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (a[mid] < value) lo = mid+1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < len && a[lo] == value;
+}
+
+/* ----------------------------- Run containers ----------------------------- */
+
+#define runStart(runs,i) ((runs)[(i)*2])
+#define runLast(runs,i) ((uint32_t)(runs)[(i)*2]+(runs)[(i)*2+1])
+
+/* Return the index of the last run starting at or before 'value', or -1
+ * if all the runs start after it. */
+static int32_t runSearch(const uint16_t *runs, uint32_t len, uint16_t value) {
+    int32_t lo = 0, hi = (int32_t)len-1, res = -1;
+
+    while(lo <= hi) {
+        int32_t mid = lo+(hi-lo)/2;
+        if (runStart(runs,mid) <= value) {
+            res = mid;
+            lo = mid+1;
+        } else {
+            hi = mid-1;
+        }
+    }
+    return res;
+}
+
+static void runMakeRoom(roaringContainer *c, uint32_t runs) {
+    if (runs <= c->cap) return;
+    c->cap = runs*2;
+    c->data = zrealloc(c->data,(size_t)c->cap*4);
+}
+
+/* ---------------------------- Bitmap helpers ------------------------------ */
+
+static int bitmapGet(const uint64_t *words, uint16_t value) {
+    return (words[value>>6] >> (value&63)) & 1;
+}
+
+/* Count the runs of consecutive ones in the bitmap. */
+static uint32_t bitmapCountRuns(const uint64_t *words) {
+    uint32_t runs = 0, j;
+
+    for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+        uint64_t w = words[j];
+        uint64_t next = (j+1 < ROARING_BITMAP_WORDS) ? words[j+1] : 0;
+        /* Count the bits that are the last of a run: set, with the
+         * following bit (possibly in the next word) clear. */
+        runs += __builtin_popcountll(w & ~((w >> 1) | (next << 63)));
+    }
+    return runs;
+}
+
+/* ------------------------- Container conversions -------------------------- */
+
+static uint32_t containerCountRuns(const roaringContainer *c) {
+    uint32_t j, runs = 0;
+
+    if (c->type == ROARING_RUN) return c->len;
+    if (c->type == ROARING_BITMAP) return bitmapCountRuns(c->data);
+    for (j = 0; j < c->len; j++) {
+        const uint16_t *a = c->data;
+        if (j == 0 || a[j] != a[j-1]+1) runs++;
+    }
+    return runs;
+}
+
+static void containerToBitmap(roaringContainer *c) {
+    uint64_t *words = zcalloc(ROARING_BITMAP_BYTES);
+    uint16_t *src = c->data;
+    uint32_t j, v;
+
+    if (c->type == ROARING_ARRAY) {
+        for (j = 0; j < c->len; j++)
+            words[src[j]>>6] |= 1ULL << (src[j]&63);
+    } else if (c->type == ROARING_RUN) {
+        for (j = 0; j < c->len; j++)
+            for (v = runStart(src,j); v <= runLast(src,j); v++)
+                words[v>>6] |= 1ULL << (v&63);
+    }
+    zfree(c->data);
+    c->data = words;
+    c->type = ROARING_BITMAP;
+    c->len = c->cap = 0;
+}
+
+static void containerToArray(roaringContainer *c) {
+    uint16_t *a = zmalloc(sizeof(uint16_t)*c->card);
+    uint32_t j, v, n = 0;
+
+    if (c->type == ROARING_BITMAP) {
+        uint64_t *words = c->data;
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            uint64_t w = words[j];
+            while(w) {
+                a[n++] = j*64+__builtin_ctzll(w);
+                w &= w-1;
+            }
+        }
+    } else if (c->type == ROARING_RUN) {
+        uint16_t *runs = c->data;
+        for (j = 0; j < c->len; j++)
+            for (v = runStart(runs,j); v <= runLast(runs,j); v++)
+                a[n++] = v;
+    }
+    zfree(c->data);
+    c->data = a;
+    c->type = ROARING_ARRAY;
+    c->len = c->cap = c->card;
+}
+
+static void containerToRun(roaringContainer *c, uint32_t runs) {
+    uint16_t *r = zmalloc((size_t)runs*4);
+    uint32_t n = 0;
+    int32_t start = -1, last = -1;
+    int64_t v;
+
+    /* Emit the runs visiting the values in ascending order. */
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t j;
+        for (j = 0; j <= c->len; j++) {
+            v = (j < c->len) ? a[j] : -2;
+            if (j == 0) {
+                start = v;
+            } else if (v != last+1) {
+                r[n*2] = start;
+                r[n*2+1] = last-start;
+                n++;
+                start = v;
+            }
+            last = v;
+        }
+    } else if (c->type == ROARING_BITMAP) {
+        uint64_t *words = c->data;
+        for (v = 0; v <= 65536; v++) {
+            int set = v < 65536 && bitmapGet(words,v);
+            if (set && start == -1) {
+                start = v;
+            } else if (!set && start != -1) {
+                r[n*2] = start;
+                r[n*2+1] = v-1-start;
+                n++;
+                start = -1;
+            }
+        }
+    }
+    zfree(c->data);
+    c->data = r;
+    c->type = ROARING_RUN;
+    c->len = c->cap = n;
+}
+
+/* Convert the container to the smallest representation for its content.
+ * 'runs' is the number of runs of the container, if already known, or 0. */
+static void containerOptimize(roaringContainer *c, uint32_t runs) {
+    size_t runsize, othersize;
+
+    if (runs == 0) runs = containerCountRuns(c);
+    runsize = (size_t)runs*4;
+    othersize = c->card <= ROARING_ARRAY_MAX ? (size_t)c->card*2 :
+                                               ROARING_BITMAP_BYTES;
+    if (runsize < othersize) {
+        if (c->type != ROARING_RUN) containerToRun(c,runs);
+    } else if (c->card <= ROARING_ARRAY_MAX) {
+        if (c->type != ROARING_ARRAY) containerToArray(c);
+    } else {
+        if (c->type != ROARING_BITMAP) containerToBitmap(c);
+    }
+}
+
+/* ----------------------- Container level operations ----------------------- */
+
+static int containerContains(const roaringContainer *c, uint16_t low) {
+    uint32_t pos;
+
+    if (c->type == ROARING_ARRAY) {
+        return arraySearch(c->data,c->len,low,&pos);
+    } else if (c->type == ROARING_BITMAP) {
+        return bitmapGet(c->data,low);
+    } else {
+        int32_t i = runSearch(c->data,c->len,low);
+        return i != -1 && low <= runLast((uint16_t*)c->data,i);
+    }
+}
+
+/* Add 'low' to the container. Returns 1 if the value was added, 0 if it
+ * was already there. */
+static int containerAdd(roaringContainer *c, uint16_t low) {
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t pos;
+
+        /* Fast path: appending, as it happens adding values in order. */
+        if (c->len && a[c->len-1] < low) {
+            pos = c->len;
+        } else if (arraySearch(a,c->len,low,&pos)) {
+            return 0;
+        }
+        if (c->len == ROARING_ARRAY_MAX) {
+            containerToBitmap(c);
+            containerAdd(c,low);
+            containerOptimize(c,0);
+            return 1;
+        }
+        if (c->len == c->cap) {
+            c->cap = c->cap ? c->cap*2 : 4;
+            if (c->cap > ROARING_ARRAY_MAX) c->cap = ROARING_ARRAY_MAX;
+            c->data = a = zrealloc(a,sizeof(uint16_t)*c->cap);
+        }
+        memmove(a+pos+1,a+pos,sizeof(uint16_t)*(c->len-pos));
+        a[pos] = low;
+        c->len++;
+        c->card++;
+    } else if (c->type == ROARING_BITMAP) {
+        uint64_t *words = c->data;
+        if (bitmapGet(words,low)) return 0;
+        words[low>>6] |= 1ULL << (low&63);
+        c->card++;
+        if (c->card % ROARING_ARRAY_MAX == 1) containerOptimize(c,0);
+    } else {
+        uint16_t *runs = c->data;
+        int32_t i = runSearch(runs,c->len,low);
+        int extends_prev = i != -1 && runLast(runs,i)+1 == low;
+        int extends_next = (uint32_t)(i+1) < c->len &&
+                           runStart(runs,i+1) == (uint32_t)low+1;
+
+        if (i != -1 && low <= runLast(runs,i)) return 0;
+        if (extends_prev && extends_next) {
+            /* Merge the two runs. */
+            runs[i*2+1] = runLast(runs,i+1)-runStart(runs,i);
+            memmove(runs+(i+1)*2,runs+(i+2)*2,(c->len-i-2)*4);
+            c->len--;
+        } else if (extends_prev) {
+            runs[i*2+1]++;
+        } else if (extends_next) {
+            runs[(i+1)*2]--;
+            runs[(i+1)*2+1]++;
+        } else {
+            runMakeRoom(c,c->len+1);
+            runs = c->data;
+            memmove(runs+(i+2)*2,runs+(i+1)*2,(c->len-i-1)*4);
+            runs[(i+1)*2] = low;
+            runs[(i+1)*2+1] = 0;
+            c->len++;
+        }
+        c->card++;
+        if (c->len*4 >= (c->card <= ROARING_ARRAY_MAX ? c->card*2 :
+                                                        ROARING_BITMAP_BYTES))
+            containerOptimize(c,c->len);
+    }
+    return 1;
+}
+
+/* Remove 'low' from the container. Returns 1 if the value was removed, 0
+ * if it was not there. */
+static int containerRemove(roaringContainer *c, uint16_t low) {
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t pos;
+
+        if (!arraySearch(a,c->len,low,&pos)) return 0;
+        memmove(a+pos,a+pos+1,sizeof(uint16_t)*(c->len-pos-1));
+        c->len--;
+        c->card--;
+        if (c->len && c->len < c->cap/4) {
+            c->cap /= 2;
+            c->data = zrealloc(a,sizeof(uint16_t)*c->cap);
+        }
+    } else if (c->type == ROARING_BITMAP) {
+        uint64_t *words = c->data;
+        if (!bitmapGet(words,low)) return 0;
+        words[low>>6] &= ~(1ULL << (low&63));
+        c->card--;
+        if (c->card <= ROARING_ARRAY_MAX/2) containerOptimize(c,0);
+    } else {
+        uint16_t *runs = c->data;
+        int32_t i = runSearch(runs,c->len,low);
+        uint32_t start, last;
+
+        if (i == -1 || low > runLast(runs,i)) return 0;
+        start = runStart(runs,i);
+        last = runLast(runs,i);
+        if (start == last) {
+            memmove(runs+i*2,runs+(i+1)*2,(c->len-i-1)*4);
+            c->len--;
+        } else if (low == start) {
+            runs[i*2]++;
+            runs[i*2+1]--;
+        } else if (low == last) {
+            runs[i*2+1]--;
+        } else {
+            /* Split the run in two. */
+            runMakeRoom(c,c->len+1);
+            runs = c->data;
+            memmove(runs+(i+2)*2,runs+(i+1)*2,(c->len-i-1)*4);
+            runs[i*2+1] = low-1-start;
+            runs[(i+1)*2] = low+1;
+            runs[(i+1)*2+1] = last-low-1;
+            c->len++;
+        }
+        c->card--;
+        if (c->card && c->len*4 >= (c->card <= ROARING_ARRAY_MAX ?
+                                    c->card*2 : ROARING_BITMAP_BYTES))
+            containerOptimize(c,c->len);
+    }
+    return 1;
+}
+
+/* Return the value with the specified rank (0 based) in the container. */
+static uint16_t containerSelect(const roaringContainer *c, uint32_t rank) {
+    uint32_t j;
+
+    if (c->type == ROARING_ARRAY) {
+        return ((uint16_t*)c->data)[rank];
+    } else if (c->type == ROARING_BITMAP) {
+        const uint64_t *words = c->data;
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++) {
+            uint32_t count = __builtin_popcountll(words[j]);
+            if (rank < count) {
+                uint64_t w = words[j];
+                while(rank--) w &= w-1;
+                return j*64+__builtin_ctzll(w);
+            }
+            rank -= count;
+        }
+    } else {
+        const uint16_t *runs = c->data;
+        for (j = 0; j < c->len; j++) {
+            uint32_t count = (uint32_t)runs[j*2+1]+1;
+            if (rank < count) return runs[j*2]+rank;
+            rank -= count;
+        }
+    }
+    return 0; /* Not reached with a valid rank. */
+}
+
+static void containerFree(roaringContainer *c) {
+    zfree(c->data);
+}
+
+static size_t containerDataSize(const roaringContainer *c) {
+    if (c->type == ROARING_ARRAY) return (size_t)c->cap*2;
+    if (c->type == ROARING_BITMAP) return ROARING_BITMAP_BYTES;
+    return (size_t)c->cap*4;
+}
+
+/* ------------------------------ Container tree ---------------------------- */
+
+/* Containers live in the leaves of a counted B+tree, linked in both
+ * directions so that iterating the set scans the leaves in order. Inner
+ * nodes store, for every child, a lower bound of the keys found under it
+ * (used to route lookups) and the number of elements found under it, so
+ * that the element with a given rank is found in O(log(N)).
+ *
+ * The separator of a child is the key of its first container when the
+ * child is created, and it is never updated: keys smaller than the
+ * separator are routed to the previous child, so it stays a lower bound
+ * after the first container is removed, and it is never consulted for the
+ * first child. Every node but the root holds at least one entry, underfull
+ * nodes are merged with a sibling when the two fit together, and the root
+ * is removed when it is left with a single child. */
+
+typedef struct roaringPathItem {
+    roaringInner *node;
+    uint32_t idx;       /* Child of 'node' we descended into. */
+} roaringPathItem;
+
+static roaringLeaf *roaringCreateLeaf(roaring *r) {
+    roaringLeaf *leaf = zmalloc(sizeof(*leaf));
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    r->leaves++;
+    return leaf;
+}
+
+static roaringInner *roaringCreateInner(roaring *r) {
+    roaringInner *inner = zmalloc(sizeof(*inner));
+    inner->count = 0;
+    r->inners++;
+    return inner;
+}
+
+/* Number of containers (leaves) or children (inner nodes) of a node. */
+static inline uint32_t roaringNodeCount(void *node, int level) {
+    return level == 1 ? ((roaringLeaf*)node)->count :
+                        ((roaringInner*)node)->count;
+}
+
+static uint64_t roaringNodeCard(void *node, int level) {
+    uint64_t card = 0;
+    uint32_t j;
+
+    if (level == 1) {
+        roaringLeaf *leaf = node;
+        for (j = 0; j < leaf->count; j++) card += leaf->c[j].card;
+    } else {
+        roaringInner *inner = node;
+        for (j = 0; j < inner->count; j++) card += inner->card[j];
+    }
+    return card;
+}
+
+/* Return the child of 'inner' that may contain the key: the last one whose
+ * separator is less than or equal to it, or the first one. */
+static uint32_t roaringInnerSearch(const roaringInner *inner, uint64_t key) {
+    uint32_t lo = 1, hi = inner->count;
+
+    while(lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (inner->key[mid] > key) hi = mid;
+        else lo = mid+1;
+    }
+    return lo-1;
+}
+
+/* Return the position of the first container of the leaf with a key
+ * greater than or equal to the specified one. */
+static uint32_t roaringLeafSearch(const roaringLeaf *leaf, uint64_t key) {
+    uint32_t lo = 0, hi = leaf->count;
+
+    while(lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        if (leaf->c[mid].key < key) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Descend to the leaf that holds, or should hold, the container with the
+ * specified key. The inner nodes traversed are stored in 'path' if not
+ * NULL. */
+static roaringLeaf *roaringDescend(const roaring *r, uint64_t key,
+                                   roaringPathItem *path)
+{
+    void *node = r->root;
+    int l;
+
+    for (l = r->level; l > 1; l--) {
+        roaringInner *inner = node;
+        uint32_t i = roaringInnerSearch(inner,key);
+
+        if (path) {
+            path[l].node = inner;
+            path[l].idx = i;
+        }
+        node = inner->child[i];
+    }
+    return node;
+}
+
+/* Return the container with the specified key, or NULL. */
+static roaringContainer *roaringFind(const roaring *r, uint64_t key) {
+    roaringLeaf *leaf = roaringDescend(r,key,NULL);
+    uint32_t pos = roaringLeafSearch(leaf,key);
+
+    return (pos < leaf->count && leaf->c[pos].key == key) ? leaf->c+pos : NULL;
+}
+
+static void roaringInnerInsertAt(roaringInner *inner, uint32_t pos,
+                                 uint64_t key, uint64_t card, void *child)
+{
+    uint32_t move = inner->count-pos;
+
+    memmove(inner->key+pos+1,inner->key+pos,move*sizeof(uint64_t));
+    memmove(inner->card+pos+1,inner->card+pos,move*sizeof(uint64_t));
+    memmove(inner->child+pos+1,inner->child+pos,move*sizeof(void*));
+    inner->key[pos] = key;
+    inner->card[pos] = card;
+    inner->child[pos] = child;
+    inner->count++;
+}
+
+static void roaringInnerRemoveAt(roaringInner *inner, uint32_t pos) {
+    uint32_t move = inner->count-pos-1;
+
+    memmove(inner->key+pos,inner->key+pos+1,move*sizeof(uint64_t));
+    memmove(inner->card+pos,inner->card+pos+1,move*sizeof(uint64_t));
+    memmove(inner->child+pos,inner->child+pos+1,move*sizeof(void*));
+    inner->count--;
+}
+
+static void roaringLeafInsertAt(roaringLeaf *leaf, uint32_t pos,
+                                const roaringContainer *c)
+{
+    memmove(leaf->c+pos+1,leaf->c+pos,
+            (leaf->count-pos)*sizeof(roaringContainer));
+    leaf->c[pos] = *c;
+    leaf->count++;
+}
+
+/* Insert the non empty container 'c' at position 'pos' of the leaf found
+ * following 'path', splitting the nodes that are full up to the root. The
+ * set takes ownership of the container data, but not of the element count:
+ * the caller updates r->card. */
+static void roaringInsertContainer(roaring *r, roaringLeaf *leaf, uint32_t pos,
+                                   const roaringContainer *c,
+                                   roaringPathItem *path)
+{
+    roaringLeaf *right;
+    void *newnode;
+    uint64_t newkey, newcard, oldcard;
+    uint32_t split;
+    int l, rightmost;
+
+    for (l = 2; l <= r->level; l++)
+        path[l].node->card[path[l].idx] += c->card;
+    r->len++;
+    r->bytes += containerDataSize(c);
+    if (leaf->count < ROARING_LEAF_CAP) {
+        roaringLeafInsertAt(leaf,pos,c);
+        return;
+    }
+
+    /* Split the full leaf. When appending to the last leaf, as it happens
+     * with elements added in ascending order, the full leaf is left alone
+     * instead of creating two half empty ones. */
+    rightmost = leaf == r->tail;
+    split = (rightmost && pos == leaf->count) ? ROARING_LEAF_CAP :
+                                                ROARING_LEAF_CAP/2;
+    right = roaringCreateLeaf(r);
+    right->count = ROARING_LEAF_CAP-split;
+    memcpy(right->c,leaf->c+split,right->count*sizeof(roaringContainer));
+    leaf->count = split;
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        r->tail = right;
+    leaf->next = right;
+    if (pos <= split && split < ROARING_LEAF_CAP)
+        roaringLeafInsertAt(leaf,pos,c);
+    else
+        roaringLeafInsertAt(right,pos-split,c);
+
+    /* Link the new node into the parent, splitting it as well if needed,
+     * up to the root. */
+    newnode = right;
+    newkey = right->c[0].key;
+    newcard = roaringNodeCard(right,1);
+    oldcard = roaringNodeCard(leaf,1);
+    for (l = 2; l <= r->level; l++) {
+        roaringInner *inner = path[l].node, *sibling;
+        uint32_t i = path[l].idx+1;
+
+        inner->card[i-1] = oldcard;
+        if (inner->count < ROARING_INNER_CAP) {
+            roaringInnerInsertAt(inner,i,newkey,newcard,newnode);
+            return;
+        }
+
+        split = (rightmost && i == inner->count) ? ROARING_INNER_CAP :
+                                                   ROARING_INNER_CAP/2;
+        sibling = roaringCreateInner(r);
+        sibling->count = ROARING_INNER_CAP-split;
+        memcpy(sibling->key,inner->key+split,sibling->count*sizeof(uint64_t));
+        memcpy(sibling->card,inner->card+split,
+               sibling->count*sizeof(uint64_t));
+        memcpy(sibling->child,inner->child+split,sibling->count*sizeof(void*));
+        inner->count = split;
+        if (i <= split && split < ROARING_INNER_CAP)
+            roaringInnerInsertAt(inner,i,newkey,newcard,newnode);
+        else
+            roaringInnerInsertAt(sibling,i-split,newkey,newcard,newnode);
+
+        newnode = sibling;
+        newkey = sibling->key[0];
+        newcard = roaringNodeCard(sibling,l);
+        oldcard = roaringNodeCard(inner,l);
+    }
+
+    /* The root was split: grow the tree by one level. */
+    roaringInner *root = roaringCreateInner(r);
+    root->count = 2;
+    root->key[0] = 0; /* Never used. */
+    root->card[0] = oldcard;
+    root->child[0] = r->root;
+    root->key[1] = newkey;
+    root->card[1] = newcard;
+    root->child[1] = newnode;
+    r->root = root;
+    r->level++;
+}
+
+/* Append a non empty container with a key greater than every other key. */
+static void roaringAppendContainer(roaring *r, const roaringContainer *c) {
+    roaringPathItem path[ROARING_MAXLEVEL+1];
+    roaringLeaf *leaf = roaringDescend(r,c->key,path);
+
+    roaringInsertContainer(r,leaf,leaf->count,c,path);
+}
+
+/* Remove the child 'pos' of 'inner', an empty node at level 'level'. */
+static void roaringRemoveChild(roaring *r, roaringInner *inner, uint32_t pos,
+                               int level)
+{
+    void *node = inner->child[pos];
+
+    if (level == 1) {
+        roaringLeaf *leaf = node;
+        if (leaf->prev) leaf->prev->next = leaf->next;
+        else r->head = leaf->next;
+        if (leaf->next) leaf->next->prev = leaf->prev;
+        else r->tail = leaf->prev;
+        r->leaves--;
+    } else {
+        r->inners--;
+    }
+    zfree(node);
+    roaringInnerRemoveAt(inner,pos);
+}
+
+/* Append the child 'pos'+1 of 'inner' to the child 'pos' and remove it.
+ * Both children are at level 'level' and their entries fit a single node. */
+static void roaringMergeChildren(roaring *r, roaringInner *inner, uint32_t pos,
+                                 int level)
+{
+    void *left = inner->child[pos], *right = inner->child[pos+1];
+
+    if (level == 1) {
+        roaringLeaf *ll = left, *rl = right;
+        memcpy(ll->c+ll->count,rl->c,rl->count*sizeof(roaringContainer));
+        ll->count += rl->count;
+        ll->next = rl->next;
+        if (rl->next) rl->next->prev = ll;
+        else r->tail = ll;
+        r->leaves--;
+    } else {
+        roaringInner *li = left, *ri = right;
+        memcpy(li->key+li->count,ri->key,ri->count*sizeof(uint64_t));
+        memcpy(li->card+li->count,ri->card,ri->count*sizeof(uint64_t));
+        memcpy(li->child+li->count,ri->child,ri->count*sizeof(void*));
+        li->count += ri->count;
+        r->inners--;
+    }
+    zfree(right);
+    inner->card[pos] += inner->card[pos+1];
+    roaringInnerRemoveAt(inner,pos+1);
+}
+
+/* Free and remove the empty container at position 'pos' of the leaf found
+ * following 'path', then restore the tree invariants. */
+static void roaringDeleteContainer(roaring *r, roaringLeaf *leaf, uint32_t pos,
+                                   roaringPathItem *path)
+{
+    void *node = leaf;
+    int l;
+
+    r->bytes -= containerDataSize(leaf->c+pos);
+    containerFree(leaf->c+pos);
+    memmove(leaf->c+pos,leaf->c+pos+1,
+            (leaf->count-pos-1)*sizeof(roaringContainer));
+    leaf->count--;
+    r->len--;
+
+    /* Remove empty nodes and merge underfull ones with a sibling. As long
+     * as a node loses a child we need to check its parent as well. */
+    for (l = 1; l < r->level; l++) {
+        roaringInner *parent = path[l+1].node;
+        uint32_t i = path[l+1].idx;
+        uint32_t cap = (l == 1) ? ROARING_LEAF_CAP : ROARING_INNER_CAP;
+        uint32_t n = roaringNodeCount(node,l);
+
+        if (n == 0) {
+            roaringRemoveChild(r,parent,i,l);
+        } else if (n < cap/4) {
+            if (i > 0 && n+roaringNodeCount(parent->child[i-1],l) <= cap)
+                roaringMergeChildren(r,parent,i-1,l);
+            else if (i+1 < parent->count &&
+                     n+roaringNodeCount(parent->child[i+1],l) <= cap)
+                roaringMergeChildren(r,parent,i,l);
+            else
+                break;
+        } else {
+            break;
+        }
+        node = parent;
+    }
+
+    /* Shrink the tree while the root has a single child. */
+    while(r->level > 1 && ((roaringInner*)r->root)->count == 1) {
+        roaringInner *root = r->root;
+        r->root = root->child[0];
+        zfree(root);
+        r->inners--;
+        r->level--;
+    }
+}
+
+static void roaringFreeNode(void *node, int level) {
+    uint32_t j;
+
+    if (level == 1) {
+        roaringLeaf *leaf = node;
+        for (j = 0; j < leaf->count; j++) containerFree(leaf->c+j);
+    } else {
+        roaringInner *inner = node;
+        for (j = 0; j < inner->count; j++)
+            roaringFreeNode(inner->child[j],level-1);
+    }
+    zfree(node);
+}
+
+/* ----------------------------- Set operations ----------------------------- */
+
+/* Create an empty set: the root is an empty leaf. */
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r));
+    r->card = 0;
+    r->len = 0;
+    r->leaves = r->inners = 0;
+    r->bytes = 0;
+    r->head = r->tail = roaringCreateLeaf(r);
+    r->root = r->head;
+    r->level = 1;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    roaringFreeNode(r->root,r->level);
+    zfree(r);
+}
+
+/* Add 'value' to the set. Returns 1 if it was added, 0 if it was already
+ * a member. */
+int roaringAdd(roaring *r, int64_t value) {
+    roaringPathItem path[ROARING_MAXLEVEL+1];
+    uint64_t u = roaringBias(value), key = u>>16;
+    roaringLeaf *leaf = roaringDescend(r,key,path);
+    uint32_t pos = roaringLeafSearch(leaf,key);
+    int l;
+
+    if (pos < leaf->count && leaf->c[pos].key == key) {
+        size_t bytes = containerDataSize(leaf->c+pos);
+
+        if (!containerAdd(leaf->c+pos,u&0xffff)) return 0;
+        r->bytes += containerDataSize(leaf->c+pos) - bytes;
+        for (l = 2; l <= r->level; l++)
+            path[l].node->card[path[l].idx]++;
+    } else {
+        roaringContainer c;
+
+        c.key = key;
+        c.card = c.len = c.cap = 0;
+        c.type = ROARING_ARRAY;
+        c.data = NULL;
+        containerAdd(&c,u&0xffff);
+        roaringInsertContainer(r,leaf,pos,&c,path);
+    }
+    r->card++;
+    return 1;
+}
+
+/* Remove 'value' from the set. Returns 1 if it was removed, 0 if it was not
+ * a member. */
+int roaringRemove(roaring *r, int64_t value) {
+    roaringPathItem path[ROARING_MAXLEVEL+1];
+    uint64_t u = roaringBias(value), key = u>>16;
+    roaringLeaf *leaf = roaringDescend(r,key,path);
+    uint32_t pos = roaringLeafSearch(leaf,key);
+    size_t bytes;
+    int l;
+
+    if (pos == leaf->count || leaf->c[pos].key != key) return 0;
+    bytes = containerDataSize(leaf->c+pos);
+    if (!containerRemove(leaf->c+pos,u&0xffff)) return 0;
+    r->bytes += containerDataSize(leaf->c+pos) - bytes;
+    for (l = 2; l <= r->level; l++)
+        path[l].node->card[path[l].idx]--;
+    if (leaf->c[pos].card == 0) roaringDeleteContainer(r,leaf,pos,path);
+    r->card--;
+    return 1;
+}
+
+int roaringContains(const roaring *r, int64_t value) {
+    uint64_t u = roaringBias(value);
+    roaringContainer *c = roaringFind(r,u>>16);
+
+    return c && containerContains(c,u&0xffff);
+}
+
+uint64_t roaringCard(const roaring *r) {
+    return r->card;
+}
+
+/* Return a random 64 bit number. */
+static uint64_t roaringRand64(void) {
+    return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ rand();
+}
+
+/* Return a random element of a non empty set, selecting it by rank so that
+ * every element has the same probability. The container holding the rank
+ * is found descending the tree with the element counts of the inner
+ * nodes. */
+int64_t roaringRandom(const roaring *r) {
+    uint64_t rank = roaringRand64() % r->card;
+    const roaringLeaf *leaf;
+    void *node = r->root;
+    uint32_t j;
+    int l;
+
+    for (l = r->level; l > 1; l--) {
+        roaringInner *inner = node;
+
+        for (j = 0; rank >= inner->card[j]; j++) rank -= inner->card[j];
+        node = inner->child[j];
+    }
+    leaf = node;
+    for (j = 0; rank >= leaf->c[j].card; j++) rank -= leaf->c[j].card;
+    return roaringValue(leaf->c+j,containerSelect(leaf->c+j,rank));
+}
+
+/* Return the bytes of memory used by the set, in constant time. */
+size_t roaringMemUsage(const roaring *r) {
+    return sizeof(*r) + r->leaves*sizeof(roaringLeaf) +
+           r->inners*sizeof(roaringInner) + r->bytes;
+}
+
+/* Intersect the containers in 'cs', all with the same key, returning the
+ * result into a new container 'dst', that may be empty. */
+static void containerIntersect(roaringContainer **cs, int num,
+                               roaringContainer *dst) {
+    int j, smallest = 0, allbitmaps = 1;
+
+    for (j = 0; j < num; j++) {
+        if (cs[j]->type != ROARING_BITMAP) allbitmaps = 0;
+        if (cs[j]->card < cs[smallest]->card) smallest = j;
+    }
+
+    if (allbitmaps) {
+        uint64_t *words = zmalloc(ROARING_BITMAP_BYTES);
+        uint32_t w, card = 0;
+
+        memcpy(words,cs[0]->data,ROARING_BITMAP_BYTES);
+        for (w = 0; w < ROARING_BITMAP_WORDS; w++) {
+            for (j = 1; j < num; j++) words[w] &= ((uint64_t*)cs[j]->data)[w];
+            card += __builtin_popcountll(words[w]);
+        }
+        dst->type = ROARING_BITMAP;
+        dst->data = words;
+        dst->card = card;
+        dst->len = dst->cap = 0;
+    } else {
+        /* Check every value of the smallest container against the others.
+         * The result can't be bigger than the smallest container. */
+        roaringContainer *small = cs[smallest], tmp;
+        uint16_t *a = zmalloc(sizeof(uint16_t)*small->card), *values;
+        uint32_t i, n = 0;
+
+        /* Work on the sorted values of the smallest container, converting
+         * a copy of it when it is not an array. */
+        tmp = *small;
+        if (small->type != ROARING_ARRAY) {
+            tmp.data = zmalloc(containerDataSize(small));
+            memcpy(tmp.data,small->data,containerDataSize(small));
+            containerToArray(&tmp);
+        }
+        values = tmp.data;
+        for (i = 0; i < small->card; i++) {
+            for (j = 0; j < num; j++)
+                if (j != smallest && !containerContains(cs[j],values[i]))
+                    break;
+            if (j == num) a[n++] = values[i];
+        }
+        if (tmp.data != small->data) zfree(tmp.data);
+        dst->type = ROARING_ARRAY;
+        dst->data = a;
+        dst->card = dst->len = dst->cap = n;
+    }
+    if (dst->card) containerOptimize(dst,0);
+}
+
+/* Return a new set with the elements that are members of all the 'num'
+ * sets. Containers are intersected only when all the sets have a container
+ * with the same key, and bitmap containers are intersected a word at a
+ * time. */
+roaring *roaringIntersect(roaring **sets, int num) {
+    roaring *res = roaringNew(), *small = sets[0];
+    roaringContainer **cs = zmalloc(sizeof(roaringContainer*)*num);
+    const roaringLeaf *leaf;
+    uint32_t i;
+    int j;
+
+    for (j = 1; j < num; j++)
+        if (sets[j]->len < small->len) small = sets[j];
+
+    for (leaf = small->head; leaf; leaf = leaf->next) {
+        for (i = 0; i < leaf->count; i++) {
+            uint64_t key = leaf->c[i].key;
+            roaringContainer dst;
+
+            for (j = 0; j < num; j++)
+                if ((cs[j] = roaringFind(sets[j],key)) == NULL) break;
+            if (j != num) continue;
+            dst.key = key;
+            containerIntersect(cs,num,&dst);
+            if (dst.card == 0) {
+                containerFree(&dst);
+                continue;
+            }
+            roaringAppendContainer(res,&dst);
+            res->card += dst.card;
+        }
+    }
+    zfree(cs);
+    return res;
+}
+
+/* -------------------------------- Iterator -------------------------------- */
+
+void roaringInitIterator(roaringIterator *it, const roaring *r) {
+    it->r = r;
+    it->leaf = r->head;
+    it->ci = 0;
+    it->pos = 0;
+    it->off = 0;
+}
+
+/* Position the iterator at the first element >= 'value'. */
+void roaringIteratorSeek(roaringIterator *it, int64_t value) {
+    uint64_t u = roaringBias(value), key = u>>16;
+    uint16_t low = u&0xffff;
+    const roaringContainer *c;
+
+    it->leaf = roaringDescend(it->r,key,NULL);
+    it->ci = roaringLeafSearch(it->leaf,key);
+    it->pos = it->off = 0;
+    if (it->ci == it->leaf->count || it->leaf->c[it->ci].key != key) return;
+    c = it->leaf->c+it->ci;
+    if (c->type == ROARING_ARRAY) {
+        arraySearch(c->data,c->len,low,&it->pos);
+    } else if (c->type == ROARING_BITMAP) {
+        it->pos = low;
+    } else {
+        int32_t i = runSearch(c->data,c->len,low);
+        if (i == -1) return;
+        if (low <= runLast((uint16_t*)c->data,i)) {
+            it->pos = i;
+            it->off = low-runStart((uint16_t*)c->data,i);
+        } else {
+            it->pos = i+1;
+        }
+    }
+}
+
+/* Store the next element in '*value' and return 1, or return 0 when there
+ * are no more elements. Elements are returned in ascending order. */
+int roaringNext(roaringIterator *it, int64_t *value) {
+    while(it->leaf) {
+        const roaringContainer *c;
+
+        if (it->ci == it->leaf->count) {
+            it->leaf = it->leaf->next;
+            it->ci = 0;
+            continue;
+        }
+        c = it->leaf->c+it->ci;
+        if (c->type == ROARING_ARRAY) {
+            if (it->pos < c->len) {
+                *value = roaringValue(c,((uint16_t*)c->data)[it->pos++]);
+                return 1;
+            }
+        } else if (c->type == ROARING_BITMAP) {
+            const uint64_t *words = c->data;
+            while(it->pos < 65536) {
+                uint64_t w = words[it->pos>>6] >> (it->pos&63);
+                if (w) {
+                    it->pos += __builtin_ctzll(w);
+                    *value = roaringValue(c,it->pos);
+                    it->pos++;
+                    return 1;
+                }
+                it->pos = (it->pos|63)+1;
+            }
+        } else {
+            const uint16_t *runs = c->data;
+            if (it->pos < c->len) {
+                *value = roaringValue(c,runs[it->pos*2]+it->off);
+                if (it->off++ == runs[it->pos*2+1]) {
+                    it->pos++;
+                    it->off = 0;
+                }
+                return 1;
+            }
+        }
+        it->ci++;
+        it->pos = it->off = 0;
+    }
+    return 0;
+}
+
+/* ----------------------------- Serialization ------------------------------ */
+
+/* The serialized format is, with all the integers in little endian:
+ *
+ * <containers:uint32>
+ * for every container:
+ *   <key:uint64><type:uint8><card:uint32><len:uint32><payload>
+ *
+ * Where the payload is 'len' uint16 values for ARRAY containers, 'len'
+ * pairs of uint16 for RUN containers, and 1024 uint64 words for BITMAP
+ * containers. */
+
+#define ROARING_HDR_SIZE 4
+#define ROARING_CONTAINER_HDR_SIZE 17
+
+static size_t containerPayloadSize(const roaringContainer *c) {
+    if (c->type == ROARING_ARRAY) return (size_t)c->len*2;
+    if (c->type == ROARING_BITMAP) return ROARING_BITMAP_BYTES;
+    return (size_t)c->len*4;
+}
+
+/* Serialize a container at 'p', returning the pointer to the next byte. */
+static unsigned char *containerSerialize(const roaringContainer *c,
+                                         unsigned char *p)
+{
+    size_t payload = containerPayloadSize(c), k;
+    uint32_t v32;
+    uint64_t v64;
+
+    v64 = intrev64ifbe(c->key);
+    memcpy(p,&v64,8); p += 8;
+    *p++ = c->type;
+    v32 = intrev32ifbe(c->card);
+    memcpy(p,&v32,4); p += 4;
+    v32 = intrev32ifbe(c->len);
+    memcpy(p,&v32,4); p += 4;
+    memcpy(p,c->data,payload);
+#if (BYTE_ORDER == BIG_ENDIAN)
+    if (c->type == ROARING_BITMAP) {
+        for (k = 0; k < payload; k += 8) memrev64(p+k);
+    } else {
+        for (k = 0; k < payload; k += 2) memrev16(p+k);
+    }
+#else
+    (void)k;
+#endif
+    return p+payload;
+}
+
+unsigned char *roaringSerialize(const roaring *r, size_t *len) {
+    const roaringLeaf *leaf;
+    size_t size = ROARING_HDR_SIZE;
+    unsigned char *buf, *p;
+    uint32_t j, v32;
+
+    for (leaf = r->head; leaf; leaf = leaf->next)
+        for (j = 0; j < leaf->count; j++)
+            size += ROARING_CONTAINER_HDR_SIZE+containerPayloadSize(leaf->c+j);
+    p = buf = zmalloc(size);
+
+    v32 = intrev32ifbe(r->len);
+    memcpy(p,&v32,4); p += 4;
+    for (leaf = r->head; leaf; leaf = leaf->next)
+        for (j = 0; j < leaf->count; j++) p = containerSerialize(leaf->c+j,p);
+    *len = size;
+    return buf;
+}
+
+/* Validate the content of a deserialized container. */
+static int containerIsValid(const roaringContainer *c) {
+    uint32_t j, card = 0;
+
+    if (c->card == 0 || c->card > 65536) return 0;
+    if (c->type == ROARING_ARRAY) {
+        const uint16_t *a = c->data;
+        if (c->len != c->card || c->len > ROARING_ARRAY_MAX) return 0;
+        for (j = 1; j < c->len; j++) if (a[j] <= a[j-1]) return 0;
+    } else if (c->type == ROARING_BITMAP) {
+        const uint64_t *words = c->data;
+        for (j = 0; j < ROARING_BITMAP_WORDS; j++)
+            card += __builtin_popcountll(words[j]);
+        if (card != c->card) return 0;
+    } else {
+        const uint16_t *runs = c->data;
+        if (c->len == 0) return 0;
+        for (j = 0; j < c->len; j++) {
+            if (runLast(runs,j) > 65535) return 0;
+            if (j && runStart(runs,j) <= runLast(runs,j-1)+1) return 0;
+            card += (uint32_t)runs[j*2+1]+1;
+        }
+        if (card != c->card) return 0;
+    }
+    return 1;
+}
+
+/* Load a set serialized by roaringSerialize(). Returns NULL if the buffer
+ * is not a valid serialized set. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *p = buf, *end = buf+len;
+    roaring *r;
+    uint32_t count, j, v32;
+    uint64_t v64, prevkey = 0;
+
+    if (len < ROARING_HDR_SIZE) return NULL;
+    memcpy(&v32,p,4); p += 4;
+    count = intrev32ifbe(v32);
+    if (count > (len-ROARING_HDR_SIZE)/ROARING_CONTAINER_HDR_SIZE) return NULL;
+
+    r = roaringNew();
+    for (j = 0; j < count; j++) {
+        roaringContainer c;
+        size_t payload;
+
+        if (end-p < ROARING_CONTAINER_HDR_SIZE) goto err;
+        memcpy(&v64,p,8); p += 8;
+        c.key = intrev64ifbe(v64);
+        c.type = *p++;
+        memcpy(&v32,p,4); p += 4;
+        c.card = intrev32ifbe(v32);
+        memcpy(&v32,p,4); p += 4;
+        c.len = c.cap = intrev32ifbe(v32);
+        if (c.type > ROARING_RUN || c.len > 65536 ||
+            c.key >= (1ULL<<48) || (j && c.key <= prevkey)) goto err;
+        payload = containerPayloadSize(&c);
+        if ((size_t)(end-p) < payload) goto err;
+        c.data = zmalloc(payload ? payload : 1);
+        memcpy(c.data,p,payload);
+#if (BYTE_ORDER == BIG_ENDIAN)
+        {
+            size_t k;
+            unsigned char *d = c.data;
+            if (c.type == ROARING_BITMAP) {
+                for (k = 0; k < payload; k += 8) memrev64(d+k);
+            } else {
+                for (k = 0; k < payload; k += 2) memrev16(d+k);
+            }
+        }
+#endif
+        p += payload;
+        if (!containerIsValid(&c)) {
+            containerFree(&c);
+            goto err;
+        }
+        roaringAppendContainer(r,&c);
+        r->card += c.card;
+        prevkey = c.key;
+    }
+    if (p != end) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+#define assert(_e) ((_e)?(void)0:(_roaringAssert(#_e,__FILE__,__LINE__),exit(1)))
+static void _roaringAssert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static long long roaringUsec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Check the counts and the key order of the subtree at 'node', returning
+ * the number of elements under it. */
+static uint64_t roaringCheckNode(roaring *r, void *node, int level,
+                                 roaringLeaf **prev, uint32_t *containers,
+                                 size_t *bytes) {
+    uint64_t card = 0;
+    uint32_t j;
+
+    if (level == 1) {
+        roaringLeaf *leaf = node;
+        assert(leaf->prev == *prev);
+        assert(leaf->count || node == r->root);
+        for (j = 0; j < leaf->count; j++) {
+            assert(leaf->c[j].card);
+            assert(j == 0 || leaf->c[j].key > leaf->c[j-1].key);
+            assert(*prev == NULL || j || leaf->c[0].key >
+                   (*prev)->c[(*prev)->count-1].key);
+            card += leaf->c[j].card;
+            *bytes += containerDataSize(leaf->c+j);
+        }
+        *containers += leaf->count;
+        *prev = leaf;
+    } else {
+        roaringInner *inner = node;
+        assert(inner->count > 1 || node != r->root);
+        for (j = 0; j < inner->count; j++) {
+            roaringLeaf *first = *prev ? (*prev)->next : r->head;
+            assert(roaringCheckNode(r,inner->child[j],level-1,prev,
+                                    containers,bytes) == inner->card[j]);
+            assert(j == 0 || inner->key[j] <= first->c[0].key);
+            assert(j == 0 || inner->key[j] > first->prev->c[first->prev->count-1].key);
+            card += inner->card[j];
+        }
+    }
+    return card;
+}
+
+static void roaringCheckTree(roaring *r) {
+    roaringLeaf *last = NULL;
+    uint32_t containers = 0;
+    size_t bytes = 0;
+
+    assert(roaringCheckNode(r,r->root,r->level,&last,&containers,&bytes) ==
+           r->card);
+    assert(last == r->tail && last->next == NULL);
+    assert(containers == r->len);
+    assert(bytes == r->bytes);
+}
+
+/* Check that the set contains exactly the elements flagged in 'ref', that
+ * are the values from 'base' to 'base+len-1', iterating in order. */
+static void roaringCheck(roaring *r, int64_t base, const char *ref, int len) {
+    roaringIterator it;
+    int64_t v, prev = 0;
+    uint64_t count = 0;
+    int j, first = 1;
+
+    roaringCheckTree(r);
+    for (j = 0; j < len; j++) assert(roaringContains(r,base+j) == ref[j]);
+    roaringInitIterator(&it,r);
+    while(roaringNext(&it,&v)) {
+        assert(first || v > prev);
+        assert(v >= base && v < base+len && ref[v-base]);
+        prev = v;
+        first = 0;
+        count++;
+    }
+    assert(count == roaringCard(r));
+}
+
+#define UNUSED(x) (void)(x)
+int roaringTest(int argc, char **argv) {
+    roaring *r;
+    int j;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Add, remove and containers conversions: "); {
+        int len = 300000;
+        int64_t base = -100000;
+        char *ref = zcalloc(len);
+
+        r = roaringNew();
+        /* A dense range (bitmap / run), a sparse range (array), a full
+         * range (run), random adds and removes everywhere. */
+        for (j = 0; j < 60000; j++) { roaringAdd(r,base+j); ref[j] = 1; }
+        for (j = 100000; j < 200000; j += 37) { roaringAdd(r,base+j); ref[j] = 1; }
+        for (j = 200000; j < 265536; j++) { roaringAdd(r,base+j); ref[j] = 1; }
+        roaringCheck(r,base,ref,len);
+        for (j = 0; j < 200000; j++) {
+            int k = rand() % len;
+            if (rand() % 2) {
+                assert(roaringAdd(r,base+k) == !ref[k]);
+                ref[k] = 1;
+            } else {
+                assert(roaringRemove(r,base+k) == ref[k]);
+                ref[k] = 0;
+            }
+        }
+        roaringCheck(r,base,ref,len);
+        for (j = 0; j < len; j++) if (ref[j]) roaringRemove(r,base+j);
+        assert(roaringCard(r) == 0 && r->len == 0);
+        roaringFree(r);
+        zfree(ref);
+        printf("OK\n");
+    }
+
+    printf("Random elements are uniformly distributed: "); {
+        int hits = 0;
+
+        /* A full container and a container with a single element. */
+        r = roaringNew();
+        for (j = 0; j < 65536; j++) roaringAdd(r,j);
+        roaringAdd(r,1000000);
+        for (j = 0; j < 100000; j++) {
+            int64_t v = roaringRandom(r);
+            assert(roaringContains(r,v));
+            if (v == 1000000) hits++;
+        }
+        assert(hits < 50); /* Expected ~1.5. */
+        roaringRemove(r,1000000);
+        for (j = 0; j < 1000; j++) assert(roaringRandom(r) < 65536);
+        roaringFree(r);
+        printf("OK\n");
+    }
+
+    printf("Sparse sets: "); {
+        int len = 2000000, n = 0;
+        int64_t base = -1000000LL*65536;
+        char *ref = zcalloc(len);
+        long long start = roaringUsec();
+
+        /* One element per container, added and removed in random order:
+         * containers are created and deleted in the middle of the tree. */
+        r = roaringNew();
+        for (j = 0; j < 1000000; j++) {
+            int k = rand() % len;
+            assert(roaringAdd(r,base+(int64_t)k*65536) == !ref[k]);
+            n += !ref[k];
+            ref[k] = 1;
+        }
+        assert(roaringCard(r) == (uint64_t)n && r->len == (uint32_t)n);
+        roaringCheckTree(r);
+        for (j = 0; j < 1000000; j++) {
+            int64_t v = roaringRandom(r);
+            int k = (v-base)/65536;
+            assert(v == base+(int64_t)k*65536 && ref[k]);
+            if (j % 2) {
+                assert(roaringRemove(r,v));
+                ref[k] = 0;
+            }
+        }
+        roaringCheckTree(r);
+        for (j = 0; j < len; j++) {
+            assert(roaringContains(r,base+(int64_t)j*65536) == ref[j]);
+            if (ref[j]) assert(roaringRemove(r,base+(int64_t)j*65536));
+        }
+        assert(roaringCard(r) == 0 && r->len == 0 && r->level == 1);
+        roaringFree(r);
+        zfree(ref);
+        printf("OK, %lldusec\n",roaringUsec()-start);
+    }
+
+    printf("Extreme values and seek: "); {
+        roaringIterator it;
+        int64_t v;
+
+        r = roaringNew();
+        roaringAdd(r,INT64_MAX);
+        roaringAdd(r,INT64_MIN);
+        roaringAdd(r,0);
+        roaringAdd(r,-1);
+        roaringInitIterator(&it,r);
+        assert(roaringNext(&it,&v) && v == INT64_MIN);
+        assert(roaringNext(&it,&v) && v == -1);
+        assert(roaringNext(&it,&v) && v == 0);
+        assert(roaringNext(&it,&v) && v == INT64_MAX);
+        assert(!roaringNext(&it,&v));
+        roaringIteratorSeek(&it,-5);
+        assert(roaringNext(&it,&v) && v == -1);
+        roaringIteratorSeek(&it,1);
+        assert(roaringNext(&it,&v) && v == INT64_MAX);
+        roaringFree(r);
+        printf("OK\n");
+    }
+
+    printf("Serialization: "); {
+        unsigned char *buf;
+        size_t len;
+        roaring *copy;
+        roaringIterator i1, i2;
+        int64_t v1, v2;
+
+        r = roaringNew();
+        for (j = 0; j < 100000; j++) roaringAdd(r,j);           /* run */
+        for (j = 0; j < 10000; j++) roaringAdd(r,rand());       /* arrays */
+        for (j = 0; j < 65536; j += 2) roaringAdd(r,1000000+j); /* bitmap */
+        buf = roaringSerialize(r,&len);
+        copy = roaringDeserialize(buf,len);
+        assert(copy != NULL && roaringCard(copy) == roaringCard(r));
+        roaringInitIterator(&i1,r);
+        roaringInitIterator(&i2,copy);
+        while(roaringNext(&i1,&v1)) assert(roaringNext(&i2,&v2) && v1 == v2);
+        assert(roaringDeserialize(buf,len-1) == NULL);
+        buf[4+8] = 7; /* Invalid type of the first container. */
+        assert(roaringDeserialize(buf,len) == NULL);
+        zfree(buf);
+        roaringFree(copy);
+        roaringFree(r);
+        printf("OK\n");
+    }
+
+    printf("Intersection: "); {
+        roaring *sets[3], *inter;
+        int64_t v;
+        roaringIterator it;
+        uint64_t count = 0;
+
+        for (j = 0; j < 3; j++) sets[j] = roaringNew();
+        for (j = 0; j < 500000; j++) {
+            roaringAdd(sets[0],j);
+            if (j % 3 == 0) roaringAdd(sets[1],j);
+            if (j % 5 == 0 || (j > 200000 && j < 300000)) roaringAdd(sets[2],j);
+        }
+        inter = roaringIntersect(sets,3);
+        for (j = 0; j < 500000; j++) {
+            int expected = j % 3 == 0 && (j % 5 == 0 || (j > 200000 && j < 300000));
+            assert(roaringContains(inter,j) == expected);
+            count += expected;
+        }
+        assert(roaringCard(inter) == count);
+        roaringInitIterator(&it,inter);
+        count = 0;
+        while(roaringNext(&it,&v)) count++;
+        assert(roaringCard(inter) == count);
+        roaringFree(inter);
+
+        /* The intersection of a single set is a copy of the set. */
+        inter = roaringIntersect(sets,1);
+        roaringInitIterator(&it,inter);
+        count = 0;
+        while(roaringNext(&it,&v)) count++;
+        assert(count == 500000 && roaringCard(inter) == count);
+        roaringFree(inter);
+        for (j = 0; j < 3; j++) roaringFree(sets[j]);
+        printf("OK\n");
+    }
+
+    printf("Memory usage of 1M integers: "); {
+        long long start = roaringUsec();
+        r = roaringNew();
+        for (j = 0; j < 1000000; j++) roaringAdd(r,j*3);
+        printf("sequential (step 3) %zu bytes, ",roaringMemUsage(r));
+        roaringFree(r);
+        r = roaringNew();
+        for (j = 0; j < 1000000; j++) roaringAdd(r,rand() % 100000000);
+        printf("random %zu bytes, %lldusec\n",roaringMemUsage(r),
+            roaringUsec()-start);
+        roaringFree(r);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Container types. */
+#define ROARING_ARRAY 0     /* Sorted array of 16 bit values. */
+#define ROARING_BITMAP 1    /* Bitmap of 65536 bits. */
+#define ROARING_RUN 2       /* Sorted array of (start,length-1) runs. */
+
+/* A container holds all the elements sharing the same 48 high bits. */
+typedef struct roaringContainer {
+    uint64_t key;       /* High 48 bits of the (biased) elements. */
+    uint32_t card;      /* Number of elements, from 1 to 65536. */
+    uint32_t len;       /* ARRAY: number of values, RUN: number of runs. */
+    uint32_t cap;       /* ARRAY: allocated values, RUN: allocated runs. */
+    uint8_t type;
+    void *data;
+} roaringContainer;
+
+/* Containers are stored in a counted B+tree keyed by container key, so that
+ * creating or removing a container, and finding the element with a given
+ * rank, are O(log(N)) in the number of containers. Leaves and inner nodes
+ * are sized to fill a 1k allocation. */
+#define ROARING_LEAF_CAP 31
+#define ROARING_INNER_CAP 42
+#define ROARING_MAXLEVEL 32
+
+typedef struct roaringLeaf {
+    struct roaringLeaf *prev, *next;
+    uint32_t count;
+    roaringContainer c[ROARING_LEAF_CAP];   /* Containers sorted by key. */
+} roaringLeaf;
+
+typedef struct roaringInner {
+    uint32_t count;
+    uint64_t key[ROARING_INNER_CAP];    /* Lower bound of the keys under
+                                           every child but the first. */
+    uint64_t card[ROARING_INNER_CAP];   /* Elements under every child. */
+    void *child[ROARING_INNER_CAP];
+} roaringInner;
+
+typedef struct roaring {
+    uint64_t card;      /* Total number of elements. */
+    uint32_t len;       /* Number of containers. */
+    uint32_t leaves, inners; /* Number of nodes, for memory usage. */
+    size_t bytes;       /* Data of the containers, for memory usage. */
+    int level;          /* 1 when the root is a leaf. */
+    void *root;
+    roaringLeaf *head, *tail;
+} roaring;
+
+typedef struct roaringIterator {
+    const roaring *r;
+    const roaringLeaf *leaf; /* Current leaf, NULL when done. */
+    uint32_t ci;        /* Current container inside the leaf. */
+    uint32_t pos;       /* ARRAY: index, BITMAP: bit, RUN: run index. */
+    uint32_t off;       /* RUN: offset inside the current run. */
+} roaringIterator;
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringContains(const roaring *r, int64_t value);
+uint64_t roaringCard(const roaring *r);
+int64_t roaringRandom(const roaring *r);
+roaring *roaringIntersect(roaring **sets, int num);
+size_t roaringMemUsage(const roaring *r);
+void roaringInitIterator(roaringIterator *it, const roaring *r);
+void roaringIteratorSeek(roaringIterator *it, int64_t value);
+int roaringNext(roaringIterator *it, int64_t *value);
+unsigned char *roaringSerialize(const roaring *r, size_t *len);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif /* __ROARING_H */
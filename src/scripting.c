@@ -191,15 +191,197 @@ char *redisProtocolToLuaType_MultiBulk(lua_State *lua, char *reply) {
         lua_pushboolean(lua,0);
         return p;
     }
-    lua_newtable(lua);
+    /* Size the array part upfront and fill it with raw sets, the table is
+     * fresh so there is no metatable to honor. */
+    lua_createtable(lua,mbulklen,0);
     for (j = 0; j < mbulklen; j++) {
-        lua_pushnumber(lua,j+1);
         p = redisProtocolToLuaType(lua,p);
-        lua_settable(lua,-3);
+        lua_rawseti(lua,-2,j+1);
     }
     return p;
 }
 
+/* ---------------------------------------------------------------------------
+ * Direct reply path of redis.call().
+ *
+ * While a command called from Lua runs, the reply functions of networking.c
+ * hand the common reply types (status, error, integer, bulk, null and arrays
+ * of known length) to the functions below, that push them on the Lua stack
+ * without generating any protocol. Arrays are pre-sized tables that stay on
+ * the stack while their elements are stored into them.
+ *
+ * As soon as a reply is emitted in a way we don't handle directly (for
+ * instance deferred lengths, or a bulk written in multiple pieces), the
+ * direct path is switched off for the rest of the call: the protocol is
+ * accumulated in the server.lua_reply arena as usual and converted by
+ * luaDirectReplyEnd(), that stores the values into the arrays still open.
+ * This is always correct since the direct path only consumes whole values
+ * or array headers, so the arena always starts at a value boundary.
+ * ------------------------------------------------------------------------- */
+
+#define LUA_DIRECT_REPLY_MAX_DEPTH 8
+
+static struct luaDirectReply {
+    int active; /* Push replies on the Lua stack directly? */
+    int type;   /* RESP type of the top level reply, '_' for nulls, or 0. */
+    int values; /* Number of top level values pushed. */
+    int depth;  /* Number of arrays still waiting for elements. */
+    struct {
+        long len;   /* Number of elements of the array. */
+        long count; /* Elements stored so far. */
+    } arrays[LUA_DIRECT_REPLY_MAX_DEPTH];
+} luaDirect;
+
+/* Store the value at the top of the Lua stack into the innermost open
+ * array, closing the arrays that are complete. Like the protocol parser,
+ * only the first top level value is retained. */
+static void luaDirectReplyStore(lua_State *lua) {
+    while (luaDirect.depth) {
+        long *count = &luaDirect.arrays[luaDirect.depth-1].count;
+
+        lua_rawseti(lua,-2,++*count);
+        if (*count < luaDirect.arrays[luaDirect.depth-1].len) return;
+        luaDirect.depth--; /* The array is complete, store it as well. */
+    }
+    if (luaDirect.values++) lua_pop(lua,1);
+}
+
+/* Return C_ERR to the caller, that will emit the protocol for the reply
+ * instead, after turning off the direct path for the rest of the call. */
+int luaDirectReplyStop(void) {
+    luaDirect.active = 0;
+    return C_ERR;
+}
+
+static int luaDirectReplyArray(long len) {
+    if (luaDirect.depth == LUA_DIRECT_REPLY_MAX_DEPTH)
+        return luaDirectReplyStop();
+    if (!luaDirect.type) luaDirect.type = '*';
+    lua_createtable(server.lua,len,0);
+    if (len == 0) {
+        luaDirectReplyStore(server.lua);
+    } else {
+        luaDirect.arrays[luaDirect.depth].len = len;
+        luaDirect.arrays[luaDirect.depth].count = 0;
+        luaDirect.depth++;
+    }
+    return C_OK;
+}
+
+/* Push the bulk string 's' on the Lua stack. */
+int luaDirectReplyBulk(const char *s, size_t len) {
+    if (!luaDirect.active) return C_ERR;
+    if (!luaDirect.type) luaDirect.type = '$';
+    lua_pushlstring(server.lua,s,len);
+    luaDirectReplyStore(server.lua);
+    return C_OK;
+}
+
+/* Push a status or error reply as a table with a single 'ok' or 'err'
+ * field. Errors without an explicit code get the "ERR " one, exactly like
+ * addReplyErrorLength() does, and as the protocol parser, the string is
+ * truncated at the first CR. */
+static int luaDirectReplyTable(const char *field, const char *s, size_t len,
+                               int type)
+{
+    char *cr;
+
+    if (!luaDirect.active) return C_ERR;
+    if (!luaDirect.type) luaDirect.type = type;
+    if ((cr = memchr(s,'\r',len)) != NULL) len = cr-s;
+    lua_newtable(server.lua);
+    lua_pushstring(server.lua,field);
+    if (type == '-' && (!len || s[0] != '-')) {
+        lua_pushstring(server.lua,"ERR ");
+        lua_pushlstring(server.lua,s,len);
+        lua_concat(server.lua,2);
+    } else if (type == '-') {
+        lua_pushlstring(server.lua,s+1,len-1);
+    } else {
+        lua_pushlstring(server.lua,s,len);
+    }
+    lua_settable(server.lua,-3);
+    luaDirectReplyStore(server.lua);
+    return C_OK;
+}
+
+int luaDirectReplyStatus(const char *s, size_t len) {
+    return luaDirectReplyTable("ok",s,len,'+');
+}
+
+int luaDirectReplyError(const char *s, size_t len) {
+    return luaDirectReplyTable("err",s,len,'-');
+}
+
+/* Called with every piece of protocol emitted by the Lua client. Pieces
+ * that are exactly one whole status, error, integer, bulk or null reply,
+ * or an array header, are consumed, which covers the shared objects like
+ * shared.ok or shared.czero, and the integer and multi bulk length helpers.
+ * Anything else stops the direct path. */
+int luaDirectReplyProto(const char *s, size_t len) {
+    const char *cr;
+    long long ll = 0;
+
+    if (!luaDirect.active) return C_ERR;
+    if (len < 3 || s[len-2] != '\r' || (cr = memchr(s,'\r',len)) == NULL)
+        return luaDirectReplyStop();
+
+    switch(s[0]) {
+    case '+': case '-': case ':':
+        if (cr != s+len-2) return luaDirectReplyStop();
+        break;
+    case '$': case '*':
+        /* Only bulks have a payload after the length. */
+        if (!string2ll(s+1,cr-s-1,&ll) || ll < -1 ||
+            len != (size_t)(cr-s)+2+((s[0] == '$' && ll >= 0) ? ll+2 : 0))
+            return luaDirectReplyStop();
+        if (s[0] == '*' && ll >= 0) return luaDirectReplyArray(ll);
+        break;
+    default:
+        return luaDirectReplyStop();
+    }
+    if (!luaDirect.type) luaDirect.type = (ll == -1) ? '_' : s[0];
+    redisProtocolToLuaType(server.lua,(char*)s);
+    luaDirectReplyStore(server.lua);
+    return C_OK;
+}
+
+/* Prepare the direct path for the execution of a command. The protocol is
+ * still needed when the debugger logs the replies. */
+static void luaDirectReplyBegin(lua_State *lua) {
+    luaDirect.active = !(ldb.active && ldb.step);
+    luaDirect.type = 0;
+    luaDirect.values = 0;
+    luaDirect.depth = 0;
+    lua_checkstack(lua,LUA_DIRECT_REPLY_MAX_DEPTH+LUA_MINSTACK);
+}
+
+/* Convert what is left in the arena after the direct path was stopped and
+ * return the RESP type of the reply, that is now at the top of the stack. */
+static int luaDirectReplyEnd(lua_State *lua) {
+    char *p = server.lua_reply, *end = p+sdslen(server.lua_reply);
+
+    luaDirect.active = 0;
+    if (!luaDirect.type && p != end) {
+        luaDirect.type = ((p[0] == '$' || p[0] == '*') && p[1] == '-') ?
+                         '_' : p[0];
+    }
+    while (p < end) {
+        char *next = redisProtocolToLuaType(lua,p);
+
+        if (next == p) break; /* Not a RESP2 type, nothing was pushed. */
+        luaDirectReplyStore(lua);
+        p = next;
+    }
+    /* Never leave arrays on the stack, even if a command emitted less
+     * elements than announced. */
+    while (luaDirect.depth) {
+        luaDirect.depth--;
+        luaDirectReplyStore(lua);
+    }
+    return luaDirect.type;
+}
+
 /* This function is used in order to push an error on the Lua stack in the
  * format used by redis.pcall to return errors, which is a lua table
  * with a single "err" field set to the error string. Note that this
@@ -282,7 +464,7 @@ void luaReplyToRedisReply(client *c, lua_State *lua) {
         addReplyBulkCBuffer(c,(char*)lua_tostring(lua,-1),lua_strlen(lua,-1));
         break;
     case LUA_TBOOLEAN:
-        addReply(c,lua_toboolean(lua,-1) ? shared.cone : shared.nullbulk);
+        addReply(c,lua_toboolean(lua,-1) ? shared.cone : shared.null[c->resp]);
         break;
     case LUA_TNUMBER:
         addReplyLongLong(c,(long long)lua_tonumber(lua,-1));
@@ -334,7 +516,7 @@ void luaReplyToRedisReply(client *c, lua_State *lua) {
         }
         break;
     default:
-        addReply(c,shared.nullbulk);
+        addReply(c,shared.null[c->resp]);
     }
     lua_pop(lua,1);
 }
@@ -345,11 +527,12 @@ void luaReplyToRedisReply(client *c, lua_State *lua) {
 
 #define LUA_CMD_OBJCACHE_SIZE 32
 #define LUA_CMD_OBJCACHE_MAX_LEN 64
+#define LUA_REPLY_ARENA_MAX_SIZE (1024*64)
 int luaRedisGenericCommand(lua_State *lua, int raise_error) {
     int j, argc = lua_gettop(lua);
     struct redisCommand *cmd;
     client *c = server.lua_client;
-    sds reply;
+    int reply_type;
 
     /* Cached across calls. */
     static robj **argv = NULL;
@@ -484,6 +667,14 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         goto cleanup;
     }
 
+    /* Scripts called with EVAL_RO / EVALSHA_RO promised not to write: this
+     * is what allows them to run on read-only replicas and to never be
+     * propagated. */
+    if (server.lua_readonly && (cmd->flags & CMD_WRITE)) {
+        luaPushError(lua, "Write commands are not allowed from read-only scripts");
+        goto cleanup;
+    }
+
     /* Write commands are forbidden against read-only slaves, or if a
      * command marked as non-deterministic was already called in the context
      * of this script. */
@@ -573,44 +764,35 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         if (server.lua_repl & PROPAGATE_REPL)
             call_flags |= CMD_CALL_PROPAGATE_REPL;
     }
+    luaDirectReplyBegin(lua);
     call(c,call_flags);
 
     /* Convert the result of the Redis command into a suitable Lua type.
-     * The first thing we need is to create a single string from the client
-     * output buffers. */
-    if (listLength(c->reply) == 0 && c->bufpos < PROTO_REPLY_CHUNK_BYTES) {
-        /* This is a fast path for the common case of a reply inside the
-         * client static buffer. Don't create an SDS string but just use
-         * the client buffer directly. */
-        c->buf[c->bufpos] = '\0';
-        reply = c->buf;
-        c->bufpos = 0;
-    } else {
-        reply = sdsnewlen(c->buf,c->bufpos);
-        c->bufpos = 0;
-        while(listLength(c->reply)) {
-            clientReplyBlock *o = listNodeValue(listFirst(c->reply));
-
-            reply = sdscatlen(reply,o->buf,o->used);
-            listDelNode(c->reply,listFirst(c->reply));
-        }
-    }
-    if (raise_error && reply[0] != '-') raise_error = 0;
-    redisProtocolToLuaType(lua,reply);
+     * Most replies were already pushed on the stack by the direct reply
+     * path, the rest is accumulated in the server.lua_reply arena, that we
+     * parse in place and reuse for the next call. */
+    reply_type = luaDirectReplyEnd(lua);
+    if (raise_error && reply_type != '-') raise_error = 0;
 
     /* If the debugger is active, log the reply from Redis. */
     if (ldb.active && ldb.step)
-        ldbLogRedisReply(reply);
+        ldbLogRedisReply(server.lua_reply);
 
     /* Sort the output array if needed, assuming it is a non-null multi bulk
      * reply as expected. */
     if ((cmd->flags & CMD_SORT_FOR_SCRIPT) &&
         (server.lua_replicate_commands == 0) &&
-        (reply[0] == '*' && reply[1] != '-')) {
+        reply_type == '*') {
             luaSortArray(lua);
     }
-    if (reply != c->buf) sdsfree(reply);
-    c->reply_bytes = 0;
+
+    /* Don't let a single huge reply pin the arena memory forever. */
+    if (sdsalloc(server.lua_reply) > LUA_REPLY_ARENA_MAX_SIZE) {
+        sdsfree(server.lua_reply);
+        server.lua_reply = sdsempty();
+    } else {
+        sdsclear(server.lua_reply);
+    }
 
 cleanup:
     /* Clean up. Command code may have changed argv/argc so we use the
@@ -920,6 +1102,7 @@ void scriptingInit(int setup) {
 
     if (setup) {
         server.lua_client = NULL;
+        server.lua_reply = sdsempty();
         server.lua_caller = NULL;
         server.lua_timedout = 0;
         ldbInit();
@@ -1160,37 +1343,13 @@ int redis_math_randomseed (lua_State *L) {
  * EVAL and SCRIPT commands implementation
  * ------------------------------------------------------------------------- */
 
-/* Define a Lua function with the specified body.
- * The function name will be generated in the following form:
- *
- *   f_<hex sha1 sum>
- *
- * The function increments the reference count of the 'body' object as a
- * side effect of a successful call.
- *
- * On success a pointer to an SDS string representing the function SHA1 of the
- * just added function is returned (and will be valid until the next call
- * to scriptingReset() function), otherwise NULL is returned.
- *
- * The function handles the fact of being called with a script that already
- * exists, and in such a case, it behaves like in the success case.
- *
- * If 'c' is not NULL, on error the client is informed with an appropriate
- * error describing the nature of the problem and the Lua interpreter error. */
-sds luaCreateFunction(client *c, lua_State *lua, robj *body) {
-    char funcname[43];
-    dictEntry *de;
-
-    funcname[0] = 'f';
-    funcname[1] = '_';
-    sha1hex(funcname+2,body->ptr,sdslen(body->ptr));
-
-    sds sha = sdsnewlen(funcname+2,40);
-    if ((de = dictFind(server.lua_scripts,sha)) != NULL) {
-        sdsfree(sha);
-        return dictGetKey(de);
-    }
-
+/* Compile the script 'body' defining the Lua function 'funcname' (that is
+ * f_<hex sha1 sum>) in the interpreter. Returns C_OK on success, otherwise
+ * C_ERR is returned and, if 'c' is not NULL, the client is informed with an
+ * appropriate error describing the nature of the problem and the Lua
+ * interpreter error. */
+int luaCompileFunction(client *c, lua_State *lua, char *funcname, robj *body) {
+    ustime_t start = ustime();
     sds funcdef = sdsempty();
     funcdef = sdscat(funcdef,"function ");
     funcdef = sdscatlen(funcdef,funcname,42);
@@ -1205,9 +1364,8 @@ sds luaCreateFunction(client *c, lua_State *lua, robj *body) {
                 lua_tostring(lua,-1));
         }
         lua_pop(lua,1);
-        sdsfree(sha);
         sdsfree(funcdef);
-        return NULL;
+        return C_ERR;
     }
     sdsfree(funcdef);
 
@@ -1217,20 +1375,89 @@ sds luaCreateFunction(client *c, lua_State *lua, robj *body) {
                 lua_tostring(lua,-1));
         }
         lua_pop(lua,1);
+        return C_ERR;
+    }
+    server.stat_lua_compiled_scripts++;
+    server.stat_lua_compile_time += ustime()-start;
+    return C_OK;
+}
+
+/* Add the script 'body' to the scripts cache without compiling it, so that
+ * EVALSHA and SCRIPT EXISTS know about it: the Lua function is compiled by
+ * evalGenericCommand() the first time the script is called. This is how the
+ * scripts saved in the RDB file are loaded, so that loading many scripts
+ * does not slow down the startup.
+ *
+ * The function increments the reference count of the 'body' object if the
+ * script was not already cached. Returns the SHA1 of the script, valid until
+ * the next call to scriptingReset(). */
+sds luaRegisterScript(robj *body) {
+    char hex[41];
+    dictEntry *de;
+
+    sha1hex(hex,body->ptr,sdslen(body->ptr));
+    sds sha = sdsnewlen(hex,40);
+    if ((de = dictFind(server.lua_scripts,sha)) != NULL) {
         sdsfree(sha);
-        return NULL;
+        return dictGetKey(de);
     }
 
     /* We also save a SHA1 -> Original script map in a dictionary
      * so that we can replicate / write in the AOF all the
      * EVALSHA commands as EVAL using the original script. */
     int retval = dictAdd(server.lua_scripts,sha,body);
-    serverAssertWithInfo(c ? c : server.lua_client,NULL,retval == DICT_OK);
+    serverAssertWithInfo(server.lua_client,NULL,retval == DICT_OK);
     server.lua_scripts_mem += sdsZmallocSize(sha) + getStringObjectSdsUsedMemory(body);
     incrRefCount(body);
     return sha;
 }
 
+/* Define a Lua function with the specified body.
+ * The function name will be generated in the following form:
+ *
+ *   f_<hex sha1 sum>
+ *
+ * The function increments the reference count of the 'body' object as a
+ * side effect of a successful call.
+ *
+ * On success a pointer to an SDS string representing the function SHA1 of the
+ * just added function is returned (and will be valid until the next call
+ * to scriptingReset() function), otherwise NULL is returned.
+ *
+ * The function handles the fact of being called with a script that already
+ * exists, and in such a case, it behaves like in the success case. A script
+ * registered by luaRegisterScript() but not compiled yet is compiled.
+ *
+ * If 'c' is not NULL, on error the client is informed with an appropriate
+ * error describing the nature of the problem and the Lua interpreter error. */
+sds luaCreateFunction(client *c, lua_State *lua, robj *body) {
+    char funcname[43];
+    dictEntry *de;
+
+    funcname[0] = 'f';
+    funcname[1] = '_';
+    sha1hex(funcname+2,body->ptr,sdslen(body->ptr));
+
+    sds sha = sdsnewlen(funcname+2,40);
+    de = dictFind(server.lua_scripts,sha);
+    sdsfree(sha);
+    if (de != NULL) {
+        /* Already cached: make sure it was compiled as well. */
+        lua_getglobal(lua,funcname);
+        int defined = !lua_isnil(lua,-1);
+        lua_pop(lua,1);
+        if (!defined &&
+            luaCompileFunction(c,lua,funcname,dictGetVal(de)) == C_ERR)
+        {
+            return NULL;
+        }
+        return dictGetKey(de);
+    }
+
+    if (luaCompileFunction(c,lua,funcname,body) == C_ERR) return NULL;
+    return luaRegisterScript(body);
+}
+
 /* This is the Lua script "count" hook that we use to detect scripts timeout. */
 void luaMaskCountHook(lua_State *lua, lua_Debug *ar) {
     long long elapsed = mstime() - server.lua_time_start;
@@ -1282,6 +1509,9 @@ void evalGenericCommand(client *c, int evalsha) {
     server.lua_multi_emitted = 0;
     server.lua_repl = PROPAGATE_AOF|PROPAGATE_REPL;
 
+    /* EVAL_RO and EVALSHA_RO are flagged as read only in the command table. */
+    server.lua_readonly = (c->cmd->flags & CMD_READONLY) != 0;
+
     /* Get the number of arguments that are keys */
     if (getLongLongFromObjectOrReply(c,c->argv[2],&numkeys,NULL) != C_OK)
         return;
@@ -1322,14 +1552,22 @@ void evalGenericCommand(client *c, int evalsha) {
     if (lua_isnil(lua,-1)) {
         lua_pop(lua,1); /* remove the nil from the stack */
         /* Function not defined... let's define it if we have the
-         * body of the function. If this is an EVALSHA call we can just
-         * return an error. */
+         * body of the function. If this is an EVALSHA call the body may
+         * still be in the scripts cache, loaded from the RDB file and not
+         * compiled yet, otherwise we can just return an error. */
+        robj *body = c->argv[1];
         if (evalsha) {
-            lua_pop(lua,1); /* remove the error handler from the stack. */
-            addReply(c, shared.noscripterr);
-            return;
+            sds sha = sdsnewlen(funcname+2,40);
+            dictEntry *de = dictFind(server.lua_scripts,sha);
+            sdsfree(sha);
+            if (de == NULL) {
+                lua_pop(lua,1); /* remove the error handler from the stack. */
+                addReply(c, shared.noscripterr);
+                return;
+            }
+            body = dictGetVal(de);
         }
-        if (luaCreateFunction(c,lua,c->argv[1]) == NULL) {
+        if (luaCreateFunction(c,lua,body) == NULL) {
             lua_pop(lua,1); /* remove the error handler from the stack. */
             /* The error is sent to the client by luaCreateFunction()
              * itself when it returns NULL. */
@@ -1434,7 +1672,7 @@ void evalGenericCommand(client *c, int evalsha) {
      * For repliation, everytime a new slave attaches to the master, we need to
      * flush our cache of scripts that can be replicated as EVALSHA, while
      * for AOF we need to do so every time we rewrite the AOF file. */
-    if (evalsha && !server.lua_replicate_commands) {
+    if (evalsha && !server.lua_replicate_commands && !server.lua_readonly) {
         if (!replicationScriptCacheExists(c->argv[1]->ptr)) {
             /* This script is not in our script cache, replicate it as
              * EVAL, then add it into the script cache, as from now on
@@ -1487,6 +1725,17 @@ void evalShaCommand(client *c) {
     }
 }
 
+/* EVAL_RO / EVALSHA_RO: same as EVAL / EVALSHA, but the script is refused
+ * any write command. Since such scripts can't change the dataset they are
+ * never propagated, and can be served by read-only replicas. */
+void evalRoCommand(client *c) {
+    evalCommand(c);
+}
+
+void evalShaRoCommand(client *c) {
+    evalShaCommand(c);
+}
+
 void scriptCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
         const char *help[] = {
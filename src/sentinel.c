@@ -3078,7 +3078,7 @@ void sentinelCommand(client *c) {
         if (c->argc != 3) goto numargserr;
         ri = sentinelGetMasterByName(c->argv[2]->ptr);
         if (ri == NULL) {
-            addReply(c,shared.nullmultibulk);
+            addReply(c,shared.nullarray[c->resp]);
         } else {
             sentinelAddr *addr = sentinelGetCurrentMasterAddress(ri);
 
@@ -3246,7 +3246,7 @@ void sentinelCommand(client *c) {
             if (ri->info)
                 addReplyBulkCBuffer(c,ri->info,sdslen(ri->info));
             else
-                addReply(c,shared.nullbulk);
+                addReply(c,shared.null[c->resp]);
 
             dictIterator *sdi;
             dictEntry *sde;
@@ -3258,7 +3258,7 @@ void sentinelCommand(client *c) {
                 if (sri->info)
                     addReplyBulkCBuffer(c,sri->info,sdslen(sri->info));
                 else
-                    addReply(c,shared.nullbulk);
+                    addReply(c,shared.null[c->resp]);
             }
             dictReleaseIterator(sdi);
         }
@@ -160,6 +160,8 @@ struct redisCommand redisCommandTable[] = {
         {"brpop",                brpopCommand,               -3, "ws",   0, NULL,               1, -2, 1, 0, 0},
         {"brpoplpush",           brpoplpushCommand,          4,  "wms",  0, NULL,               1, 2,  1, 0, 0},
         {"blpop",                blpopCommand,               -3, "ws",   0, NULL,               1, -2, 1, 0, 0},
+        {"lmpop",                lmpopCommand,               -4, "w",    0, lmpopGetKeys,       0, 0,  0, 0, 0},
+        {"blmpop",               blmpopCommand,              -5, "ws",   0, lmpopGetKeys,       0, 0,  0, 0, 0},
         {"llen",                 llenCommand,                2,  "rF",   0, NULL,               1, 1,  1, 0, 0},
         {"lindex",               lindexCommand,              3,  "r",    0, NULL,               1, 1,  1, 0, 0},
         {"lset",                 lsetCommand,                4,  "wm",   0, NULL,               1, 1,  1, 0, 0},
@@ -242,6 +244,7 @@ struct redisCommand redisCommandTable[] = {
         {"scan",                 scanCommand,                -2, "rR",   0, NULL,               0, 0,  0, 0, 0},
         {"dbsize",               dbsizeCommand,              1,  "rF",   0, NULL,               0, 0,  0, 0, 0},
         {"auth",                 authCommand,                2,  "sltF", 0, NULL,               0, 0,  0, 0, 0},
+        {"hello",                helloCommand,               -1, "sltF", 0, NULL,               0, 0,  0, 0, 0},
         {"ping",                 pingCommand,                -1, "tF",   0, NULL,               0, 0,  0, 0, 0},
         {"echo",                 echoCommand,                2,  "F",    0, NULL,               0, 0,  0, 0, 0},
         {"save",                 saveCommand,                1,  "as",   0, NULL,               0, 0,  0, 0, 0},
@@ -276,11 +279,15 @@ struct redisCommand redisCommandTable[] = {
         {"punsubscribe",         punsubscribeCommand,        -1, "pslt", 0, NULL,               0, 0,  0, 0, 0},
         {"publish",              publishCommand,             3,  "pltF", 0, NULL,               0, 0,  0, 0, 0},
         {"pubsub",               pubsubCommand,              -2, "pltR", 0, NULL,               0, 0,  0, 0, 0},
+        {"ssubscribe",           ssubscribeCommand,          -2, "rpslt", 0, NULL,              1, -1, 1, 0, 0},
+        {"sunsubscribe",         sunsubscribeCommand,        -1, "rpslt", 0, NULL,              1, -1, 1, 0, 0},
+        {"spublish",             spublishCommand,            3,  "pltF", 0, NULL,               1, 1,  1, 0, 0},
         {"watch",                watchCommand,               -2, "sF",   0, NULL,               1, -1, 1, 0, 0},
         {"unwatch",              unwatchCommand,             1,  "sF",   0, NULL,               0, 0,  0, 0, 0},
         {"cluster",              clusterCommand,             -2, "a",    0, NULL,               0, 0,  0, 0, 0},
         {"restore",              restoreCommand,             -4, "wm",   0, NULL,               1, 1,  1, 0, 0},
         {"restore-asking",       restoreCommand,             -4, "wmk",  0, NULL,               1, 1,  1, 0, 0},
+        {"restore-chunk",        restoreChunkCommand,        -4, "wmk",  0, NULL,               1, 1,  1, 0, 0},
         {"migrate",              migrateCommand,             -6, "wR",   0, migrateGetKeys,     0, 0,  0, 0, 0},
         {"asking",               askingCommand,              1,  "F",    0, NULL,               0, 0,  0, 0, 0},
         {"readonly",             readonlyCommand,            1,  "F",    0, NULL,               0, 0,  0, 0, 0},
@@ -291,6 +298,8 @@ struct redisCommand redisCommandTable[] = {
         {"client",               clientCommand,              -2, "as",   0, NULL,               0, 0,  0, 0, 0},
         {"eval",                 evalCommand,                -3, "s",    0, evalGetKeys,        0, 0,  0, 0, 0},
         {"evalsha",              evalShaCommand,             -3, "s",    0, evalGetKeys,        0, 0,  0, 0, 0},
+        {"eval_ro",              evalRoCommand,              -3, "rs",   0, evalGetKeys,        0, 0,  0, 0, 0},
+        {"evalsha_ro",           evalShaRoCommand,           -3, "rs",   0, evalGetKeys,        0, 0,  0, 0, 0},
         {"slowlog",              slowlogCommand,             -2, "aR",   0, NULL,               0, 0,  0, 0, 0},
         {"script",               scriptCommand,              -2, "s",    0, NULL,               0, 0,  0, 0, 0},
         {"time",                 timeCommand,                1,  "RF",   0, NULL,               0, 0,  0, 0, 0},
@@ -323,13 +332,15 @@ struct redisCommand redisCommandTable[] = {
         {"xack",                 xackCommand,                -4, "wF",   0, NULL,               1, 1,  1, 0, 0},
         {"xpending",             xpendingCommand,            -3, "rR",   0, NULL,               1, 1,  1, 0, 0},
         {"xclaim",               xclaimCommand,              -6, "wRF",  0, NULL,               1, 1,  1, 0, 0},
+        {"xautoclaim",           xautoclaimCommand,          -5, "wRF",  0, NULL,               1, 1,  1, 0, 0},
         {"xinfo",                xinfoCommand,               -2, "rR",   0, NULL,               2, 2,  1, 0, 0},
         {"xdel",                 xdelCommand,                -3, "wF",   0, NULL,               1, 1,  1, 0, 0},
         {"xtrim",                xtrimCommand,               -2, "wFR",  0, NULL,               1, 1,  1, 0, 0},
         {"post",                 securityWarningCommand,     -1, "lt",   0, NULL,               0, 0,  0, 0, 0},
         {"host:",                securityWarningCommand,     -1, "lt",   0, NULL,               0, 0,  0, 0, 0},
         {"latency",              latencyCommand,             -2, "aslt", 0, NULL,               0, 0,  0, 0, 0},
-        {"lolwut",               lolwutCommand,              -1, "r",    0, NULL,               0, 0,  0, 0, 0}
+        {"lolwut",               lolwutCommand,              -1, "r",    0, NULL,               0, 0,  0, 0, 0},
+        {"hotkeys",              hotkeysCommand,             -2, "aR",   0, NULL,               0, 0,  0, 0, 0}
 };
 
 /*============================ Utility functions ============================ */
@@ -563,6 +574,15 @@ uint64_t dictEncObjHash(const void *key) {
     }
 }
 
+/* Returns the size of the DB dict entry metadata in bytes. In cluster mode,
+ * the metadata is used for constructing a doubly linked list of the dict
+ * entries belonging to the same cluster slot. See the Slot to Key API in
+ * db.c. */
+size_t dictEntryMetadataSize(dict *d) {
+    UNUSED(d);
+    return server.cluster_enabled ? sizeof(clusterDictEntryMetadata) : 0;
+}
+
 /* Generic hash table type where keys are Redis Objects, Values
  * dummy pointers. */
 dictType objectKeyPointerValueDictType = {
@@ -613,7 +633,8 @@ dictType dbDictType = {
         NULL,                       /* val dup */
         dictSdsKeyCompare,          /* key compare */
         dictSdsDestructor,          /* key destructor */
-        dictObjectDestructor   /* val destructor */
+        dictObjectDestructor,       /* val destructor */
+        dictEntryMetadataSize       /* size of entry metadata in bytes */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -713,6 +734,18 @@ dictType migrateCacheDictType = {
         NULL                        /* val destructor */
 };
 
+/* Values being assembled by RESTORE-CHUNK (client->restore_chunks). Keys
+ * are "<dbid>:<key name>" sds strings, values are the partial Redis
+ * objects. */
+dictType restoreChunksDictType = {
+        dictSdsHash,                /* hash function */
+        NULL,                       /* key dup */
+        NULL,                       /* val dup */
+        dictSdsKeyCompare,          /* key compare */
+        dictSdsDestructor,          /* key destructor */
+        dictObjectDestructor        /* val destructor */
+};
+
 /* Replication cached script dict (server.repl_scriptcache_dict).
  * Keys are sds SHA1 strings, while values are not used at all in the current
  * implementation. */
@@ -1042,6 +1075,9 @@ void databasesCron(void) {
         }
     }
 
+    /* Evict keys in background if we are over the high watermark. */
+    backgroundEvictionCycle();
+
     /* Defrag keys gradually. */
     /** 内存碎片 */
     if (server.active_defrag_enabled)
@@ -1282,6 +1318,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /** 对数据库的周期处理 */
     databasesCron();
 
+    /* Keep the client side caching invalidation table under the configured
+     * size, evicting tracked keys if needed. */
+    trackingLimitUsedSlots();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     /** 没有RDB子进程和AOF子进程, 有延迟执行的BGSAVE命令和BGREWRITEAOF, 重写AOF文件 */
@@ -1452,6 +1492,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
+    /* Run a step of background eviction (returns ASAP if the memory used
+     * is under the watermarks). */
+    backgroundEvictionCycle();
+
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
     if (server.get_ack_from_slaves) {
@@ -1480,6 +1524,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
 
+    /* Send the invalidation messages to clients participating to the
+     * client side caching protocol in broadcasting (BCAST) mode. */
+    trackingBroadcastInvalidationMessages();
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
@@ -1512,9 +1560,22 @@ void createSharedObjects(void) {
     shared.czero = createObject(OBJ_STRING, sdsnew(":0\r\n"));
     shared.cone = createObject(OBJ_STRING, sdsnew(":1\r\n"));
     shared.cnegone = createObject(OBJ_STRING, sdsnew(":-1\r\n"));
-    shared.nullbulk = createObject(OBJ_STRING, sdsnew("$-1\r\n"));
-    shared.nullmultibulk = createObject(OBJ_STRING, sdsnew("*-1\r\n"));
     shared.emptymultibulk = createObject(OBJ_STRING, sdsnew("*0\r\n"));
+
+    /* Replies whose encoding depends on the protocol spoken by the client:
+     * the arrays are indexed by the client->resp protocol version. */
+    shared.null[0] = shared.null[1] = NULL;
+    shared.null[2] = createObject(OBJ_STRING, sdsnew("$-1\r\n"));
+    shared.null[3] = createObject(OBJ_STRING, sdsnew("_\r\n"));
+    shared.nullarray[0] = shared.nullarray[1] = NULL;
+    shared.nullarray[2] = createObject(OBJ_STRING, sdsnew("*-1\r\n"));
+    shared.nullarray[3] = createObject(OBJ_STRING, sdsnew("_\r\n"));
+    shared.emptymap[0] = shared.emptymap[1] = NULL;
+    shared.emptymap[2] = createObject(OBJ_STRING, sdsnew("*0\r\n"));
+    shared.emptymap[3] = createObject(OBJ_STRING, sdsnew("%0\r\n"));
+    shared.emptyset[0] = shared.emptyset[1] = NULL;
+    shared.emptyset[2] = createObject(OBJ_STRING, sdsnew("*0\r\n"));
+    shared.emptyset[3] = createObject(OBJ_STRING, sdsnew("~0\r\n"));
     shared.pong = createObject(OBJ_STRING, sdsnew("+PONG\r\n"));
     shared.queued = createObject(OBJ_STRING, sdsnew("+QUEUED\r\n"));
     shared.emptyscan = createObject(OBJ_STRING, sdsnew("*2\r\n$1\r\n0\r\n*0\r\n"));
@@ -1570,6 +1631,9 @@ void createSharedObjects(void) {
     shared.unsubscribebulk = createStringObject("$11\r\nunsubscribe\r\n", 18);
     shared.psubscribebulk = createStringObject("$10\r\npsubscribe\r\n", 17);
     shared.punsubscribebulk = createStringObject("$12\r\npunsubscribe\r\n", 19);
+    shared.smessagebulk = createStringObject("$8\r\nsmessage\r\n", 14);
+    shared.ssubscribebulk = createStringObject("$10\r\nssubscribe\r\n", 17);
+    shared.sunsubscribebulk = createStringObject("$12\r\nsunsubscribe\r\n", 19);
     shared.del = createStringObject("DEL", 3);
     shared.unlink = createStringObject("UNLINK", 6);
     shared.rpop = createStringObject("RPOP", 4);
@@ -1588,6 +1652,10 @@ void createSharedObjects(void) {
                                           sdscatprintf(sdsempty(), "*%d\r\n", j));
         shared.bulkhdr[j] = createObject(OBJ_STRING,
                                          sdscatprintf(sdsempty(), "$%d\r\n", j));
+        shared.maphdr[j] = createObject(OBJ_STRING,
+                                        sdscatprintf(sdsempty(), "%%%d\r\n", j));
+        shared.sethdr[j] = createObject(OBJ_STRING,
+                                        sdscatprintf(sdsempty(), "~%d\r\n", j));
     }
     /* The following two shared objects, minstring and maxstrings, are not
      * actually used for their value but as a special object meaning
@@ -1636,6 +1704,8 @@ void initServerConfig(void) {
     server.active_defrag_cycle_max = CONFIG_DEFAULT_DEFRAG_CYCLE_MAX;
     server.active_defrag_max_scan_fields = CONFIG_DEFAULT_DEFRAG_MAX_SCAN_FIELDS;
     server.proto_max_bulk_len = CONFIG_DEFAULT_PROTO_MAX_BULK_LEN;
+    server.hotkeys_sample_rate = CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.hotkeys_size = CONFIG_DEFAULT_HOTKEYS_SIZE;
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
@@ -1670,10 +1740,13 @@ void initServerConfig(void) {
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
+    server.rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
+    server.active_defrag_targeted_bins = 0;
+    server.active_defrag_targeted_frag_bytes = 0;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
     server.blocked_clients = 0;
@@ -1684,16 +1757,23 @@ void initServerConfig(void) {
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
+    server.tinylfu_window = CONFIG_DEFAULT_TINYLFU_WINDOW;
+    server.maxmemory_low_watermark = CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK;
+    server.maxmemory_high_watermark = CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK;
+    server.tinylfu_candidate = NULL;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
+    server.list_compress_codec = OBJ_LIST_COMPRESS_CODEC;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_large_encoding = OBJ_ZSET_LARGE_ENCODING;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
     server.stream_node_max_bytes = OBJ_STREAM_NODE_MAX_BYTES;
     server.stream_node_max_entries = OBJ_STREAM_NODE_MAX_ENTRIES;
+    server.tracking_table_max_keys = CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS;
     server.shutdown_asap = 0;
     server.cluster_enabled = 0;
     server.cluster_node_timeout = CLUSTER_DEFAULT_NODE_TIMEOUT;
@@ -1701,12 +1781,16 @@ void initServerConfig(void) {
     server.cluster_slave_validity_factor = CLUSTER_DEFAULT_SLAVE_VALIDITY;
     server.cluster_require_full_coverage = CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE;
     server.cluster_slave_no_failover = CLUSTER_DEFAULT_SLAVE_NO_FAILOVER;
+    server.cluster_bus_compact = CLUSTER_DEFAULT_BUS_COMPACT;
     server.cluster_configfile = zstrdup(CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     server.cluster_announce_ip = CONFIG_DEFAULT_CLUSTER_ANNOUNCE_IP;
     server.cluster_announce_port = CONFIG_DEFAULT_CLUSTER_ANNOUNCE_PORT;
     server.cluster_announce_bus_port = CONFIG_DEFAULT_CLUSTER_ANNOUNCE_BUS_PORT;
     server.cluster_module_flags = CLUSTER_MODULE_FLAG_NONE;
     server.migrate_cached_sockets = dictCreate(&migrateCacheDictType, NULL);
+    server.migrate_jobs = listCreate();
+    server.migrate_jobs_timer = -1;
+    server.migrate_chunk_size = CONFIG_DEFAULT_MIGRATE_CHUNK_SIZE;
     server.next_client_id = 1; /* Client IDs, start from 1 .*/
     server.loading_process_events_interval_bytes = (1024 * 1024 * 2);
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
@@ -1780,6 +1864,7 @@ void initServerConfig(void) {
     server.lpushCommand = lookupCommandByCString("lpush");
     server.lpopCommand = lookupCommandByCString("lpop");
     server.rpopCommand = lookupCommandByCString("rpop");
+    server.lmpopCommand = lookupCommandByCString("lmpop");
     server.zpopminCommand = lookupCommandByCString("zpopmin");
     server.zpopmaxCommand = lookupCommandByCString("zpopmax");
     server.sremCommand = lookupCommandByCString("srem");
@@ -1808,6 +1893,7 @@ void initServerConfig(void) {
      * script to the slave / AOF. This is the new way starting from
      * Redis 5. However it is possible to revert it via redis.conf. */
     server.lua_always_replicate_commands = 1;
+    server.lua_persist_scripts = CONFIG_DEFAULT_LUA_PERSIST_SCRIPTS;
 }
 
 extern char **environ;
@@ -2068,6 +2154,9 @@ void resetServerStats(void) {
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
     server.stat_evictedkeys = 0;
+    server.stat_tinylfu_rejected = 0;
+    server.stat_background_evictedkeys = 0;
+    server.stat_sync_eviction_cycles = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_active_defrag_hits = 0;
@@ -2075,6 +2164,10 @@ void resetServerStats(void) {
     server.stat_active_defrag_key_hits = 0;
     server.stat_active_defrag_key_misses = 0;
     server.stat_active_defrag_scanned = 0;
+    server.stat_active_defrag_cycle_moved_bytes = 0;
+    server.stat_active_defrag_scan_reclaimed_bytes = 0;
+    server.stat_lua_compiled_scripts = 0;
+    server.stat_lua_compile_time = 0;
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
@@ -2090,6 +2183,7 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_hotkeys_sampled = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -2178,6 +2272,9 @@ void initServer(void) {
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType, NULL);
         server.db[j].expires = dictCreate(&keyptrDictType, NULL);
+        server.db[j].prefix_sizes = dictCreate(&keyptrDictType, NULL);
+        server.db[j].prefix_stats = server.memory_prefixes_count ?
+            zcalloc(sizeof(memoryPrefixStats) * server.memory_prefixes_count) : NULL;
         server.db[j].blocking_keys = dictCreate(&keylistDictType, NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType, NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType, NULL);
@@ -2186,10 +2283,14 @@ void initServer(void) {
         server.db[j].defrag_later = listCreate();
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
+    hotkeysInit();
     server.pubsub_channels = dictCreate(&keylistDictType, NULL);
     server.pubsub_patterns = listCreate();
+    server.pubsubshard_channels = dictCreate(&keylistDictType, NULL);
     listSetFreeMethod(server.pubsub_patterns, freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns, listMatchPubsubPattern);
+    server.pubsub_patterns_index = raxNew();
+    server.tracking_clients = 0;
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
@@ -2563,6 +2664,8 @@ void call(client *c, int flags) {
     ustime_t start, duration;
     int client_old_flags = c->flags;
     struct redisCommand *real_cmd = c->cmd;
+    hotkeysSample hs;
+    int hotkeys_sampled = 0;
 
     server.fixed_time_expire++;
 
@@ -2584,9 +2687,16 @@ void call(client *c, int flags) {
     dirty = server.dirty;
     updateCachedTime(0);
     start = server.ustime;
+    /* Sample the keys accessed by the command for HOTKEYS, see hotkeys.c. */
+    if (server.hotkeys_sample_rate && !server.loading &&
+        --server.hotkeys_countdown <= 0) {
+        hotkeysSampleBefore(c, &hs);
+        hotkeys_sampled = 1;
+    }
     // 调用命令指向的函数，执行客户端的命令
     c->cmd->proc(c);
     duration = ustime() - start;
+    if (hotkeys_sampled) hotkeysSampleAfter(c, &hs);
     dirty = server.dirty - dirty;
     if (dirty < 0) dirty = 0;
 
@@ -2605,6 +2715,18 @@ void call(client *c, int flags) {
             server.lua_caller->flags |= CLIENT_FORCE_AOF;
     }
 
+    /* If the client has keys tracking enabled for client side caching,
+     * make sure to remember the keys it fetched via this command. */
+    if (c->cmd->flags & CMD_READONLY) {
+        client *caller = (c->flags & CLIENT_LUA && server.lua_caller) ?
+                            server.lua_caller : c;
+        if (caller->flags & CLIENT_TRACKING &&
+            !(caller->client_tracking_flags & TRACKING_BCAST))
+        {
+            trackingRememberKeys(caller);
+        }
+    }
+
     /* Log the command into the Slow log if needed, and populate the
      * per-command statistics that we show in INFO commandstats. */
     if (flags & CMD_CALL_SLOWLOG && c->cmd->proc != execCommand) {
@@ -2729,7 +2851,8 @@ int processCommand(client *c) {
 
     /* Check if the user is authenticated */
     /** 权限校验 */
-    if (server.requirepass && !c->authenticated && c->cmd->proc != authCommand) {
+    if (server.requirepass && !c->authenticated &&
+        c->cmd->proc != authCommand && c->cmd->proc != helloCommand) {
         flagTransaction(c);
         addReply(c, shared.noautherr);
         return C_OK;
@@ -2769,7 +2892,11 @@ int processCommand(client *c) {
      * propagation of DELs due to eviction. */
     /** 执行内存淘汰 **/
     if (server.maxmemory && !server.lua_timedout) {
+        /* With a TinyLFU policy the eviction may refuse to make room for
+         * the keys this command is going to write. */
+        if (c->cmd->flags & CMD_DENYOOM) server.tinylfu_candidate = c;
         int out_of_memory = freeMemoryIfNeededAndSafe() == C_ERR;
+        server.tinylfu_candidate = NULL;
         /* freeMemoryIfNeeded may flush slave output buffers. This may result
          * into a slave, that may be the active client, to be freed. */
         if (server.current_client == NULL) return C_ERR;
@@ -2825,14 +2952,18 @@ int processCommand(client *c) {
         return C_OK;
     }
 
-    /* Only allow SUBSCRIBE and UNSUBSCRIBE in the context of Pub/Sub */
-    if (c->flags & CLIENT_PUBSUB &&
+    /* Only allow SUBSCRIBE and UNSUBSCRIBE in the context of Pub/Sub.
+     * RESP3 clients receive Pub/Sub messages as push replies that can be
+     * told apart from the command replies, so they can run any command. */
+    if (c->flags & CLIENT_PUBSUB && c->resp == 2 &&
         c->cmd->proc != pingCommand &&
         c->cmd->proc != subscribeCommand &&
         c->cmd->proc != unsubscribeCommand &&
         c->cmd->proc != psubscribeCommand &&
-        c->cmd->proc != punsubscribeCommand) {
-        addReplyError(c, "only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT allowed in this context");
+        c->cmd->proc != punsubscribeCommand &&
+        c->cmd->proc != ssubscribeCommand &&
+        c->cmd->proc != sunsubscribeCommand) {
+        addReplyError(c, "only (P|S)SUBSCRIBE / (P|S)UNSUBSCRIBE / PING / QUIT allowed in this context");
         return C_OK;
     }
 
@@ -3070,7 +3201,7 @@ void pingCommand(client *c) {
         return;
     }
 
-    if (c->flags & CLIENT_PUBSUB) {
+    if (c->flags & CLIENT_PUBSUB && c->resp == 2) {
         addReply(c, shared.mbulkhdr[2]);
         addReplyBulkCBuffer(c, "pong", 4);
         if (c->argc == 1)
@@ -3112,7 +3243,7 @@ int addReplyCommandFlag(client *c, struct redisCommand *cmd, int f, char *reply)
 /* Output the representation of a Redis command. Used by the COMMAND command. */
 void addReplyCommand(client *c, struct redisCommand *cmd) {
     if (!cmd) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     } else {
         /* We are adding: command name, arg count, flags, first, last, offset */
         addReplyMultiBulkLen(c, 6);
@@ -3330,10 +3461,12 @@ sds genRedisInfoString(char *section) {
                             "connected_clients:%lu\r\n"
                             "client_recent_max_input_buffer:%zu\r\n"
                             "client_recent_max_output_buffer:%zu\r\n"
-                            "blocked_clients:%d\r\n",
+                            "blocked_clients:%d\r\n"
+                            "tracking_clients:%d\r\n",
                             listLength(server.clients) - listLength(server.slaves),
                             maxin, maxout,
-                            server.blocked_clients);
+                            server.blocked_clients,
+                            server.tracking_clients);
     }
 
     /* Memory */
@@ -3408,6 +3541,10 @@ sds genRedisInfoString(char *section) {
                             "mem_aof_buffer:%zu\r\n"
                             "mem_allocator:%s\r\n"
                             "active_defrag_running:%d\r\n"
+                            "active_defrag_targeted_bins:%d\r\n"
+                            "active_defrag_targeted_frag_bytes:%zu\r\n"
+                            "active_defrag_cycle_moved_bytes:%lld\r\n"
+                            "active_defrag_scan_reclaimed_bytes:%lld\r\n"
                             "lazyfree_pending_objects:%zu\r\n",
                             zmalloc_used,
                             hmem,
@@ -3448,6 +3585,10 @@ sds genRedisInfoString(char *section) {
                             mh->aof_buffer,
                             ZMALLOC_LIB,
                             server.active_defrag_running,
+                            server.active_defrag_targeted_bins,
+                            server.active_defrag_targeted_frag_bytes,
+                            server.stat_active_defrag_cycle_moved_bytes,
+                            server.stat_active_defrag_scan_reclaimed_bytes,
                             lazyfreeGetPendingObjectsCount()
         );
         freeMemoryOverheadData(mh);
@@ -3563,17 +3704,26 @@ sds genRedisInfoString(char *section) {
                             "expired_stale_perc:%.2f\r\n"
                             "expired_time_cap_reached_count:%lld\r\n"
                             "evicted_keys:%lld\r\n"
+                            "tinylfu_rejected_writes:%lld\r\n"
+                            "background_evicted_keys:%lld\r\n"
+                            "sync_eviction_cycles:%lld\r\n"
                             "keyspace_hits:%lld\r\n"
                             "keyspace_misses:%lld\r\n"
                             "pubsub_channels:%ld\r\n"
                             "pubsub_patterns:%lu\r\n"
+                            "pubsubshard_channels:%lu\r\n"
                             "latest_fork_usec:%lld\r\n"
                             "migrate_cached_sockets:%ld\r\n"
                             "slave_expires_tracked_keys:%zu\r\n"
                             "active_defrag_hits:%lld\r\n"
                             "active_defrag_misses:%lld\r\n"
                             "active_defrag_key_hits:%lld\r\n"
-                            "active_defrag_key_misses:%lld\r\n",
+                            "active_defrag_key_misses:%lld\r\n"
+                            "lua_compiled_scripts:%lld\r\n"
+                            "lua_compile_time_usec:%lld\r\n"
+                            "tracking_total_keys:%llu\r\n"
+                            "tracking_total_items:%llu\r\n"
+                            "tracking_total_prefixes:%llu\r\n",
                             server.stat_numconnections,
                             server.stat_numcommands,
                             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3589,17 +3739,26 @@ sds genRedisInfoString(char *section) {
                             server.stat_expired_stale_perc * 100,
                             server.stat_expired_time_cap_reached_count,
                             server.stat_evictedkeys,
+                            server.stat_tinylfu_rejected,
+                            server.stat_background_evictedkeys,
+                            server.stat_sync_eviction_cycles,
                             server.stat_keyspace_hits,
                             server.stat_keyspace_misses,
                             dictSize(server.pubsub_channels),
                             listLength(server.pubsub_patterns),
+                            dictSize(server.pubsubshard_channels),
                             server.stat_fork_time,
                             dictSize(server.migrate_cached_sockets),
                             getSlaveKeyWithExpireCount(),
                             server.stat_active_defrag_hits,
                             server.stat_active_defrag_misses,
                             server.stat_active_defrag_key_hits,
-                            server.stat_active_defrag_key_misses);
+                            server.stat_active_defrag_key_misses,
+                            server.stat_lua_compiled_scripts,
+                            server.stat_lua_compile_time,
+                            (unsigned long long) trackingGetTotalKeys(),
+                            (unsigned long long) trackingGetTotalItems(),
+                            (unsigned long long) trackingGetTotalPrefixes());
     }
 
     /* Replication */
@@ -3763,6 +3922,13 @@ sds genRedisInfoString(char *section) {
         dictReleaseIterator(di);
     }
 
+    /* Hot keys, only on explicit request like commandstats. */
+    if (allsections || !strcasecmp(section, "hotkeys")) {
+        if (sections++) info = sdscat(info, "\r\n");
+        info = sdscatprintf(info, "# Hotkeys\r\n");
+        info = genHotkeysInfoString(info, 10);
+    }
+
     /* Cluster */
     if (allsections || defsections || !strcasecmp(section, "cluster")) {
         if (sections++) info = sdscat(info, "\r\n");
@@ -4166,6 +4332,8 @@ int main(int argc, char **argv) {
             quicklistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -4176,6 +4344,8 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "lz4")) {
+            return lz4Test(argc, argv);
         } else if (!strcasecmp(argv[2], "zmalloc")) {
             return zmalloc_test(argc, argv);
         }
@@ -4191,6 +4361,7 @@ int main(int argc, char **argv) {
     setlocale(LC_COLLATE, "");
     tzset(); /* Populates 'timezone' global. */
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
+    crc64_init();
     srand(time(NULL) ^ getpid());
     gettimeofday(&tv, NULL);
 
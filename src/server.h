@@ -60,6 +60,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -73,6 +74,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #include "sha1.h"
 #include "endianconv.h"
 #include "crc64.h"
+#include "lz4.h"
 
 /* Error codes */
 #define C_OK                    0
@@ -102,6 +104,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000
+#define CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000
 #define CONFIG_AUTHPASS_MAX_LEN 512
 #define CONFIG_DEFAULT_SLAVE_PRIORITY 100
 #define CONFIG_DEFAULT_REPL_TIMEOUT 60
@@ -140,6 +143,10 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
+#define CONFIG_DEFAULT_TINYLFU_WINDOW 1
+#define CONFIG_DEFAULT_MAXMEMORY_LOW_WATERMARK 100 /* Background eviction off. */
+#define CONFIG_DEFAULT_MAXMEMORY_HIGH_WATERMARK 100
+#define EVICTION_BACKGROUND_STEP_USEC 1000 /* Max time of a background step. */
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
@@ -167,6 +174,9 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
 #define CONFIG_DEFAULT_DEFRAG_MAX_SCAN_FIELDS 1000 /* keys with more than 1000 fields will be processed separately */
 #define CONFIG_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
+#define CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE 0 /* Hot keys sampling disabled */
+#define CONFIG_DEFAULT_HOTKEYS_SIZE 64  /* Keys tracked by HOTKEYS GET/BIGKEYS */
+#define CONFIG_HOTKEYS_SIZE_MAX 1024
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -258,6 +268,19 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
 #define CLIENT_PROTECTED (1<<28) /* Client should not be freed for now. */
+#define CLIENT_TRACKING (1<<29)  /* Client enabled keys tracking in order to
+                                    perform client side caching. */
+
+/* Client side caching options (client_tracking_flags field), meaningful
+ * only when the CLIENT_TRACKING flag is set. */
+#define TRACKING_BROKEN_REDIR (1<<0) /* Target client is invalid. */
+#define TRACKING_BCAST (1<<1)     /* Tracking in BCAST mode. */
+#define TRACKING_OPTIN (1<<2)     /* Tracking in opt-in mode. */
+#define TRACKING_OPTOUT (1<<3)    /* Tracking in opt-out mode. */
+#define TRACKING_CACHING (1<<4)   /* CACHING yes/no was given, depending on
+                                     optin/optout mode. */
+#define TRACKING_NOLOOP (1<<5)    /* Don't send invalidation messages about
+                                     writes performed by myself.*/
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -267,7 +290,8 @@ typedef long long ustime_t; /* microsecond time type. */
 #define BLOCKED_MODULE 3  /* Blocked by a loadable module. */
 #define BLOCKED_STREAM 4  /* XREAD. */
 #define BLOCKED_ZSET 5    /* BZPOP et al. */
-#define BLOCKED_NUM 6     /* Number of blocked states. */
+#define BLOCKED_MIGRATE 6 /* MIGRATE of large keys, sent in chunks. */
+#define BLOCKED_NUM 7     /* Number of blocked states. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -356,18 +380,28 @@ typedef long long ustime_t; /* microsecond time type. */
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
+/* RDB string compression codecs. */
+#define RDB_CODEC_LZF 0
+#define RDB_CODEC_LZ4 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC RDB_CODEC_LZF
+
+/* MIGRATE transfers collections with more elements than this in chunks. */
+#define CONFIG_DEFAULT_MIGRATE_CHUNK_SIZE 1000
+
 /* Zipped structures related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define OBJ_ZSET_LARGE_ENCODING OBJ_ENCODING_SKIPLIST
 #define OBJ_STREAM_NODE_MAX_BYTES 4096
 #define OBJ_STREAM_NODE_MAX_ENTRIES 100
 
 /* List defaults */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
 #define OBJ_LIST_COMPRESS_DEPTH 0
+#define OBJ_LIST_COMPRESS_CODEC QUICKLIST_NODE_ENCODING_LZF
 
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
@@ -383,6 +417,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_TINYLFU (1<<3)
 #define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
     (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
 
@@ -394,11 +429,17 @@ typedef long long ustime_t; /* microsecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+/* TinyLFU policies keep the LRU clock in robj->lru (used to break ties
+ * between keys of the same estimated frequency), so they also set the
+ * LRU flag. */
+#define MAXMEMORY_VOLATILE_TINYLFU ((8<<8)|MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_TINYLFU)
+#define MAXMEMORY_ALLKEYS_TINYLFU ((9<<8)|MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_TINYLFU|MAXMEMORY_FLAG_ALLKEYS)
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
 /* Scripting */
 #define LUA_SCRIPT_TIME_LIMIT 5000 /* milliseconds */
+#define CONFIG_DEFAULT_LUA_PERSIST_SCRIPTS 1
 
 /* Units */
 #define UNIT_SECONDS 0
@@ -613,6 +654,8 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_ROARING 11 /* Encoded as roaring bitmap containers */
+#define OBJ_ENCODING_BTREE 12  /* Encoded as dict plus counted B+tree */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -652,9 +695,28 @@ typedef struct clientReplyBlock {
 /* Redis database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
+/* Memory accounted to the keys of a memory-prefixes group in a DB. */
+typedef struct memoryPrefixStats {
+    unsigned long long keys;
+    unsigned long long bytes;
+} memoryPrefixStats;
+
+/* State of a command sampled for the hot keys detection, kept by call()
+ * while the command is executed. See hotkeys.c. */
+typedef struct hotkeysSample {
+    robj **keys;                /* Keys accessed by the command. */
+    int numkeys;
+    int dbid;
+    int write;                  /* True if it is a write command. */
+    size_t bytes_written;       /* Bytes of the arguments that are not keys. */
+    long long reply_bytes;      /* server.stat_reply_bytes before the call. */
+} hotkeysSample;
+
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
     dict *expires;              /* Timeout of keys with a timeout set */
+    dict *prefix_sizes;         /* Bytes accounted to keys of a memory-prefixes group */
+    memoryPrefixStats *prefix_stats; /* Totals of each memory-prefixes group */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -693,6 +755,10 @@ typedef struct blockingState {
     robj *target;           /* The key that should receive the element,
                              * for BRPOPLPUSH. */
 
+    /* BLOCKED_LIST */
+    int list_where;         /* LIST_HEAD or LIST_TAIL: side to pop from. */
+    long list_count;        /* BLMPOP COUNT option, 0 for BLPOP/BRPOP. */
+
     /* BLOCK_STREAM */
     size_t xread_count;     /* XREAD COUNT option. */
     robj *xread_group;      /* XREADGROUP group name. */
@@ -708,6 +774,9 @@ typedef struct blockingState {
     void *module_blocked_handle; /* RedisModuleBlockedClient structure.
                                     which is opaque for the Redis core, only
                                     handled in module.c. */
+
+    /* BLOCKED_MIGRATE */
+    void *migrate_job;      /* migrateJob structure, handled in cluster.c. */
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -758,6 +827,7 @@ typedef struct client {
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
     int flags;              /* Client flags: CLIENT_* macros. */
+    int resp;               /* RESP protocol version. Can be 2 or 3. */
     int authenticated;      /* When requirepass is non-NULL. */
     int replstate;          /* Replication state if this is a slave. */
     int repl_put_online_on_ack; /* Install slave write handler on first ACK. */
@@ -783,8 +853,20 @@ typedef struct client {
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
+    dict *pubsubshard_channels; /* shard channels a client is interested in
+                                   (SSUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
     listNode *client_list_node; /* list node in client list */
+    dict *restore_chunks;   /* Values being assembled by RESTORE-CHUNK. */
+
+    /* Client side caching: when CLIENT_TRACKING is set this is the ID of
+     * the client to send invalidation messages to, or 0 for the client
+     * itself. */
+    int client_tracking_flags;  /* TRACKING_* options. */
+    uint64_t client_tracking_redirection;
+    rax *client_tracking_prefixes; /* A dictionary of prefixes we are already
+                                      subscribed to in BCAST mode, in the
+                                      context of client side caching. */
 
     /* Response buffer */
     int bufpos;
@@ -804,17 +886,20 @@ struct moduleLoadQueueEntry {
 
 struct sharedObjectsStruct {
     robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *cnegone, *pong, *space,
-            *colon, *nullbulk, *nullmultibulk, *queued,
+            *colon, *queued, *null[4], *nullarray[4], *emptymap[4], *emptyset[4],
             *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
             *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
             *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
             *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
             *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *unlink,
+            *smessagebulk, *ssubscribebulk, *sunsubscribebulk,
             *rpop, *lpop, *lpush, *rpoplpush, *zpopmin, *zpopmax, *emptyscan,
             *select[PROTO_SHARED_SELECT_CMDS],
             *integers[OBJ_SHARED_INTEGERS],
             *mbulkhdr[OBJ_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
-    *bulkhdr[OBJ_SHARED_BULKHDR_LEN];  /* "$<value>\r\n" */
+            *bulkhdr[OBJ_SHARED_BULKHDR_LEN],  /* "$<value>\r\n" */
+            *maphdr[OBJ_SHARED_BULKHDR_LEN],   /* "%<value>\r\n" */
+    *sethdr[OBJ_SHARED_BULKHDR_LEN];   /* "~<value>\r\n" */
     sds minstring, maxstring;
 };
 
@@ -840,9 +925,53 @@ typedef struct zskiplist {
     int level; // 最大层级
 } zskiplist;
 
+/* Counted B+tree used by the btree encoding of large sorted sets, see
+ * zbtree.c. Leaves are sized to fill a 1k allocation. */
+#define ZBT_LEAF_CAP 62
+#define ZBT_INNER_CAP 32
+#define ZBT_MAXLEVEL 32
+
+typedef struct zbtEntry {
+    double score;
+    sds ele;
+} zbtEntry;
+
+typedef struct zbtLeaf {
+    struct zbtLeaf *prev, *next;
+    unsigned int count;
+    zbtEntry e[ZBT_LEAF_CAP];   /* Elements sorted by score, then element. */
+} zbtLeaf;
+
+typedef struct zbtInner {
+    unsigned int count;
+    zbtEntry key[ZBT_INNER_CAP];        /* Smallest element under every child. */
+    unsigned long size[ZBT_INNER_CAP];  /* Number of elements under every child. */
+    void *child[ZBT_INNER_CAP];
+} zbtInner;
+
+typedef struct zbtree {
+    void *root;
+    zbtLeaf *head, *tail;
+    unsigned long length;
+    unsigned long leaves, inners;   /* Number of nodes, for memory usage. */
+    int level;                      /* 1 when the root is a leaf. */
+} zbtree;
+
+typedef struct zbtCursor {
+    zbtLeaf *leaf;
+    unsigned int idx;
+} zbtCursor;
+
+#define zbtCursorEntry(c) (&(c)->leaf->e[(c)->idx])
+
+/* Sorted sets not encoded as ziplist use a dict plus either a skiplist or
+ * a btree, depending on the encoding: the other pointer is NULL. With the
+ * btree encoding the dict stores the score itself instead of a pointer to
+ * it, since elements move inside the tree nodes. */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
 typedef struct clientBufferLimitsConfig {
@@ -973,6 +1102,8 @@ struct redisServer {
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
+    int active_defrag_targeted_bins; /* Allocator bins the active defrag targets */
+    size_t active_defrag_targeted_frag_bytes; /* Bytes wasted in the targeted bins */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -1012,6 +1143,9 @@ struct redisServer {
     mstime_t clients_pause_end_time; /* Time when we undo clients_paused */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
+    list *migrate_jobs;         /* MIGRATE commands sending keys in chunks. */
+    long long migrate_jobs_timer; /* Time event driving migrate_jobs, or -1. */
+    long migrate_chunk_size;    /* Max elements sent by MIGRATE per chunk. */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
     /* RDB / AOF loading information */
@@ -1022,7 +1156,7 @@ struct redisServer {
     off_t loading_process_events_interval_bytes;
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand,
-            *lpopCommand, *rpopCommand, *zpopminCommand,
+            *lpopCommand, *rpopCommand, *lmpopCommand, *zpopminCommand,
             *zpopmaxCommand, *sremCommand, *execCommand,
             *expireCommand, *pexpireCommand, *xclaimCommand,
             *xgroupCommand;
@@ -1034,6 +1168,9 @@ struct redisServer {
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
     long long stat_expired_time_cap_reached_count; /* Early expire cylce stops.*/
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_tinylfu_rejected; /* Writes refused by TinyLFU admission. */
+    long long stat_background_evictedkeys; /* Keys evicted in background. */
+    long long stat_sync_eviction_cycles; /* Evictions blocking a command. */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     long long stat_active_defrag_hits;      /* number of allocations moved */
@@ -1041,6 +1178,8 @@ struct redisServer {
     long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
     long long stat_active_defrag_key_misses;/* number of keys scanned and not moved */
     long long stat_active_defrag_scanned;   /* number of dictEntries scanned */
+    long long stat_active_defrag_cycle_moved_bytes; /* bytes moved by the last defrag cycle */
+    long long stat_active_defrag_scan_reclaimed_bytes; /* frag bytes reclaimed by the last full scan */
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
@@ -1055,6 +1194,8 @@ struct redisServer {
     struct malloc_stats cron_malloc_stats; /* sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_reply_bytes;     /* Bytes of replies added to client buffers. */
+    long long stat_hotkeys_sampled; /* Commands sampled for hot keys. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
@@ -1129,6 +1270,7 @@ struct redisServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* RDB_CODEC_* used when compressing. */
     int rdb_checksum;               /* Use RDB checksum? */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
@@ -1221,6 +1363,10 @@ struct redisServer {
     int maxmemory_samples;          /* Pricision of random sampling */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
+    int tinylfu_window;             /* % of evictions admitted unconditionally. */
+    int maxmemory_low_watermark;    /* Background eviction target, % of maxmemory. */
+    int maxmemory_high_watermark;   /* Background eviction start, % of maxmemory. */
+    client *tinylfu_candidate;      /* Client whose write triggers eviction. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
     /* Blocked clients */
     unsigned int blocked_clients;   /* # of clients executing a blocking cmd.*/
@@ -1239,12 +1385,22 @@ struct redisServer {
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    int zset_large_encoding;        /* OBJ_ENCODING_SKIPLIST or OBJ_ENCODING_BTREE */
     size_t hll_sparse_max_bytes;
     size_t stream_node_max_bytes;
     int64_t stream_node_max_entries;
     /* List parameters */
     int list_max_ziplist_size;
     int list_compress_depth;
+    int list_compress_codec;        /* QUICKLIST_NODE_ENCODING_LZF or LZ4 */
+    /* Memory accounting per key prefix, see MEMORY PREFIXES */
+    sds *memory_prefixes;
+    int memory_prefixes_count;
+    rax *memory_prefixes_index;     /* Prefix -> group index + 1. */
+    /* Hot keys and big keys sampling, see HOTKEYS */
+    int hotkeys_sample_rate;        /* Sample one command every N on average. */
+    int hotkeys_size;               /* Keys tracked in each table. */
+    int hotkeys_countdown;          /* Commands left before the next sample. */
     /* time cache */
     time_t unixtime;    /* Unix time sampled every cron cycle. */
     time_t timezone;    /* Cached timezone. As set by tzset(). */
@@ -1254,8 +1410,15 @@ struct redisServer {
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
     list *pubsub_patterns;  /* A list of pubsub_patterns */
+    rax *pubsub_patterns_index; /* Literal prefix of the patterns -> list of
+                                   pubsub_patterns with that prefix. */
+    dict *pubsubshard_channels; /* Map shard channels to list of subscribed
+                                   clients */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
+    /* Client side caching */
+    unsigned int tracking_clients;  /* # of clients with tracking enabled.*/
+    size_t tracking_table_max_keys; /* Max number of keys in tracking table. */
     /* Cluster */
     int cluster_enabled;      /* Is cluster enabled? */
     mstime_t cluster_node_timeout; /* Cluster node timeout. */
@@ -1267,6 +1430,8 @@ struct redisServer {
                                           there is at least an uncovered slot.*/
     int cluster_slave_no_failover;  /* Prevent slave from starting a failover
                                        if the master is in failure state. */
+    int cluster_bus_compact;        /* Use the compact bus encoding with the
+                                       nodes supporting it. */
     char *cluster_announce_ip;  /* IP address to announce on cluster bus. */
     int cluster_announce_port;     /* base port to announce on cluster bus. */
     int cluster_announce_bus_port; /* bus port to announce on cluster bus. */
@@ -1277,6 +1442,7 @@ struct redisServer {
     /* Scripting */
     lua_State *lua; /* The Lua interpreter. We use just one for all clients */
     client *lua_client;   /* The "fake client" to query Redis from Lua */
+    sds lua_reply;        /* Reply arena of lua_client, see scripting.c */
     client *lua_caller;   /* The client running EVAL right now, or NULL */
     dict *lua_scripts;         /* A dictionary of SHA1 -> Lua scripts */
     unsigned long long lua_scripts_mem;  /* Cached scripts' memory + oh */
@@ -1286,6 +1452,8 @@ struct redisServer {
                              execution of the current script. */
     int lua_random_dirty; /* True if a random command was called during the
                              execution of the current script. */
+    int lua_readonly;     /* True if the current script was called with
+                             EVAL_RO / EVALSHA_RO and can't write. */
     int lua_replicate_commands; /* True if we are doing single commands repl. */
     int lua_multi_emitted;/* True if we already proagated MULTI. */
     int lua_repl;         /* Script replication flags for redis.set_repl(). */
@@ -1293,6 +1461,9 @@ struct redisServer {
                              execution. */
     int lua_kill;         /* Kill the script if true. */
     int lua_always_replicate_commands; /* Default replication type. */
+    int lua_persist_scripts; /* Save the scripts cache in every RDB file. */
+    long long stat_lua_compiled_scripts; /* Scripts compiled since startup. */
+    long long stat_lua_compile_time;  /* Time spent compiling scripts (us). */
     /* Lazy free */
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
@@ -1319,6 +1490,7 @@ struct redisServer {
 typedef struct pubsubPattern {
     client *client;
     robj *pattern;
+    size_t prefixlen;   /* Length of the literal prefix of the pattern. */
 } pubsubPattern;
 
 typedef void redisCommandProc(client *c);
@@ -1385,6 +1557,7 @@ typedef struct {
     robj *subject;
     int encoding;
     int ii; /* intset iterator */
+    roaringIterator ri; /* roaring iterator */
     dictIterator *di;
 } setTypeIterator;
 
@@ -1426,6 +1599,7 @@ extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
 extern dictType keyptrDictType;
 extern dictType modulesDictType;
+extern dictType restoreChunksDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -1456,6 +1630,8 @@ void moduleBlockedClientPipeReadable(aeEventLoop *el, int fd, void *privdata, in
 
 size_t moduleCount(void);
 
+void addReplyLoadedModules(client *c);
+
 void moduleAcquireGIL(void);
 
 void moduleReleaseGIL(void);
@@ -1500,6 +1676,10 @@ void *addDeferredMultiBulkLength(client *c);
 
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 
+void setDeferredMapLen(client *c, void *node, long length);
+
+void setDeferredSetLen(client *c, void *node, long length);
+
 void processInputBuffer(client *c);
 
 void processInputBufferAndReplicate(client *c);
@@ -1542,6 +1722,18 @@ void addReplyLongLong(client *c, long long ll);
 
 void addReplyMultiBulkLen(client *c, long length);
 
+void addReplyMapLen(client *c, long length);
+
+void addReplySetLen(client *c, long length);
+
+void addReplyPushLen(client *c, long length);
+
+void addReplyNull(client *c);
+
+void addReplyNullArray(client *c);
+
+void addReplyBool(client *c, int b);
+
 void addReplyHelp(client *c, const char **help);
 
 void addReplySubcommandSyntaxError(client *c);
@@ -1575,6 +1767,10 @@ unsigned long getClientOutputBufferMemoryUsage(client *c);
 
 void freeClientsInAsyncFreeQueue(void);
 
+client *lookupClientByID(uint64_t id);
+
+int clientSetNameOrReply(client *c, robj *name);
+
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 
 int getClientType(client *c);
@@ -1724,6 +1920,7 @@ robj *createZiplistObject(void);
 robj *createSetObject(void);
 
 robj *createIntsetObject(void);
+robj *createRoaringObject(void);
 
 robj *createHashObject(void);
 
@@ -1978,6 +2175,51 @@ int zslLexValueGteMin(sds value, zlexrangespec *spec);
 
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
+double zsetDictGetScore(const zset *zs, dictEntry *de);
+
+void zsetInsertNew(zset *zs, double score, sds ele);
+
+/* Sorted set btree encoding (zbtree.c) */
+zbtree *zbtCreate(void);
+
+void zbtFree(zbtree *zbt);
+
+size_t zbtMemUsage(const zbtree *zbt);
+
+void zbtInsert(zbtree *zbt, double score, sds ele);
+
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *oldele);
+
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore);
+
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele);
+
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtCursor *c);
+
+int zbtFirst(zbtree *zbt, zbtCursor *c);
+
+int zbtLast(zbtree *zbt, zbtCursor *c);
+
+int zbtNext(zbtCursor *c);
+
+int zbtPrev(zbtCursor *c);
+
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtCursor *c, unsigned long *rank);
+
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtCursor *c, unsigned long *rank);
+
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c, unsigned long *rank);
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c, unsigned long *rank);
+
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict);
+
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict);
+
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict);
+
+void zbtReplaceEle(zbtree *zbt, double score, sds oldele, sds newele);
+
 /* Core functions */
 int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *level);
 
@@ -1987,8 +2229,12 @@ int freeMemoryIfNeeded(void);
 
 int freeMemoryIfNeededAndSafe(void);
 
+void backgroundEvictionCycle(void);
+
 int processCommand(client *c);
 
+int time_independent_strcmp(char *a, char *b);
+
 void setupSignalHandlers(void);
 
 struct redisCommand *lookupCommand(sds name);
@@ -2055,11 +2301,35 @@ unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 
 const char *evictPolicyToString(void);
+const char *rdbCompressionCodecToString(int codec);
 
 struct redisMemOverhead *getMemoryOverheadData(void);
 
 void freeMemoryOverheadData(struct redisMemOverhead *mh);
 
+void memoryPrefixUpdateKey(redisDb *db, sds key);
+
+void memoryPrefixRemoveKey(redisDb *db, sds key);
+
+void memoryPrefixResetDb(redisDb *db);
+
+void memoryPrefixesSet(sds *prefixes, int count);
+
+size_t dbEntryComputeSize(dictEntry *de);
+
+char *getObjectTypeName(robj *o);
+
+/* Hot keys */
+void hotkeysInit(void);
+
+void hotkeysReset(void);
+
+void hotkeysSampleBefore(client *c, hotkeysSample *hs);
+
+void hotkeysSampleAfter(client *c, hotkeysSample *hs);
+
+sds genHotkeysInfoString(sds info, int count);
+
 #define RESTART_SERVER_NONE 0
 #define RESTART_SERVER_GRACEFULLY (1<<0)     /* Do proper shutdown. */
 #define RESTART_SERVER_CONFIG_REWRITE (1<<1) /* CONFIG REWRITE before restart.*/
@@ -2075,6 +2345,12 @@ int setTypeRemove(robj *subject, sds value);
 
 int setTypeIsMember(robj *subject, sds value);
 
+int setTypeAddInteger(robj *subject, long long llval);
+
+int setTypeRemoveInteger(robj *subject, long long llval);
+
+int setTypeIsMemberInteger(robj *subject, long long llval);
+
 setTypeIterator *setTypeInitIterator(robj *subject);
 
 void setTypeReleaseIterator(setTypeIterator *si);
@@ -2136,12 +2412,34 @@ int pubsubUnsubscribeAllChannels(client *c, int notify);
 
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
 
+int pubsubUnsubscribeShardAllChannels(client *c, int notify);
+
+void pubsubShardUnsubscribeAllClients(robj *channel);
+
 void freePubsubPattern(void *p);
 
 int listMatchPubsubPattern(void *a, void *b);
 
 int pubsubPublishMessage(robj *channel, robj *message);
 
+int pubsubPublishMessageShard(robj *channel, robj *message);
+
+int clientTotalPubSubSubscriptionCount(client *c);
+
+/* Client side caching (tracking mode) */
+void enableTracking(client *c, uint64_t redirect_to, int options,
+                    robj **prefix, size_t numprefix);
+void disableTracking(client *c);
+int checkPrefixCollisionsOrReply(client *c, robj **prefix, size_t numprefix);
+void trackingRememberKeys(client *c);
+void trackingInvalidateKey(client *c, robj *keyobj);
+void trackingInvalidateKeysOnFlush(int dbid);
+void trackingLimitUsedSlots(void);
+void trackingBroadcastInvalidationMessages(void);
+uint64_t trackingGetTotalItems(void);
+uint64_t trackingGetTotalKeys(void);
+uint64_t trackingGetTotalPrefixes(void);
+
 /* Keyspace events notification */
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
 
@@ -2222,6 +2520,8 @@ void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
 
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
+void slotToKeyIterInit(unsigned int hashslot);
+unsigned int getKeysInSlotNext(unsigned int hashslot, robj **keys, unsigned int count);
 
 unsigned int countKeysInSlot(unsigned int hashslot);
 
@@ -2233,9 +2533,13 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor);
 
 int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor);
 
-void slotToKeyAdd(robj *key);
+void slotToKeyInit(void);
+
+void slotToKeyAddEntry(dictEntry *entry);
 
-void slotToKeyDel(robj *key);
+void slotToKeyDelEntry(dictEntry *entry);
+
+void slotToKeyReplaceEntry(dictEntry *entry);
 
 void slotToKeyFlush(void);
 
@@ -2243,8 +2547,6 @@ int dbAsyncDelete(redisDb *db, robj *key);
 
 void emptyDbAsync(redisDb *db);
 
-void slotToKeyFlushAsync(void);
-
 size_t lazyfreeGetPendingObjectsCount(void);
 
 void freeObjAsync(robj *o);
@@ -2266,6 +2568,8 @@ int *georadiusGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numk
 
 int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
+int *lmpopGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+
 /* Cluster */
 void clusterInit(void);
 
@@ -2277,8 +2581,19 @@ void clusterCron(void);
 
 void clusterPropagatePublish(robj *channel, robj *message);
 
+void clusterPropagatePublishShard(robj *channel, robj *message);
+
+void slotToChannelAdd(sds channel);
+
+void slotToChannelDel(sds channel);
+
 void migrateCloseTimedoutSockets(void);
 
+void unblockClientFromMigrate(client *c);
+
+void migrateJobsSignalModifiedKey(redisDb *db, robj *key);
+void migrateJobsSignalFlushedDb(void);
+
 void clusterBeforeSleep(void);
 
 int clusterSendModuleMessageToTarget(const char *target, uint64_t module_id, uint8_t type, unsigned char *payload,
@@ -2313,6 +2628,18 @@ int ldbPendingChildren(void);
 
 sds luaCreateFunction(client *c, lua_State *lua, robj *body);
 
+sds luaRegisterScript(robj *body);
+
+int luaDirectReplyProto(const char *s, size_t len);
+
+int luaDirectReplyBulk(const char *s, size_t len);
+
+int luaDirectReplyStatus(const char *s, size_t len);
+
+int luaDirectReplyError(const char *s, size_t len);
+
+int luaDirectReplyStop(void);
+
 /* Blocked clients */
 void processUnblockedClients(void);
 
@@ -2356,6 +2683,10 @@ uint8_t LFULogIncr(uint8_t value);
 
 unsigned long LFUDecrAndReturn(robj *o);
 
+void tinylfuRecordAccess(sds key);
+
+unsigned int tinylfuEstimate(sds key);
+
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
 
@@ -2591,6 +2922,10 @@ void blpopCommand(client *c);
 
 void brpopCommand(client *c);
 
+void lmpopCommand(client *c);
+
+void blmpopCommand(client *c);
+
 void brpoplpushCommand(client *c);
 
 void appendCommand(client *c);
@@ -2653,6 +2988,12 @@ void publishCommand(client *c);
 
 void pubsubCommand(client *c);
 
+void ssubscribeCommand(client *c);
+
+void sunsubscribeCommand(client *c);
+
+void spublishCommand(client *c);
+
 void watchCommand(client *c);
 
 void unwatchCommand(client *c);
@@ -2661,6 +3002,8 @@ void clusterCommand(client *c);
 
 void restoreCommand(client *c);
 
+void restoreChunkCommand(client *c);
+
 void migrateCommand(client *c);
 
 void askingCommand(client *c);
@@ -2677,10 +3020,16 @@ void memoryCommand(client *c);
 
 void clientCommand(client *c);
 
+void helloCommand(client *c);
+
 void evalCommand(client *c);
 
 void evalShaCommand(client *c);
 
+void evalRoCommand(client *c);
+
+void evalShaRoCommand(client *c);
+
 void scriptCommand(client *c);
 
 void timeCommand(client *c);
@@ -2751,6 +3100,8 @@ void xpendingCommand(client *c);
 
 void xclaimCommand(client *c);
 
+void xautoclaimCommand(client *c);
+
 void xinfoCommand(client *c);
 
 void xdelCommand(client *c);
@@ -2759,6 +3110,8 @@ void xtrimCommand(client *c);
 
 void lolwutCommand(client *c);
 
+void hotkeysCommand(client *c);
+
 #if defined(__GNUC__)
 
 void *calloc(size_t count, size_t size) __attribute__ ((deprecated));
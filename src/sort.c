@@ -303,7 +303,7 @@ void sortCommand(client *c) {
 
     /* Destructively convert encoded sorted sets for SORT. */
     if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+        zsetConvert(sortval, server.zset_large_encoding);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -388,6 +388,28 @@ void sortCommand(client *c) {
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == OBJ_ZSET && dontsort &&
+               sortval->encoding == OBJ_ENCODING_BTREE) {
+        /* Same as below for the btree encoding. */
+        zbtree *zbt = ((zset*)sortval->ptr)->zbt;
+        zbtCursor cur;
+        sds sdsele;
+        int rangelen = vectorlen, valid;
+
+        valid = zbtGetElementByRank(zbt, desc ? zbt->length-start :
+                                                (unsigned long)start+1, &cur);
+        while(rangelen--) {
+            serverAssertWithInfo(c,sortval,valid);
+            sdsele = zbtCursorEntry(&cur)->ele;
+            vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
+            vector[j].u.score = 0;
+            vector[j].u.cmpobj = NULL;
+            j++;
+            valid = desc ? zbtPrev(&cur) : zbtNext(&cur);
+        }
+        /* Fix start/end: output code is not aware of this optimization. */
+        end -= start;
+        start = 0;
     } else if (sortval->type == OBJ_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -519,7 +541,7 @@ void sortCommand(client *c) {
 
                 if (sop->type == SORT_OP_GET) {
                     if (!val) {
-                        addReply(c,shared.nullbulk);
+                        addReply(c,shared.null[c->resp]);
                     } else {
                         addReplyBulk(c,val);
                         decrRefCount(val);
@@ -58,6 +58,11 @@ typedef struct streamCG {
                                as processed. The key of the radix tree is the
                                ID as a 64 bit big endian number, while the
                                associated value is a streamNACK structure.*/
+    rax *pel_by_time;       /* The same entries of the PEL, indexed by last
+                               delivery time: keys are the 64 bit big endian
+                               delivery time followed by the entry ID, so
+                               that the oldest deliveries come first. The
+                               radix tree has no associated values. */
     rax *consumers;         /* A radix tree representing the consumers by name
                                and their associated representation in the form
                                of streamConsumer structures. */
@@ -93,6 +98,26 @@ typedef struct sreamPropInfo {
     robj *groupname;
 } streamPropInfo;
 
+/* Stream trimming strategies and options, see streamTrim(). */
+#define TRIM_STRATEGY_NONE 0
+#define TRIM_STRATEGY_MAXLEN 1
+#define TRIM_STRATEGY_MINID 2
+
+/* Default LIMIT of approximated trimming when stream-node-max-entries is 0,
+ * otherwise it is 100 times stream-node-max-entries. */
+#define STREAM_TRIM_DEFAULT_LIMIT 10000
+
+typedef struct streamTrimArgs {
+    int strategy;           /* One of TRIM_STRATEGY_*. */
+    int approx;             /* If 1 only delete whole radix tree nodes. */
+    long long limit;        /* Max entries removed by an approximated trim,
+                               zero means no limit. */
+    long long maxlen;       /* Max length for TRIM_STRATEGY_MAXLEN. */
+    streamID minid;         /* Min ID to keep for TRIM_STRATEGY_MINID. */
+    int threshold_arg_idx;  /* Index of the threshold argument in the
+                               command vector, for rewriting. */
+} streamTrimArgs;
+
 /* Prototypes of exported APIs. */
 struct client;
 
@@ -107,7 +132,11 @@ streamCG *streamLookupCG(stream *s, sds groupname);
 streamConsumer *streamLookupConsumer(streamCG *cg, sds name, int create);
 streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id);
 streamNACK *streamCreateNACK(streamConsumer *consumer);
+void streamIndexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack);
+void streamUnindexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack);
+void streamSetNACKDeliveryTime(streamCG *cg, unsigned char *rawid, streamNACK *nack, mstime_t delivery_time);
 void streamDecodeID(void *buf, streamID *id);
 int streamCompareID(streamID *a, streamID *b);
+int64_t streamTrim(stream *s, streamTrimArgs *args);
 
 #endif
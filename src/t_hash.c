@@ -657,7 +657,7 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
     int ret;
 
     if (o == NULL) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
         return;
     }
 
@@ -668,7 +668,7 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
 
         ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
         if (ret < 0) {
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
         } else {
             if (vstr) {
                 addReplyBulkCBuffer(c, vstr, vlen);
@@ -680,7 +680,7 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
     } else if (o->encoding == OBJ_ENCODING_HT) {
         sds value = hashTypeGetFromHashTable(o, field);
         if (value == NULL)
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
         else
             addReplyBulkCBuffer(c, value, sdslen(value));
     } else {
@@ -691,7 +691,7 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
 void hgetCommand(client *c) {
     robj *o;
 
-    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
+    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.null[c->resp])) == NULL ||
         checkType(c, o, OBJ_HASH))
         return;
 
@@ -789,7 +789,10 @@ void genericHgetallCommand(client *c, int flags) {
     int multiplier = 0;
     int length, count = 0;
 
-    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptymultibulk)) == NULL
+    /* HGETALL replies with a map, HKEYS and HVALS with an array. */
+    robj *emptyResp = (flags & OBJ_HASH_KEY && flags & OBJ_HASH_VALUE) ?
+                      shared.emptymap[c->resp] : shared.emptymultibulk;
+    if ((o = lookupKeyReadOrReply(c, c->argv[1], emptyResp)) == NULL
         || checkType(c, o, OBJ_HASH))
         return;
 
@@ -797,7 +800,10 @@ void genericHgetallCommand(client *c, int flags) {
     if (flags & OBJ_HASH_VALUE) multiplier++;
 
     length = hashTypeLength(o) * multiplier;
-    addReplyMultiBulkLen(c, length);
+    if (multiplier == 2)
+        addReplyMapLen(c, length / 2);
+    else
+        addReplyMultiBulkLen(c, length);
 
     hi = hashTypeInitIterator(o);
     while (hashTypeNext(hi) != C_ERR) {
@@ -332,7 +332,7 @@ void llenCommand(client *c) {
 }
 
 void lindexCommand(client *c) {
-    robj *o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk);
+    robj *o = lookupKeyReadOrReply(c, c->argv[1], shared.null[c->resp]);
     if (o == NULL || checkType(c, o, OBJ_LIST)) return;
     long index;
     robj *value = NULL;
@@ -351,7 +351,7 @@ void lindexCommand(client *c) {
             addReplyBulk(c, value);
             decrRefCount(value);
         } else {
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
         }
     } else {
         serverPanic("Unknown list encoding");
@@ -385,12 +385,12 @@ void lsetCommand(client *c) {
 }
 
 void popGenericCommand(client *c, int where) {
-    robj *o = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
+    robj *o = lookupKeyWriteOrReply(c, c->argv[1], shared.null[c->resp]);
     if (o == NULL || checkType(c, o, OBJ_LIST)) return;
 
     robj *value = listTypePop(o, where);
     if (value == NULL) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     } else {
         char *event = (where == LIST_HEAD) ? "lpop" : "rpop";
 
@@ -588,14 +588,14 @@ void rpoplpushHandlePush(client *c, robj *dstkey, robj *dstobj, robj *value) {
 
 void rpoplpushCommand(client *c) {
     robj *sobj, *value;
-    if ((sobj = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
+    if ((sobj = lookupKeyWriteOrReply(c, c->argv[1], shared.null[c->resp])) == NULL ||
         checkType(c, sobj, OBJ_LIST))
         return;
 
     if (listTypeLength(sobj) == 0) {
         /* This may only happen after loading very old RDB files. Recent
          * versions of Redis delete keys of empty lists. */
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     } else {
         robj *dobj = lookupKeyWrite(c->db, c->argv[2]);
         robj *touchedkey = c->argv[1];
@@ -631,76 +631,159 @@ void rpoplpushCommand(client *c) {
  * Blocking POP operations
  *----------------------------------------------------------------------------*/
 
-/* This is a helper function for handleClientsBlockedOnLists(). It's work
- * is to serve a specific client (receiver) that is blocked on 'key'
- * in the context of the specified 'db', doing the following:
+/* Pop up to 'count' elements from the 'where' side of the list 'o' stored
+ * at 'key', and reply to 'c' with a two elements array: the key name and
+ * the array of popped elements, as LMPOP and BLMPOP do. The elements are
+ * removed with a single range deletion instead of one pop at a time.
  *
- * 1) Provide the client with the 'value' element.
- * 2) If the dstkey is not NULL (we are serving a BRPOPLPUSH) also push the
- *    'value' element on the destination list (the LPUSH side of the command).
- * 3) Propagate the resulting BRPOP, BLPOP and additional LPUSH if any into
- *    the AOF and replication channel.
+ * The list must not be empty. Deleting the key once empty, signaling it as
+ * modified and propagating the pop are up to the caller.
+ * Returns the number of popped elements. */
+long listPopRangeAndReply(client *c, robj *o, robj *key, int where, long count) {
+    long llen = listTypeLength(o);
+    long j;
+
+    if (count > llen) count = llen;
+    addReplyMultiBulkLen(c, 2);
+    addReplyBulk(c, key);
+    addReplyMultiBulkLen(c, count);
+    if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+        listTypeIterator *iter = listTypeInitIterator(o,
+            (where == LIST_HEAD) ? 0 : -1,
+            (where == LIST_HEAD) ? LIST_TAIL : LIST_HEAD);
+
+        for (j = 0; j < count; j++) {
+            listTypeEntry entry;
+            listTypeNext(iter, &entry);
+            quicklistEntry *qe = &entry.entry;
+            if (qe->value) {
+                addReplyBulkCBuffer(c, qe->value, qe->sz);
+            } else {
+                addReplyBulkLongLong(c, qe->longval);
+            }
+        }
+        listTypeReleaseIterator(iter);
+        quicklistDelRange(o->ptr, (where == LIST_HEAD) ? 0 : -count, count);
+    } else {
+        serverPanic("Unknown list encoding");
+    }
+    notifyKeyspaceEvent(NOTIFY_LIST, (where == LIST_HEAD) ? "lpop" : "rpop",
+                        key, c->db->id);
+    return count;
+}
+
+/* Return the command vector used to propagate the pop of 'count' elements
+ * from the 'where' side of 'key': [LR]POP <key> for a single element, and
+ * LMPOP 1 <key> LEFT|RIGHT COUNT <count> otherwise. The number of arguments
+ * is stored in '*argc'. The caller owns the vector and its objects. */
+robj **listPopCommandVector(robj *key, int where, long count, int *argc) {
+    robj **argv = zmalloc(sizeof(robj *) * 6);
+
+    if (count == 1) {
+        argv[0] = (where == LIST_HEAD) ? shared.lpop : shared.rpop;
+        incrRefCount(argv[0]);
+        argv[1] = key;
+        incrRefCount(key);
+        *argc = 2;
+    } else {
+        argv[0] = createStringObject("LMPOP", 5);
+        argv[1] = createStringObject("1", 1);
+        argv[2] = key;
+        incrRefCount(key);
+        argv[3] = (where == LIST_HEAD) ? createStringObject("LEFT", 4) :
+                                         createStringObject("RIGHT", 5);
+        argv[4] = createStringObject("COUNT", 5);
+        argv[5] = createStringObjectFromLongLong(count);
+        *argc = 6;
+    }
+    return argv;
+}
+
+/* Propagate the pop of 'count' elements from the 'where' side of 'key' into
+ * the AOF and replication channel as a single command. */
+void listPropagatePops(redisDb *db, robj *key, int where, long count) {
+    int argc, j;
+    robj **argv = listPopCommandVector(key, where, count, &argc);
+
+    propagate((argc == 2) ?
+              ((where == LIST_HEAD) ? server.lpopCommand : server.rpopCommand) :
+              server.lmpopCommand,
+              db->id, argv, argc, PROPAGATE_AOF | PROPAGATE_REPL);
+    for (j = 0; j < argc; j++) decrRefCount(argv[j]);
+    zfree(argv);
+}
+
+/* This is a helper function for handleClientsBlockedOnKeys(). It's work
+ * is to serve a client (receiver) blocked on 'key' by BLPOP, BRPOP or
+ * BLMPOP, popping from the list 'o' the elements it is waiting for and
+ * replying with them. The client must be already unblocked.
+ *
+ * The pop is not propagated: the caller propagates the elements popped
+ * serving many clients with a single command, see listPropagatePops().
+ * Returns the number of popped elements. */
+long serveClientBlockedOnListPop(client *receiver, robj *o, robj *key,
+                                 int where, long count)
+{
+    if (count) return listPopRangeAndReply(receiver, o, key, where, count);
+
+    /* BLPOP/BRPOP */
+    robj *value = listTypePop(o, where);
+    serverAssert(value != NULL);
+    addReplyMultiBulkLen(receiver, 2);
+    addReplyBulk(receiver, key);
+    addReplyBulk(receiver, value);
+    decrRefCount(value);
+
+    /* Notify event. */
+    char *event = (where == LIST_HEAD) ? "lpop" : "rpop";
+    notifyKeyspaceEvent(NOTIFY_LIST, event, key, receiver->db->id);
+    return 1;
+}
+
+/* This is a helper function for handleClientsBlockedOnKeys(). It's work
+ * is to serve a specific client (receiver) blocked by BRPOPLPUSH on 'key'
+ * in the context of the specified 'db', doing the following:
  *
- * The argument 'where' is LIST_TAIL or LIST_HEAD, and indicates if the
- * 'value' element was popped from the head (BLPOP) or tail (BRPOP) so that
- * we can propagate the command properly.
+ * 1) Push the 'value' element, popped from the tail of 'key', on the
+ *    destination list (the LPUSH side of the command).
+ * 2) Propagate the resulting RPOP and LPUSH into the AOF and replication
+ *    channel.
  *
  * The function returns C_OK if we are able to serve the client, otherwise
  * C_ERR is returned to signal the caller that the list POP operation
  * should be undone as the client was not served: This only happens for
  * BRPOPLPUSH that fails to push the value to the destination key as it is
  * of the wrong type. */
-int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb *db, robj *value, int where) {
+int serveClientBlockedOnList(client *receiver, robj *key, robj *dstkey, redisDb *db, robj *value) {
     robj *argv[3];
+    robj *dstobj = lookupKeyWrite(receiver->db, dstkey);
 
-    if (dstkey == NULL) {
-        /* Propagate the [LR]POP operation. */
-        argv[0] = (where == LIST_HEAD) ? shared.lpop :
-                  shared.rpop;
+    if (!(dstobj &&
+          checkType(receiver, dstobj, OBJ_LIST))) {
+        /* Propagate the RPOP operation. */
+        argv[0] = shared.rpop;
         argv[1] = key;
-        propagate((where == LIST_HEAD) ?
-                  server.lpopCommand : server.rpopCommand,
-                  db->id, argv, 2, PROPAGATE_AOF | PROPAGATE_REPL);
-
-        /* BRPOP/BLPOP */
-        addReplyMultiBulkLen(receiver, 2);
-        addReplyBulk(receiver, key);
-        addReplyBulk(receiver, value);
-
-        /* Notify event. */
-        char *event = (where == LIST_HEAD) ? "lpop" : "rpop";
-        notifyKeyspaceEvent(NOTIFY_LIST, event, key, receiver->db->id);
+        propagate(server.rpopCommand,
+                  db->id, argv, 2,
+                  PROPAGATE_AOF |
+                  PROPAGATE_REPL);
+        rpoplpushHandlePush(receiver, dstkey, dstobj,
+                            value);
+        /* Propagate the LPUSH operation. */
+        argv[0] = shared.lpush;
+        argv[1] = dstkey;
+        argv[2] = value;
+        propagate(server.lpushCommand,
+                  db->id, argv, 3,
+                  PROPAGATE_AOF |
+                  PROPAGATE_REPL);
+
+        /* Notify event ("lpush" was notified by rpoplpushHandlePush). */
+        notifyKeyspaceEvent(NOTIFY_LIST, "rpop", key, receiver->db->id);
     } else {
-        /* BRPOPLPUSH */
-        robj *dstobj =
-                lookupKeyWrite(receiver->db, dstkey);
-        if (!(dstobj &&
-              checkType(receiver, dstobj, OBJ_LIST))) {
-            /* Propagate the RPOP operation. */
-            argv[0] = shared.rpop;
-            argv[1] = key;
-            propagate(server.rpopCommand,
-                      db->id, argv, 2,
-                      PROPAGATE_AOF |
-                      PROPAGATE_REPL);
-            rpoplpushHandlePush(receiver, dstkey, dstobj,
-                                value);
-            /* Propagate the LPUSH operation. */
-            argv[0] = shared.lpush;
-            argv[1] = dstkey;
-            argv[2] = value;
-            propagate(server.lpushCommand,
-                      db->id, argv, 3,
-                      PROPAGATE_AOF |
-                      PROPAGATE_REPL);
-
-            /* Notify event ("lpush" was notified by rpoplpushHandlePush). */
-            notifyKeyspaceEvent(NOTIFY_LIST, "rpop", key, receiver->db->id);
-        } else {
-            /* BRPOPLPUSH failed because of wrong
-             * destination type. */
-            return C_ERR;
-        }
+        /* BRPOPLPUSH failed because of wrong
+         * destination type. */
+        return C_ERR;
     }
     return C_OK;
 }
@@ -755,11 +838,13 @@ void blockingPopGenericCommand(client *c, int where) {
     /* If we are inside a MULTI/EXEC and the list is empty the only thing
      * we can do is treating it as a timeout (even with timeout 0). */
     if (c->flags & CLIENT_MULTI) {
-        addReply(c, shared.nullmultibulk);
+        addReply(c, shared.nullarray[c->resp]);
         return;
     }
 
     /* If the list is empty or the key does not exists we must block */
+    c->bpop.list_where = where;
+    c->bpop.list_count = 0;
     blockForKeys(c, BLOCKED_LIST, c->argv + 1, c->argc - 2, timeout, NULL, NULL);
 }
 
@@ -784,9 +869,11 @@ void brpoplpushCommand(client *c) {
         if (c->flags & CLIENT_MULTI) {
             /* Blocking against an empty list in a multi state
              * returns immediately. */
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
         } else {
             /* The list is empty and the client blocks. */
+            c->bpop.list_where = LIST_TAIL;
+            c->bpop.list_count = 0;
             blockForKeys(c, BLOCKED_LIST, c->argv + 1, 1, timeout, c->argv[2], NULL);
         }
     } else {
@@ -800,3 +887,102 @@ void brpoplpushCommand(client *c) {
         }
     }
 }
+
+/* LMPOP/BLMPOP
+ *
+ * 'numkeys_idx' is the index of the numkeys argument: 1 for LMPOP and 2 for
+ * BLMPOP, that takes the timeout as first argument. The elements are popped
+ * from the first non empty list, and the command is replicated as an LMPOP
+ * of that list with the number of elements actually popped. */
+void lmpopGenericCommand(client *c, int numkeys_idx, int is_block) {
+    long numkeys, count = 1;
+    mstime_t timeout = 0;
+    int where, j;
+
+    if (is_block &&
+        getTimeoutFromObjectOrReply(c, c->argv[1], &timeout, UNIT_SECONDS)
+        != C_OK)
+        return;
+
+    if (getLongFromObjectOrReply(c, c->argv[numkeys_idx], &numkeys, NULL)
+        != C_OK)
+        return;
+    if (numkeys <= 0) {
+        addReplyError(c, "numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > c->argc - numkeys_idx - 2) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+
+    /* Parse the direction and the optional COUNT. */
+    j = numkeys_idx + 1 + numkeys;
+    if (!strcasecmp(c->argv[j]->ptr, "left")) {
+        where = LIST_HEAD;
+    } else if (!strcasecmp(c->argv[j]->ptr, "right")) {
+        where = LIST_TAIL;
+    } else {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+    j++;
+    if (j < c->argc) {
+        if (j + 2 != c->argc || strcasecmp(c->argv[j]->ptr, "count")) {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+        if (getLongFromObjectOrReply(c, c->argv[j + 1], &count, NULL) != C_OK)
+            return;
+        if (count <= 0) {
+            addReplyError(c, "count should be greater than 0");
+            return;
+        }
+    }
+
+    for (j = numkeys_idx + 1; j < numkeys_idx + 1 + numkeys; j++) {
+        robj *key = c->argv[j];
+        robj *o = lookupKeyWrite(c->db, key);
+        if (o == NULL) continue;
+        if (checkType(c, o, OBJ_LIST)) return;
+
+        long popped = listPopRangeAndReply(c, o, key, where, count);
+        incrRefCount(key); /* Protect the key from the rewrite below. */
+        if (listTypeLength(o) == 0) {
+            dbDelete(c->db, key);
+            notifyKeyspaceEvent(NOTIFY_GENERIC, "del", key, c->db->id);
+        }
+        signalModifiedKey(c->db, key);
+        server.dirty += popped;
+
+        /* Replicate the pop of this key only. */
+        int argc;
+        robj **argv = listPopCommandVector(key, where, popped, &argc);
+        replaceClientCommandVector(c, argc, argv);
+        decrRefCount(key);
+        return;
+    }
+
+    /* If we are inside a MULTI/EXEC and the lists are empty the only thing
+     * we can do is treating it as a timeout (even with timeout 0). */
+    if (!is_block || (c->flags & CLIENT_MULTI)) {
+        addReply(c, shared.nullarray[c->resp]);
+        return;
+    }
+
+    /* If the lists are empty or the keys don't exist we must block */
+    c->bpop.list_where = where;
+    c->bpop.list_count = count;
+    blockForKeys(c, BLOCKED_LIST, c->argv + numkeys_idx + 1, numkeys, timeout,
+                 NULL, NULL);
+}
+
+/* LMPOP numkeys key [key ...] LEFT|RIGHT [COUNT count] */
+void lmpopCommand(client *c) {
+    lmpopGenericCommand(c, 1, 0);
+}
+
+/* BLMPOP timeout numkeys key [key ...] LEFT|RIGHT [COUNT count] */
+void blmpopCommand(client *c) {
+    lmpopGenericCommand(c, 2, 1);
+}
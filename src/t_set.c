@@ -59,22 +59,15 @@ int setTypeAdd(robj *subject, sds value) {
             dictSetVal(ht,de,NULL);
             return 1;
         }
-    } else if (subject->encoding == OBJ_ENCODING_INTSET) {
+    } else if (subject->encoding == OBJ_ENCODING_INTSET ||
+               subject->encoding == OBJ_ENCODING_ROARING) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
-            uint8_t success = 0;
-            subject->ptr = intsetAdd(subject->ptr,llval,&success);
-            if (success) {
-                /* Convert to regular set when the intset contains
-                 * too many entries. */
-                if (intsetLen(subject->ptr) > server.set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
-                return 1;
-            }
+            return setTypeAddInteger(subject,llval);
         } else {
             /* Failed to get integer from object, convert to regular set. */
             setTypeConvert(subject,OBJ_ENCODING_HT);
 
-            /* The set *was* an intset and this value is not integer
+            /* The set *was* an integer set and this value is not integer
              * encodable, so dictAdd should always work. */
             serverAssert(dictAdd(subject->ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
@@ -85,6 +78,32 @@ int setTypeAdd(robj *subject, sds value) {
     return 0;
 }
 
+/* Like setTypeAdd() but for an integer value, that is added to integer
+ * encoded sets without converting it into a string. */
+int setTypeAddInteger(robj *subject, long long llval) {
+    if (subject->encoding == OBJ_ENCODING_INTSET) {
+        uint8_t success = 0;
+        subject->ptr = intsetAdd(subject->ptr,llval,&success);
+        if (success) {
+            /* Convert to a roaring set when the intset contains
+             * too many entries. */
+            if (intsetLen(subject->ptr) > server.set_max_intset_entries)
+                setTypeConvert(subject,OBJ_ENCODING_ROARING);
+            return 1;
+        }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringAdd(subject->ptr,llval);
+    } else if (subject->encoding == OBJ_ENCODING_HT) {
+        sds value = sdsfromlonglong(llval);
+        int added = setTypeAdd(subject,value);
+        sdsfree(value);
+        return added;
+    } else {
+        serverPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
 int setTypeRemove(robj *setobj, sds value) {
     long long llval;
     if (setobj->encoding == OBJ_ENCODING_HT) {
@@ -92,12 +111,28 @@ int setTypeRemove(robj *setobj, sds value) {
             if (htNeedsResize(setobj->ptr)) dictResize(setobj->ptr);
             return 1;
         }
-    } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
-        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
-            int success;
-            setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
-            if (success) return 1;
-        }
+    } else if (setobj->encoding == OBJ_ENCODING_INTSET ||
+               setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return setTypeRemoveInteger(setobj,llval);
+    } else {
+        serverPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
+int setTypeRemoveInteger(robj *setobj, long long llval) {
+    if (setobj->encoding == OBJ_ENCODING_INTSET) {
+        int success;
+        setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
+        return success;
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        return roaringRemove(setobj->ptr,llval);
+    } else if (setobj->encoding == OBJ_ENCODING_HT) {
+        sds value = sdsfromlonglong(llval);
+        int removed = setTypeRemove(setobj,value);
+        sdsfree(value);
+        return removed;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -108,10 +143,26 @@ int setTypeIsMember(robj *subject, sds value) {
     long long llval;
     if (subject->encoding == OBJ_ENCODING_HT) {
         return dictFind((dict*)subject->ptr,value) != NULL;
-    } else if (subject->encoding == OBJ_ENCODING_INTSET) {
-        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
-            return intsetFind((intset*)subject->ptr,llval);
-        }
+    } else if (subject->encoding == OBJ_ENCODING_INTSET ||
+               subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return setTypeIsMemberInteger(subject,llval);
+    } else {
+        serverPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
+int setTypeIsMemberInteger(robj *subject, long long llval) {
+    if (subject->encoding == OBJ_ENCODING_INTSET) {
+        return intsetFind((intset*)subject->ptr,llval);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringContains(subject->ptr,llval);
+    } else if (subject->encoding == OBJ_ENCODING_HT) {
+        sds value = sdsfromlonglong(llval);
+        int ismember = setTypeIsMember(subject,value);
+        sdsfree(value);
+        return ismember;
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -126,6 +177,8 @@ setTypeIterator *setTypeInitIterator(robj *subject) {
         si->di = dictGetIterator(subject->ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringInitIterator(&si->ri,subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -161,6 +214,9 @@ int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
         if (!intsetGet(si->subject->ptr,si->ii++,llele))
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        if (!roaringNext(&si->ri,llele)) return -1;
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -183,6 +239,7 @@ sds setTypeNextObject(setTypeIterator *si) {
     switch(encoding) {
         case -1:    return NULL;
         case OBJ_ENCODING_INTSET:
+        case OBJ_ENCODING_ROARING:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
             return sdsdup(sdsele);
@@ -194,8 +251,8 @@ sds setTypeNextObject(setTypeIterator *si) {
 
 /* Return random element from a non empty set.
  * The returned element can be a int64_t value if the set is encoded
- * as an "intset" blob of integers, or an SDS string if the set
- * is a regular set.
+ * as an "intset" blob of integers or as a roaring set, or an SDS string
+ * if the set is a regular set.
  *
  * The caller provides both pointers to be populated with the right
  * object. The return value of the function is the object->encoding
@@ -213,6 +270,9 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom(setobj->ptr);
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom(setobj->ptr);
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -224,6 +284,8 @@ unsigned long setTypeSize(const robj *subject) {
         return dictSize((const dict*)subject->ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringCard((const roaring*)subject->ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -231,19 +293,25 @@ unsigned long setTypeSize(const robj *subject) {
 
 /* Convert the set to specified encoding. The resulting dict (when converting
  * to a hash table) is presized to hold the number of elements in the original
- * set. */
+ * set.
+ *
+ * Integer sets can be converted between the intset and roaring encodings,
+ * or to a hash table when a non integer element is added. */
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
+    int64_t intele;
+    sds element;
+    void *newptr;
+
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             setobj->encoding != OBJ_ENCODING_HT &&
+                             setobj->encoding != enc);
 
     if (enc == OBJ_ENCODING_HT) {
-        int64_t intele;
         dict *d = dictCreate(&setDictType,NULL);
-        sds element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen(setobj->ptr));
+        dictExpand(d,setTypeSize(setobj));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
@@ -252,13 +320,30 @@ void setTypeConvert(robj *setobj, int enc) {
             serverAssert(dictAdd(d,element,NULL) == DICT_OK);
         }
         setTypeReleaseIterator(si);
+        newptr = d;
+    } else if (enc == OBJ_ENCODING_ROARING) {
+        roaring *r = roaringNew();
 
-        setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->ptr);
-        setobj->ptr = d;
+        si = setTypeInitIterator(setobj);
+        while (setTypeNext(si,&element,&intele) != -1) roaringAdd(r,intele);
+        setTypeReleaseIterator(si);
+        newptr = r;
+    } else if (enc == OBJ_ENCODING_INTSET) {
+        intset *is = intsetNew();
+
+        /* Elements are returned in order, so every intsetAdd() appends. */
+        si = setTypeInitIterator(setobj);
+        while (setTypeNext(si,&element,&intele) != -1)
+            is = intsetAdd(is,intele,NULL);
+        setTypeReleaseIterator(si);
+        newptr = is;
     } else {
         serverPanic("Unsupported set conversion");
     }
+
+    freeSetObject(setobj);
+    setobj->encoding = enc;
+    setobj->ptr = newptr;
 }
 
 void saddCommand(client *c) {
@@ -475,10 +560,10 @@ void spopWithCountCommand(client *c) {
         while(count--) {
             /* Emit and remove. */
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
-                set->ptr = intsetRemove(set->ptr,llele,NULL);
+                setTypeRemoveInteger(set,llele);
             } else {
                 addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
                 objele = createStringObject(sdsele,sdslen(sdsele));
@@ -505,7 +590,7 @@ void spopWithCountCommand(client *c) {
         /* Create a new set with just the remaining elements. */
         while(remaining--) {
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 sdsele = sdsfromlonglong(llele);
             } else {
                 sdsele = sdsdup(sdsele);
@@ -520,7 +605,7 @@ void spopWithCountCommand(client *c) {
         setTypeIterator *si;
         si = setTypeInitIterator(set);
         while((encoding = setTypeNext(si,&sdsele,&llele)) != -1) {
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
             } else {
@@ -566,16 +651,16 @@ void spopCommand(client *c) {
 
     /* Make sure a key with the name inputted exists, and that it's type is
      * indeed a set */
-    if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,set,OBJ_SET)) return;
 
     /* Get a random element from the set */
     encoding = setTypeRandomElement(set,&sdsele,&llele);
 
     /* Remove the element from the set */
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (encoding != OBJ_ENCODING_HT) {
         ele = createStringObjectFromLongLong(llele);
-        set->ptr = intsetRemove(set->ptr,llele,NULL);
+        setTypeRemoveInteger(set,llele);
     } else {
         ele = createStringObject(sdsele,sdslen(sdsele));
         setTypeRemove(set,ele->ptr);
@@ -650,7 +735,7 @@ void srandmemberWithCountCommand(client *c) {
         addReplyMultiBulkLen(c,count);
         while(count--) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 addReplyBulkLongLong(c,llele);
             } else {
                 addReplyBulkCBuffer(c,ele,sdslen(ele));
@@ -687,7 +772,7 @@ void srandmemberWithCountCommand(client *c) {
         while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             int retval = DICT_ERR;
 
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
             } else {
                 retval = dictAdd(d,createStringObject(ele,sdslen(ele)),NULL);
@@ -717,7 +802,7 @@ void srandmemberWithCountCommand(client *c) {
 
         while(added < count) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
+            if (encoding != OBJ_ENCODING_HT) {
                 objele = createStringObjectFromLongLong(llele);
             } else {
                 objele = createStringObject(ele,sdslen(ele));
@@ -760,11 +845,11 @@ void srandmemberCommand(client *c) {
         return;
     }
 
-    if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+    if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.null[c->resp])) == NULL ||
         checkType(c,set,OBJ_SET)) return;
 
     encoding = setTypeRandomElement(set,&ele,&llele);
-    if (encoding == OBJ_ENCODING_INTSET) {
+    if (encoding != OBJ_ENCODING_HT) {
         addReplyBulkLongLong(c,llele);
     } else {
         addReplyBulkCBuffer(c,ele,sdslen(ele));
@@ -813,7 +898,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
                 }
                 addReply(c,shared.czero);
             } else {
-                addReply(c,shared.emptymultibulk);
+                addReply(c,shared.emptyset[c->resp]);
             }
             return;
         }
@@ -840,6 +925,61 @@ void sinterGenericCommand(client *c, robj **setkeys,
         dstset = createIntsetObject();
     }
 
+    /* When all the sets are intsets we can intersect the sorted arrays
+     * directly, see intsetIntersect(). */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != OBJ_ENCODING_INTSET) break;
+    if (j == setnum) {
+        intset **intsets = zmalloc(sizeof(intset*)*setnum);
+        intset *inter;
+
+        for (j = 0; j < setnum; j++) intsets[j] = sets[j]->ptr;
+        inter = intsetIntersect(intsets,setnum);
+        zfree(intsets);
+        if (!dstkey) {
+            for (j = 0; j < intsetLen(inter); j++) {
+                intsetGet(inter,j,&intobj);
+                addReplyBulkLongLong(c,intobj);
+            }
+            cardinality = intsetLen(inter);
+            zfree(inter);
+        } else {
+            zfree(dstset->ptr);
+            dstset->ptr = inter;
+            if (intsetLen(inter) > server.set_max_intset_entries)
+                setTypeConvert(dstset,OBJ_ENCODING_ROARING);
+        }
+        goto reply;
+    }
+
+    /* The same when all the sets are roaring sets: see roaringIntersect(). */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != OBJ_ENCODING_ROARING) break;
+    if (j == setnum) {
+        roaring **rsets = zmalloc(sizeof(roaring*)*setnum);
+        roaring *inter;
+
+        for (j = 0; j < setnum; j++) rsets[j] = sets[j]->ptr;
+        inter = roaringIntersect(rsets,setnum);
+        zfree(rsets);
+        if (!dstkey) {
+            roaringIterator ri;
+
+            roaringInitIterator(&ri,inter);
+            while(roaringNext(&ri,&intobj)) addReplyBulkLongLong(c,intobj);
+            cardinality = roaringCard(inter);
+            roaringFree(inter);
+        } else {
+            freeSetObject(dstset);
+            dstset->ptr = inter;
+            dstset->encoding = OBJ_ENCODING_ROARING;
+            if (roaringCard(inter) &&
+                roaringCard(inter) <= server.set_max_intset_entries)
+                setTypeConvert(dstset,OBJ_ENCODING_INTSET);
+        }
+        goto reply;
+    }
+
     /* Iterate all the elements of the first (smallest) set, and test
      * the element against all the other sets, if at least one set does
      * not include the element it is discarded */
@@ -847,23 +987,11 @@ void sinterGenericCommand(client *c, robj **setkeys,
     while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
         for (j = 1; j < setnum; j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
-                /* intset with intset is simple... and fast */
-                if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,intobj))
-                {
-                    break;
-                /* in order to compare an integer with an object we
-                 * have to use the generic function, creating an object
-                 * for this */
-                } else if (sets[j]->encoding == OBJ_ENCODING_HT) {
-                    elesds = sdsfromlonglong(intobj);
-                    if (!setTypeIsMember(sets[j],elesds)) {
-                        sdsfree(elesds);
-                        break;
-                    }
-                    sdsfree(elesds);
-                }
+            if (encoding != OBJ_ENCODING_HT) {
+                /* Integers are checked directly against integer sets,
+                 * while to compare an integer with an object
+                 * setTypeIsMemberInteger() creates an object for this. */
+                if (!setTypeIsMemberInteger(sets[j],intobj)) break;
             } else if (encoding == OBJ_ENCODING_HT) {
                 if (!setTypeIsMember(sets[j],elesds)) {
                     break;
@@ -880,10 +1008,8 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     addReplyBulkLongLong(c,intobj);
                 cardinality++;
             } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
-                    elesds = sdsfromlonglong(intobj);
-                    setTypeAdd(dstset,elesds);
-                    sdsfree(elesds);
+                if (encoding != OBJ_ENCODING_HT) {
+                    setTypeAddInteger(dstset,intobj);
                 } else {
                     setTypeAdd(dstset,elesds);
                 }
@@ -892,6 +1018,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
     }
     setTypeReleaseIterator(si);
 
+reply:
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
@@ -911,7 +1038,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
         signalModifiedKey(c->db,dstkey);
         server.dirty++;
     } else {
-        setDeferredMultiBulkLength(c,replylen,cardinality);
+        setDeferredSetLen(c,replylen,cardinality);
     }
     zfree(sets);
 }
@@ -934,7 +1061,8 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
     setTypeIterator *si;
     robj *dstset = NULL;
     sds ele;
-    int j, cardinality = 0;
+    int64_t llele;
+    int j, encoding, cardinality = 0;
     int diff_algo = 1;
 
     for (j = 0; j < setnum; j++) {
@@ -997,9 +1125,10 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
             if (!sets[j]) continue; /* non existing keys are like empty sets */
 
             si = setTypeInitIterator(sets[j]);
-            while((ele = setTypeNextObject(si)) != NULL) {
-                if (setTypeAdd(dstset,ele)) cardinality++;
-                sdsfree(ele);
+            while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
+                if (encoding != OBJ_ENCODING_HT ?
+                    setTypeAddInteger(dstset,llele) :
+                    setTypeAdd(dstset,ele)) cardinality++;
             }
             setTypeReleaseIterator(si);
         }
@@ -1013,18 +1142,22 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
          * This way we perform at max N*M operations, where N is the size of
          * the first set, and M the number of sets. */
         si = setTypeInitIterator(sets[0]);
-        while((ele = setTypeNextObject(si)) != NULL) {
+        while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             for (j = 1; j < setnum; j++) {
                 if (!sets[j]) continue; /* no key is an empty set. */
                 if (sets[j] == sets[0]) break; /* same set! */
-                if (setTypeIsMember(sets[j],ele)) break;
+                if (encoding != OBJ_ENCODING_HT ?
+                    setTypeIsMemberInteger(sets[j],llele) :
+                    setTypeIsMember(sets[j],ele)) break;
             }
             if (j == setnum) {
                 /* There is no other set with this element. Add it. */
-                setTypeAdd(dstset,ele);
+                if (encoding != OBJ_ENCODING_HT)
+                    setTypeAddInteger(dstset,llele);
+                else
+                    setTypeAdd(dstset,ele);
                 cardinality++;
             }
-            sdsfree(ele);
         }
         setTypeReleaseIterator(si);
     } else if (op == SET_OP_DIFF && sets[0] && diff_algo == 2) {
@@ -1039,13 +1172,16 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
             if (!sets[j]) continue; /* non existing keys are like empty sets */
 
             si = setTypeInitIterator(sets[j]);
-            while((ele = setTypeNextObject(si)) != NULL) {
+            while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
                 if (j == 0) {
-                    if (setTypeAdd(dstset,ele)) cardinality++;
+                    if (encoding != OBJ_ENCODING_HT ?
+                        setTypeAddInteger(dstset,llele) :
+                        setTypeAdd(dstset,ele)) cardinality++;
                 } else {
-                    if (setTypeRemove(dstset,ele)) cardinality--;
+                    if (encoding != OBJ_ENCODING_HT ?
+                        setTypeRemoveInteger(dstset,llele) :
+                        setTypeRemove(dstset,ele)) cardinality--;
                 }
-                sdsfree(ele);
             }
             setTypeReleaseIterator(si);
 
@@ -1057,11 +1193,13 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
 
     /* Output the content of the resulting set, if not in STORE mode */
     if (!dstkey) {
-        addReplyMultiBulkLen(c,cardinality);
+        addReplySetLen(c,cardinality);
         si = setTypeInitIterator(dstset);
-        while((ele = setTypeNextObject(si)) != NULL) {
-            addReplyBulkCBuffer(c,ele,sdslen(ele));
-            sdsfree(ele);
+        while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
+            if (encoding != OBJ_ENCODING_HT)
+                addReplyBulkLongLong(c,llele);
+            else
+                addReplyBulkCBuffer(c,ele,sdslen(ele));
         }
         setTypeReleaseIterator(si);
         decrRefCount(dstset);
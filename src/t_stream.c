@@ -42,7 +42,7 @@
 
 void streamFreeCG(streamCG *cg);
 void streamFreeNACK(streamNACK *na);
-size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamConsumer *consumer);
+size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamCG *group, streamConsumer *consumer);
 
 /* -----------------------------------------------------------------------
  * Low level stream encoding: a radix tree of listpacks.
@@ -360,35 +360,146 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
     return C_OK;
 }
 
-/* Trim the stream 's' to have no more than maxlen elements, and return the
- * number of elements removed from the stream. The 'approx' option, if non-zero,
- * specifies that the trimming must be performed in a approximated way in
- * order to maximize performances. This means that the stream may contain
- * more elements than 'maxlen', and elements are only removed if we can remove
- * a *whole* node of the radix tree. The elements are removed from the head
- * of the stream (older elements).
+/* When a stream node has more than STREAM_COMPACT_MIN_DELETED entries flagged
+ * as deleted, and they are more than the valid ones, its listpack is rewritten
+ * without them, see streamCompactListpack(). */
+#define STREAM_COMPACT_MIN_DELETED 10
+
+int streamNodeNeedsCompaction(int64_t valid, int64_t deleted) {
+    return deleted > STREAM_COMPACT_MIN_DELETED && deleted > valid;
+}
+
+/* Append to 'dst' a copy of the listpack element pointed by 'p'. */
+static unsigned char *lpAppendCopy(unsigned char *dst, unsigned char *p) {
+    unsigned char buf[LP_INTBUF_SIZE];
+    int64_t len;
+    unsigned char *ele = lpGet(p,&len,buf);
+    return lpAppend(dst,ele,len);
+}
+
+/* Rewrite the listpack 'lp' of a stream node dropping the entries flagged
+ * as deleted, and return the new listpack (the old one is freed).
+ *
+ * The master entry is copied as it is, with the deleted counter set to zero:
+ * since the IDs and the SAMEFIELDS compression of the remaining entries are
+ * relative to the master entry (and the node key), they are still valid and
+ * the entries are copied verbatim. */
+unsigned char *streamCompactListpack(unsigned char *lp) {
+    unsigned char *new = lpNew();
+    unsigned char *p = lpFirst(lp);
+
+    new = lpAppendCopy(new,p);          /* Valid entries count. */
+    p = lpNext(lp,p);
+    new = lpAppendInteger(new,0);       /* No more deleted entries. */
+    p = lpNext(lp,p);
+    int64_t master_fields_count = lpGetInteger(p);
+    new = lpAppendCopy(new,p);
+    p = lpNext(lp,p);
+    for (int64_t j = 0; j < master_fields_count; j++) {
+        new = lpAppendCopy(new,p);
+        p = lpNext(lp,p);
+    }
+    new = lpAppendCopy(new,p);          /* Master entry zero terminator. */
+    p = lpNext(lp,p);
+
+    while(p) {
+        int flags = lpGetInteger(p);
+        unsigned char *q = p;
+
+        /* Count the listpack elements of this entry: flags, ms and seq
+         * deltas, the fields (or values only), and the final lp-count. */
+        int64_t elements = 3;
+        q = lpNext(lp,q); /* Seek ms delta. */
+        q = lpNext(lp,q); /* Seek seq delta. */
+        q = lpNext(lp,q); /* Seek num-fields or values (if compressed). */
+        if (flags & STREAM_ITEM_FLAG_SAMEFIELDS)
+            elements += master_fields_count;
+        else
+            elements += 1+lpGetInteger(q)*2;
+        elements++;
+
+        while(elements--) {
+            if (!(flags & STREAM_ITEM_FLAG_DELETED)) new = lpAppendCopy(new,p);
+            p = lpNext(lp,p);
+        }
+    }
+    lpFree(lp);
+    return new;
+}
+
+/* Return 1 if all the entries of the stream node the iterator 'ri' is
+ * positioned at have an ID smaller than 'id', without scanning the node:
+ * the entries of a node are all smaller than the master ID of the next node,
+ * and the entries of the last node can't be greater than the stream last
+ * ID. */
+static int streamNodeIsBeforeID(stream *s, raxIterator *ri, streamID *id) {
+    raxIterator next;
+    streamID edge;
+    int retval;
+
+    raxStart(&next,s->rax);
+    raxSeek(&next,">",ri->key,ri->key_len);
+    if (raxNext(&next)) {
+        streamDecodeID(next.key,&edge);
+        retval = streamCompareID(&edge,id) <= 0;
+    } else {
+        retval = streamCompareID(&s->last_id,id) < 0;
+    }
+    raxStop(&next);
+    return retval;
+}
+
+/* Trim the stream 's' according to 'args', and return the number of elements
+ * removed from the stream. The elements are removed from the head of the
+ * stream (older elements), using one of the following strategies:
+ *
+ * TRIM_STRATEGY_MAXLEN: the stream will have no more than args->maxlen
+ *                       elements.
+ * TRIM_STRATEGY_MINID:  all the elements having an ID smaller than
+ *                       args->minid are evicted.
+ *
+ * The 'approx' option, if non-zero, specifies that the trimming must be
+ * performed in a approximated way in order to maximize performances. This
+ * means that the stream may contain more elements than wanted, and elements
+ * are only removed if we can remove a *whole* node of the radix tree.
+ * In this mode, args->limit (if non zero) caps the number of elements
+ * removed by a single call, so that the trimming done by XADD has a bounded
+ * cost.
  *
  * The function may return zero if:
  *
- * 1) The stream is already shorter or equal to the specified max length.
+ * 1) There was nothing to trim.
  * 2) The 'approx' option is true and the head node had not enough elements
- *    to be deleted, leaving the stream with a number of elements >= maxlen.
+ *    to be deleted, or removing it would exceed the limit.
  */
-int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
-    if (s->length <= maxlen) return 0;
+int64_t streamTrim(stream *s, streamTrimArgs *args) {
+    size_t maxlen = args->maxlen;
+    streamID *minid = &args->minid;
+    int maxlen_strategy = args->strategy == TRIM_STRATEGY_MAXLEN;
+
+    if (s->length == 0) return 0;
+    if (maxlen_strategy && s->length <= maxlen) return 0;
 
     raxIterator ri;
     raxStart(&ri,s->rax);
     raxSeek(&ri,"^",NULL,0);
 
     int64_t deleted = 0;
-    while(s->length > maxlen && raxNext(&ri)) {
+    while(raxNext(&ri)) {
+        if (maxlen_strategy && s->length <= maxlen) break;
+
         unsigned char *lp = ri.data, *p = lpFirst(lp);
         int64_t entries = lpGetInteger(p);
 
         /* Check if we can remove the whole node, and still have at
-         * least maxlen elements. */
-        if (s->length - entries >= maxlen) {
+         * least maxlen elements / only elements >= minid. */
+        int remove_node = maxlen_strategy ?
+                          s->length - entries >= maxlen :
+                          streamNodeIsBeforeID(s,&ri,minid);
+        if (remove_node) {
+            /* Don't exceed the amount of work we are allowed to do. */
+            if (args->approx && args->limit && deleted + entries > args->limit)
+                break;
             lpFree(lp);
             raxRemove(s->rax,ri.key,ri.key_len,NULL);
             raxSeek(&ri,">=",ri.key,ri.key_len);
@@ -399,16 +510,14 @@ int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
 
         /* If we cannot remove a whole element, and approx is true,
          * stop here. */
-        if (approx) break;
+        if (args->approx) break;
 
         /* Otherwise, we have to mark single entries inside the listpack
-         * as deleted. We start by updating the entries/deleted counters. */
-        int64_t to_delete = s->length - maxlen;
-        serverAssert(to_delete < entries);
-        lp = lpReplaceInteger(lp,&p,entries-to_delete);
+         * as deleted. */
+        streamID master_id;
+        streamDecodeID(ri.key,&master_id);
         p = lpNext(lp,p); /* Seek deleted field. */
         int64_t marked_deleted = lpGetInteger(p);
-        lp = lpReplaceInteger(lp,&p,marked_deleted+to_delete);
         p = lpNext(lp,p); /* Seek num-of-fields in the master entry. */
 
         /* Skip all the master fields. */
@@ -421,17 +530,29 @@ int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
         /* 'p' is now pointing to the first entry inside the listpack.
          * We have to run entry after entry, marking entries as deleted
          * if they are already not deleted. */
+        int64_t node_deleted = 0;
         while(p) {
             int flags = lpGetInteger(p);
             int to_skip;
 
+            /* With MINID stop at the first entry that should be kept. */
+            if (!maxlen_strategy) {
+                streamID currid;
+                unsigned char *q = lpNext(lp,p);
+                currid.ms = master_id.ms + lpGetInteger(q);
+                q = lpNext(lp,q);
+                currid.seq = master_id.seq + lpGetInteger(q);
+                if (streamCompareID(&currid,minid) >= 0) break;
+            }
+
             /* Mark the entry as deleted. */
             if (!(flags & STREAM_ITEM_FLAG_DELETED)) {
                 flags |= STREAM_ITEM_FLAG_DELETED;
                 lp = lpReplaceInteger(lp,&p,flags);
-                deleted++;
+                node_deleted++;
                 s->length--;
-                if (s->length <= maxlen) break; /* Enough entries deleted. */
+                if (maxlen_strategy && s->length <= maxlen)
+                    break; /* Enough entries deleted. */
             }
 
             p = lpNext(lp,p); /* Skip ID ms delta. */
@@ -447,14 +568,25 @@ int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
             while(to_skip--) p = lpNext(lp,p); /* Skip the whole entry. */
             p = lpNext(lp,p); /* Skip the final lp-count field. */
         }
+        deleted += node_deleted;
 
-        /* Here we should perform garbage collection in case at this point
-         * there are too many entries deleted inside the listpack. */
-        entries -= to_delete;
-        marked_deleted += to_delete;
-        if (entries + marked_deleted > 10 && marked_deleted > entries/2) {
-            /* TODO: perform a garbage collection. */
+        /* Update the entries/deleted counters. */
+        entries -= node_deleted;
+        marked_deleted += node_deleted;
+        if (entries == 0) {
+            /* Every entry of the node was older than MINID. */
+            lpFree(lp);
+            raxRemove(s->rax,ri.key,ri.key_len,NULL);
+            break;
         }
+        p = lpFirst(lp);
+        lp = lpReplaceInteger(lp,&p,entries);
+        p = lpNext(lp,p); /* Seek deleted field. */
+        lp = lpReplaceInteger(lp,&p,marked_deleted);
+
+        /* Get rid of the deleted entries if they are now the majority. */
+        if (streamNodeNeedsCompaction(entries,marked_deleted))
+            lp = streamCompactListpack(lp);
 
         /* Update the listpack with the new pointer. */
         raxInsert(s->rax,ri.key,ri.key_len,lp,NULL);
@@ -724,11 +856,18 @@ void streamIteratorRemoveEntry(streamIterator *si, streamID *current) {
         raxRemove(si->stream->rax,si->ri.key,si->ri.key_len,NULL);
     } else {
         /* In the base case we alter the counters of valid/deleted entries. */
-        lp = lpReplaceInteger(lp,&p,aux-1);
+        int64_t valid = aux-1;
+        lp = lpReplaceInteger(lp,&p,valid);
         p = lpNext(lp,p); /* Seek deleted field. */
         aux = lpGetInteger(p);
         lp = lpReplaceInteger(lp,&p,aux+1);
 
+        /* Get rid of the deleted entries if they are now the majority:
+         * the iterator is re-seeked below, so it's safe to replace the
+         * listpack. */
+        if (streamNodeNeedsCompaction(valid,aux+1))
+            lp = streamCompactListpack(lp);
+
         /* Update the listpack with the new pointer. */
         if (si->lp != lp)
             raxInsert(si->stream->rax,si->ri.key,si->ri.key_len,lp,NULL);
@@ -748,9 +887,6 @@ void streamIteratorRemoveEntry(streamIterator *si, streamID *current) {
     }
     streamIteratorStop(si);
     streamIteratorStart(si,si->stream,&start,&end,si->rev);
-
-    /* TODO: perform a garbage collection here if the ration between
-     * deleted and valid goes over a certain limit. */
 }
 
 /* Stop the stream iterator. The only cleanup we need is to free the rax
@@ -913,7 +1049,7 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
      * as delivered. */
     if (group && (flags & STREAM_RWR_HISTORY)) {
         return streamReplyWithRangeFromConsumerPEL(c,s,start,end,count,
-                                                   consumer);
+                                                   group,consumer);
     }
 
     if (!(flags & STREAM_RWR_RAWENTRIES))
@@ -973,12 +1109,14 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
                 raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
                 /* Update the consumer and NACK metadata. */
                 nack->consumer = consumer;
-                nack->delivery_time = mstime();
+                streamSetNACKDeliveryTime(group,buf,nack,mstime());
                 nack->delivery_count = 1;
                 /* Add the entry in the new consumer local PEL. */
                 raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
             } else if (group_inserted == 1 && consumer_inserted == 0) {
                 serverPanic("NACK half-created. Should not be possible.");
+            } else {
+                streamIndexNACK(group,buf,nack);
             }
 
             /* Propagate as XCLAIM. */
@@ -1013,7 +1151,7 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
  * seek into the radix tree of the messages in order to emit the full message
  * to the client. However clients only reach this code path when they are
  * fetching the history of already retrieved messages, which is rare. */
-size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamConsumer *consumer) {
+size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start, streamID *end, size_t count, streamCG *group, streamConsumer *consumer) {
     raxIterator ri;
     unsigned char startkey[sizeof(streamID)];
     unsigned char endkey[sizeof(streamID)];
@@ -1039,10 +1177,10 @@ size_t streamReplyWithRangeFromConsumerPEL(client *c, stream *s, streamID *start
             streamID id;
             streamDecodeID(ri.key,&id);
             addReplyStreamID(c,&id);
-            addReply(c,shared.nullmultibulk);
+            addReply(c,shared.nullarray[c->resp]);
         } else {
             streamNACK *nack = ri.data;
-            nack->delivery_time = mstime();
+            streamSetNACKDeliveryTime(group,ri.key,nack,mstime());
             nack->delivery_count++;
         }
         arraylen++;
@@ -1153,58 +1291,150 @@ int streamParseStrictIDOrReply(client *c, robj *o, streamID *id, uint64_t missin
     return streamGenericParseIDOrReply(c,o,id,missing_seq,1);
 }
 
-/* We propagate MAXLEN ~ <count> as MAXLEN = <resulting-len-of-stream>
- * otherwise trimming is no longer determinsitic on replicas / AOF. */
-void streamRewriteApproxMaxlen(client *c, stream *s, int maxlen_arg_idx) {
-    robj *maxlen_obj = createStringObjectFromLongLong(s->length);
+/* Parse the trimming option starting at c->argv[i], shared by XADD and
+ * XTRIM:
+ *
+ * MAXLEN [~|=] <count>     -- Cap the stream at the specified length.
+ * MINID [~|=] <id>         -- Evict the entries with an ID smaller than <id>.
+ * LIMIT <count>            -- Max number of entries evicted by a call, only
+ *                             valid with approximated (~) trimming.
+ *
+ * The function returns the index of the last argument consumed, zero if
+ * c->argv[i] is not a trimming option, or -1 if an error was sent to the
+ * client. */
+int streamParseTrimOptionOrReply(client *c, int i, streamTrimArgs *args) {
+    int moreargs = (c->argc-1) - i; /* Number of additional arguments. */
+    char *opt = c->argv[i]->ptr;
+    int maxlen = !strcasecmp(opt,"maxlen");
+
+    if ((maxlen || !strcasecmp(opt,"minid")) && moreargs) {
+        int strategy = maxlen ? TRIM_STRATEGY_MAXLEN : TRIM_STRATEGY_MINID;
+        if (args->strategy != TRIM_STRATEGY_NONE &&
+            args->strategy != strategy)
+        {
+            addReplyError(c,"syntax error, MAXLEN and MINID options at the "
+                            "same time are not compatible");
+            return -1;
+        }
+        args->strategy = strategy;
+        args->approx = 0;
+        char *next = c->argv[i+1]->ptr;
+        /* Check for the form MAXLEN/MINID ~ <threshold>. */
+        if (moreargs >= 2 && next[0] == '~' && next[1] == '\0') {
+            args->approx = 1;
+            i++;
+        } else if (moreargs >= 2 && next[0] == '=' && next[1] == '\0') {
+            i++;
+        }
+        i++;
+        if (maxlen) {
+            if (getLongLongFromObjectOrReply(c,c->argv[i],&args->maxlen,NULL)
+                != C_OK) return -1;
+            if (args->maxlen < 0) {
+                addReplyError(c,"The MAXLEN argument must be >= 0.");
+                return -1;
+            }
+        } else {
+            if (streamParseStrictIDOrReply(c,c->argv[i],&args->minid,0)
+                != C_OK) return -1;
+        }
+        args->threshold_arg_idx = i;
+        return i;
+    } else if (!strcasecmp(opt,"limit") && moreargs) {
+        i++;
+        if (getLongLongFromObjectOrReply(c,c->argv[i],&args->limit,NULL)
+            != C_OK) return -1;
+        if (args->limit < 0) {
+            addReplyError(c,"The LIMIT argument must be >= 0.");
+            return -1;
+        }
+        return i;
+    }
+    return 0;
+}
+
+/* Check the trimming options after parsing, and apply the default LIMIT
+ * of approximated trimming. 'args->limit' must be initialized to -1 before
+ * parsing, meaning no LIMIT was given. */
+int streamCheckTrimArgsOrReply(client *c, streamTrimArgs *args) {
+    if (args->limit != -1 && !args->approx) {
+        /* Approximated trimming is propagated as exact trimming, see
+         * streamRewriteApproxTrim(), so the LIMIT is ignored when the
+         * command comes from our master or from the AOF. */
+        if ((c->flags & CLIENT_MASTER) || server.loading) {
+            args->limit = 0;
+            return C_OK;
+        }
+        addReplyError(c,"syntax error, LIMIT cannot be used without the "
+                        "special ~ option");
+        return C_ERR;
+    }
+    if (args->limit == -1) {
+        /* When stream-node-max-entries is 0 nodes are bounded only by size,
+         * fall back to a fixed limit so that the work stays bounded. */
+        if (!args->approx)
+            args->limit = 0;
+        else if (server.stream_node_max_entries)
+            args->limit = 100*server.stream_node_max_entries;
+        else
+            args->limit = STREAM_TRIM_DEFAULT_LIMIT;
+    }
+    return C_OK;
+}
+
+/* We propagate MAXLEN ~ <count> as MAXLEN = <resulting-len-of-stream> and
+ * MINID ~ <id> as MINID = <first-id-of-the-stream>, otherwise trimming is
+ * no longer determinsitic on replicas / AOF. */
+void streamRewriteApproxTrim(client *c, stream *s, streamTrimArgs *args) {
+    robj *threshold_obj;
+
+    if (args->strategy == TRIM_STRATEGY_MAXLEN) {
+        threshold_obj = createStringObjectFromLongLong(s->length);
+    } else {
+        /* Everything before the first entry that is left was evicted. If
+         * the stream is now empty, all its entries were before MINID. */
+        streamID first_id = args->minid;
+        if (s->length) {
+            streamIterator si;
+            int64_t numfields;
+            streamIteratorStart(&si,s,NULL,NULL,0);
+            streamIteratorGetID(&si,&first_id,&numfields);
+            streamIteratorStop(&si);
+        }
+        threshold_obj = createObjectFromStreamID(&first_id);
+    }
     robj *equal_obj = createStringObject("=",1);
 
-    rewriteClientCommandArgument(c,maxlen_arg_idx,maxlen_obj);
-    rewriteClientCommandArgument(c,maxlen_arg_idx-1,equal_obj);
+    rewriteClientCommandArgument(c,args->threshold_arg_idx,threshold_obj);
+    rewriteClientCommandArgument(c,args->threshold_arg_idx-1,equal_obj);
 
     decrRefCount(equal_obj);
-    decrRefCount(maxlen_obj);
+    decrRefCount(threshold_obj);
 }
 
-/* XADD key [MAXLEN [~|=] <count>] <ID or *> [field value] [field value] ... */
+/* XADD key [MAXLEN|MINID [~|=] <threshold> [LIMIT <count>]] <ID or *>
+ *      [field value] [field value] ... */
 void xaddCommand(client *c) {
     streamID id;
     int id_given = 0; /* Was an ID different than "*" specified? */
-    long long maxlen = -1;  /* If left to -1 no trimming is performed. */
-    int approx_maxlen = 0;  /* If 1 only delete whole radix tree nodes, so
-                               the maxium length is not applied verbatim. */
-    int maxlen_arg_idx = 0; /* Index of the count in MAXLEN, for rewriting. */
+    streamTrimArgs trim = {.strategy = TRIM_STRATEGY_NONE, .limit = -1};
 
     /* Parse options. */
     int i = 2; /* This is the first argument position where we could
                   find an option, or the ID. */
     for (; i < c->argc; i++) {
-        int moreargs = (c->argc-1) - i; /* Number of additional arguments. */
         char *opt = c->argv[i]->ptr;
         if (opt[0] == '*' && opt[1] == '\0') {
             /* This is just a fast path for the common case of auto-ID
              * creation. */
             break;
-        } else if (!strcasecmp(opt,"maxlen") && moreargs) {
-            approx_maxlen = 0;
-            char *next = c->argv[i+1]->ptr;
-            /* Check for the form MAXLEN ~ <count>. */
-            if (moreargs >= 2 && next[0] == '~' && next[1] == '\0') {
-                approx_maxlen = 1;
-                i++;
-            } else if (moreargs >= 2 && next[0] == '=' && next[1] == '\0') {
-                i++;
-            }
-            if (getLongLongFromObjectOrReply(c,c->argv[i+1],&maxlen,NULL)
-                != C_OK) return;
-
-            if (maxlen < 0) {
-                addReplyError(c,"The MAXLEN argument must be >= 0.");
-                return;
-            }
-            i++;
-            maxlen_arg_idx = i;
         } else {
+            int last = streamParseTrimOptionOrReply(c,i,&trim);
+            if (last == -1) return;
+            if (last) {
+                i = last;
+                continue;
+            }
             /* If we are here is a syntax error or a valid ID. */
             if (streamParseStrictIDOrReply(c,c->argv[i],&id,0) != C_OK) return;
             id_given = 1;
@@ -1212,6 +1442,7 @@ void xaddCommand(client *c) {
         }
     }
     int field_pos = i+1;
+    if (streamCheckTrimArgsOrReply(c,&trim) != C_OK) return;
 
     /* Check arity. */
     if ((c->argc - field_pos) < 2 || ((c->argc-field_pos) % 2) == 1) {
@@ -1248,12 +1479,12 @@ void xaddCommand(client *c) {
     notifyKeyspaceEvent(NOTIFY_STREAM,"xadd",c->argv[1],c->db->id);
     server.dirty++;
 
-    if (maxlen >= 0) {
+    if (trim.strategy != TRIM_STRATEGY_NONE) {
         /* Notify xtrim event if needed. */
-        if (streamTrimByLength(s,maxlen,approx_maxlen)) {
+        if (streamTrim(s,&trim)) {
             notifyKeyspaceEvent(NOTIFY_STREAM,"xtrim",c->argv[1],c->db->id);
         }
-        if (approx_maxlen) streamRewriteApproxMaxlen(c,s,maxlen_arg_idx);
+        if (trim.approx) streamRewriteApproxTrim(c,s,&trim);
     }
 
     /* Let's rewrite the ID argument with the one actually generated for
@@ -1302,7 +1533,7 @@ void xrangeGenericCommand(client *c, int rev) {
     s = o->ptr;
 
     if (count == 0) {
-        addReply(c,shared.nullmultibulk);
+        addReply(c,shared.nullarray[c->resp]);
     } else {
         if (count == -1) count = 0;
         streamReplyWithRange(c,s,&startid,&endid,count,rev,NULL,NULL,0,NULL);
@@ -1552,7 +1783,7 @@ void xreadCommand(client *c) {
         /* If we are inside a MULTI/EXEC and the list is empty the only thing
          * we can do is treating it as a timeout (even with timeout 0). */
         if (c->flags & CLIENT_MULTI) {
-            addReply(c,shared.nullmultibulk);
+            addReply(c,shared.nullarray[c->resp]);
             goto cleanup;
         }
         blockForKeys(c, BLOCKED_STREAM, c->argv+streams_arg, streams_count,
@@ -1581,7 +1812,7 @@ void xreadCommand(client *c) {
 
     /* No BLOCK option, nor any stream we can serve. Reply as with a
      * timeout happened. */
-    addReply(c,shared.nullmultibulk);
+    addReply(c,shared.nullarray[c->resp]);
     /* Continue to cleanup... */
 
 cleanup: /* Cleanup. */
@@ -1613,6 +1844,40 @@ void streamFreeNACK(streamNACK *na) {
     zfree(na);
 }
 
+/* Build the key of a NACK in the delivery time index of the consumer
+ * group: the big endian delivery time followed by the raw entry ID. */
+#define STREAM_DELIVERY_KEY_LEN (sizeof(uint64_t)+sizeof(streamID))
+static void streamEncodeDeliveryKey(unsigned char *buf, mstime_t delivery_time, unsigned char *rawid) {
+    uint64_t t = htonu64((uint64_t)delivery_time);
+    memcpy(buf,&t,sizeof(t));
+    memcpy(buf+sizeof(t),rawid,sizeof(streamID));
+}
+
+/* Add the NACK of the entry 'rawid' (a big endian encoded ID) to the
+ * delivery time index of the group. Must be called every time a NACK
+ * is added to the group PEL. */
+void streamIndexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack) {
+    unsigned char key[STREAM_DELIVERY_KEY_LEN];
+    streamEncodeDeliveryKey(key,nack->delivery_time,rawid);
+    raxInsert(cg->pel_by_time,key,sizeof(key),NULL,NULL);
+}
+
+/* Remove the NACK from the delivery time index of the group. Must be called
+ * before the NACK is removed from the group PEL. */
+void streamUnindexNACK(streamCG *cg, unsigned char *rawid, streamNACK *nack) {
+    unsigned char key[STREAM_DELIVERY_KEY_LEN];
+    streamEncodeDeliveryKey(key,nack->delivery_time,rawid);
+    raxRemove(cg->pel_by_time,key,sizeof(key),NULL);
+}
+
+/* Change the delivery time of an indexed NACK. */
+void streamSetNACKDeliveryTime(streamCG *cg, unsigned char *rawid, streamNACK *nack, mstime_t delivery_time) {
+    if (nack->delivery_time == delivery_time) return;
+    streamUnindexNACK(cg,rawid,nack);
+    nack->delivery_time = delivery_time;
+    streamIndexNACK(cg,rawid,nack);
+}
+
 /* Free a consumer and associated data structures. Note that this function
  * will not reassign the pending messages associated with this consumer
  * nor will delete them from the stream, so when this function is called
@@ -1636,6 +1901,7 @@ streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id) {
 
     streamCG *cg = zmalloc(sizeof(*cg));
     cg->pel = raxNew();
+    cg->pel_by_time = raxNew();
     cg->consumers = raxNew();
     cg->last_id = *id;
     raxInsert(s->cgroups,(unsigned char*)name,namelen,cg,NULL);
@@ -1645,6 +1911,7 @@ streamCG *streamCreateCG(stream *s, char *name, size_t namelen, streamID *id) {
 /* Free a consumer group and all its associated data. */
 void streamFreeCG(streamCG *cg) {
     raxFreeWithCallback(cg->pel,(void(*)(void*))streamFreeNACK);
+    raxFree(cg->pel_by_time);
     raxFreeWithCallback(cg->consumers,(void(*)(void*))streamFreeConsumer);
     zfree(cg);
 }
@@ -1693,6 +1960,7 @@ uint64_t streamDelConsumer(streamCG *cg, sds name) {
     raxSeek(&ri,"^",NULL,0);
     while(raxNext(&ri)) {
         streamNACK *nack = ri.data;
+        streamUnindexNACK(cg,ri.key,nack);
         raxRemove(cg->pel,ri.key,ri.key_len,NULL);
         streamFreeNACK(nack);
     }
@@ -1911,6 +2179,7 @@ void xackCommand(client *c) {
          * we are able to remove the entry from both PELs. */
         streamNACK *nack = raxFind(group->pel,buf,sizeof(buf));
         if (nack != raxNotFound) {
+            streamUnindexNACK(group,buf,nack);
             raxRemove(group->pel,buf,sizeof(buf),NULL);
             raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
             streamFreeNACK(nack);
@@ -1978,9 +2247,9 @@ void xpendingCommand(client *c) {
         addReplyLongLong(c,raxSize(group->pel));
         /* First and last IDs. */
         if (raxSize(group->pel) == 0) {
-            addReply(c,shared.nullbulk); /* Start. */
-            addReply(c,shared.nullbulk); /* End. */
-            addReply(c,shared.nullmultibulk); /* Clients. */
+            addReply(c,shared.null[c->resp]); /* Start. */
+            addReply(c,shared.null[c->resp]); /* End. */
+            addReply(c,shared.nullarray[c->resp]); /* Clients. */
         } else {
             /* Start. */
             raxIterator ri;
@@ -2266,6 +2535,7 @@ void xclaimCommand(client *c) {
             /* Create the NACK. */
             nack = streamCreateNACK(NULL);
             raxInsert(group->pel,buf,sizeof(buf),nack,NULL);
+            streamIndexNACK(group,buf,nack);
         }
 
         if (nack != raxNotFound) {
@@ -2286,7 +2556,7 @@ void xclaimCommand(client *c) {
                 raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
             /* Update the consumer and idle time. */
             nack->consumer = consumer;
-            nack->delivery_time = deliverytime;
+            streamSetNACKDeliveryTime(group,buf,nack,deliverytime);
             /* Set the delivery attempts counter if given, otherwise 
              * autoincrement unless JUSTID option provided */
             if (retrycount >= 0) {
@@ -2302,7 +2572,7 @@ void xclaimCommand(client *c) {
             } else {
                 size_t emitted = streamReplyWithRange(c,o->ptr,&id,&id,1,0,
                                     NULL,NULL,STREAM_RWR_RAWENTRIES,NULL);
-                if (!emitted) addReply(c,shared.nullbulk);
+                if (!emitted) addReply(c,shared.null[c->resp]);
             }
             arraylen++;
 
@@ -2320,6 +2590,123 @@ void xclaimCommand(client *c) {
     preventCommandPropagation(c);
 }
 
+/* XAUTOCLAIM <key> <group> <consumer> <min-idle-time> [COUNT <count>] [JUSTID]
+ *
+ * Transfer to <consumer> the ownership of up to <count> (100 by default)
+ * pending messages of the group that were not delivered since at least
+ * <min-idle-time> milliseconds, oldest deliveries first. The reply is the
+ * same of XCLAIM, and so is the effect on the claimed messages: their
+ * delivery counter is incremented (unless JUSTID is given) and their idle
+ * time reset.
+ *
+ * Candidates are fetched from the delivery time index of the group, so the
+ * cost is proportional to the number of claimed messages, not to the size
+ * of the PEL. Since claimed messages get a fresh delivery time, calling the
+ * command again returns the next batch of idle messages. */
+void xautoclaimCommand(client *c) {
+    streamCG *group = NULL;
+    robj *o = lookupKeyRead(c->db,c->argv[1]);
+    long long minidle; /* Minimum idle time argument. */
+    long count = 100;
+    int justid = 0;
+
+    if (o) {
+        if (checkType(c,o,OBJ_STREAM)) return; /* Type error. */
+        group = streamLookupCG(o->ptr,c->argv[2]->ptr);
+    }
+
+    /* No key or group? Send an error given that the group creation
+     * is mandatory. */
+    if (o == NULL || group == NULL) {
+        addReplyErrorFormat(c,"-NOGROUP No such key '%s' or "
+                              "consumer group '%s'", (char*)c->argv[1]->ptr,
+                              (char*)c->argv[2]->ptr);
+        return;
+    }
+
+    if (getLongLongFromObjectOrReply(c,c->argv[4],&minidle,
+        "Invalid min-idle-time argument for XAUTOCLAIM")
+        != C_OK) return;
+    if (minidle < 0) minidle = 0;
+
+    for (int j = 5; j < c->argc; j++) {
+        int moreargs = (c->argc-1) - j; /* Number of additional arguments. */
+        char *opt = c->argv[j]->ptr;
+        if (!strcasecmp(opt,"COUNT") && moreargs) {
+            j++;
+            if (getLongFromObjectOrReply(c,c->argv[j],&count,NULL) != C_OK)
+                return;
+            if (count <= 0) {
+                addReplyError(c,"COUNT must be > 0");
+                return;
+            }
+        } else if (!strcasecmp(opt,"JUSTID")) {
+            justid = 1;
+        } else {
+            addReplyErrorFormat(c,"Unrecognized XAUTOCLAIM option '%s'",opt);
+            return;
+        }
+    }
+
+    /* Collect the IDs first: claiming changes the delivery time of the
+     * entries, so we can't modify the index while iterating it. */
+    mstime_t now = mstime();
+    unsigned char *ids = NULL;
+    long numids = 0, idsalloc = 0;
+    raxIterator ri;
+    raxStart(&ri,group->pel_by_time);
+    raxSeek(&ri,"^",NULL,0);
+    while(numids < count && raxNext(&ri)) {
+        uint64_t t;
+        memcpy(&t,ri.key,sizeof(t));
+        if (now - (mstime_t)ntohu64(t) < minidle) break;
+        if (numids == idsalloc) {
+            idsalloc = idsalloc ? idsalloc*2 : 16;
+            ids = zrealloc(ids,idsalloc*sizeof(streamID));
+        }
+        memcpy(ids+numids*sizeof(streamID),ri.key+sizeof(t),sizeof(streamID));
+        numids++;
+    }
+    raxStop(&ri);
+
+    /* Do the actual claiming. */
+    streamConsumer *consumer = streamLookupConsumer(group,c->argv[3]->ptr,1);
+    addReplyMultiBulkLen(c,numids);
+    for (long j = 0; j < numids; j++) {
+        unsigned char *buf = ids+j*sizeof(streamID);
+        streamID id;
+        streamDecodeID(buf,&id);
+
+        streamNACK *nack = raxFind(group->pel,buf,sizeof(streamID));
+        serverAssert(nack != raxNotFound);
+
+        /* Move the entry to the new consumer and update its metadata. */
+        if (nack->consumer)
+            raxRemove(nack->consumer->pel,buf,sizeof(streamID),NULL);
+        nack->consumer = consumer;
+        streamSetNACKDeliveryTime(group,buf,nack,now);
+        if (!justid) nack->delivery_count++;
+        raxInsert(consumer->pel,buf,sizeof(streamID),nack,NULL);
+
+        /* Send the reply for this entry. */
+        if (justid) {
+            addReplyStreamID(c,&id);
+        } else {
+            size_t emitted = streamReplyWithRange(c,o->ptr,&id,&id,1,0,
+                                NULL,NULL,STREAM_RWR_RAWENTRIES,NULL);
+            if (!emitted) addReply(c,shared.null[c->resp]);
+        }
+
+        /* Propagate this change. */
+        robj *idarg = createObjectFromStreamID(&id);
+        streamPropagateXCLAIM(c,c->argv[1],group,c->argv[2],idarg,nack);
+        decrRefCount(idarg);
+        server.dirty++;
+    }
+    zfree(ids);
+    preventCommandPropagation(c);
+}
+
 
 /* XDEL <key> [<ID1> <ID2> ... <IDN>]
  *
@@ -2365,10 +2752,12 @@ void xdelCommand(client *c) {
  *                             the specified length. Use ~ before the
  *                             count in order to demand approximated trimming
  *                             (like XADD MAXLEN option).
+ * MINID [~|=] <id>         -- Trim so that the stream will not contain
+ *                             entries with IDs smaller than <id>. Use ~ like
+ *                             with MAXLEN for approximated trimming.
+ * LIMIT <count>            -- Max number of entries that an approximated
+ *                             trimming can evict.
  */
-
-#define TRIM_STRATEGY_NONE 0
-#define TRIM_STRATEGY_MAXLEN 1
 void xtrimCommand(client *c) {
     robj *o;
 
@@ -2379,47 +2768,25 @@ void xtrimCommand(client *c) {
     stream *s = o->ptr;
 
     /* Argument parsing. */
-    int trim_strategy = TRIM_STRATEGY_NONE;
-    long long maxlen = -1;  /* If left to -1 no trimming is performed. */
-    int approx_maxlen = 0;  /* If 1 only delete whole radix tree nodes, so
-                               the maxium length is not applied verbatim. */
-    int maxlen_arg_idx = 0; /* Index of the count in MAXLEN, for rewriting. */
+    streamTrimArgs trim = {.strategy = TRIM_STRATEGY_NONE, .limit = -1};
 
     /* Parse options. */
     int i = 2; /* Start of options. */
     for (; i < c->argc; i++) {
-        int moreargs = (c->argc-1) - i; /* Number of additional arguments. */
-        char *opt = c->argv[i]->ptr;
-        if (!strcasecmp(opt,"maxlen") && moreargs) {
-            approx_maxlen = 0;
-            trim_strategy = TRIM_STRATEGY_MAXLEN;
-            char *next = c->argv[i+1]->ptr;
-            /* Check for the form MAXLEN ~ <count>. */
-            if (moreargs >= 2 && next[0] == '~' && next[1] == '\0') {
-                approx_maxlen = 1;
-                i++;
-            } else if (moreargs >= 2 && next[0] == '=' && next[1] == '\0') {
-                i++;
-            }
-            if (getLongLongFromObjectOrReply(c,c->argv[i+1],&maxlen,NULL)
-                != C_OK) return;
-
-            if (maxlen < 0) {
-                addReplyError(c,"The MAXLEN argument must be >= 0.");
-                return;
-            }
-            i++;
-            maxlen_arg_idx = i;
-        } else {
+        int last = streamParseTrimOptionOrReply(c,i,&trim);
+        if (last == -1) return;
+        if (last == 0) {
             addReply(c,shared.syntaxerr);
             return;
         }
+        i = last;
     }
+    if (streamCheckTrimArgsOrReply(c,&trim) != C_OK) return;
 
     /* Perform the trimming. */
     int64_t deleted = 0;
-    if (trim_strategy == TRIM_STRATEGY_MAXLEN) {
-        deleted = streamTrimByLength(s,maxlen,approx_maxlen);
+    if (trim.strategy != TRIM_STRATEGY_NONE) {
+        deleted = streamTrim(s,&trim);
     } else {
         addReplyError(c,"XTRIM called without an option to trim the stream");
         return;
@@ -2430,7 +2797,7 @@ void xtrimCommand(client *c) {
         signalModifiedKey(c->db,c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_STREAM,"xtrim",c->argv[1],c->db->id);
         server.dirty += deleted;
-        if (approx_maxlen) streamRewriteApproxMaxlen(c,s,maxlen_arg_idx);
+        if (trim.approx) streamRewriteApproxTrim(c,s,&trim);
     }
     addReplyLongLong(c,deleted);
 }
@@ -2491,7 +2858,7 @@ NULL
             mstime_t idle = now - consumer->seen_time;
             if (idle < 0) idle = 0;
 
-            addReplyMultiBulkLen(c,6);
+            addReplyMapLen(c,3);
             addReplyBulkCString(c,"name");
             addReplyBulkCBuffer(c,consumer->name,sdslen(consumer->name));
             addReplyBulkCString(c,"pending");
@@ -2513,7 +2880,7 @@ NULL
         raxSeek(&ri,"^",NULL,0);
         while(raxNext(&ri)) {
             streamCG *cg = ri.data;
-            addReplyMultiBulkLen(c,8);
+            addReplyMapLen(c,4);
             addReplyBulkCString(c,"name");
             addReplyBulkCBuffer(c,ri.key,ri.key_len);
             addReplyBulkCString(c,"consumers");
@@ -2526,7 +2893,7 @@ NULL
         raxStop(&ri);
     } else if (!strcasecmp(opt,"STREAM") && c->argc == 3) {
         /* XINFO STREAM <key> (or the alias XINFO <key>). */
-        addReplyMultiBulkLen(c,14);
+        addReplyMapLen(c,7);
         addReplyBulkCString(c,"length");
         addReplyLongLong(c,s->length);
         addReplyBulkCString(c,"radix-tree-keys");
@@ -2547,11 +2914,11 @@ NULL
         addReplyBulkCString(c,"first-entry");
         count = streamReplyWithRange(c,s,&start,&end,1,0,NULL,NULL,
                                      STREAM_RWR_RAWENTRIES,NULL);
-        if (!count) addReply(c,shared.nullbulk);
+        if (!count) addReply(c,shared.null[c->resp]);
         addReplyBulkCString(c,"last-entry");
         count = streamReplyWithRange(c,s,&start,&end,1,1,NULL,NULL,
                                      STREAM_RWR_RAWENTRIES,NULL);
-        if (!count) addReply(c,shared.nullbulk);
+        if (!count) addReply(c,shared.null[c->resp]);
     } else {
         addReplySubcommandSyntaxError(c);
     }
@@ -85,7 +85,7 @@ void setGenericCommand(client *c, int flags, robj *key, robj *val, robj *expire,
      * */
     if ((flags & OBJ_SET_NX && lookupKeyWrite(c->db, key) != NULL) ||
         (flags & OBJ_SET_XX && lookupKeyWrite(c->db, key) == NULL)) {
-        addReply(c, abort_reply ? abort_reply : shared.nullbulk);
+        addReply(c, abort_reply ? abort_reply : shared.null[c->resp]);
         return;
     }
     /** 在数据库中设置key-value */
@@ -185,7 +185,7 @@ int getGenericCommand(client *c) {
     robj *o;
     // o为value对象
     // o == NULL时, lookupKeyReadOrReply()已经回复
-    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL)
+    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.null[c->resp])) == NULL)
         return C_OK;
     // value类型不是String时
     if (o->type != OBJ_STRING) {
@@ -323,10 +323,10 @@ void mgetCommand(client *c) {
     for (j = 1; j < c->argc; j++) {
         robj *o = lookupKeyRead(c->db, c->argv[j]);
         if (o == NULL) {
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
         } else {
             if (o->type != OBJ_STRING) {
-                addReply(c, shared.nullbulk);
+                addReply(c, shared.null[c->resp]);
             } else {
                 addReplyBulk(c, o);
             }
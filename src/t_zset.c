@@ -54,7 +54,10 @@
  * b) the comparison is not just by key (our 'score') but by satellite data.
  * c) there is a back pointer, so it's a doubly linked list with the back
  * pointers being only at "level 1". This allows to traverse the list
- * from tail to head, useful for ZREVRANGE. */
+ * from tail to head, useful for ZREVRANGE.
+ *
+ * When zset-large-encoding is set to btree, a counted B+tree is used
+ * instead of the skiplist (OBJ_ENCODING_BTREE), see zbtree.c. */
 
 #include "server.h"
 #include <math.h>
@@ -1191,12 +1194,37 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
  * Common sorted set API
  *----------------------------------------------------------------------------*/
 
+/* Return the score stored in the dict entry of a sorted set that is not
+ * ziplist encoded: the skiplist encoding stores a pointer to the score of
+ * the skiplist node, the btree encoding the score itself. */
+double zsetDictGetScore(const zset *zs, dictEntry *de) {
+    if (zs->zbt) return dictGetDoubleVal(de);
+    return *(double *) dictGetVal(de);
+}
+
+/* Add a new element to a sorted set that is not ziplist encoded. The
+ * element must not already exist. The SDS string is owned by the sorted set
+ * after the call. */
+void zsetInsertNew(zset *zs, double score, sds ele) {
+    if (zs->zbt) {
+        dictEntry *de = dictAddRaw(zs->dict, ele, NULL);
+        serverAssert(de != NULL);
+        dictSetDoubleVal(de, score);
+        zbtInsert(zs->zbt, score, ele);
+    } else {
+        zskiplistNode *znode = zslInsert(zs->zsl, score, ele);
+        serverAssert(dictAdd(zs->dict, ele, &znode->score) == DICT_OK);
+    }
+}
+
 unsigned long zsetLength(const robj *zobj) {
     unsigned long length = 0;
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         length = ((const zset *) zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((const zset *) zobj->ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1217,12 +1245,17 @@ void zsetConvert(robj *zobj, int encoding) {
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_SKIPLIST && encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType, NULL);
-        zs->zsl = zslCreate();
+        zs->zsl = NULL;
+        zs->zbt = NULL;
+        if (encoding == OBJ_ENCODING_BTREE)
+            zs->zbt = zbtCreate();
+        else
+            zs->zsl = zslCreate();
 
         eptr = ziplistIndex(zl, 0);
         serverAssertWithInfo(NULL, zobj, eptr != NULL);
@@ -1237,14 +1270,13 @@ void zsetConvert(robj *zobj, int encoding) {
             else
                 ele = sdsnewlen((char *) vstr, vlen);
 
-            node = zslInsert(zs->zsl, score, ele);
-            serverAssert(dictAdd(zs->dict, ele, &node->score) == DICT_OK);
+            zsetInsertNew(zs, score, ele);
             zzlNext(zl, &eptr, &sptr);
         }
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
+        zobj->encoding = encoding;
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         unsigned char *zl = ziplistNew();
 
@@ -1266,6 +1298,27 @@ void zsetConvert(robj *zobj, int encoding) {
             node = next;
         }
 
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = ziplistNew();
+        zbtCursor cur;
+        int valid;
+
+        if (encoding != OBJ_ENCODING_ZIPLIST)
+            serverPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        dictRelease(zs->dict);
+        valid = zbtFirst(zs->zbt, &cur);
+        while (valid) {
+            zbtEntry *e = zbtCursorEntry(&cur);
+            zl = zzlInsertAt(zl, NULL, e->ele, e->score);
+            valid = zbtNext(&cur);
+        }
+        zbtFree(zs->zbt);
+
         zfree(zs);
         zobj->ptr = zl;
         zobj->encoding = OBJ_ENCODING_ZIPLIST;
@@ -1279,9 +1332,7 @@ void zsetConvert(robj *zobj, int encoding) {
  * expected ranges. */
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
-    zset *zset = zobj->ptr;
-
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
+    if (zsetLength(zobj) <= server.zset_max_ziplist_entries &&
         maxelelen <= server.zset_max_ziplist_value)
         zsetConvert(zobj, OBJ_ENCODING_ZIPLIST);
 }
@@ -1295,11 +1346,12 @@ int zsetScore(robj *zobj, sds member, double *score) {
 
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = zobj->ptr;
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double *) dictGetVal(de);
+        *score = zsetDictGetScore(zs, de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1397,7 +1449,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             zobj->ptr = zzlInsert(zobj->ptr, ele, score);
             if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries ||
                 sdslen(ele) > server.zset_max_ziplist_value)
-                zsetConvert(zobj, OBJ_ENCODING_SKIPLIST);
+                zsetConvert(zobj, server.zset_large_encoding);
             if (newscore) *newscore = score;
             *flags |= ZADD_ADDED;
             return 1;
@@ -1450,6 +1502,45 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             *flags |= ZADD_NOP;
             return 1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+
+        de = dictFind(zs->dict, ele);
+        if (de != NULL) {
+            /* NX? Return, same element already exists. */
+            if (nx) {
+                *flags |= ZADD_NOP;
+                return 1;
+            }
+            curscore = dictGetDoubleVal(de);
+
+            /* Prepare the score for the increment if needed. */
+            if (incr) {
+                score += curscore;
+                if (isnan(score)) {
+                    *flags |= ZADD_NAN;
+                    return 0;
+                }
+                if (newscore) *newscore = score;
+            }
+
+            /* Move the element inside the tree when the score changes. */
+            if (score != curscore) {
+                zbtUpdateScore(zs->zbt, curscore, ele, score);
+                dictSetDoubleVal(de, score);
+                *flags |= ZADD_UPDATED;
+            }
+            return 1;
+        } else if (!xx) {
+            zsetInsertNew(zs, score, sdsdup(ele));
+            *flags |= ZADD_ADDED;
+            if (newscore) *newscore = score;
+            return 1;
+        } else {
+            *flags |= ZADD_NOP;
+            return 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1487,6 +1578,22 @@ int zsetDel(robj *zobj, sds ele) {
             int retval = zslDelete(zs->zsl, score, ele, NULL);
             serverAssert(retval);
 
+            if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+            return 1;
+        }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+        double score;
+
+        de = dictUnlink(zs->dict, ele);
+        if (de != NULL) {
+            /* Same as above: the tree owns the SDS string. */
+            score = dictGetDoubleVal(de);
+            dictFreeUnlinkedEntry(zs->dict, de);
+            int retval = zbtDelete(zs->zbt, score, ele, NULL);
+            serverAssert(retval);
+
             if (htNeedsResize(zs->dict)) dictResize(zs->dict);
             return 1;
         }
@@ -1557,6 +1664,21 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
         } else {
             return -1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        dictEntry *de;
+
+        de = dictFind(zs->dict, ele);
+        if (de != NULL) {
+            rank = zbtGetRank(zs->zbt, dictGetDoubleVal(de), ele);
+            serverAssert(rank != 0);
+            if (reverse)
+                return llen - rank;
+            else
+                return rank - 1;
+        } else {
+            return -1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1675,7 +1797,7 @@ void zaddGenericCommand(client *c, int flags) {
         if (processed)
             addReplyDouble(c, score);
         else
-            addReply(c, shared.nullbulk);
+            addReply(c, shared.null[c->resp]);
     } else { /* ZADD. */
         addReplyLongLong(c, ch ? added + updated : added);
     }
@@ -1812,6 +1934,24 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db, key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch (rangetype) {
+            case ZRANGE_RANK:
+                deleted = zbtDeleteRangeByRank(zs->zbt, start + 1, end + 1, zs->dict);
+                break;
+            case ZRANGE_SCORE:
+                deleted = zbtDeleteRangeByScore(zs->zbt, &range, zs->dict);
+                break;
+            case ZRANGE_LEX:
+                deleted = zbtDeleteRangeByLex(zs->zbt, &lexrange, zs->dict);
+                break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db, key);
+            keyremoved = 1;
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1856,6 +1996,7 @@ typedef struct {
                 intset *is;
                 int ii;
             } is;
+            roaringIterator ri;
             struct {
                 dict *dict;
                 dictIterator *di;
@@ -1873,6 +2014,10 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zbtCursor cur;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1911,6 +2056,8 @@ void zuiInitIterator(zsetopsrc *op) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             it->is.is = op->subject->ptr;
             it->is.ii = 0;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringInitIterator(&it->ri, op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.dict = op->subject->ptr;
             it->ht.di = dictGetIterator(op->subject->ptr);
@@ -1930,6 +2077,9 @@ void zuiInitIterator(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            it->bt.valid = zbtFirst(zs->zbt, &it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1944,7 +2094,8 @@ void zuiClearIterator(zsetopsrc *op) {
 
     if (op->type == OBJ_SET) {
         iterset *it = &op->iter.set;
-        if (op->encoding == OBJ_ENCODING_INTSET) {
+        if (op->encoding == OBJ_ENCODING_INTSET ||
+            op->encoding == OBJ_ENCODING_ROARING) {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
@@ -1955,7 +2106,8 @@ void zuiClearIterator(zsetopsrc *op) {
         iterzset *it = &op->iter.zset;
         if (op->encoding == OBJ_ENCODING_ZIPLIST) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1972,6 +2124,8 @@ unsigned long zuiLength(zsetopsrc *op) {
     if (op->type == OBJ_SET) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             return intsetLen(op->subject->ptr);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringCard(op->subject->ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             return dictSize(ht);
@@ -1984,6 +2138,9 @@ unsigned long zuiLength(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2016,6 +2173,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringNext(&it->ri, &ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -2046,6 +2210,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (!it->bt.valid)
+                return 0;
+            val->ele = zbtCursorEntry(&it->bt.cur)->ele;
+            val->score = zbtCursorEntry(&it->bt.cur)->score;
+
+            /* Move to next element. */
+            it->bt.valid = zbtNext(&it->bt.cur);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2131,6 +2303,14 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringContains(op->subject->ptr, val->ell)) {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = op->subject->ptr;
             zuiSdsFromValue(val);
@@ -2153,11 +2333,12 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict, val->ele)) != NULL) {
-                *score = *(double *) dictGetVal(de);
+                *score = zsetDictGetScore(zs, de);
                 return 1;
             } else {
                 return 0;
@@ -2223,7 +2404,6 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     size_t maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2342,8 +2522,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiNewSdsFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl, score, tmp);
-                    dictAdd(dstzset->dict, tmp, &znode->score);
+                    zsetInsertNew(dstzset, score, tmp);
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
@@ -2408,8 +2587,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         while ((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
             score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl, score, ele);
-            dictAdd(dstzset->dict, ele, &znode->score);
+            zsetInsertNew(dstzset, score, ele);
         }
         dictReleaseIterator(di);
         dictRelease(accumulator);
@@ -2419,7 +2597,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     if (dbDelete(c->db, dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
+    if (dictSize(dstzset->dict)) {
         zsetConvertToZiplistIfNeeded(dstobj, maxelelen);
         dbAdd(c->db, dstkey, dstobj);
         addReplyLongLong(c, zsetLength(dstobj));
@@ -2547,6 +2725,22 @@ void zrangeGenericCommand(client *c, int reverse) {
                 addReplyDouble(c, ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        zbtEntry *e;
+        int valid;
+
+        valid = zbtGetElementByRank(zs->zbt,
+                                    reverse ? llen - start : start + 1, &cur);
+        while (rangelen--) {
+            serverAssertWithInfo(c, zobj, valid);
+            e = zbtCursorEntry(&cur);
+            addReplyBulkCBuffer(c, e->ele, sdslen(e->ele));
+            if (withscores)
+                addReplyDouble(c, e->score);
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2745,6 +2939,57 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        zbtEntry *e;
+        unsigned long rank;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInRange(zs->zbt, &range, &cur, &rank);
+        } else {
+            valid = zbtFirstInRange(zs->zbt, &range, &cur, &rank);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            return;
+        }
+
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* Since we know the rank of the first element we can jump over
+         * the offset with a single lookup. */
+        if (offset > 0) {
+            if (reverse)
+                valid = (unsigned long) offset < rank &&
+                        zbtGetElementByRank(zs->zbt, rank - offset, &cur);
+            else
+                valid = zbtGetElementByRank(zs->zbt, rank + offset, &cur);
+        }
+
+        while (valid && limit--) {
+            e = zbtCursorEntry(&cur);
+
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(e->score, &range)) break;
+            } else {
+                if (!zslValueLteMax(e->score, &range)) break;
+            }
+
+            rangelen++;
+            addReplyBulkCBuffer(c, e->ele, sdslen(e->ele));
+
+            if (withscores) {
+                addReplyDouble(c, e->score);
+            }
+
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2835,6 +3080,15 @@ void zcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        unsigned long first, last;
+
+        /* The lookups return the rank of the elements as well. */
+        if (zbtFirstInRange(zs->zbt, &range, &cur, &first) &&
+            zbtLastInRange(zs->zbt, &range, &cur, &last))
+            count = last - first + 1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2912,6 +3166,15 @@ void zlexcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        unsigned long first, last;
+
+        /* The lookups return the rank of the elements as well. */
+        if (zbtFirstInLexRange(zs->zbt, &range, &cur, &first) &&
+            zbtLastInLexRange(zs->zbt, &range, &cur, &last))
+            count = last - first + 1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3094,6 +3357,53 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtCursor cur;
+        zbtEntry *e;
+        unsigned long rank;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInLexRange(zs->zbt, &range, &cur, &rank);
+        } else {
+            valid = zbtFirstInLexRange(zs->zbt, &range, &cur, &rank);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* Jump over the offset using the rank of the first element. */
+        if (offset > 0) {
+            if (reverse)
+                valid = (unsigned long) offset < rank &&
+                        zbtGetElementByRank(zs->zbt, rank - offset, &cur);
+            else
+                valid = zbtGetElementByRank(zs->zbt, rank + offset, &cur);
+        }
+
+        while (valid && limit--) {
+            e = zbtCursorEntry(&cur);
+
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(e->ele, &range)) break;
+            } else {
+                if (!zslLexValueLteMax(e->ele, &range)) break;
+            }
+
+            rangelen++;
+            addReplyBulkCBuffer(c, e->ele, sdslen(e->ele));
+
+            valid = reverse ? zbtPrev(&cur) : zbtNext(&cur);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3126,12 +3436,12 @@ void zscoreCommand(client *c) {
     robj *zobj;
     double score;
 
-    if ((zobj = lookupKeyReadOrReply(c, key, shared.nullbulk)) == NULL ||
+    if ((zobj = lookupKeyReadOrReply(c, key, shared.null[c->resp])) == NULL ||
         checkType(c, zobj, OBJ_ZSET))
         return;
 
     if (zsetScore(zobj, c->argv[2]->ptr, &score) == C_ERR) {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     } else {
         addReplyDouble(c, score);
     }
@@ -3143,7 +3453,7 @@ void zrankGenericCommand(client *c, int reverse) {
     robj *zobj;
     long rank;
 
-    if ((zobj = lookupKeyReadOrReply(c, key, shared.nullbulk)) == NULL ||
+    if ((zobj = lookupKeyReadOrReply(c, key, shared.null[c->resp])) == NULL ||
         checkType(c, zobj, OBJ_ZSET))
         return;
 
@@ -3152,7 +3462,7 @@ void zrankGenericCommand(client *c, int reverse) {
     if (rank >= 0) {
         addReplyLongLong(c, rank);
     } else {
-        addReply(c, shared.nullbulk);
+        addReply(c, shared.null[c->resp]);
     }
 }
 
@@ -3259,6 +3569,17 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
             serverAssertWithInfo(c, zobj, zln != NULL);
             ele = sdsdup(zln->ele);
             score = zln->score;
+        } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = zobj->ptr;
+            zbtCursor cur;
+            int valid;
+
+            /* Get the first or last element in the sorted set. */
+            valid = (where == ZSET_MAX ? zbtLast(zs->zbt, &cur) :
+                     zbtFirst(zs->zbt, &cur));
+            serverAssertWithInfo(c, zobj, valid);
+            ele = sdsdup(zbtCursorEntry(&cur)->ele);
+            score = zbtCursorEntry(&cur)->score;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -3341,7 +3662,7 @@ void blockingGenericZpopCommand(client *c, int where) {
     /* If we are inside a MULTI/EXEC and the zset is empty the only thing
      * we can do is treating it as a timeout (even with timeout 0). */
     if (c->flags & CLIENT_MULTI) {
-        addReply(c, shared.nullmultibulk);
+        addReply(c, shared.nullarray[c->resp]);
         return;
     }
 
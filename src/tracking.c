@@ -0,0 +1,563 @@
+/* tracking.c - Client side caching: keys tracking and invalidation
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+/* The tracking table is a radix tree of keys, where every key points to a
+ * radix tree of client IDs: the clients that may have the key cached. When a
+ * key is modified, all the clients are sent an invalidation message and the
+ * key is removed from the table, so every key is invalidated at most once per
+ * read. Client IDs of clients that disabled tracking or disconnected are not
+ * removed eagerly: they are just skipped when the key is invalidated.
+ *
+ * In broadcasting mode (BCAST) clients are not tracked per key: they register
+ * a set of prefixes (possibly the empty one) in the PrefixTable, and they
+ * get invalidation messages for every modified key matching one of them. The
+ * modified keys are accumulated for every prefix and sent in a single message
+ * before returning to the event loop.
+ *
+ * Invalidation messages are delivered to the client the tracking client
+ * redirects to, or to the tracking client itself, as push messages (RESP3)
+ * or as Pub/Sub messages on the __redis__:invalidate channel (RESP2), with
+ * a payload that is an array of invalidated keys, or a null array when the
+ * whole keyspace was flushed. */
+rax *TrackingTable = NULL;
+rax *PrefixTable = NULL;
+uint64_t TrackingTableTotalItems = 0; /* Total number of IDs stored across
+                                         the whole tracking table. This gives
+                                         an hint about the total memory we
+                                         are using server side for CSC. */
+robj *TrackingChannelName;
+
+/* This is the structure that we have as value of the PrefixTable, and
+ * represents the list of keys modified, and the list of clients that need
+ * to be notified, for a given prefix. */
+typedef struct bcastState {
+    rax *keys;      /* Keys modified in the current event loop cycle, pointing
+                       to the client that modified them, or NULL. */
+    rax *clients;   /* Clients subscribed to the notification events for this
+                       prefix. */
+} bcastState;
+
+/* Remove the tracking state from the client 'c'. Note that there is not much
+ * to do for us here, if not to decrement the counter of the clients in
+ * tracking mode, because we just store the ID of the client in the tracking
+ * table, so we'll remove the ID reference in a lazy way. Otherwise when a
+ * client with many entries in the table is removed, it would cost a lot of
+ * time to do the cleanup. */
+void disableTracking(client *c) {
+    /* If this client is in broadcasting mode, we need to unsubscribe it
+     * from all the prefixes it is registered to. */
+    if (c->client_tracking_flags & TRACKING_BCAST) {
+        raxIterator ri;
+        raxStart(&ri,c->client_tracking_prefixes);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            bcastState *bs = raxFind(PrefixTable,ri.key,ri.key_len);
+            serverAssert(bs != raxNotFound);
+            raxRemove(bs->clients,(unsigned char*)&c,sizeof(c),NULL);
+            /* Was it the last client? Remove the prefix from the
+             * table. */
+            if (raxSize(bs->clients) == 0) {
+                raxFree(bs->clients);
+                raxFree(bs->keys);
+                zfree(bs);
+                raxRemove(PrefixTable,ri.key,ri.key_len,NULL);
+            }
+        }
+        raxStop(&ri);
+        raxFree(c->client_tracking_prefixes);
+        c->client_tracking_prefixes = NULL;
+    }
+
+    /* Clear flags and adjust the count. */
+    if (c->flags & CLIENT_TRACKING) {
+        server.tracking_clients--;
+        c->flags &= ~CLIENT_TRACKING;
+        c->client_tracking_flags = 0;
+        c->client_tracking_redirection = 0;
+    }
+}
+
+/* Return 1 if two prefixes overlap, that is, one is a prefix of the other:
+ * the same key would be reported twice to the client. */
+static int stringCheckPrefix(unsigned char *s1, size_t s1_len,
+                             unsigned char *s2, size_t s2_len)
+{
+    size_t min_length = s1_len < s2_len ? s1_len : s2_len;
+    return memcmp(s1,s2,min_length) == 0;
+}
+
+/* Check that the client 'c' can track the 'numprefix' prefixes in the
+ * 'prefixes' array without overlaps, among them and with the
+ * prefixes it is already tracking. Reply with an error and return 0
+ * otherwise. */
+int checkPrefixCollisionsOrReply(client *c, robj **prefixes, size_t numprefix) {
+    for (size_t i = 0; i < numprefix; i++) {
+        /* Check input list has no overlap with existing prefixes. */
+        if (c->client_tracking_prefixes) {
+            raxIterator ri;
+            raxStart(&ri,c->client_tracking_prefixes);
+            raxSeek(&ri,"^",NULL,0);
+            while(raxNext(&ri)) {
+                if (stringCheckPrefix(ri.key,ri.key_len,
+                    prefixes[i]->ptr,sdslen(prefixes[i]->ptr)))
+                {
+                    sds collision = sdsnewlen(ri.key,ri.key_len);
+                    addReplyErrorFormat(c,
+                        "Prefix '%s' overlaps with an existing prefix '%s'. "
+                        "Prefixes for a single client must not overlap.",
+                        (unsigned char *)prefixes[i]->ptr,
+                        (unsigned char *)collision);
+                    sdsfree(collision);
+                    raxStop(&ri);
+                    return 0;
+                }
+            }
+            raxStop(&ri);
+        }
+        /* Check input has no overlap with itself. */
+        for (size_t j = i + 1; j < numprefix; j++) {
+            if (stringCheckPrefix(prefixes[i]->ptr,sdslen(prefixes[i]->ptr),
+                                  prefixes[j]->ptr,sdslen(prefixes[j]->ptr)))
+            {
+                addReplyErrorFormat(c,
+                    "Prefix '%s' overlaps with another provided prefix '%s'. "
+                    "Prefixes for a single client must not overlap.",
+                    (unsigned char *)prefixes[i]->ptr,
+                    (unsigned char *)prefixes[j]->ptr);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Set the client 'c' to track the prefix 'prefix'. If the client 'c' is
+ * already registered for the specified prefix, no operation is performed. */
+void enableBcastTrackingForPrefix(client *c, char *prefix, size_t plen) {
+    bcastState *bs = raxFind(PrefixTable,(unsigned char*)prefix,plen);
+    /* If this is the first client subscribing to such prefix, create
+     * the prefix in the table. */
+    if (bs == raxNotFound) {
+        bs = zmalloc(sizeof(*bs));
+        bs->keys = raxNew();
+        bs->clients = raxNew();
+        raxTryInsert(PrefixTable,(unsigned char*)prefix,plen,bs,NULL);
+    }
+    if (raxTryInsert(bs->clients,(unsigned char*)&c,sizeof(c),NULL,NULL)) {
+        if (c->client_tracking_prefixes == NULL)
+            c->client_tracking_prefixes = raxNew();
+        raxTryInsert(c->client_tracking_prefixes,
+                     (unsigned char*)prefix,plen,NULL,NULL);
+    }
+}
+
+/* Enable the tracking state for the client 'c', and as a side effect allocates
+ * the tracking table if needed. If the 'redirect_to' argument is non zero, the
+ * invalidation messages for this client will be sent to the client ID
+ * specified by the 'redirect_to' argument. Note that if such client will
+ * eventually get freed, we'll just skip the invalidation messages. */
+void enableTracking(client *c, uint64_t redirect_to, int options,
+                    robj **prefix, size_t numprefix)
+{
+    if (!(c->flags & CLIENT_TRACKING)) server.tracking_clients++;
+    c->flags |= CLIENT_TRACKING;
+    c->client_tracking_flags &= ~(TRACKING_BROKEN_REDIR|TRACKING_BCAST|
+                                  TRACKING_OPTIN|TRACKING_OPTOUT|
+                                  TRACKING_NOLOOP);
+    c->client_tracking_flags |= options;
+    c->client_tracking_redirection = redirect_to;
+
+    /* This may be the first client we ever enable. Create the tracking
+     * table if it does not exist. */
+    if (TrackingTable == NULL) {
+        TrackingTable = raxNew();
+        PrefixTable = raxNew();
+        TrackingChannelName = createStringObject("__redis__:invalidate",20);
+    }
+
+    /* For broadcasting, set the list of prefixes in the client. */
+    if (options & TRACKING_BCAST) {
+        if (numprefix == 0) enableBcastTrackingForPrefix(c,"",0);
+        for (size_t j = 0; j < numprefix; j++) {
+            sds sdsprefix = prefix[j]->ptr;
+            enableBcastTrackingForPrefix(c,sdsprefix,sdslen(sdsprefix));
+        }
+    }
+}
+
+/* This function is called after the execution of a readonly command in the
+ * case the client 'c' has keys tracking enabled and the tracking is not
+ * in BCAST mode. It populates the tracking invalidation table according
+ * to the keys the user fetched, so that Redis will know what are the clients
+ * that should receive an invalidation message with certain groups of keys
+ * are modified. */
+void trackingRememberKeys(client *c) {
+    /* Return if we are in optin/out mode and the right CACHING command
+     * was/wasn't given in order to modify the default behavior. */
+    uint64_t optin = c->client_tracking_flags & TRACKING_OPTIN;
+    uint64_t optout = c->client_tracking_flags & TRACKING_OPTOUT;
+    uint64_t caching_given = c->client_tracking_flags & TRACKING_CACHING;
+    if ((optin && !caching_given) || (optout && caching_given)) return;
+
+    int numkeys;
+    int *keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    if (keys == NULL) return;
+
+    for(int j = 0; j < numkeys; j++) {
+        int idx = keys[j];
+        sds sdskey = c->argv[idx]->ptr;
+        rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
+        if (ids == raxNotFound) {
+            ids = raxNew();
+            int inserted = raxTryInsert(TrackingTable,(unsigned char*)sdskey,
+                                        sdslen(sdskey),ids, NULL);
+            serverAssert(inserted == 1);
+        }
+        if (raxTryInsert(ids,(unsigned char*)&c->id,sizeof(c->id),NULL,NULL))
+            TrackingTableTotalItems++;
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Given a key name, this function sends an invalidation message in the
+ * proper channel (depending on the client the tracking client redirects
+ * to). If 'proto' is not NULL, it is a raw protocol array of keys to send
+ * as the message payload, otherwise the payload is an array with the single
+ * key 'keyname', or a null array if 'keyname' is NULL (whole keyspace
+ * flushed).
+ *
+ * RESP3 clients get the invalidation as an "invalidate" push message, on
+ * the same connection used for the commands. For RESP2 clients invalidation
+ * messages are Pub/Sub messages on the __redis__:invalidate channel: they
+ * can only be delivered to clients in Pub/Sub mode, which is why RESP2
+ * tracking clients redirect to another connection subscribed to that
+ * channel. */
+void sendTrackingMessage(client *c, char *keyname, size_t keylen, sds proto) {
+    client *target = c;
+
+    if (c->client_tracking_redirection) {
+        target = lookupClientByID(c->client_tracking_redirection);
+        if (!target) {
+            /* The client we are redirecting to disconnected: the tracking
+             * client can't trust its cache anymore, remember it so that
+             * CLIENT GETREDIR can report it. */
+            c->client_tracking_flags |= TRACKING_BROKEN_REDIR;
+            return;
+        }
+    }
+
+    if (target->resp > 2) {
+        addReplyPushLen(target,2);
+        addReplyBulkCBuffer(target,"invalidate",10);
+    } else if (target->flags & CLIENT_PUBSUB) {
+        /* Only send such info for RESP2 clients in Pub/Sub mode, so that
+         * they can tell the invalidation messages apart from the command
+         * replies. */
+        addReply(target,shared.mbulkhdr[3]);
+        addReply(target,shared.messagebulk);
+        addReplyBulk(target,TrackingChannelName);
+    } else {
+        return;
+    }
+    if (proto) {
+        addReplyString(target,proto,sdslen(proto));
+    } else if (keyname) {
+        addReplyMultiBulkLen(target,1);
+        addReplyBulkCBuffer(target,keyname,keylen);
+    } else {
+        addReply(target,shared.nullarray[target->resp]);
+    }
+}
+
+/* This function is called when a key is modified in Redis and in the case
+ * we have at least one client with the BCAST mode enabled.
+ * Its goal is to set the key in the right broadcast state if the key
+ * matches one or more prefixes in the prefix table. Later when we
+ * return to the event loop, we'll send invalidation messages to the
+ * clients subscribed to each prefix. */
+void trackingRememberKeyToBroadcast(client *c, char *keyname, size_t keylen) {
+    raxIterator ri;
+    raxStart(&ri,PrefixTable);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        if (ri.key_len > keylen) continue;
+        if (ri.key_len != 0 && memcmp(ri.key,keyname,ri.key_len) != 0)
+            continue;
+        bcastState *bs = ri.data;
+        /* We insert the client pointer as associated value in the radix
+         * tree. This way we know who was the client that did the last
+         * change to the key, and can avoid sending the notification in the
+         * case the client is in NOLOOP mode. */
+        raxInsert(bs->keys,(unsigned char*)keyname,keylen,c,NULL);
+    }
+    raxStop(&ri);
+}
+
+/* This function is called from signalModifiedKey() or other places in Redis
+ * when a key changes value. In the context of keys tracking, our task here is
+ * to send a notification to every client that may have keys about such caching
+ * slot.
+ *
+ * Note that 'c' may be NULL in case the operation was performed outside the
+ * context of a client modifying the database (for instance when we delete a
+ * key because of expire).
+ *
+ * The last argument 'bcast' tells the function if it should also schedule
+ * the key for broadcasting to clients in BCAST mode. This is the case when
+ * the function is called from the Redis core once a key is modified, however
+ * we also call the function in order to evict keys in the key table in case
+ * of memory pressure: in that case the key didn't really change, so we want
+ * just to notify the clients that are in the table for this key, that would
+ * otherwise miss the fact we are no longer tracking the key for them. */
+void trackingInvalidateKeyRaw(client *c, char *key, size_t keylen, int bcast) {
+    if (TrackingTable == NULL) return;
+
+    if (bcast && raxSize(PrefixTable) > 0)
+        trackingRememberKeyToBroadcast(c,key,keylen);
+
+    rax *ids = raxFind(TrackingTable,(unsigned char*)key,keylen);
+    if (ids == raxNotFound) return;
+
+    raxIterator ri;
+    raxStart(&ri,ids);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t id;
+        memcpy(&id,ri.key,sizeof(id));
+        client *target = lookupClientByID(id);
+        /* Note that if the client is in BCAST mode, we don't want to
+         * send invalidation messages that were pending in the case
+         * previously the client was not in BCAST mode. This can happen if
+         * TRACKING is enabled normally, and then the client switches to
+         * BCAST mode. */
+        if (target == NULL ||
+            !(target->flags & CLIENT_TRACKING)||
+            target->client_tracking_flags & TRACKING_BCAST)
+        {
+            continue;
+        }
+
+        /* If the client enabled the NOLOOP mode, don't send notifications
+         * about keys changed by the client itself. */
+        if (target->client_tracking_flags & TRACKING_NOLOOP &&
+            target == c)
+        {
+            continue;
+        }
+
+        sendTrackingMessage(target,key,keylen,NULL);
+    }
+    raxStop(&ri);
+
+    /* Free the tracking table: we'll create the radix tree and populate it
+     * again if more keys will be modified in this caching slot. */
+    TrackingTableTotalItems -= raxSize(ids);
+    raxFree(ids);
+    raxRemove(TrackingTable,(unsigned char*)key,keylen,NULL);
+}
+
+/* Wrapper (the one actually called across the core) to pass the key
+ * as object. */
+void trackingInvalidateKey(client *c, robj *keyobj) {
+    if (TrackingTable == NULL) return;
+    robj *decoded = getDecodedObject(keyobj);
+    trackingInvalidateKeyRaw(c,decoded->ptr,sdslen(decoded->ptr),1);
+    decrRefCount(decoded);
+}
+
+/* This function is called when one or all the Redis databases are flushed
+ * (dbid == -1 in case of FLUSHALL). Caching keys are not specific for
+ * each DB but are global: currently what we do is send a special
+ * notification to clients with tracking enabled, sending a null array
+ * payload that means "all the keys are invalidated", and forget about all
+ * the tracked keys. */
+void freeTrackingRadixTree(void *rt) {
+    raxFree(rt);
+}
+
+void trackingInvalidateKeysOnFlush(int dbid) {
+    UNUSED(dbid);
+    if (server.tracking_clients) {
+        listNode *ln;
+        listIter li;
+        listRewind(server.clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            client *c = listNodeValue(ln);
+            if (c->flags & CLIENT_TRACKING) sendTrackingMessage(c,NULL,0,NULL);
+        }
+    }
+
+    /* In case of FLUSHALL, reclaim all the memory used by tracking. */
+    if (TrackingTable) {
+        raxFreeWithCallback(TrackingTable,freeTrackingRadixTree);
+        TrackingTable = raxNew();
+        TrackingTableTotalItems = 0;
+    }
+}
+
+/* Tracking forces Redis to remember information about which client may have
+ * certain keys. In workloads where there are a lot of reads, but keys are
+ * hardly modified, the amount of information we have to remember server side
+ * could be a lot, with the number of keys being totally not bound.
+ *
+ * So Redis allows the user to configure a maximum number of keys for the
+ * invalidation table. This function makes sure that we don't go over the
+ * specified fill rate: if we are over, we can just evict informations about
+ * a random key, and send invalidation messages to clients like if the key was
+ * modified. */
+void trackingLimitUsedSlots(void) {
+    static unsigned int timeout_counter = 0;
+    if (TrackingTable == NULL) return;
+    if (server.tracking_table_max_keys == 0) return; /* No limits set. */
+    size_t max_keys = server.tracking_table_max_keys;
+    if (raxSize(TrackingTable) <= max_keys) {
+        timeout_counter = 0;
+        return; /* Limit not reached. */
+    }
+
+    /* We have to invalidate a few keys to reach the limit again. The effort
+     * we do here is proportional to the number of times we entered this
+     * function and found that we are still over the limit. */
+    int effort = 100 * (timeout_counter+1);
+
+    /* We just remove one key after another by using a random walk. */
+    raxIterator ri;
+    raxStart(&ri,TrackingTable);
+    while(effort > 0) {
+        effort--;
+        raxSeek(&ri,"^",NULL,0);
+        raxRandomWalk(&ri,0);
+        if (raxEOF(&ri)) break;
+        trackingInvalidateKeyRaw(NULL,(char*)ri.key,ri.key_len,0);
+        if (raxSize(TrackingTable) <= max_keys) {
+            timeout_counter = 0;
+            raxStop(&ri);
+            return; /* Return ASAP: we are again under the limit. */
+        }
+    }
+
+    /* If we reach this point, we were not able to go under the configured
+     * limit using the maximum effort we had for this run. */
+    raxStop(&ri);
+    timeout_counter++;
+}
+
+/* Generate the raw protocol of an array of the keys in the rax 'keys'
+ * modified by clients other than 'c', if 'c' is in NOLOOP mode, or by any
+ * client otherwise. Set *count to the number of keys in the array. */
+sds trackingBuildBroadcastReply(client *c, rax *keys, size_t *count) {
+    raxIterator ri;
+    sds proto = sdsempty();
+    int noloop = c && c->client_tracking_flags & TRACKING_NOLOOP;
+
+    *count = 0;
+    raxStart(&ri,keys);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        if (noloop && ri.data == c) continue;
+        proto = sdscatfmt(proto,"$%U\r\n",(unsigned long long)ri.key_len);
+        proto = sdscatlen(proto,ri.key,ri.key_len);
+        proto = sdscatlen(proto,"\r\n",2);
+        (*count)++;
+    }
+    raxStop(&ri);
+    sds reply = sdscatfmt(sdsempty(),"*%U\r\n",(unsigned long long)*count);
+    reply = sdscatsds(reply,proto);
+    sdsfree(proto);
+    return reply;
+}
+
+/* This function will run the prefixes of clients in BCAST mode and
+ * keys that were modified about each prefix, and will send the
+ * notifications to each client in each prefix. */
+void trackingBroadcastInvalidationMessages(void) {
+    raxIterator ri, ri2;
+
+    /* Return ASAP if there is nothing to do here. */
+    if (TrackingTable == NULL || !server.tracking_clients) return;
+
+    raxStart(&ri,PrefixTable);
+    raxSeek(&ri,"^",NULL,0);
+
+    /* For each prefix... */
+    while(raxNext(&ri)) {
+        bcastState *bs = ri.data;
+
+        if (raxSize(bs->keys)) {
+            /* Generate the common protocol for all the clients that are
+             * not using the NOLOOP option. */
+            size_t count;
+            sds proto = trackingBuildBroadcastReply(NULL,bs->keys,&count);
+
+            /* Send this array of keys to every client in the list. */
+            raxStart(&ri2,bs->clients);
+            raxSeek(&ri2,"^",NULL,0);
+            while(raxNext(&ri2)) {
+                client *c;
+                memcpy(&c,ri2.key,sizeof(c));
+                if (c->client_tracking_flags & TRACKING_NOLOOP) {
+                    /* This client may have certain keys excluded. */
+                    sds adhoc = trackingBuildBroadcastReply(c,bs->keys,&count);
+                    if (count) sendTrackingMessage(c,NULL,0,adhoc);
+                    sdsfree(adhoc);
+                } else {
+                    sendTrackingMessage(c,NULL,0,proto);
+                }
+            }
+            raxStop(&ri2);
+
+            /* Clean up: we can remove everything from this state, because we
+             * want to only track the new keys that will be accumulated starting
+             * from now. */
+            sdsfree(proto);
+        }
+        raxFree(bs->keys);
+        bs->keys = raxNew();
+    }
+    raxStop(&ri);
+}
+
+/* This is just used in order to access the amount of used slots in the
+ * tracking table. */
+uint64_t trackingGetTotalItems(void) {
+    return TrackingTableTotalItems;
+}
+
+uint64_t trackingGetTotalKeys(void) {
+    if (TrackingTable == NULL) return 0;
+    return raxSize(TrackingTable);
+}
+
+uint64_t trackingGetTotalPrefixes(void) {
+    if (PrefixTable == NULL) return 0;
+    return raxSize(PrefixTable);
+}
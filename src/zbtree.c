@@ -0,0 +1,829 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*-----------------------------------------------------------------------------
+ * Counted B+tree for sorted sets
+ *----------------------------------------------------------------------------*/
+
+/* This is an alternative to the skiplist used by large sorted sets, selected
+ * with the zset-large-encoding option. Like the skiplist it is paired with
+ * a dict mapping elements to scores, and orders elements by score and then
+ * lexicographically by element.
+ *
+ * Leaves store packed arrays of (score,element) pairs and are linked in both
+ * directions, so range queries scan contiguous memory instead of chasing a
+ * pointer per element. Inner nodes store, for every child, the smallest
+ * element found under it (used to route lookups) and the number of elements
+ * found under it, so that the rank of an element and the element at a given
+ * rank are both found in O(log(N)), like zslGetRank() and
+ * zslGetElementByRank() do with the skiplist spans.
+ *
+ * Separators in the inner nodes are always the exact minimum of the
+ * child: they reference the SDS string owned by the leaf, so they must be
+ * updated every time the first element of a subtree changes.
+ *
+ * Every node but the root holds at least one element. Underfull nodes are
+ * merged with a sibling when the two fit together, and the root is removed
+ * when it is left with a single child. */
+
+#include "server.h"
+
+typedef struct zbtPathItem {
+    zbtInner *node;
+    unsigned int idx;   /* Child of 'node' we descended into. */
+} zbtPathItem;
+
+/* Compare two elements using the sorted set order. */
+static inline int zbtCompare(double s1, sds e1, double s2, sds e2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return sdscmp(e1,e2);
+}
+
+static zbtLeaf *zbtCreateLeaf(zbtree *zbt) {
+    zbtLeaf *leaf = zmalloc(sizeof(*leaf));
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    zbt->leaves++;
+    return leaf;
+}
+
+static zbtInner *zbtCreateInner(zbtree *zbt) {
+    zbtInner *inner = zmalloc(sizeof(*inner));
+    inner->count = 0;
+    zbt->inners++;
+    return inner;
+}
+
+/* Create a new empty tree: the root is an empty leaf. */
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+    zbt->leaves = zbt->inners = 0;
+    zbt->head = zbt->tail = zbtCreateLeaf(zbt);
+    zbt->root = zbt->head;
+    zbt->length = 0;
+    zbt->level = 1;
+    return zbt;
+}
+
+static void zbtFreeNode(void *node, int level) {
+    if (level == 1) {
+        zbtLeaf *leaf = node;
+        unsigned int j;
+
+        for (j = 0; j < leaf->count; j++) sdsfree(leaf->e[j].ele);
+    } else {
+        zbtInner *inner = node;
+        unsigned int j;
+
+        for (j = 0; j < inner->count; j++)
+            zbtFreeNode(inner->child[j],level-1);
+    }
+    zfree(node);
+}
+
+/* Free the whole tree, including the SDS strings of the elements. */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root,zbt->level);
+    zfree(zbt);
+}
+
+/* Memory used by the tree nodes, not including the elements. */
+size_t zbtMemUsage(const zbtree *zbt) {
+    return sizeof(*zbt) + zbt->leaves*zmalloc_size(zbt->head) +
+           zbt->inners*sizeof(zbtInner);
+}
+
+/* Number of elements (leaves) or children (inner nodes) of a node. */
+static inline unsigned int zbtNodeCount(void *node, int level) {
+    return level == 1 ? ((zbtLeaf*)node)->count : ((zbtInner*)node)->count;
+}
+
+/* Smallest element under a non empty node. */
+static inline zbtEntry *zbtNodeMin(void *node, int level) {
+    return level == 1 ? &((zbtLeaf*)node)->e[0] : &((zbtInner*)node)->key[0];
+}
+
+/* Return the child of 'inner' that may contain the element: the last one
+ * whose smallest element is less than or equal to it, or the first one. */
+static unsigned int zbtInnerSearch(zbtInner *inner, double score, sds ele) {
+    unsigned int lo = 1, hi = inner->count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        zbtEntry *k = &inner->key[mid];
+        if (zbtCompare(k->score,k->ele,score,ele) > 0)
+            hi = mid;
+        else
+            lo = mid+1;
+    }
+    return lo-1;
+}
+
+/* Return the position of the first element of the leaf that is greater than
+ * or equal to the specified one. */
+static unsigned int zbtLeafSearch(zbtLeaf *leaf, double score, sds ele) {
+    unsigned int lo = 0, hi = leaf->count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        zbtEntry *e = &leaf->e[mid];
+        if (zbtCompare(e->score,e->ele,score,ele) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Descend the tree looking for the specified element, populating 'path'
+ * with the inner nodes traversed. On success 1 is returned and the element
+ * position is stored in '*leafptr' and '*posptr', otherwise 0 is returned. */
+static int zbtFind(zbtree *zbt, double score, sds ele, zbtPathItem *path,
+                   zbtLeaf **leafptr, unsigned int *posptr)
+{
+    void *node = zbt->root;
+    zbtLeaf *leaf;
+    unsigned int pos;
+    int l;
+
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        path[l].node = inner;
+        path[l].idx = zbtInnerSearch(inner,score,ele);
+        node = inner->child[path[l].idx];
+    }
+    leaf = node;
+    pos = zbtLeafSearch(leaf,score,ele);
+    if (pos == leaf->count ||
+        zbtCompare(leaf->e[pos].score,leaf->e[pos].ele,score,ele) != 0)
+        return 0;
+    *leafptr = leaf;
+    *posptr = pos;
+    return 1;
+}
+
+/* Like zbtFind() but locates the element with the specified 1-based rank,
+ * that must be between 1 and the tree length. */
+static void zbtFindByRank(zbtree *zbt, unsigned long rank, zbtPathItem *path,
+                          zbtLeaf **leafptr, unsigned int *posptr)
+{
+    void *node = zbt->root;
+    int l;
+
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        unsigned int i = 0;
+
+        while (rank > inner->size[i]) rank -= inner->size[i++];
+        path[l].node = inner;
+        path[l].idx = i;
+        node = inner->child[i];
+    }
+    *leafptr = node;
+    *posptr = rank-1;
+}
+
+/* The smallest element under the node reached at level 'from'-1 changed:
+ * update the separators referencing it, walking up while the node is the
+ * first child of its parent. */
+static void zbtUpdateMin(zbtree *zbt, zbtPathItem *path, int from, zbtEntry *min) {
+    zbtEntry e = *min;
+    int l;
+
+    for (l = from; l <= zbt->level; l++) {
+        path[l].node->key[path[l].idx] = e;
+        if (path[l].idx != 0) break;
+    }
+}
+
+static void zbtLeafInsertAt(zbtLeaf *leaf, unsigned int pos, double score, sds ele) {
+    memmove(leaf->e+pos+1,leaf->e+pos,(leaf->count-pos)*sizeof(zbtEntry));
+    leaf->e[pos].score = score;
+    leaf->e[pos].ele = ele;
+    leaf->count++;
+}
+
+static void zbtInnerInsertAt(zbtInner *inner, unsigned int pos, zbtEntry *key,
+                             unsigned long size, void *child)
+{
+    unsigned int move = inner->count-pos;
+
+    memmove(inner->key+pos+1,inner->key+pos,move*sizeof(zbtEntry));
+    memmove(inner->size+pos+1,inner->size+pos,move*sizeof(unsigned long));
+    memmove(inner->child+pos+1,inner->child+pos,move*sizeof(void*));
+    inner->key[pos] = *key;
+    inner->size[pos] = size;
+    inner->child[pos] = child;
+    inner->count++;
+}
+
+static void zbtInnerRemoveAt(zbtInner *inner, unsigned int pos) {
+    unsigned int move = inner->count-pos-1;
+
+    memmove(inner->key+pos,inner->key+pos+1,move*sizeof(zbtEntry));
+    memmove(inner->size+pos,inner->size+pos+1,move*sizeof(unsigned long));
+    memmove(inner->child+pos,inner->child+pos+1,move*sizeof(void*));
+    inner->count--;
+}
+
+static unsigned long zbtInnerSize(zbtInner *inner) {
+    unsigned long size = 0;
+    unsigned int j;
+
+    for (j = 0; j < inner->count; j++) size += inner->size[j];
+    return size;
+}
+
+/* Insert a new element. The element must not already exist (the caller
+ * checks it with the dict). The SDS string is referenced by the tree
+ * after the call. */
+void zbtInsert(zbtree *zbt, double score, sds ele) {
+    zbtPathItem path[ZBT_MAXLEVEL+1];
+    void *node = zbt->root, *newnode;
+    zbtLeaf *leaf, *right;
+    zbtEntry newkey;
+    unsigned long oldsize, newsize;
+    unsigned int pos, split;
+    int l, rightmost;
+
+    /* Descend to the leaf, accounting for the new element on the way down.
+     * The separator of the subtree only changes when the element becomes
+     * its new minimum, which is only possible for the first child. */
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        unsigned int i = zbtInnerSearch(inner,score,ele);
+        zbtEntry *k = &inner->key[i];
+
+        if (zbtCompare(score,ele,k->score,k->ele) < 0) {
+            k->score = score;
+            k->ele = ele;
+        }
+        inner->size[i]++;
+        path[l].node = inner;
+        path[l].idx = i;
+        node = inner->child[i];
+    }
+    leaf = node;
+    pos = zbtLeafSearch(leaf,score,ele);
+    zbt->length++;
+
+    if (leaf->count < ZBT_LEAF_CAP) {
+        zbtLeafInsertAt(leaf,pos,score,ele);
+        return;
+    }
+
+    /* The leaf is full: before splitting it try to make room moving an
+     * element to a sibling with the same parent, so that only the parent
+     * separator and counts change. This keeps leaves fuller with random
+     * insertions. */
+    if (zbt->level > 1) {
+        zbtInner *parent = path[2].node;
+        unsigned int i = path[2].idx;
+        zbtLeaf *sibling;
+
+        if (i > 0 && pos > 0 &&
+            (sibling = parent->child[i-1])->count < ZBT_LEAF_CAP)
+        {
+            sibling->e[sibling->count++] = leaf->e[0];
+            memmove(leaf->e,leaf->e+1,(leaf->count-1)*sizeof(zbtEntry));
+            leaf->count--;
+            zbtLeafInsertAt(leaf,pos-1,score,ele);
+            parent->size[i-1]++;
+            parent->size[i]--;
+            parent->key[i] = leaf->e[0];
+            return;
+        }
+        if (i+1 < parent->count && pos < leaf->count &&
+            (sibling = parent->child[i+1])->count < ZBT_LEAF_CAP)
+        {
+            zbtLeafInsertAt(sibling,0,leaf->e[leaf->count-1].score,
+                            leaf->e[leaf->count-1].ele);
+            leaf->count--;
+            zbtLeafInsertAt(leaf,pos,score,ele);
+            parent->size[i+1]++;
+            parent->size[i]--;
+            parent->key[i+1] = sibling->e[0];
+            return;
+        }
+    }
+
+    /* The leaf is full and must be split. Appending to the tail or
+     * prepending to the head are common (monotonic scores), in this case we
+     * leave the full leaf alone instead of creating two half empty ones. */
+    rightmost = leaf == zbt->tail;
+    if (rightmost && pos == leaf->count)
+        split = ZBT_LEAF_CAP;
+    else if (leaf == zbt->head && pos == 0)
+        split = 0;
+    else
+        split = ZBT_LEAF_CAP/2;
+
+    right = zbtCreateLeaf(zbt);
+    memcpy(right->e,leaf->e+split,(ZBT_LEAF_CAP-split)*sizeof(zbtEntry));
+    right->count = ZBT_LEAF_CAP-split;
+    leaf->count = split;
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        zbt->tail = right;
+    leaf->next = right;
+    if (pos <= split && split < ZBT_LEAF_CAP)
+        zbtLeafInsertAt(leaf,pos,score,ele);
+    else
+        zbtLeafInsertAt(right,pos-split,score,ele);
+
+    /* Link the new node into the parent, splitting it as well if needed,
+     * up to the root. */
+    newnode = right;
+    newkey = right->e[0];
+    newsize = right->count;
+    oldsize = leaf->count;
+    for (l = 2; l <= zbt->level; l++) {
+        zbtInner *inner = path[l].node, *sibling;
+        unsigned int i = path[l].idx+1;
+
+        inner->size[i-1] = oldsize;
+        if (inner->count < ZBT_INNER_CAP) {
+            zbtInnerInsertAt(inner,i,&newkey,newsize,newnode);
+            return;
+        }
+
+        split = (rightmost && i == inner->count) ? ZBT_INNER_CAP :
+                                                   ZBT_INNER_CAP/2;
+        sibling = zbtCreateInner(zbt);
+        sibling->count = ZBT_INNER_CAP-split;
+        memcpy(sibling->key,inner->key+split,sibling->count*sizeof(zbtEntry));
+        memcpy(sibling->size,inner->size+split,
+               sibling->count*sizeof(unsigned long));
+        memcpy(sibling->child,inner->child+split,sibling->count*sizeof(void*));
+        inner->count = split;
+        if (i <= split && split < ZBT_INNER_CAP)
+            zbtInnerInsertAt(inner,i,&newkey,newsize,newnode);
+        else
+            zbtInnerInsertAt(sibling,i-split,&newkey,newsize,newnode);
+
+        newnode = sibling;
+        newkey = sibling->key[0];
+        newsize = zbtInnerSize(sibling);
+        oldsize = zbtInnerSize(inner);
+    }
+
+    /* The root was split: grow the tree by one level. */
+    zbtInner *root = zbtCreateInner(zbt);
+    root->count = 2;
+    root->key[0] = *zbtNodeMin(zbt->root,zbt->level);
+    root->size[0] = oldsize;
+    root->child[0] = zbt->root;
+    root->key[1] = newkey;
+    root->size[1] = newsize;
+    root->child[1] = newnode;
+    zbt->root = root;
+    zbt->level++;
+    serverAssert(zbt->level <= ZBT_MAXLEVEL);
+}
+
+/* Remove the child 'pos' of 'inner' (an empty node at level 'level'). */
+static void zbtRemoveChild(zbtree *zbt, zbtInner *inner, unsigned int pos, int level) {
+    void *node = inner->child[pos];
+
+    if (level == 1) {
+        zbtLeaf *leaf = node;
+        if (leaf->prev) leaf->prev->next = leaf->next;
+        else zbt->head = leaf->next;
+        if (leaf->next) leaf->next->prev = leaf->prev;
+        else zbt->tail = leaf->prev;
+        zbt->leaves--;
+    } else {
+        zbt->inners--;
+    }
+    zfree(node);
+    zbtInnerRemoveAt(inner,pos);
+}
+
+/* Append the child 'pos'+1 of 'inner' to the child 'pos' and remove it.
+ * Both children are at level 'level' and their elements fit a single node. */
+static void zbtMergeChildren(zbtree *zbt, zbtInner *inner, unsigned int pos, int level) {
+    void *left = inner->child[pos], *right = inner->child[pos+1];
+
+    if (level == 1) {
+        zbtLeaf *l = left, *r = right;
+        memcpy(l->e+l->count,r->e,r->count*sizeof(zbtEntry));
+        l->count += r->count;
+        l->next = r->next;
+        if (r->next) r->next->prev = l;
+        else zbt->tail = l;
+        zbt->leaves--;
+    } else {
+        zbtInner *l = left, *r = right;
+        memcpy(l->key+l->count,r->key,r->count*sizeof(zbtEntry));
+        memcpy(l->size+l->count,r->size,r->count*sizeof(unsigned long));
+        memcpy(l->child+l->count,r->child,r->count*sizeof(void*));
+        l->count += r->count;
+        zbt->inners--;
+    }
+    zfree(right);
+    inner->size[pos] += inner->size[pos+1];
+    zbtInnerRemoveAt(inner,pos+1);
+}
+
+/* Remove 'count' elements starting at position 'pos' of the leaf found
+ * following 'path', then restore the tree invariants. The SDS strings of
+ * the removed elements are not freed. */
+static void zbtDeleteAt(zbtree *zbt, zbtLeaf *leaf, unsigned int pos,
+                        unsigned int count, zbtPathItem *path)
+{
+    void *node = leaf;
+    int l;
+
+    for (l = 2; l <= zbt->level; l++)
+        path[l].node->size[path[l].idx] -= count;
+    memmove(leaf->e+pos,leaf->e+pos+count,
+            (leaf->count-pos-count)*sizeof(zbtEntry));
+    leaf->count -= count;
+    zbt->length -= count;
+    if (pos == 0 && leaf->count) zbtUpdateMin(zbt,path,2,&leaf->e[0]);
+
+    /* Remove empty nodes and merge underfull ones with a sibling. As long
+     * as a node loses a child we need to check its parent as well. */
+    for (l = 1; l < zbt->level; l++) {
+        zbtInner *parent = path[l+1].node;
+        unsigned int i = path[l+1].idx;
+        unsigned int cap = (l == 1) ? ZBT_LEAF_CAP : ZBT_INNER_CAP;
+        unsigned int n = zbtNodeCount(node,l);
+
+        if (n == 0) {
+            zbtRemoveChild(zbt,parent,i,l);
+            if (i == 0 && parent->count)
+                zbtUpdateMin(zbt,path,l+2,&parent->key[0]);
+        } else if (n < cap/4) {
+            if (i > 0 && n+zbtNodeCount(parent->child[i-1],l) <= cap)
+                zbtMergeChildren(zbt,parent,i-1,l);
+            else if (i+1 < parent->count &&
+                     n+zbtNodeCount(parent->child[i+1],l) <= cap)
+                zbtMergeChildren(zbt,parent,i,l);
+            else
+                break;
+        } else {
+            break;
+        }
+        node = parent;
+    }
+
+    /* Shrink the tree while the root has a single child. */
+    while (zbt->level > 1 && ((zbtInner*)zbt->root)->count == 1) {
+        zbtInner *root = zbt->root;
+        zbt->root = root->child[0];
+        zfree(root);
+        zbt->inners--;
+        zbt->level--;
+    }
+}
+
+/* Delete an element with matching score/element from the tree.
+ * The function returns 1 if the element was found and deleted, otherwise
+ * 0 is returned.
+ *
+ * If 'oldele' is NULL the SDS string of the deleted element is freed,
+ * otherwise it is not freed and it is returned by reference, so that it
+ * can be reused by the caller. */
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *oldele) {
+    zbtPathItem path[ZBT_MAXLEVEL+1];
+    zbtLeaf *leaf;
+    unsigned int pos;
+
+    if (!zbtFind(zbt,score,ele,path,&leaf,&pos)) return 0;
+    if (oldele)
+        *oldele = leaf->e[pos].ele;
+    else
+        sdsfree(leaf->e[pos].ele);
+    zbtDeleteAt(zbt,leaf,pos,1,path);
+    return 1;
+}
+
+/* Update the score of an element inside the tree. The element must exist.
+ * When the new score does not change the position of the element only the
+ * score is updated in place, otherwise the element is removed and inserted
+ * again, reusing the same SDS string. */
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore) {
+    zbtPathItem path[ZBT_MAXLEVEL+1];
+    zbtLeaf *leaf;
+    unsigned int pos;
+
+    serverAssert(zbtFind(zbt,curscore,ele,path,&leaf,&pos));
+    if (pos > 0 &&
+        zbtCompare(leaf->e[pos-1].score,leaf->e[pos-1].ele,newscore,ele) < 0 &&
+        ((pos+1 < leaf->count &&
+          zbtCompare(newscore,ele,leaf->e[pos+1].score,leaf->e[pos+1].ele) < 0) ||
+         (pos+1 == leaf->count && (leaf->next == NULL ||
+          zbtCompare(newscore,ele,leaf->next->e[0].score,leaf->next->e[0].ele) < 0))))
+    {
+        leaf->e[pos].score = newscore;
+        return;
+    }
+    ele = leaf->e[pos].ele;
+    zbtDeleteAt(zbt,leaf,pos,1,path);
+    zbtInsert(zbt,newscore,ele);
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise.
+ * Note that the rank is 1-based. */
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele) {
+    void *node = zbt->root;
+    unsigned long rank = 0;
+    unsigned int pos, j;
+    zbtLeaf *leaf;
+    int l;
+
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        unsigned int i = zbtInnerSearch(inner,score,ele);
+        for (j = 0; j < i; j++) rank += inner->size[j];
+        node = inner->child[i];
+    }
+    leaf = node;
+    pos = zbtLeafSearch(leaf,score,ele);
+    if (pos == leaf->count ||
+        zbtCompare(leaf->e[pos].score,leaf->e[pos].ele,score,ele) != 0)
+        return 0;
+    return rank+pos+1;
+}
+
+/* Position the cursor on the element with the specified 1-based rank.
+ * Returns 0 if the rank is out of range. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtCursor *c) {
+    zbtPathItem path[ZBT_MAXLEVEL+1];
+
+    if (rank == 0 || rank > zbt->length) return 0;
+    zbtFindByRank(zbt,rank,path,&c->leaf,&c->idx);
+    return 1;
+}
+
+/* Position the cursor on the first or the last element of the tree.
+ * Returns 0 if the tree is empty. */
+int zbtFirst(zbtree *zbt, zbtCursor *c) {
+    c->leaf = zbt->head;
+    c->idx = 0;
+    return zbt->length != 0;
+}
+
+int zbtLast(zbtree *zbt, zbtCursor *c) {
+    c->leaf = zbt->tail;
+    c->idx = zbt->tail->count-1;
+    return zbt->length != 0;
+}
+
+/* Move the cursor to the next or previous element. Returns 0 when there
+ * are no more elements, in which case the cursor is no longer valid. */
+int zbtNext(zbtCursor *c) {
+    if (++c->idx < c->leaf->count) return 1;
+    c->leaf = c->leaf->next;
+    c->idx = 0;
+    return c->leaf != NULL;
+}
+
+int zbtPrev(zbtCursor *c) {
+    if (c->idx > 0) {
+        c->idx--;
+        return 1;
+    }
+    c->leaf = c->leaf->prev;
+    if (c->leaf == NULL) return 0;
+    c->idx = c->leaf->count-1;
+    return 1;
+}
+
+/* Predicates used to seek ranges: 'gte' ones are false and then true along
+ * the tree, 'lte' ones are true and then false. */
+typedef int zbtPredicate(zbtEntry *e, void *spec);
+
+static int zbtScoreGteMin(zbtEntry *e, void *spec) {
+    return zslValueGteMin(e->score,spec);
+}
+
+static int zbtScoreLteMax(zbtEntry *e, void *spec) {
+    return zslValueLteMax(e->score,spec);
+}
+
+static int zbtLexGteMin(zbtEntry *e, void *spec) {
+    return zslLexValueGteMin(e->ele,spec);
+}
+
+static int zbtLexLteMax(zbtEntry *e, void *spec) {
+    return zslLexValueLteMax(e->ele,spec);
+}
+
+/* Position the cursor on the first element matching 'pred', storing its
+ * 1-based rank in '*rank'. Returns 0 if no element matches. */
+static int zbtSeekFirst(zbtree *zbt, zbtPredicate *pred, void *spec,
+                        zbtCursor *c, unsigned long *rank)
+{
+    void *node = zbt->root;
+    unsigned long r = 0;
+    unsigned int lo, hi, j;
+    zbtLeaf *leaf;
+    int l;
+
+    /* Descend into the last child whose minimum does not match: the first
+     * matching element is either there or it is the next one. */
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        lo = 0, hi = inner->count;
+        while (lo < hi) {
+            unsigned int mid = (lo+hi)/2;
+            if (pred(&inner->key[mid],spec)) hi = mid; else lo = mid+1;
+        }
+        if (lo > 0) lo--;
+        for (j = 0; j < lo; j++) r += inner->size[j];
+        node = inner->child[lo];
+    }
+    leaf = node;
+    lo = 0, hi = leaf->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (pred(&leaf->e[mid],spec)) hi = mid; else lo = mid+1;
+    }
+    r += lo+1;
+    if (lo == leaf->count) {
+        leaf = leaf->next;
+        lo = 0;
+        if (leaf == NULL) return 0;
+    }
+    c->leaf = leaf;
+    c->idx = lo;
+    if (rank) *rank = r;
+    return 1;
+}
+
+/* Position the cursor on the last element matching 'pred', storing its
+ * 1-based rank in '*rank'. Returns 0 if no element matches. */
+static int zbtSeekLast(zbtree *zbt, zbtPredicate *pred, void *spec,
+                       zbtCursor *c, unsigned long *rank)
+{
+    void *node = zbt->root;
+    unsigned long r = 0;
+    unsigned int lo, hi, j;
+    zbtLeaf *leaf;
+    int l;
+
+    /* Descend into the last child whose minimum matches. */
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        lo = 0, hi = inner->count;
+        while (lo < hi) {
+            unsigned int mid = (lo+hi)/2;
+            if (pred(&inner->key[mid],spec)) lo = mid+1; else hi = mid;
+        }
+        if (lo == 0) return 0;
+        lo--;
+        for (j = 0; j < lo; j++) r += inner->size[j];
+        node = inner->child[lo];
+    }
+    leaf = node;
+    lo = 0, hi = leaf->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (pred(&leaf->e[mid],spec)) lo = mid+1; else hi = mid;
+    }
+    if (lo == 0) return 0;
+    c->leaf = leaf;
+    c->idx = lo-1;
+    if (rank) *rank = r+lo;
+    return 1;
+}
+
+/* Find the first element that is contained in the specified range, and
+ * optionally its rank. Returns 0 when no element is contained in the range. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtCursor *c, unsigned long *rank) {
+    if (!zbtSeekFirst(zbt,zbtScoreGteMin,range,c,rank)) return 0;
+    return zslValueLteMax(zbtCursorEntry(c)->score,range);
+}
+
+/* Find the last element that is contained in the specified range, and
+ * optionally its rank. Returns 0 when no element is contained in the range. */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtCursor *c, unsigned long *rank) {
+    if (!zbtSeekLast(zbt,zbtScoreLteMax,range,c,rank)) return 0;
+    return zslValueGteMin(zbtCursorEntry(c)->score,range);
+}
+
+/* Same as zbtFirstInRange() and zbtLastInRange() for lexicographic ranges. */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c, unsigned long *rank) {
+    if (!zbtSeekFirst(zbt,zbtLexGteMin,range,c,rank)) return 0;
+    return zslLexValueLteMax(zbtCursorEntry(c)->ele,range);
+}
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtCursor *c, unsigned long *rank) {
+    if (!zbtSeekLast(zbt,zbtLexLteMax,range,c,rank)) return 0;
+    return zslLexValueGteMin(zbtCursorEntry(c)->ele,range);
+}
+
+/* Delete all the elements with rank between start and end from the tree,
+ * removing them from the dict as well. Start and end are inclusive and
+ * 1-based. Elements are removed a leaf at a time. */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    zbtPathItem path[ZBT_MAXLEVEL+1];
+    unsigned long removed = 0, todo = end-start+1;
+
+    while (todo) {
+        zbtLeaf *leaf;
+        unsigned int pos, count, j;
+
+        zbtFindByRank(zbt,start,path,&leaf,&pos);
+        count = leaf->count-pos;
+        if (count > todo) count = todo;
+        for (j = pos; j < pos+count; j++) {
+            dictDelete(dict,leaf->e[j].ele);
+            sdsfree(leaf->e[j].ele);
+        }
+        zbtDeleteAt(zbt,leaf,pos,count,path);
+        removed += count;
+        todo -= count;
+    }
+    return removed;
+}
+
+/* Delete all the elements with score in the specified range. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    unsigned long start, end;
+    zbtCursor c;
+
+    if (!zbtFirstInRange(zbt,range,&c,&start)) return 0;
+    if (!zbtLastInRange(zbt,range,&c,&end)) return 0;
+    return zbtDeleteRangeByRank(zbt,start,end,dict);
+}
+
+/* Delete all the elements in the specified lexicographic range. */
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    unsigned long start, end;
+    zbtCursor c;
+
+    if (!zbtFirstInLexRange(zbt,range,&c,&start)) return 0;
+    if (!zbtLastInLexRange(zbt,range,&c,&end)) return 0;
+    return zbtDeleteRangeByRank(zbt,start,end,dict);
+}
+
+/* Compare an element of the tree with 'newele', the new location of the
+ * SDS string 'oldele' that was already freed: if the element references
+ * 'oldele' it is the one we are looking for and it must not be accessed. */
+static int zbtCompareMoved(zbtEntry *e, double score, sds oldele, sds newele) {
+    if (e->ele == oldele) {
+        e->ele = newele;
+        return 0;
+    }
+    return zbtCompare(e->score,e->ele,score,newele);
+}
+
+/* Used by active defrag when the SDS string of an element was moved: update
+ * the leaf and all the separators referencing it. 'oldele' was already
+ * freed, so only 'newele' is used for comparisons. */
+void zbtReplaceEle(zbtree *zbt, double score, sds oldele, sds newele) {
+    void *node = zbt->root;
+    zbtLeaf *leaf;
+    int l;
+
+    for (l = zbt->level; l > 1; l--) {
+        zbtInner *inner = node;
+        unsigned int i = 0;
+
+        while (i+1 < inner->count &&
+               zbtCompareMoved(&inner->key[i+1],score,oldele,newele) <= 0)
+            i++;
+        if (inner->key[i].ele == oldele) inner->key[i].ele = newele;
+        node = inner->child[i];
+    }
+    leaf = node;
+    unsigned int j;
+    for (j = 0; j < leaf->count; j++) {
+        if (zbtCompareMoved(&leaf->e[j],score,oldele,newele) == 0) return;
+    }
+    serverPanic("Moved element not found in the sorted set btree");
+}
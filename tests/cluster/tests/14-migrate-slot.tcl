@@ -0,0 +1,125 @@
+# Check the MIGRATE SLOT option, moving a whole hash slot in a single call.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 3 nodes cluster" {
+    create_cluster 3 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set slot [R 0 cluster keyslot "{migrate}"]
+for {set id 0} {$id < 3} {incr id} {
+    if {[catch {R $id exists "{migrate}"}] == 0} {set src $id}
+}
+set dst [expr {($src+1) % 3}]
+set src_id [dict get [get_myself $src] id]
+set dst_id [dict get [get_myself $dst] id]
+set dst_port [get_instance_attrib redis $dst port]
+set src_port [get_instance_attrib redis $src port]
+
+test "MIGRATE SLOT requires the slot to be in migrating state" {
+    catch {R $src migrate 127.0.0.1 $dst_port "" 0 5000 slot $slot} e
+    assert_match {*not in migrating state*} $e
+}
+
+test "MIGRATE SLOT moves all the keys and the slot ownership" {
+    for {set j 0} {$j < 1000} {incr j} {
+        R $src set "{migrate}key:$j" $j
+    }
+    R $src rpush "{migrate}list" a b c
+    R $dst cluster setslot $slot importing $src_id
+    R $src cluster setslot $slot migrating $dst_id
+    assert_equal OK [R $src migrate 127.0.0.1 $dst_port "" 0 5000 slot $slot]
+    assert_equal 0 [R $src cluster countkeysinslot $slot]
+    assert_equal 1001 [R $dst cluster countkeysinslot $slot]
+    assert_equal 999 [R $dst get "{migrate}key:999"]
+    assert_equal {a b c} [R $dst lrange "{migrate}list" 0 -1]
+    catch {R $src get "{migrate}key:1"} e
+    assert_match "MOVED $slot *:$dst_port" $e
+}
+
+test "The new owner of the slot is propagated to the cluster" {
+    foreach_redis_id id {
+        if {$id == $dst} continue
+        wait_for_condition 1000 50 {
+            [catch {R $id get "{migrate}key:1"} e] &&
+            [string match "MOVED $slot *:$dst_port" $e]
+        } else {
+            fail "Instance #$id does not redirect to the new slot owner"
+        }
+    }
+}
+
+test "MIGRATE SLOT sends large keys in chunks while serving clients" {
+    R $dst config set migrate-chunk-size 100
+    set elements {}
+    for {set j 0} {$j < 5000} {incr j} {lappend elements $j}
+    R $dst rpush "{migrate}biglist" {*}$elements
+    R $src cluster setslot $slot importing $dst_id
+    R $dst cluster setslot $slot migrating $src_id
+    set rd [redis 127.0.0.1 [get_instance_attrib redis $dst port] 1]
+    $rd migrate 127.0.0.1 $src_port "" 0 5000 slot $slot
+    # The slot is moved in steps: other clients are served meanwhile.
+    assert_equal PONG [R $dst ping]
+    assert_equal OK [$rd read]
+    $rd close
+    assert_equal 0 [R $dst cluster countkeysinslot $slot]
+    assert_equal 1002 [R $src cluster countkeysinslot $slot]
+    assert_equal 5000 [R $src llen "{migrate}biglist"]
+    assert_equal 999 [R $src get "{migrate}key:999"]
+    R $dst config set migrate-chunk-size 1000
+}
+
+test "MIGRATE SLOT of an empty slot moves the ownership" {
+    R $src del "{migrate}biglist" "{migrate}list"
+    for {set j 0} {$j < 1000} {incr j} {
+        R $src del "{migrate}key:$j"
+    }
+    R $dst cluster setslot $slot importing $src_id
+    R $src cluster setslot $slot migrating $dst_id
+    assert_equal OK [R $src migrate 127.0.0.1 $dst_port "" 0 5000 slot $slot]
+    catch {R $src get "{migrate}key:1"} e
+    assert_match "MOVED $slot *:$dst_port" $e
+}
+
+test "MIGRATE SLOT streams the writes received during the transfer" {
+    for {set j 0} {$j < 1000} {incr j} {
+        R $dst set "{migrate}key:$j" $j
+    }
+    set elements {}
+    for {set j 0} {$j < 5000} {incr j} {lappend elements $j}
+    R $dst rpush "{migrate}biglist" {*}$elements
+    R $dst config set migrate-chunk-size 10
+    R $src cluster setslot $slot importing $dst_id
+    R $dst cluster setslot $slot migrating $src_id
+    set rd [redis 127.0.0.1 $dst_port 1]
+    $rd migrate 127.0.0.1 $src_port "" 0 5000 slot $slot
+    wait_for_condition 1000 10 {
+        [R $src cluster countkeysinslot $slot] > 0
+    } else {
+        fail "MIGRATE SLOT did not start copying the slot"
+    }
+    # Until the slot moves the source serves all its keys, copied or not,
+    # with no -ASK redirection.
+    assert_equal {} [R $dst get "{migrate}new"]
+    R $dst set "{migrate}new" foo
+    R $dst incr "{migrate}key:0"
+    R $dst del "{migrate}key:1"
+    R $dst rpush "{migrate}biglist" tail
+    assert_equal OK [$rd read]
+    $rd close
+    assert_equal 0 [R $dst cluster countkeysinslot $slot]
+    assert_equal 1001 [R $src cluster countkeysinslot $slot]
+    assert_equal foo [R $src get "{migrate}new"]
+    assert_equal 1 [R $src get "{migrate}key:0"]
+    assert_equal 0 [R $src exists "{migrate}key:1"]
+    assert_equal 999 [R $src get "{migrate}key:999"]
+    assert_equal 5001 [R $src llen "{migrate}biglist"]
+    assert_equal tail [R $src lindex "{migrate}biglist" -1]
+    catch {R $dst get "{migrate}key:0"} e
+    assert_match "MOVED $slot *:$src_port" $e
+    R $dst config set migrate-chunk-size 1000
+}
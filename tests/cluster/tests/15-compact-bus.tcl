@@ -0,0 +1,85 @@
+# Check the compact cluster bus encoding (cluster-bus-compact option).
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 3 nodes cluster" {
+    create_cluster 3 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+test "Nodes send PING/PONG packets without the slots bitmap" {
+    foreach_redis_id id {
+        wait_for_condition 1000 50 {
+            [CI $id cluster_stats_messages_compact_sent] > 0
+        } else {
+            fail "Instance #$id is not using the compact encoding"
+        }
+    }
+}
+
+set slot [R 0 cluster keyslot "{compact}"]
+for {set id 0} {$id < 3} {incr id} {
+    if {[catch {R $id exists "{compact}"}] == 0} {set src $id}
+}
+set dst [expr {($src+1) % 3}]
+set dst_id [dict get [get_myself $dst] id]
+set dst_port [get_instance_attrib redis $dst port]
+
+test "Slots ownership changes are propagated" {
+    R $dst cluster bumpepoch
+    R $dst cluster setslot $slot node $dst_id
+    foreach_redis_id id {
+        if {$id == $dst} continue
+        wait_for_condition 1000 50 {
+            [catch {R $id get "{compact}"} e] &&
+            [string match "MOVED $slot *:$dst_port" $e]
+        } else {
+            fail "Instance #$id does not redirect to the new slot owner"
+        }
+    }
+    assert_cluster_state ok
+}
+
+proc test_large_publish {instance} {
+    foreach_redis_id j {
+        if {$j != $instance} {
+            R $j deferred 1
+            R $j subscribe testchannel
+            R $j read; # Read the subscribe reply
+        }
+    }
+
+    set data [string repeat "compressible payload " 1000]
+    R $instance PUBLISH testchannel $data
+
+    foreach_redis_id j {
+        if {$j != $instance} {
+            set msg [R $j read]
+            assert {$data eq [lindex $msg 2]}
+            R $j unsubscribe testchannel
+            R $j read; # Read the unsubscribe reply
+            R $j deferred 0
+        }
+    }
+}
+
+test "Large PUBLISH messages are compressed and delivered" {
+    set before [CI 0 cluster_stats_messages_compressed_sent]
+    test_large_publish 0
+    assert {[CI 0 cluster_stats_messages_compressed_sent] >= $before+2}
+}
+
+test "Nodes with the compact encoding disabled stay compatible" {
+    R 1 config set cluster-bus-compact no
+    set before [CI 1 cluster_stats_messages_compact_sent]
+    # Let the other nodes notice and send full packets again.
+    after 2000
+    assert_cluster_state ok
+    assert {[CI 1 cluster_stats_messages_compact_sent] == $before}
+    test_large_publish 1
+    test_large_publish 0
+    R 1 config set cluster-bus-compact yes
+}
@@ -0,0 +1,83 @@
+# Test sharded Pub/Sub (SSUBSCRIBE / SPUBLISH) propagation inside a shard.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 3 nodes cluster with replicas" {
+    create_cluster 3 3
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set channel "{sharded}channel"
+set slot [R 0 cluster keyslot $channel]
+for {set id 0} {$id < 3} {incr id} {
+    if {[catch {R $id spublish $channel hello}] == 0} {set master $id}
+}
+set master_id [dict get [get_myself $master] id]
+set other [expr {($master+1) % 3}]
+set other_id [dict get [get_myself $other] id]
+
+test "The master of the channel slot has a replica" {
+    wait_for_condition 1000 50 {
+        [llength [R $master cluster slaves $master_id]] > 0
+    } else {
+        fail "No replica attached to instance #$master"
+    }
+    foreach_redis_id id {
+        if {[dict get [get_myself $id] slaveof] eq $master_id} {
+            set replica $id
+        }
+    }
+}
+
+proc shard_client {id} {
+    redis 127.0.0.1 [get_instance_attrib redis $id port] 1
+}
+
+test "SSUBSCRIBE is redirected to the node serving the slot" {
+    catch {R $other ssubscribe $channel} e
+    assert_match "MOVED $slot *" $e
+}
+
+test "SPUBLISH is delivered to the master and replicas of the shard" {
+    set rd_master [shard_client $master]
+    $rd_master ssubscribe $channel
+    assert_equal [list ssubscribe $channel 1] [$rd_master read]
+
+    set rd_replica [shard_client $replica]
+    $rd_replica readonly
+    assert_equal OK [$rd_replica read]
+    $rd_replica ssubscribe $channel
+    assert_equal [list ssubscribe $channel 1] [$rd_replica read]
+
+    assert_equal 1 [R $master spublish $channel hello]
+    assert_equal [list smessage $channel hello] [$rd_master read]
+    assert_equal [list smessage $channel hello] [$rd_replica read]
+}
+
+test "SPUBLISH is not propagated outside the shard" {
+    foreach_redis_id id {
+        if {$id == $master} continue
+        set count [CI $id cluster_stats_messages_publishshard_received]
+        if {$id == $replica} {
+            assert {$count > 0}
+        } else {
+            assert {$count eq {}}
+        }
+    }
+}
+
+test "Subscribers are unsubscribed when the slot moves to another shard" {
+    R $other cluster bumpepoch
+    R $other cluster setslot $slot node $other_id
+    assert_equal [list sunsubscribe $channel 0] [$rd_master read]
+    assert_equal [list sunsubscribe $channel 0] [$rd_replica read]
+    assert_equal [list $channel 0] [R $master pubsub shardnumsub $channel]
+    $rd_master ssubscribe $channel
+    catch {$rd_master read} e
+    assert_match "MOVED $slot *" $e
+    $rd_master close
+    $rd_replica close
+}
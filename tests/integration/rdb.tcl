@@ -58,6 +58,25 @@ start_server [list overrides [list "dir" $server_path]] {
     }
 }
 
+start_server [list overrides [list "dir" $server_path "rdb-compression-codec" "lz4"]] {
+    test {Test RDB LZ4 string compression} {
+        r set small [string repeat a 25]
+        r set big [string repeat "json:\{\"field\":1234\}," 5000]
+        for {set j 0} {$j < 100} {incr j} {
+            r hset hash field:$j [string repeat "value:$j " 20]
+            r rpush list [string repeat "item:$j " 20]
+        }
+        set digest [r debug digest]
+        r debug reload
+        set newdigest [r debug digest]
+        assert {$digest eq $newdigest}
+        r config set rdb-compression-codec lzf
+        r debug reload
+        assert {[r debug digest] eq $digest}
+        r flushall
+    }
+}
+
 # Helper function to start a server and kill it, just to check the error
 # logged.
 set defaults {}
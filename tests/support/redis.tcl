@@ -182,6 +182,27 @@ proc ::redis::redis_bulk_read {fd} {
 proc ::redis::redis_multi_bulk_read {id fd} {
     set count [redis_read_line $fd]
     if {$count == -1} return {}
+    return [redis_read_elements $id $fd $count]
+}
+
+proc ::redis::redis_read_map {id fd} {
+    set count [redis_read_line $fd]
+    return [redis_read_elements $id $fd [expr {$count*2}]]
+}
+
+proc ::redis::redis_read_null fd {
+    redis_read_line $fd
+    return {}
+}
+
+proc ::redis::redis_read_bool fd {
+    set v [redis_read_line $fd]
+    if {$v == "t"} {return 1}
+    if {$v == "f"} {return 0}
+    return -code error "Bad protocol, '$v' as bool type"
+}
+
+proc ::redis::redis_read_elements {id fd count} {
     set l {}
     set err {}
     for {set i 0} {$i < $count} {incr i} {
@@ -203,10 +224,17 @@ proc ::redis::redis_read_reply {id fd} {
     set type [read $fd 1]
     switch -exact -- $type {
         : -
+        ( -
+        , -
         + {redis_read_line $fd}
         - {return -code error [redis_read_line $fd]}
         $ {redis_bulk_read $fd}
-        * {redis_multi_bulk_read $id $fd}
+        * -
+        ~ -
+        > {redis_multi_bulk_read $id $fd}
+        % {redis_read_map $id $fd}
+        _ {redis_read_null $fd}
+        # {redis_read_bool $fd}
         default {
             if {$type eq {}} {
                 set ::redis::fd($id) {}
@@ -47,6 +47,7 @@ set ::all_tests {
     integration/psync2
     integration/psync2-reg
     unit/pubsub
+    unit/tracking
     unit/slowlog
     unit/scripting
     unit/maxmemory
@@ -59,6 +59,17 @@ start_server {tags {"dump"}} {
         r get foo
     } {bar}
 
+    test {DUMP / RESTORE with an LZ4 compressed payload} {
+        r config set rdb-compression-codec lz4
+        r set foo [string repeat "abcdefgh" 100]
+        set encoded [r dump foo]
+        r config set rdb-compression-codec lzf
+        assert {[string length $encoded] < 100}
+        r del foo
+        r restore foo 0 $encoded
+        r get foo
+    } [string repeat "abcdefgh" 100]
+
     test {RESTORE returns an error of the key already exists} {
         r set foo bar
         set e {}
@@ -365,4 +376,149 @@ start_server {tags {"dump"}} {
             assert_match {*invalid password*} $err
         }
     }
+
+    test {MIGRATE sends large keys in chunks} {
+        set first [srv 0 client]
+        r flushdb
+        r config set migrate-chunk-size 100
+        for {set j 0} {$j < 1000} {incr j} {
+            r rpush list $j
+            r sadd set "member:$j"
+            r zadd zset $j "member:$j"
+            r hset hash "field:$j" $j
+        }
+        r hset hash bigfield [string repeat x 100]
+        r set string foo
+        r pexpire zset 100000
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys list set string zset hash]
+            assert_equal OK $ret
+            assert_equal 0 [$first dbsize]
+            assert_equal 5 [$second dbsize]
+            assert_equal 1000 [$second llen list]
+            assert_equal {0 1 2} [$second lrange list 0 2]
+            assert_equal {997 998 999} [$second lrange list -3 -1]
+            assert_equal 1000 [$second scard set]
+            assert_equal 1 [$second sismember set member:999]
+            assert_equal 1000 [$second zcard zset]
+            assert_equal {member:500 500} [$second zrange zset 500 500 withscores]
+            assert {[$second pttl zset] > 0}
+            assert_equal 1001 [$second hlen hash]
+            assert_equal 999 [$second hget hash field:999]
+            assert_equal foo [$second get string]
+            assert_match {*cmdstat_restore-chunk:calls=*} [$second info commandstats]
+        }
+    }
+
+    test {MIGRATE chunked transfer restarts if the key is modified} {
+        set first [srv 0 client]
+        r flushdb
+        r config set migrate-chunk-size 10
+        for {set j 0} {$j < 20000} {incr j} {
+            r hset key "field:$j" $j
+        }
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set rd [redis_deferring_client -1]
+            $rd migrate $second_host $second_port key 9 5000
+            # The server keeps serving clients while the key is sent.
+            assert {[$first hlen key] > 0}
+            $first hset key extra value
+            assert_equal OK [$rd read]
+            assert_equal 0 [$first exists key]
+            assert_equal 20001 [$second hlen key]
+            assert_equal value [$second hget key extra]
+            $rd close
+        }
+    }
+
+    test {MIGRATE chunked transfer honors REPLACE and COPY} {
+        set first [srv 0 client]
+        r flushdb
+        r config set migrate-chunk-size 10
+        for {set j 0} {$j < 100} {incr j} {
+            r rpush list $j
+        }
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            $second set list foo
+            catch {r -1 migrate $second_host $second_port list 9 5000 copy} e
+            assert_match {*BUSYKEY*} $e
+            assert_equal foo [$second get list]
+            assert_equal OK [r -1 migrate $second_host $second_port list 9 5000 copy replace]
+            assert_equal 100 [$second llen list]
+            assert_equal 100 [$first llen list]
+        }
+        r config set migrate-chunk-size 1000
+    }
+
+    test {RESTORE-CHUNK assembles values per DB} {
+        r flushdb
+        r rpush list a b
+        set payload [r dump list]
+        r del list
+        assert_equal OK [r restore-chunk list 0 $payload first]
+        r select 10
+        catch {r restore-chunk list 0 $payload last} e
+        assert_match {*No RESTORE-CHUNK transfer*} $e
+        assert_equal 0 [r exists list]
+        r select 9
+        assert_equal OK [r restore-chunk list 0 $payload last]
+        assert_equal {a b a b} [r lrange list 0 -1]
+
+        # An error discards the value being assembled.
+        r del list
+        assert_equal OK [r restore-chunk list 0 $payload first]
+        catch {r restore-chunk list -1 $payload} e
+        assert_match {*Invalid TTL*} $e
+        catch {r restore-chunk list 0 $payload last} e
+        assert_match {*No RESTORE-CHUNK transfer*} $e
+        assert_equal 0 [r exists list]
+    }
+
+    test {MIGRATE chunked transfer cut off leaves both sides clean} {
+        set first [srv 0 client]
+        r flushdb
+        r config set migrate-chunk-size 10
+        for {set j 0} {$j < 20000} {incr j} {
+            r hset key "field:$j" $j
+        }
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set rd [redis_deferring_client -1]
+            $rd client id
+            set id [$rd read]
+            $rd migrate $second_host $second_port key 9 5000
+            wait_for_condition 50 100 {
+                [s connected_clients] == 2
+            } else {
+                fail "MIGRATE did not connect to the target"
+            }
+            assert_equal 1 [$first client kill id $id]
+            $rd close
+            # The job closed its connection, and the target discarded the
+            # chunks it received.
+            wait_for_condition 50 100 {
+                [s connected_clients] == 1
+            } else {
+                fail "MIGRATE connection still open"
+            }
+            assert_equal 0 [$second exists key]
+            assert_equal 20000 [$first hlen key]
+        }
+        r config set migrate-chunk-size 1000
+    }
 }
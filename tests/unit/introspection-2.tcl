@@ -77,4 +77,79 @@ start_server {tags {"introspection"}} {
         assert_match {*calls=1,*} [cmdstat expire]
         assert_match {*calls=1,*} [cmdstat geoadd]
     }
+
+    proc hotkey_field {entry field} {
+        dict get $entry $field
+    }
+
+    test {HOTKEYS GET reports the most accessed keys} {
+        r config set hotkeys-sample-rate 1
+        r hotkeys reset
+        r set hotkey 1
+        for {set j 0} {$j < 10} {incr j} {r get hotkey}
+        r get coldkey
+        set top [r hotkeys get]
+        assert_equal 2 [llength $top]
+        assert_equal hotkey [hotkey_field [lindex $top 0] key]
+        assert_equal 11 [hotkey_field [lindex $top 0] ops]
+        assert_equal 0 [hotkey_field [lindex $top 0] ops-error]
+        assert_equal coldkey [hotkey_field [lindex $top 1] key]
+        assert_equal 1 [llength [r hotkeys get 1]]
+    }
+
+    test {HOTKEYS GET reports the bytes read and written} {
+        r hotkeys reset
+        r set rwkey [string repeat x 100]
+        r get rwkey
+        set e [lindex [r hotkeys get] 0]
+        assert_equal 100 [hotkey_field $e bytes-written]
+        assert {[hotkey_field $e bytes-read] >= 100}
+    }
+
+    test {HOTKEYS BIGKEYS reports the biggest keys written} {
+        r hotkeys reset
+        r set smallkey x
+        r set bigkey [string repeat x 10000]
+        r rpush biglist a b c
+        set big [r hotkeys bigkeys]
+        assert_equal 3 [llength $big]
+        assert_equal bigkey [hotkey_field [lindex $big 0] key]
+        assert_equal string [hotkey_field [lindex $big 0] type]
+        assert {[hotkey_field [lindex $big 0] bytes] >= 10000}
+        assert_equal list [hotkey_field [lindex $big 1] type]
+        r del bigkey
+        set big [r hotkeys bigkeys]
+        assert_equal 2 [llength $big]
+        assert_equal biglist [hotkey_field [lindex $big 0] key]
+    }
+
+    test {HOTKEYS keeps the hot keys when the table is full} {
+        r config set hotkeys-size 4
+        for {set j 0} {$j < 20} {incr j} {r incr hotkey}
+        for {set j 0} {$j < 20} {incr j} {r get cold:$j}
+        set top [r hotkeys get]
+        assert_equal 4 [llength $top]
+        assert_equal hotkey [hotkey_field [lindex $top 0] key]
+        assert_equal 20 [hotkey_field [lindex $top 0] ops]
+        # The cold keys inherit the count of the key they replaced.
+        set e [lindex $top 1]
+        assert {[hotkey_field $e ops] > [hotkey_field $e ops-error]}
+        r config set hotkeys-size 64
+        r hotkeys get
+    } {}
+
+    test {HOTKEYS INFO section and sample rate} {
+        r hotkeys reset
+        r config set hotkeys-sample-rate 10
+        for {set j 0} {$j < 1000} {incr j} {r get infokey}
+        set info [r info hotkeys]
+        assert_match {*hotkeys_sample_rate:10*} $info
+        assert_match {*hotkey_0:db=9,ops=*key="infokey"*} $info
+        regexp {hotkeys_sampled_commands:(\d+)} $info -> sampled
+        assert {$sampled > 50 && $sampled < 150}
+        r config set hotkeys-sample-rate 0
+        r hotkeys reset
+        r get infokey
+        r hotkeys get
+    } {}
 }
@@ -2,8 +2,9 @@ start_server {tags {"lazyfree"}} {
     test "UNLINK can reclaim memory in background" {
         set orig_mem [s used_memory]
         set args {}
+        # Not integers, that would be compactly roaring encoded.
         for {set i 0} {$i < 100000} {incr i} {
-            lappend args $i
+            lappend args ele:$i
         }
         r sadd myset {*}$args
         assert {[r scard myset] == 100000}
@@ -21,8 +22,9 @@ start_server {tags {"lazyfree"}} {
     test "FLUSHDB ASYNC can reclaim memory in background" {
         set orig_mem [s used_memory]
         set args {}
+        # Not integers, that would be compactly roaring encoded.
         for {set i 0} {$i < 100000} {incr i} {
-            lappend args $i
+            lappend args ele:$i
         }
         r sadd myset {*}$args
         assert {[r scard myset] == 100000}
@@ -141,6 +141,124 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    foreach policy {allkeys-tinylfu volatile-tinylfu} {
+        test "maxmemory - is the memory limit honoured? (policy $policy)" {
+            r flushall
+            r config set maxmemory 0
+            r config set maxmemory-policy $policy
+            # Make sure the frequency sketch is allocated before measuring.
+            r get nokey
+            set used [s used_memory]
+            set limit [expr {$used+100*1024}]
+            r config set maxmemory $limit
+            set numkeys 0
+            while 1 {
+                r setex [randomKey] 10000 x
+                incr numkeys
+                if {[s used_memory]+4096 > $limit} {
+                    assert {$numkeys > 10}
+                    break
+                }
+            }
+            for {set j 0} {$j < $numkeys} {incr j} {
+                r setex [randomKey] 10000 x
+            }
+            assert {[s used_memory] < ($limit+4096)}
+        }
+    }
+
+    test "maxmemory - TinyLFU OBJECT FREQ reports the estimated frequency" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-tinylfu
+        r set freqkey x
+        for {set j 0} {$j < 5} {incr j} {r get freqkey}
+        assert {[r object freq freqkey] >= 6}
+        r config set maxmemory-policy allkeys-lru
+        assert_error {*LFU*} {r object freq freqkey}
+    }
+
+    test "maxmemory - TinyLFU keeps hot keys during a scan of cold keys" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-tinylfu
+        r config set tinylfu-window 0
+        r config resetstat
+        r get nokey
+        set used [s used_memory]
+        set limit [expr {$used+100*1024}]
+        set payload [string repeat x 1000]
+        # Hot keys use about half of the memory and are read many times.
+        for {set j 0} {$j < 40} {incr j} {
+            r set "hot:$j" $payload
+            for {set k 0} {$k < 10} {incr k} {r get "hot:$j"}
+        }
+        r config set maxmemory $limit
+        # A scan of cold keys, each written just once, that would need
+        # five times the available memory.
+        set rejected 0
+        for {set j 0} {$j < 500} {incr j} {
+            if {[catch {r set "cold:$j" $payload} e]} {
+                assert_match {OOM*} $e
+                incr rejected
+            }
+        }
+        assert {[s used_memory] < ($limit+4096)}
+        assert {[s tinylfu_rejected_writes] == $rejected}
+        assert {[s evicted_keys] > 0}
+        for {set j 0} {$j < 40} {incr j} {
+            assert {[r exists "hot:$j"]}
+        }
+        r config set tinylfu-window 1
+    }
+
+    test "maxmemory - background eviction keeps memory under the watermarks" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-lru
+        r config resetstat
+        set used [s used_memory]
+        set limit [expr {$used*3}]
+        r config set maxmemory $limit
+        r config set maxmemory-low-watermark 75
+        r config set maxmemory-high-watermark 90
+        set payload [string repeat x 1000]
+        set numkeys [expr {$limit/1000}]
+        for {set j 0} {$j < $numkeys} {incr j} {
+            r set "key:$j" $payload
+        }
+        # Once the writes stop, the memory used stays between the two
+        # watermarks.
+        assert {[s used_memory] <= $limit*90/100+4096}
+        # Lowering the watermarks under the memory used starts the
+        # eviction again, until the low watermark is reached.
+        r config set maxmemory-low-watermark 50
+        r config set maxmemory-high-watermark 50
+        wait_for_condition 50 100 {
+            [s used_memory] <= $limit*50/100+4096
+        } else {
+            fail "Background eviction did not reach the low watermark"
+        }
+        assert {[s background_evicted_keys] > 0}
+        assert {[s evicted_keys] == [s background_evicted_keys]}
+        assert_equal 0 [s sync_eviction_cycles]
+    }
+
+    test "maxmemory - without watermarks writes evict synchronously" {
+        r flushall
+        r config set maxmemory-low-watermark 100
+        r config set maxmemory-high-watermark 100
+        r config resetstat
+        set payload [string repeat x 1000]
+        for {set j 0} {$j < $numkeys} {incr j} {
+            r set "key:$j" $payload
+        }
+        assert {[s used_memory] < ($limit+4096)}
+        assert {[s sync_eviction_cycles] > 0}
+        assert_equal 0 [s background_evicted_keys]
+        r config set maxmemory 0
+    }
 }
 
 proc test_slave_buffers {test_name cmd_count payload_len limit_memory pipeline} {
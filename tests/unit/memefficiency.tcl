@@ -36,6 +36,140 @@ start_server {tags {"memefficiency"}} {
     }
 }
 
+start_server {tags {"memefficiency"}} {
+    proc prefix_stat {prefix field} {
+        dict get [dict get [r memory prefixes] $prefix] $field
+    }
+
+    proc usage_of {args} {
+        set total 0
+        foreach key $args {incr total [r memory usage $key]}
+        return $total
+    }
+
+    test "MEMORY PREFIXES accounts the keys of each prefix" {
+        r flushall
+        r config set memory-prefixes "a: b:"
+        assert_equal {a: b:} [lindex [r config get memory-prefixes] 1]
+        r set a:1 foo
+        r hset a:2 f1 v1 f2 v2
+        r rpush b:1 x y z
+        r set c:1 untracked
+        assert_equal 2 [prefix_stat a: keys]
+        assert_equal 1 [prefix_stat b: keys]
+        assert_equal [usage_of a:1 a:2] [prefix_stat a: bytes]
+        assert_equal [usage_of b:1] [prefix_stat b: bytes]
+
+        # In place modifications are accounted as well.
+        r append a:1 [string repeat x 1000]
+        r hset a:2 f3 [string repeat y 100]
+        r rpush b:1 [string repeat z 500]
+        assert_equal [usage_of a:1 a:2] [prefix_stat a: bytes]
+        assert_equal [usage_of b:1] [prefix_stat b: bytes]
+
+        r del a:2
+        r lpop b:1
+        assert_equal 1 [prefix_stat a: keys]
+        assert_equal [usage_of a:1] [prefix_stat a: bytes]
+        assert_equal [usage_of b:1] [prefix_stat b: bytes]
+        r rename a:1 b:2
+        assert_equal {0 0} [list [prefix_stat a: keys] [prefix_stat a: bytes]]
+        assert_equal 2 [prefix_stat b: keys]
+        assert_equal [usage_of b:1 b:2] [prefix_stat b: bytes]
+    }
+
+    test "MEMORY PREFIXES uses the longest matching prefix" {
+        r flushall
+        r config set memory-prefixes {a: a:x: "with space"}
+        assert_equal {a: a:x: "with space"} [lindex [r config get memory-prefixes] 1]
+        r set a:1 foo
+        r set a:x:1 bar
+        r set a:x:2 bar
+        r set "with space:1" foo
+        assert_equal 1 [prefix_stat a: keys]
+        assert_equal 2 [prefix_stat a:x: keys]
+        assert_equal 1 [prefix_stat "with space" keys]
+    }
+
+    test "MEMORY PREFIXES after serving blocked clients" {
+        r flushall
+        r config set memory-prefixes "q:"
+        set rd [redis_deferring_client]
+        $rd blpop q:1 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        # The client pops one element, the others stay in the list.
+        r rpush q:1 [string repeat a 500] b c
+        assert_equal [list q:1 [string repeat a 500]] [$rd read]
+        $rd close
+        assert_equal 2 [r llen q:1]
+        assert_equal [usage_of q:1] [prefix_stat q: bytes]
+    }
+
+    test "MEMORY PREFIXES accounts roaring sets" {
+        r flushall
+        r config set memory-prefixes "r:"
+        for {set j 0} {$j < 2000} {incr j} {
+            r sadd r:1 [expr {$j*70000}]
+        }
+        assert_encoding roaring r:1
+        assert_equal [usage_of r:1] [prefix_stat r: bytes]
+        for {set j 0} {$j < 1000} {incr j} {
+            r srem r:1 [expr {$j*70000}]
+        }
+        assert_equal [usage_of r:1] [prefix_stat r: bytes]
+        r config set memory-prefixes ""
+    }
+
+    test "MEMORY PREFIXES after CONFIG SET, expires, FLUSHALL and SWAPDB" {
+        r flushall
+        r config set memory-prefixes ""
+        assert_equal {} [r memory prefixes]
+        for {set j 0} {$j < 100} {incr j} {
+            r set t1:$j [string repeat x $j]
+            r sadd t2:$j $j
+        }
+        # Changing the prefixes accounts the existing keys.
+        r config set memory-prefixes "t1: t2:"
+        assert_equal 100 [prefix_stat t1: keys]
+        assert_equal 100 [prefix_stat t2: keys]
+        set t1bytes [prefix_stat t1: bytes]
+
+        r set t1:volatile foo px 1
+        after 10
+        r get t1:volatile ;# expire it
+        assert_equal 100 [prefix_stat t1: keys]
+        assert_equal $t1bytes [prefix_stat t1: bytes]
+
+        # Totals are for all the DBs, and follow the keys when DBs are swapped.
+        r select 10
+        r set t1:other foo
+        r swapdb 9 10
+        assert_equal 101 [prefix_stat t1: keys]
+        r del t1:0
+        r select 9
+        r del t1:other
+        assert_equal 99 [prefix_stat t1: keys]
+        r swapdb 9 10
+
+        r debug reload
+        assert_equal 99 [prefix_stat t1: keys]
+        assert_equal 100 [prefix_stat t2: keys]
+
+        r flushdb
+        assert_equal 0 [prefix_stat t2: keys]
+        r set t2:1 foo
+        r flushall async
+        assert_equal {0 0} [list [prefix_stat t2: keys] [prefix_stat t2: bytes]]
+        r set t2:1 foo
+        assert_equal [usage_of t2:1] [prefix_stat t2: bytes]
+        r config set memory-prefixes ""
+    }
+}
+
 start_server {tags {"defrag"}} {
     if {[string match {*jemalloc*} [s mem_allocator]]} {
         test "Active defrag" {
@@ -122,6 +256,35 @@ start_server {tags {"defrag"}} {
                 $rd read ; # Discard replies
             }
 
+            # btree sorted sets, one big enough to be handled later
+            r config set zset-large-encoding btree
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd zadd bigzbtree $j [concat "asdfasdfasdf" $j]
+            }
+            for {set j 0} {$j < 500} {incr j} {
+                $rd zadd zbtree $j [concat "asdfasdfasdf" $j]
+            }
+            for {set j 0} {$j < 10500} {incr j} {
+                $rd read ; # Discard replies
+            }
+            assert_encoding btree bigzbtree
+            assert_encoding btree zbtree
+            r config set zset-large-encoding skiplist
+
+            # sparse roaring sets (a container per element), one big enough
+            # to be handled later
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd sadd bigroaring [expr {$j*65536}]
+            }
+            for {set j 0} {$j < 1000} {incr j} {
+                $rd sadd roaring [expr {$j*65536}]
+            }
+            for {set j 0} {$j < 11000} {incr j} {
+                $rd read ; # Discard replies
+            }
+            assert_encoding roaring bigroaring
+            assert_encoding roaring roaring
+
             set expected_frag 1.7
             if {$::accurate} {
                 # scale the hash to 1m fields in order to have a measurable the latency
@@ -142,7 +305,7 @@ start_server {tags {"defrag"}} {
             for {set j 0} {$j < 500000} {incr j} {
                 $rd read ; # Discard replies
             }
-            assert {[r dbsize] == 500010}
+            assert {[r dbsize] == 500014}
 
             # create some fragmentation
             for {set j 0} {$j < 500000} {incr j 2} {
@@ -151,7 +314,7 @@ start_server {tags {"defrag"}} {
             for {set j 0} {$j < 500000} {incr j 2} {
                 $rd read ; # Discard replies
             }
-            assert {[r dbsize] == 250010}
+            assert {[r dbsize] == 250014}
 
             # start defrag
             after 120 ;# serverCron only updates the info once in 100ms
@@ -209,5 +372,59 @@ start_server {tags {"defrag"}} {
             assert {$digest eq $newdigest}
             r save ;# saving an rdb iterates over all the data / pointers
         } {OK}
+
+        test "Active defrag only targets the fragmented bins" {
+            r flushdb
+            r config resetstat
+            r config set activedefrag no
+            r config set maxmemory 0
+            r config set active-defrag-max-scan-fields 1000
+            r config set active-defrag-threshold-lower 5
+            r config set active-defrag-ignore-bytes 2mb
+
+            # All the allocations of these keys fall in a handful of size
+            # classes (key names, dict entries, robj and 300 bytes values):
+            # deleting every other key leaves only those bins fragmented.
+            r debug populate 200000 asdf 300
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 200000} {incr j 2} {
+                $rd del asdf:$j
+            }
+            for {set j 0} {$j < 200000} {incr j 2} {
+                $rd read ; # Discard replies
+            }
+            $rd close
+            after 120 ;# serverCron only updates the info once in 100ms
+            assert {[s allocator_frag_ratio] >= 1.3}
+
+            set digest [r debug digest]
+            catch {r config set activedefrag yes} e
+            if {![string match {DISABLED*} $e]} {
+                wait_for_condition 50 100 {
+                    [s active_defrag_running] ne 0
+                } else {
+                    fail "defrag not started."
+                }
+                set bins [s active_defrag_targeted_bins]
+                assert {$bins > 0 && $bins <= 6}
+                assert {[s active_defrag_targeted_frag_bytes] > 0}
+
+                wait_for_condition 150 100 {
+                    [s active_defrag_running] eq 0
+                } else {
+                    after 120 ;# serverCron only updates the info once in 100ms
+                    puts [r info memory]
+                    fail "defrag didn't stop."
+                }
+                after 120 ;# serverCron only updates the info once in 100ms
+                if {$::verbose} {
+                    puts "targeted bins $bins"
+                    puts "reclaimed [s active_defrag_scan_reclaimed_bytes]"
+                }
+                assert {[s allocator_frag_ratio] < 1.1}
+                assert {[s active_defrag_scan_reclaimed_bytes] > 0}
+            }
+            assert {$digest eq [r debug digest]}
+        }
     }
 }
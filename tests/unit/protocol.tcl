@@ -115,3 +115,96 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol resp3"}} {
+    test "HELLO without arguments keeps RESP2 and returns server info" {
+        set reply [r hello]
+        assert_equal redis [dict get $reply server]
+        assert_equal 2 [dict get $reply proto]
+        assert_equal standalone [dict get $reply mode]
+        assert_equal master [dict get $reply role]
+    }
+
+    test "HELLO rejects unsupported protocol versions" {
+        catch {r hello 4} e
+        set e
+    } {NOPROTO*}
+
+    test "HELLO 3 switches the connection to RESP3" {
+        set reply [r hello 3 setname resp3client]
+        assert_equal 3 [dict get $reply proto]
+        assert_equal resp3client [r client getname]
+    }
+
+    test "RESP3 typed replies" {
+        assert_equal {Hello World} [r debug protocol string]
+        assert_equal 12345 [r debug protocol integer]
+        assert {[r debug protocol double] == 3.141}
+        assert_equal {} [r debug protocol null]
+        assert_equal {0 1 2} [r debug protocol array]
+        assert_equal {0 1 2} [r debug protocol set]
+        assert_equal {0 0 1 1 2 0} [r debug protocol map]
+        assert_equal 1 [r debug protocol true]
+        assert_equal 0 [r debug protocol false]
+    }
+
+    test "RESP3 maps, sets, doubles and nulls on the wire" {
+        r del myhash myset myzset nokey
+        r hset myhash f v
+        r sadd myset a
+        r zadd myzset 1.5 a
+        set fd [r channel]
+        foreach {cmd expected} {
+            "HGETALL myhash" "%1\r\n\$1\r\nf\r\n\$1\r\nv\r\n"
+            "HGETALL nokey" "%0\r\n"
+            "SMEMBERS myset" "~1\r\n\$1\r\na\r\n"
+            "ZSCORE myzset a" ",1.5\r\n"
+            "GET nokey" "_\r\n"
+        } {
+            puts -nonewline $fd "$cmd\r\n"
+            flush $fd
+            set reply [read $fd [string length $expected]]
+            assert_equal $expected $reply
+        }
+    }
+
+    test "RESP3 clients receive Pub/Sub messages as push replies" {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd subscribe chan
+        assert_equal {subscribe chan 1} [$rd read]
+        # Normal commands are allowed in the Pub/Sub context.
+        $rd set foo bar
+        assert_equal OK [$rd read]
+        r publish chan hello
+        assert_equal {message chan hello} [$rd read]
+        set fd [$rd channel]
+        r publish chan world
+        set expected ">3\r\n\$7\r\nmessage\r\n"
+        assert_equal $expected [read $fd [string length $expected]]
+        $rd close
+    }
+
+    test "HELLO 2 switches back to RESP2" {
+        set reply [r hello 2]
+        assert_equal 2 [dict get $reply proto]
+        set fd [r channel]
+        puts -nonewline $fd "ZSCORE myzset a\r\n"
+        flush $fd
+        assert_equal "\$3\r\n1.5\r\n" [read $fd 9]
+    }
+}
+
+start_server {tags {"protocol resp3"} overrides {requirepass foobar}} {
+    test "HELLO AUTH authenticates the connection" {
+        catch {r hello 3} e
+        assert_match {NOAUTH*} $e
+        catch {r hello 3 auth default wrong} e
+        assert_match {WRONGPASS*} $e
+        set reply [r hello 3 auth default foobar]
+        assert_equal 3 [dict get $reply proto]
+        r hello 2
+        r ping
+    } {PONG}
+}
@@ -47,6 +47,16 @@ start_server {tags {"pubsub"}} {
         __consume_subscribe_messages $client punsubscribe $channels
     }
 
+    proc ssubscribe {client channels} {
+        $client ssubscribe {*}$channels
+        __consume_subscribe_messages $client ssubscribe $channels
+    }
+
+    proc sunsubscribe {client {channels {}}} {
+        $client sunsubscribe {*}$channels
+        __consume_subscribe_messages $client sunsubscribe $channels
+    }
+
     test "Pub/Sub PING" {
         set rd1 [redis_deferring_client]
         subscribe $rd1 somechannel
@@ -213,6 +223,45 @@ start_server {tags {"pubsub"}} {
         $rd1 close
     }
 
+    test "PSUBSCRIBE patterns sharing literal prefixes" {
+        set rd1 [redis_deferring_client]
+        set patterns {* news.* news.it.* news.it.sport news.? news.\\* news.[ab]* ?ews.* news}
+        assert_equal {1 2 3 4 5 6 7 8 9} [psubscribe $rd1 $patterns]
+
+        # Every channel reaches exactly the patterns it matches.
+        foreach {channel matching} {
+            news.it.sport {* news.* news.it.* news.it.sport ?ews.*}
+            news.x {* news.* news.? ?ews.*}
+            news.* {* news.* news.? news.\\* ?ews.*}
+            news.alpha {* news.* news.[ab]* ?ews.*}
+            news {* news}
+            newsletter {*}
+            other {*}
+        } {
+            assert_equal [llength $matching] [r publish $channel hello]
+            set got {}
+            foreach pattern $matching {
+                set msg [$rd1 read]
+                assert_equal [list pmessage $channel hello] \
+                    [lreplace $msg 1 1]
+                lappend got [lindex $msg 1]
+            }
+            assert_equal [lsort $matching] [lsort $got]
+        }
+
+        # Unsubscribing removes the patterns from the index.
+        punsubscribe $rd1 {* news.* news.it.* news.it.sport}
+        assert_equal 2 [r publish news.x hello]
+        $rd1 read
+        $rd1 read
+        assert_equal 0 [r publish other hello]
+        assert_equal 5 [r pubsub numpat]
+        punsubscribe $rd1 {news.? news.\\* news.[ab]* ?ews.* news}
+        assert_equal 0 [r publish news.x hello]
+        assert_equal 0 [r pubsub numpat]
+        $rd1 close
+    }
+
     test "PUNSUBSCRIBE and UNSUBSCRIBE should always reply" {
         # Make sure we are not subscribed to any channel at all.
         r punsubscribe
@@ -223,6 +272,68 @@ start_server {tags {"pubsub"}} {
         concat $reply1 $reply2
     } {punsubscribe {} 0 unsubscribe {} 0}
 
+    ### Sharded Pub/Sub tests
+
+    test "SPUBLISH/SSUBSCRIBE basics" {
+        set rd1 [redis_deferring_client]
+
+        assert_equal {1 2} [ssubscribe $rd1 {chan1 chan2}]
+        assert_equal 1 [r spublish chan1 hello]
+        assert_equal 1 [r spublish chan2 world]
+        assert_equal {smessage chan1 hello} [$rd1 read]
+        assert_equal {smessage chan2 world} [$rd1 read]
+
+        sunsubscribe $rd1 {chan1}
+        assert_equal 0 [r spublish chan1 hello]
+        assert_equal 1 [r spublish chan2 world]
+        assert_equal {smessage chan2 world} [$rd1 read]
+
+        sunsubscribe $rd1 {chan2}
+        assert_equal 0 [r spublish chan2 world]
+
+        $rd1 close
+    }
+
+    test "Shard channels and global channels are separate namespaces" {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        assert_equal {1} [subscribe $rd1 {chan1}]
+        assert_equal {1} [ssubscribe $rd2 {chan1}]
+
+        assert_equal 1 [r publish chan1 hello]
+        assert_equal 1 [r spublish chan1 world]
+        assert_equal {message chan1 hello} [$rd1 read]
+        assert_equal {smessage chan1 world} [$rd2 read]
+
+        assert_equal {chan1} [r pubsub shardchannels]
+        assert_equal {chan1 1 foo 0} [r pubsub shardnumsub chan1 foo]
+        assert_equal {chan1 1} [r pubsub numsub chan1]
+
+        $rd1 close
+        $rd2 close
+    }
+
+    test "SSUBSCRIBE and PSUBSCRIBE subscription counts" {
+        set rd1 [redis_deferring_client]
+        assert_equal {1} [psubscribe $rd1 {foo.*}]
+        assert_equal {1 2} [ssubscribe $rd1 {foo.a foo.b}]
+        # Shard channels are not matched by patterns.
+        assert_equal 1 [r spublish foo.a hello]
+        assert_equal {smessage foo.a hello} [$rd1 read]
+        assert_equal {0} [punsubscribe $rd1 {foo.*}]
+        # Still in Pub/Sub context because of the shard channels.
+        $rd1 set foo bar
+        assert_error "*only (P|S)SUBSCRIBE*" {$rd1 read}
+        sunsubscribe $rd1 {foo.a foo.b}
+        $rd1 ping
+        assert_equal {PONG} [$rd1 read]
+        $rd1 close
+    }
+
+    test "SUNSUBSCRIBE should always reply" {
+        r sunsubscribe
+    } {sunsubscribe {} 0}
+
     ### Keyspace events notification tests
 
     test "Keyspace notifications: we receive keyspace notifications" {
@@ -53,17 +53,18 @@ start_server {tags {"scan"}} {
         assert_equal 100 [llength $keys]
     }
 
-    foreach enc {intset hashtable} {
+    foreach enc {intset hashtable roaring} {
         test "SSCAN with encoding $enc" {
             # Create the Set
             r del set
-            if {$enc eq {intset}} {
-                set prefix ""
-            } else {
+            if {$enc eq {hashtable}} {
                 set prefix "ele:"
+            } else {
+                set prefix ""
             }
+            if {$enc eq {roaring}} {set count 1000} else {set count 100}
             set elements {}
-            for {set j 0} {$j < 100} {incr j} {
+            for {set j 0} {$j < $count} {incr j} {
                 lappend elements ${prefix}${j}
             }
             r sadd set {*}$elements
@@ -83,7 +84,7 @@ start_server {tags {"scan"}} {
             }
 
             set keys [lsort -unique $keys]
-            assert_equal 100 [llength $keys]
+            assert_equal $count [llength $keys]
         }
     }
 
@@ -111,6 +111,80 @@ start_server {tags {"scripting"}} {
         } 1 mykey
     } {boolean 1}
 
+    test {EVAL - Large replies -> Lua type conversion} {
+        r del mylist
+        set payload [string repeat x 100]
+        for {set j 0} {$j < 2000} {incr j} {r rpush mylist "$j:$payload"}
+        # Call twice: the second reply must not see leftovers of the first.
+        r eval {
+            local a = redis.call('lrange',KEYS[1],0,-1)
+            local b = redis.call('lrange',KEYS[1],0,-1)
+            return {#a,#b,a[1],b[2000],redis.call('llen',KEYS[1])}
+        } 1 mylist
+    } [list 2000 2000 "0:[string repeat x 100]" "1999:[string repeat x 100]" 2000]
+
+    test {EVAL - Deferred length replies -> Lua type conversion} {
+        r del myzset
+        for {set j 0} {$j < 1000} {incr j} {r zadd myzset $j m$j}
+        r eval {
+            local r = redis.call('zrangebyscore',KEYS[1],10,'+inf','limit',0,500)
+            local s = redis.call('zrangebyscore',KEYS[1],0,2,'withscores')
+            return {#r,r[1],r[500],s[1],s[6]}
+        } 1 myzset
+    } {500 m10 m509 m0 2}
+
+    test {EVAL - Mixed direct and protocol replies -> Lua type conversion} {
+        r del myhash mycounter
+        r hset myhash a 1 b 2 c 3
+        r eval {
+            -- SCAN emits the cursor directly, and the deferred keys array
+            -- as protocol into the outer array.
+            local s = redis.call('hscan',KEYS[1],0)
+            local t = redis.call('type',KEYS[1])
+            local e1 = redis.pcall('incrby',KEYS[1],1)
+            local e2 = redis.pcall('incrby',KEYS[2],'foo')
+            local n = redis.call('incr',KEYS[2])
+            local g = redis.call('get',KEYS[2])
+            local m = redis.call('get','nokey')
+            table.sort(s[2])
+            return {s[1],#s[2],s[2][1],s[2][6],t.ok,e1.err,e2.err,n,g,
+                    tostring(m)}
+        } 2 myhash mycounter
+    } {0 6 1 c hash {WRONGTYPE Operation against a key holding the wrong kind of value} {ERR value is not an integer or out of range} 1 1 false}
+
+    test {EVAL_RO - Successful case} {
+        r set foo bar
+        r eval_ro {return redis.call('get',KEYS[1])} 1 foo
+    } {bar}
+
+    test {EVAL_RO - Cannot run write commands} {
+        r set foo bar
+        catch {r eval_ro {redis.call('del',KEYS[1])} 1 foo} e
+        assert_match {*Write commands are not allowed from read-only scripts*} $e
+        r get foo
+    } {bar}
+
+    test {EVALSHA_RO - Can run read-only scripts from the cache} {
+        set sha [r script load {return redis.call('get',KEYS[1])}]
+        r evalsha_ro $sha 1 foo
+    } {bar}
+
+    test {EVAL_RO - Runs under OOM and is not propagated} {
+        set repl [attach_to_replication_stream]
+        r config set maxmemory 1
+        catch {r eval {return redis.call('set',KEYS[1],'x')} 1 foo} e
+        assert_match {*OOM*} $e
+        assert_equal bar [r eval_ro {return redis.call('get',KEYS[1])} 1 foo]
+        r evalsha_ro $sha 1 foo
+        r config set maxmemory 0
+        r set foo baz
+        assert_replication_stream $repl {
+            {select *}
+            {set foo baz}
+        }
+        close_replication_stream $repl
+    }
+
     test {EVAL - Is the Lua client using the currently selected DB?} {
         r set mykey "this is DB 9"
         r select 10
@@ -485,6 +559,39 @@ start_server {tags {"scripting"}} {
     } {*wrong number*}
 }
 
+start_server {tags {"scripting"}} {
+    proc restart_and_wait {} {
+        catch {r debug restart}
+        wait_for_condition 50 100 {
+            [catch {r ping}] == 0
+        } else {
+            fail "Server did not restart"
+        }
+    }
+
+    test {Scripts are persisted in the RDB file and compiled lazily} {
+        set sha [r script load "return 'persisted'"]
+        r eval "return 'evaluated'" 0
+        restart_and_wait
+        assert_equal 0 [s lua_compiled_scripts]
+        assert_equal {1 1} [r script exists $sha \
+            [r script load "return 'evaluated'"]]
+        # SCRIPT LOAD of an already cached script compiles it.
+        assert_equal 1 [s lua_compiled_scripts]
+        assert_equal persisted [r evalsha $sha 0]
+        assert_equal 2 [s lua_compiled_scripts]
+        assert_equal persisted [r evalsha [string toupper $sha] 0]
+        assert_equal 2 [s lua_compiled_scripts]
+        assert {[s lua_compile_time_usec] > 0}
+    }
+
+    test {Scripts are not persisted with lua-persist-scripts no} {
+        r config set lua-persist-scripts no
+        restart_and_wait
+        r script exists [r script load "return 'x'"] $sha
+    } {1 0}
+}
+
 # Start a new server since the last test in this stanza will kill the
 # instance at all.
 start_server {tags {"scripting"}} {
@@ -609,6 +716,18 @@ foreach cmdrepl {0 1} {
                 }
             }
 
+            test "EVAL_RO is served by the read-only replica $rt" {
+                r set rokey 10
+                wait_for_condition 50 100 {
+                    [r -1 get rokey] eq {10}
+                } else {
+                    fail "Expected 10 in rokey, but value is '[r -1 get rokey]'"
+                }
+                assert_equal 10 [r -1 eval_ro {return redis.call('get',KEYS[1])} 1 rokey]
+                catch {r -1 eval_ro {return redis.call('incr',KEYS[1])} 1 rokey} e
+                assert_match {*read-only scripts*} $e
+            }
+
             test "Lua scripts using SELECT are replicated correctly $rt" {
                 r eval {
                     redis.call("set","foo1","bar1")
@@ -0,0 +1,228 @@
+start_server {tags {"tracking"}} {
+    # Create a deferred client we'll use to redirect invalidation
+    # messages to.
+    set rd_redirection [redis_deferring_client]
+    $rd_redirection client id
+    set redir [$rd_redirection read]
+    $rd_redirection subscribe __redis__:invalidate
+    $rd_redirection read ; # Consume the SUBSCRIBE reply.
+
+    # Create another client as well in order to test NOLOOP
+    set rd [redis_deferring_client]
+
+    test {Clients are able to enable tracking and redirect it} {
+        r CLIENT TRACKING on REDIRECT $redir
+    } {*OK}
+
+    test {The other connection is able to get invalidations} {
+        r SET a 1
+        r SET b 1
+        r GET a
+        r INCR b ; # This key should not be notified, since it wasn't fetched.
+        r SET a 2
+        set keys [lindex [$rd_redirection read] 2]
+        assert {[llength $keys] == 1}
+        assert {[lindex $keys 0] eq {a}}
+    }
+
+    test {The client is now able to disable tracking} {
+        # Make sure to add a few more keys in the tracking list
+        # so that we can check for leaks, as a side effect.
+        r MGET a b c d e f g
+        r CLIENT TRACKING off
+    }
+
+    test {Clients can enable the BCAST mode with the empty prefix} {
+        r CLIENT TRACKING on BCAST REDIRECT $redir
+    } {*OK*}
+
+    test {The connection gets invalidation messages about all the keys} {
+        r MSET a 1 b 2 c 3
+        set keys [lsort [lindex [$rd_redirection read] 2]]
+        assert {$keys eq {a b c}}
+    }
+
+    test {Clients can enable the BCAST mode with prefixes} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on BCAST REDIRECT $redir PREFIX a: PREFIX b:
+        r MULTI
+        r INCR a:1
+        r INCR a:2
+        r INCR b:1
+        r INCR b:2
+        r EXEC
+        # Because of the internals, we know we are going to receive
+        # two separated notifications for the two different prefixes.
+        set keys1 [lsort [lindex [$rd_redirection read] 2]]
+        set keys2 [lsort [lindex [$rd_redirection read] 2]]
+        set keys [lsort [list {*}$keys1 {*}$keys2]]
+        assert {$keys eq {a:1 a:2 b:1 b:2}}
+    }
+
+    test {Adding prefixes to BCAST mode works} {
+        r CLIENT TRACKING on BCAST REDIRECT $redir PREFIX c:
+        r INCR c:1234
+        set keys [lsort [lindex [$rd_redirection read] 2]]
+        assert {$keys eq {c:1234}}
+    }
+
+    test {Overlapping prefixes in BCAST mode are rejected} {
+        catch {r CLIENT TRACKING on BCAST REDIRECT $redir PREFIX a:b} e
+        set e
+    } {*overlaps*}
+
+    test {Tracking NOLOOP mode in standard mode works} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on REDIRECT $redir NOLOOP
+        r MGET otherkey1 loopkey otherkey2
+        $rd SET otherkey1 1; # We should get this
+        $rd read
+        r SET loopkey 1 ; # We should not get this
+        $rd SET otherkey2 1; # We should get this
+        $rd read
+        # Because of the internals, we know we are going to receive
+        # two separated notifications for the two different keys.
+        set keys1 [lsort [lindex [$rd_redirection read] 2]]
+        set keys2 [lsort [lindex [$rd_redirection read] 2]]
+        set keys [lsort [list {*}$keys1 {*}$keys2]]
+        assert {$keys eq {otherkey1 otherkey2}}
+    }
+
+    test {Tracking NOLOOP mode in BCAST mode works} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on BCAST REDIRECT $redir NOLOOP
+        $rd SET otherkey1 1; # We should get this
+        $rd read
+        r SET loopkey 1 ; # We should not get this
+        $rd SET otherkey2 1; # We should get this
+        $rd read
+        # Because $rd is not in NOLOOP mode the two keys are not batched
+        # together: each write is followed by its own event loop cycle.
+        set keys1 [lsort [lindex [$rd_redirection read] 2]]
+        set keys2 [lsort [lindex [$rd_redirection read] 2]]
+        set keys [lsort [list {*}$keys1 {*}$keys2]]
+        assert {$keys eq {otherkey1 otherkey2}}
+    }
+
+    test {Tracking gets notification of expired keys} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on BCAST REDIRECT $redir NOLOOP
+        r SET mykey myval px 1
+        r SET mykeyotherkey myval ; # We should not get it
+        after 1000
+        # Because of the internals, we know we are going to receive
+        # two separated notifications for the two different prefixes.
+        set keys [lsort [lindex [$rd_redirection read] 2]]
+        assert {$keys eq {mykey}}
+    }
+
+    test {OPTIN and OPTOUT are not compatible with BCAST} {
+        r CLIENT TRACKING off
+        catch {r CLIENT TRACKING on BCAST OPTIN} e
+        set e
+    } {*not compatible*}
+
+    test {Tracking in OPTIN mode tracks only the keys after CACHING yes} {
+        r CLIENT TRACKING on REDIRECT $redir OPTIN
+        r GET notcached
+        r CLIENT CACHING yes
+        r GET cached
+        r SET notcached 1
+        r SET cached 1
+        set keys [lindex [$rd_redirection read] 2]
+        assert {$keys eq {cached}}
+    }
+
+    test {Tracking in OPTOUT mode skips the keys after CACHING no} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on REDIRECT $redir OPTOUT
+        r CLIENT CACHING no
+        r GET notcached
+        r GET cached
+        r SET notcached 2
+        r SET cached 2
+        set keys [lindex [$rd_redirection read] 2]
+        assert {$keys eq {cached}}
+    }
+
+    test {CLIENT CACHING is rejected when the mode does not match} {
+        catch {r CLIENT CACHING yes} e
+        set e
+    } {*OPTIN*}
+
+    test {Flushing the keyspace invalidates all the keys} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on REDIRECT $redir
+        r GET somekey
+        r FLUSHALL
+        set msg [$rd_redirection read]
+        assert {[lindex $msg 1] eq {__redis__:invalidate}}
+        assert {[lindex $msg 2] eq {}}
+        assert_equal 0 [s tracking_total_keys]
+    }
+
+    test {Tracking table is kept under tracking-table-max-keys} {
+        r CLIENT TRACKING off
+        r CLIENT TRACKING on REDIRECT $redir
+        r CONFIG SET tracking-table-max-keys 10
+        for {set j 0} {$j < 100} {incr j} {
+            r GET key:$j
+        }
+        wait_for_condition 50 100 {
+            [s tracking_total_keys] <= 10
+        } else {
+            fail "Tracking table not evicted"
+        }
+        # The evicted keys are invalidated like if they were modified.
+        set keys [lindex [$rd_redirection read] 2]
+        assert_match {key:*} $keys
+        r CONFIG SET tracking-table-max-keys 1000000
+    }
+
+    test {CLIENT GETREDIR provides correct client id} {
+        set res [r CLIENT GETREDIR]
+        assert_equal $redir $res
+        r CLIENT TRACKING off
+        assert_equal -1 [r CLIENT GETREDIR]
+    }
+
+    test {CLIENT GETREDIR reports a broken redirection} {
+        set rd_redir2 [redis_deferring_client]
+        $rd_redir2 client id
+        set redir2 [$rd_redir2 read]
+        r CLIENT TRACKING on REDIRECT $redir2
+        r GET brokenkey
+        assert_equal 1 [r CLIENT KILL ID $redir2]
+        $rd_redir2 close
+        r SET brokenkey 1
+        assert_equal -2 [r CLIENT GETREDIR]
+        assert_match {*flags=tR*} [r CLIENT LIST]
+        r CLIENT TRACKING off
+    }
+
+    test {INFO reports the number of tracking clients} {
+        assert_equal 0 [s tracking_clients]
+        r CLIENT TRACKING on REDIRECT $redir
+        assert_equal 1 [s tracking_clients]
+        r CLIENT TRACKING off
+        assert_equal 0 [s tracking_clients]
+    }
+
+    $rd_redirection close
+    $rd close
+}
+
+start_server {tags {"tracking resp3"}} {
+    test {RESP3 tracking clients get invalidations as push messages} {
+        set rd [redis_deferring_client]
+        $rd hello 3
+        $rd read
+        $rd client tracking on
+        assert_equal OK [$rd read]
+        $rd get foo
+        $rd read
+        r set foo bar
+        assert_equal {invalidate foo} [$rd read]
+        $rd close
+    }
+}
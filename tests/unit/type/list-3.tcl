@@ -57,6 +57,54 @@ start_server {
         }
     }
 
+    foreach codec {lzf lz4} {
+        test "Compressed list consistency with random operations - $codec" {
+            r config set list-compress-depth 1
+            r config set list-compress-codec $codec
+            r del key
+            set l {}
+            for {set j 0} {$j < 2000} {incr j} {
+                set ele "element:[randomInt 100]:[string repeat abc [randomInt 20]]"
+                set len [llength $l]
+                switch [randomInt 7] {
+                    0 {r lpush key $ele; set l [linsert $l 0 $ele]}
+                    1 - 2 {r rpush key $ele; lappend l $ele}
+                    3 {
+                        if {$len} {
+                            set idx [randomInt $len]
+                            r lset key $idx $ele
+                            set l [lreplace $l $idx $idx $ele]
+                        }
+                    }
+                    4 {
+                        set idx [randomInt [expr {$len+1}]]
+                        assert_equal [lindex $l $idx] [r lindex key $idx]
+                    }
+                    5 {
+                        set start [randomInt [expr {$len+1}]]
+                        set end [expr {$start+[randomInt 50]}]
+                        assert_equal [lrange $l $start $end] \
+                                     [r lrange key $start $end]
+                    }
+                    6 {
+                        if {$len && [randomInt 4] == 0} {
+                            r lpop key
+                            set l [lrange $l 1 end]
+                        }
+                    }
+                }
+            }
+            assert_equal $l [r lrange key 0 -1]
+            r config set list-compress-codec [expr {$codec eq {lzf} ? {lz4} : {lzf}}]
+            r rpush key last
+            lappend l last
+            r debug reload
+            assert_equal $l [r lrange key 0 -1]
+            r config set list-compress-depth 0
+            r config set list-compress-codec lzf
+        }
+    }
+
     tags {slow} {
         test {ziplist implementation: value encoding and backlink} {
             if {$::accurate} {set iterations 100} else {set iterations 10}
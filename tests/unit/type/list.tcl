@@ -222,6 +222,114 @@ start_server {
         assert_equal foo [lindex [r lrange blist 0 -1] 0]
     }
 
+    test "LMPOP basics" {
+        r del mlist1{t} mlist2{t}
+        assert_equal {} [r lmpop 2 mlist1{t} mlist2{t} left]
+        r rpush mlist2{t} a b c d e
+        assert_equal {mlist2{t} a} [r lmpop 2 mlist1{t} mlist2{t} left]
+        assert_equal {mlist2{t} {e d}} [r lmpop 2 mlist1{t} mlist2{t} RIGHT count 2]
+        assert_equal {mlist2{t} {b c}} [r lmpop 1 mlist2{t} left count 10]
+        assert_equal 0 [r exists mlist2{t}]
+    }
+
+    test "LMPOP errors" {
+        r del mlist1{t}
+        assert_error "*numkeys*" {r lmpop 0 mlist1{t} left}
+        assert_error "*syntax*" {r lmpop 2 mlist1{t} left}
+        assert_error "*syntax*" {r lmpop 1 mlist1{t} middle}
+        assert_error "*syntax*" {r lmpop 1 mlist1{t} left count}
+        assert_error "*count*" {r lmpop 1 mlist1{t} left count 0}
+        r set mlist1{t} foo
+        assert_error "WRONGTYPE*" {r lmpop 1 mlist1{t} left}
+        r del mlist1{t}
+    }
+
+    test "LMPOP is propagated as a pop of the elements actually popped" {
+        r del mlist1{t} mlist2{t}
+        r rpush mlist2{t} a b c
+        set repl [attach_to_replication_stream]
+        r lmpop 2 mlist1{t} mlist2{t} left count 10
+        r rpush mlist2{t} a
+        r lmpop 2 mlist1{t} mlist2{t} right count 10
+        assert_replication_stream $repl {
+            {select *}
+            {lmpop 1 mlist2{t} LEFT COUNT 3}
+            {rpush mlist2{t} a}
+            {rpop mlist2{t}}
+        }
+        close_replication_stream $repl
+    }
+
+    test "BLMPOP with data already there and in a transaction" {
+        r del mlist1{t} mlist2{t}
+        r rpush mlist1{t} a b
+        assert_equal {mlist1{t} {b a}} [r blmpop 0 2 mlist2{t} mlist1{t} right count 5]
+        r multi
+        r blmpop 0 1 mlist1{t} left
+        assert_equal {{}} [r exec]
+    }
+
+    test "BLMPOP blocks and takes a batch of elements" {
+        set rd [redis_deferring_client]
+        r del mlist1{t} mlist2{t}
+        $rd blmpop 0 2 mlist1{t} mlist2{t} left count 3
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        r rpush mlist2{t} a b c d
+        assert_equal {mlist2{t} {a b c}} [$rd read]
+        assert_equal {d} [r lrange mlist2{t} 0 -1]
+        $rd close
+    }
+
+    test "Blocked clients on the same list are served with a single propagated pop" {
+        r del blist{t} target{t}
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            if {$j < 5} {
+                $rd brpop blist{t} 0
+            } elseif {$j < 8} {
+                $rd blmpop 0 1 blist{t} right count 2
+            } else {
+                $rd brpoplpush blist{t} target{t} 0
+            }
+            lappend clients $rd
+        }
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 10
+        } else {
+            fail "Clients not blocked"
+        }
+        set repl [attach_to_replication_stream]
+        set elements {}
+        for {set j 0} {$j < 20} {incr j} {lappend elements $j}
+        r lpush blist{t} {*}$elements
+        for {set j 0} {$j < 5} {incr j} {
+            assert_equal [list blist{t} $j] [[lindex $clients $j] read]
+        }
+        assert_equal {blist{t} {5 6}} [[lindex $clients 5] read]
+        assert_equal {blist{t} {7 8}} [[lindex $clients 6] read]
+        assert_equal {blist{t} {9 10}} [[lindex $clients 7] read]
+        assert_equal 11 [[lindex $clients 8] read]
+        assert_equal 12 [[lindex $clients 9] read]
+        assert_equal {19 18 17 16 15 14 13} [r lrange blist{t} 0 -1]
+        assert_equal {12 11} [r lrange target{t} 0 -1]
+        assert_replication_stream $repl {
+            {select *}
+            {lpush blist{t} *}
+            {lmpop 1 blist{t} RIGHT COUNT 11}
+            {rpop blist{t}}
+            {lpush target{t} 11}
+            {rpop blist{t}}
+            {lpush target{t} 12}
+        }
+        close_replication_stream $repl
+        foreach rd $clients {$rd close}
+    }
+
     test "BRPOPLPUSH with zero timeout should block indefinitely" {
         set rd [redis_deferring_client]
         r del blist target
@@ -56,7 +56,18 @@ start_server {
         for {set i 0} {$i < 512} {incr i} { r sadd myset $i }
         assert_encoding intset myset
         assert_equal 1 [r sadd myset 512]
+        assert_encoding roaring myset
+    }
+
+    test "SADD a non-integer against a roaring set" {
+        r del myset
+        for {set i 0} {$i < 1000} {incr i} { r sadd myset $i }
+        assert_encoding roaring myset
+        assert_equal 1 [r sadd myset a]
         assert_encoding hashtable myset
+        assert_equal 1001 [r scard myset]
+        assert_equal 1 [r sismember myset 999]
+        assert_equal 1 [r sismember myset a]
     }
 
     test {Variadic SADD} {
@@ -72,15 +83,227 @@ start_server {
         for {set i 0} {$i < 1280} {incr i} { r sadd mylargeintset $i }
         for {set i 0} {$i <  256} {incr i} { r sadd myhashset [format "i%03d" $i] }
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
 
         r debug reload
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
     }
 
+    test "Roaring set basics across containers" {
+        r del myset
+        # Dense ranges, sparse values, negative and extreme values, so that
+        # array, bitmap and run containers are all used.
+        set elements {-9223372036854775808 9223372036854775807 -1 0}
+        for {set i 0} {$i < 70000} {incr i} {lappend elements [expr {$i+100000}]}
+        for {set i 0} {$i < 10000} {incr i} {lappend elements [expr {$i*7-50000}]}
+        for {set i 0} {$i < 6000} {incr i} {lappend elements [expr {$i*10+(1<<40)}]}
+        for {set i 0} {$i < 1000} {incr i} {lappend elements [randomInt 1000000000]}
+        set elements [lsort -integer -unique $elements]
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        assert_equal [llength $elements] [r scard myset]
+        assert_equal $elements [lsort -integer [r smembers myset]]
+        foreach ele {-9223372036854775808 9223372036854775807 -1 0 100000
+                     169999 -49993 1099511627786} {
+            assert_equal 1 [r sismember myset $ele]
+        }
+        foreach ele {2 170000 -49994 1099511627787 foo} {
+            assert_equal 0 [r sismember myset $ele]
+        }
+
+        # Remove half of a dense range and of a sparse range.
+        set removed 0
+        for {set i 0} {$i < 70000} {incr i 2} {
+            incr removed [r srem myset [expr {$i+100000}]]
+        }
+        for {set i 0} {$i < 10000} {incr i 2} {
+            incr removed [r srem myset [expr {$i*7-50000}]]
+        }
+        assert_equal 40000 $removed
+        assert_equal [expr {[llength $elements]-40000}] [r scard myset]
+        assert_equal 0 [r sismember myset 100000]
+        assert_equal 1 [r sismember myset 100001]
+        assert_equal 0 [r srem myset 100000]
+
+        set before [lsort -integer [r smembers myset]]
+        r debug reload
+        assert_encoding roaring myset
+        assert_equal $before [lsort -integer [r smembers myset]]
+    }
+
+    test "Roaring set uses much less memory than a hash table" {
+        r del myset1 myset2
+        set elements {}
+        for {set i 0} {$i < 100000} {incr i} {lappend elements [expr {$i*3}]}
+        r sadd myset1 {*}$elements
+        r sadd myset2 a {*}$elements
+        assert_encoding roaring myset1
+        assert_encoding hashtable myset2
+        assert {[r memory usage myset1]*10 < [r memory usage myset2]}
+    }
+
+    test "SSCAN of a roaring set" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 20000} {incr i} {
+            lappend elements [expr {$i*13-100000}]
+        }
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        set cur 0
+        set keys {}
+        set calls 0
+        while 1 {
+            set res [r sscan myset $cur count 100]
+            set cur [lindex $res 0]
+            assert {[llength [lindex $res 1]] <= 100}
+            lappend keys {*}[lindex $res 1]
+            incr calls
+            if {$cur == 0} break
+        }
+        assert {$calls > 100}
+        assert_equal $elements [lsort -integer $keys]
+
+        # Elements added and removed during the iteration.
+        set cur [lindex [r sscan myset 0 count 10000] 0]
+        r srem myset [lindex $elements 15000]
+        r sadd myset 1000000000
+        set keys {}
+        while 1 {
+            set res [r sscan myset $cur count 1000]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal 10000 [llength $keys]
+        assert {[lsearch $keys 1000000000] != -1}
+        assert {[lsearch $keys [lindex $elements 15000]] == -1}
+
+        set res [r sscan myset 0 count 100000 match *99]
+        foreach ele [lindex $res 1] {assert_match *99 $ele}
+    }
+
+    test "SSCAN across a conversion between roaring and hashtable" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 5000} {incr i} {
+            lappend elements [expr {$i*3-7000}]
+        }
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+
+        # A roaring cursor presented to the hash table restarts the scan.
+        set res [r sscan myset 0 count 1000]
+        set cur [lindex $res 0]
+        set keys [lindex $res 1]
+        r sadd myset foo
+        assert_encoding hashtable myset
+        while 1 {
+            set res [r sscan myset $cur count 1000]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal [lsort [concat $elements foo]] [lsort -unique $keys]
+
+        # And a hash table cursor presented to a roaring set as well.
+        set cur [lindex [r sscan myset 0 count 100] 0]
+        assert {$cur != 0}
+        r del myset
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        set keys {}
+        while 1 {
+            set res [r sscan myset $cur count 1000]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal $elements [lsort -integer -unique $keys]
+    }
+
+    test "SSCAN of a roaring set with adjacent elements" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 10000} {incr i} {lappend elements $i}
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r sscan myset $cur count 7]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal $elements [lsort -integer -unique $keys]
+    }
+
+    test "SPOP and SRANDMEMBER against a roaring set" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 5000} {incr i} {lappend elements [expr {$i*5}]}
+        r sadd myset {*}$elements
+        assert_encoding roaring myset
+        set res [r srandmember myset 100]
+        assert_equal 100 [llength [lsort -unique $res]]
+        foreach ele $res {assert_equal 0 [expr {$ele % 5}]}
+        foreach ele [r srandmember myset -100] {assert_equal 0 [expr {$ele % 5}]}
+        set popped [r spop myset 4000]
+        assert_equal 4000 [llength [lsort -unique $popped]]
+        assert_equal 1000 [r scard myset]
+        foreach ele $popped {assert_equal 0 [r sismember myset $ele]}
+        set ele [r spop myset]
+        assert_equal 0 [r sismember myset $ele]
+        assert_equal 999 [r scard myset]
+    }
+
+    test "SRANDMEMBER of a roaring set is not biased by sparse containers" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 65536} {incr i} {lappend elements $i}
+        r sadd myset {*}$elements 1000000
+        assert_encoding roaring myset
+        set hits 0
+        foreach ele [r srandmember myset -10000] {
+            if {$ele == 1000000} {incr hits}
+        }
+        # Expected ~0.15, it was ~5000 picking a random container first.
+        assert {$hits < 10}
+    }
+
+    test "Sparse roaring sets (one element per container)" {
+        r del myset
+        set elements {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend elements [expr {($i*7919%100000)*65536-3000000000}]
+        }
+        for {set i 0} {$i < 100000} {incr i 1000} {
+            r sadd myset {*}[lrange $elements $i [expr {$i+999}]]
+        }
+        assert_encoding roaring myset
+        assert_equal 100000 [r scard myset]
+        set sorted [lsort -integer $elements]
+        assert_equal [lrange $sorted 0 99] [lrange [r smembers myset] 0 99]
+
+        # Remove containers in the middle, then pop and sample.
+        r srem myset {*}[lrange $elements 0 19999]
+        assert_equal 80000 [r scard myset]
+        set popped [r spop myset 30000]
+        assert_equal 30000 [llength [lsort -unique $popped]]
+        assert_equal 50000 [r scard myset]
+        foreach ele [lrange $popped 0 999] {assert_equal 0 [r sismember myset $ele]}
+        foreach ele [r srandmember myset -1000] {
+            assert_equal 1 [r sismember myset $ele]
+        }
+        r sadd myset {*}[lrange $elements 0 999]
+        assert_equal 51000 [r scard myset]
+        assert_equal [lsort -integer [r smembers myset]] [r smembers myset]
+    }
+
     test {SREM basics - regular set} {
         create_set myset {foo bar ciao}
         assert_encoding hashtable myset
@@ -273,6 +496,86 @@ start_server {
         lsort [r sinter set1 set2]
     } {1 2 3}
 
+    test "SINTER of intsets with mixed encodings and sizes" {
+        r config set set-max-intset-entries 5000
+        r del set1 set2 set3 setres
+        set big [expr {1<<40}]
+        # Sets of different sizes, so that both the linear merge and the
+        # galloping search are used, and of different intset encodings.
+        for {set i 0} {$i < 4000} {incr i} {r sadd set1 [expr {$i*3}]}
+        for {set i 0} {$i < 300} {incr i} {r sadd set2 [expr {$i*7}]}
+        for {set i 0} {$i < 20} {incr i} {r sadd set3 [expr {$i*21}]}
+        r sadd set1 -70000 $big
+        r sadd set2 -70000 $big
+        r sadd set3 -70000 $big
+        foreach key {set1 set2 set3} {assert_encoding intset $key}
+        set expected {}
+        for {set i 0} {$i < 20} {incr i} {lappend expected [expr {$i*21}]}
+        lappend expected -70000 $big
+        set expected [lsort -integer $expected]
+        assert_equal $expected [lsort -integer [r sinter set1 set2 set3]]
+        assert_equal $expected [lsort -integer [r sinter set3 set1 set2 set1]]
+        assert_equal [llength $expected] [r sinterstore setres set2 set1 set3]
+        assert_encoding intset setres
+        assert_equal $expected [lsort -integer [r smembers setres]]
+        r del set1 set2 set3 setres
+        r config set set-max-intset-entries 512
+    }
+
+    test "SINTER, SUNION and SDIFF of roaring sets" {
+        r del set1 set2 set3 setres
+        set l1 {}
+        set l2 {}
+        set l3 {}
+        for {set i 0} {$i < 100000} {incr i} {lappend l1 $i}
+        for {set i 0} {$i < 40000} {incr i} {lappend l2 [expr {$i*3}]}
+        for {set i 0} {$i < 2000} {incr i} {lappend l3 [expr {$i*97-1000}]}
+        r sadd set1 {*}$l1
+        r sadd set2 {*}$l2
+        r sadd set3 {*}$l3
+        foreach key {set1 set2 set3} {assert_encoding roaring $key}
+
+        unset -nocomplain u
+        array set u {}
+        foreach ele [concat $l1 $l2 $l3] {set u($ele) 1}
+        set union [lsort -integer [array names u]]
+        set inter {}
+        foreach ele $l3 {
+            if {$ele >= 0 && $ele < 100000 && $ele % 3 == 0} {
+                lappend inter $ele
+            }
+        }
+
+        assert_equal $inter [lsort -integer [r sinter set1 set2 set3]]
+        # Small intersections are stored as intsets.
+        assert_equal [llength $inter] [r sinterstore setres set3 set2 set1]
+        assert_encoding intset setres
+        assert_equal $inter [lsort -integer [r smembers setres]]
+        assert_equal 33334 [llength [r sinter set1 set2]]
+        assert_equal 33334 [r sinterstore setres set1 set2]
+        assert_encoding roaring setres
+
+        assert_equal $union [lsort -integer [r sunion set1 set2 set3]]
+        assert_equal [llength $union] [r sunionstore setres set1 set2 set3]
+        assert_encoding roaring setres
+
+        assert_equal 66666 [r sdiffstore setres set1 set2]
+        assert_encoding roaring setres
+        assert_equal 0 [r sismember setres 3]
+        assert_equal 1 [r sismember setres 4]
+        assert_equal 66666 [llength [r sdiff set1 set2]]
+
+        # Mixing roaring sets with other encodings.
+        r del set4
+        r sadd set4 3 4 5 foo
+        assert_equal {3 4 5} [lsort [r sinter set4 set1]]
+        assert_equal {3} [lsort [r sinter set4 set1 set2]]
+        assert_equal {4 5 foo} [lsort [r sdiff set4 set2]]
+        assert_equal 100001 [r sunionstore setres set1 set4]
+        assert_encoding hashtable setres
+        r del set1 set2 set3 set4 setres
+    }
+
     test "SINTERSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sinterstore setres foo111 bar222]
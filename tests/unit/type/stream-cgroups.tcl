@@ -238,6 +238,66 @@ start_server {
         assert {[lindex $reply 0 3] == 2}
     }
 
+    test {XAUTOCLAIM claims the idle entries with the oldest delivery first} {
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        set id2 [r XADD mystream * b 2]
+        set id3 [r XADD mystream * c 3]
+        r XGROUP CREATE mystream mygroup 0
+
+        # Deliver item 3 first, then items 1 and 2.
+        r XCLAIM mystream mygroup client1 0 $id3 FORCE JUSTID
+        r debug sleep 0.2
+        r XREADGROUP GROUP mygroup client1 count 2 STREAMS mystream >
+        r debug sleep 0.2
+
+        # Nothing is idle enough.
+        assert_equal {} [r XAUTOCLAIM mystream mygroup client2 10000]
+
+        set reply [r XAUTOCLAIM mystream mygroup client2 300 COUNT 2]
+        assert_equal 1 [llength $reply]
+        assert_equal [list $id3 {c 3}] [lindex $reply 0]
+
+        set reply [r XAUTOCLAIM mystream mygroup client2 10 COUNT 1 JUSTID]
+        assert_equal [list $id1] $reply
+
+        # Claimed entries are not idle anymore, the next call returns the
+        # remaining item.
+        set reply [r XAUTOCLAIM mystream mygroup client2 10 JUSTID]
+        assert_equal [list $id2] $reply
+
+        set reply [r XPENDING mystream mygroup - + 10 client2]
+        assert_equal 3 [llength $reply]
+        assert_equal 1 [lindex $reply 0 3]
+        assert_equal 2 [lindex $reply 2 3]
+    }
+
+    test {XAUTOCLAIM does not see acknowledged entries or deleted consumers} {
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        set id2 [r XADD mystream * b 2]
+        set id3 [r XADD mystream * c 3]
+        r XGROUP CREATE mystream mygroup 0
+        r XREADGROUP GROUP mygroup client1 count 2 STREAMS mystream >
+        r XREADGROUP GROUP mygroup client2 count 1 STREAMS mystream >
+        r XACK mystream mygroup $id1
+        r XGROUP DELCONSUMER mystream mygroup client2
+        r debug sleep 0.1
+        assert_equal [list $id2] [r XAUTOCLAIM mystream mygroup client3 0 JUSTID]
+    }
+
+    test {XAUTOCLAIM works after a reload and with wrong arguments} {
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        r XGROUP CREATE mystream mygroup 0
+        r XREADGROUP GROUP mygroup client1 STREAMS mystream >
+        r debug reload
+        r debug sleep 0.1
+        assert_equal [list $id1] [r XAUTOCLAIM mystream mygroup client2 50 JUSTID]
+        assert_error "*COUNT must be > 0*" {r XAUTOCLAIM mystream mygroup client2 0 COUNT 0}
+        assert_error "*NOGROUP*" {r XAUTOCLAIM mystream nogroup client2 0}
+    }
+
     start_server {} {
         set master [srv -1 client]
         set master_host [srv -1 host]
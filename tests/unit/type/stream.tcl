@@ -102,6 +102,81 @@ start_server {
         }
     }
 
+    test {XADD with MINID option} {
+        r DEL mystream
+        for {set j 1} {$j < 1001} {incr j} {
+            set minid 1000
+            if {$j >= 5} {
+                set minid [expr {$j-5}]
+            }
+            if {rand() < 0.9} {
+                r XADD mystream MINID $minid $j xitem $j
+            } else {
+                r XADD mystream MINID $minid $j yitem $j
+            }
+        }
+        set res [r xrange mystream - +]
+        set expected 995
+        foreach r $res {
+            assert {[lindex $r 1 1] == $expected}
+            incr expected
+        }
+    }
+
+    test {XTRIM with MINID option} {
+        r DEL mystream
+        r config set stream-node-max-entries 10
+        for {set j 1} {$j <= 100} {incr j} {r XADD mystream $j-0 f v}
+        # Exact trimming can stop in the middle of a node.
+        assert_equal 44 [r XTRIM mystream MINID = 45]
+        assert_equal 45-0 [lindex [r XRANGE mystream - + COUNT 1] 0 0]
+        # Approximated trimming only evicts whole nodes.
+        assert_equal 6 [r XTRIM mystream MINID ~ 58]
+        assert_equal 51-0 [lindex [r XRANGE mystream - + COUNT 1] 0 0]
+        assert_equal 50 [r XTRIM mystream MINID 200]
+        assert_equal 0 [r XLEN mystream]
+    }
+
+    test {XTRIM with ~ and LIMIT} {
+        r DEL mystream
+        r config set stream-node-max-entries 10
+        for {set j 1} {$j <= 100} {incr j} {r XADD mystream $j-0 f v}
+        assert_equal 0 [r XTRIM mystream MAXLEN ~ 0 LIMIT 5]
+        assert_equal 30 [r XTRIM mystream MAXLEN ~ 0 LIMIT 30]
+        assert_equal 20 [r XTRIM mystream MINID ~ 51 LIMIT 35]
+        assert_equal 50 [r XLEN mystream]
+        r XADD mystream MAXLEN ~ 0 LIMIT 10 101-0 f v
+        assert_equal 41 [r XLEN mystream]
+        assert_error "*LIMIT cannot be used without*" {r XTRIM mystream MAXLEN 0 LIMIT 10}
+        assert_error "*not compatible*" {r XTRIM mystream MAXLEN 0 MINID 0}
+        r config set stream-node-max-entries 100
+    }
+
+    test {XTRIM with ~ is limited when stream-node-max-entries is 0} {
+        r DEL mystream
+        r config set stream-node-max-entries 0
+        for {set j 1} {$j <= 20000} {incr j} {r XADD mystream $j-0 f v}
+        set deleted [r XTRIM mystream MAXLEN ~ 0]
+        assert {$deleted > 0 && $deleted <= 10000}
+        r config set stream-node-max-entries 100
+    }
+
+    test {Stream nodes with many deleted entries are compacted} {
+        r DEL mystream
+        set payload [string repeat x 100]
+        for {set j 1} {$j <= 100} {incr j} {r XADD mystream $j-0 f $payload}
+        set before [r memory usage mystream]
+        for {set j 1} {$j <= 60} {incr j} {r XDEL mystream $j-0}
+        assert {[r memory usage mystream] < $before/2}
+        set res [r XRANGE mystream - +]
+        assert_equal 40 [llength $res]
+        assert_equal [list 61-0 [list f $payload]] [lindex $res 0]
+        assert_equal [list 100-0 [list f $payload]] [lindex $res end]
+        r XADD mystream 101-0 f $payload
+        assert_equal 101-0 [lindex [r XREVRANGE mystream + - COUNT 1] 0 0]
+        assert_equal 41 [r XLEN mystream]
+    }
+
     test {XADD mass insertion and XLEN} {
         r DEL mystream
         r multi
@@ -376,6 +451,20 @@ start_server {tags {"stream"} overrides {appendonly yes stream-node-max-entries
     }
 }
 
+start_server {tags {"stream"} overrides {appendonly yes stream-node-max-entries 10}} {
+    test {XTRIM with ~ MINID can propagate correctly} {
+        for {set j 1} {$j <= 100} {incr j} {
+            r XADD mystream $j-0 xitem v
+        }
+        r XTRIM mystream MINID ~ 85 LIMIT 100
+        assert {[r xlen mystream] == 20}
+        r config set stream-node-max-entries 1
+        r debug loadaof
+        r XADD mystream * xitem v
+        assert {[r xlen mystream] == 21}
+    }
+}
+
 start_server {tags {"xsetid"}} {
     test {XADD can CREATE an empty stream} {
         r XADD mystream MAXLEN 0 * a b
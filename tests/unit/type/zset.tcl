@@ -10,9 +10,10 @@ start_server {tags {"zset"}} {
         if {$encoding == "ziplist"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
-        } elseif {$encoding == "skiplist"} {
+        } elseif {$encoding == "skiplist" || $encoding == "btree"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding $encoding
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -737,6 +738,8 @@ start_server {tags {"zset"}} {
 
     basics ziplist
     basics skiplist
+    basics btree
+    r config set zset-large-encoding skiplist
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -791,9 +794,10 @@ start_server {tags {"zset"}} {
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
             set elements 128
-        } elseif {$encoding == "skiplist"} {
+        } elseif {$encoding == "skiplist" || $encoding == "btree"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-large-encoding $encoding
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -1200,6 +1204,8 @@ start_server {tags {"zset"}} {
     tags {"slow"} {
         stressers ziplist
         stressers skiplist
+        stressers btree
+        r config set zset-large-encoding skiplist
     }
 
     test {ZSET skiplist order consistency when elements are moved} {
@@ -1227,4 +1233,113 @@ start_server {tags {"zset"}} {
         }
         r config set zset-max-ziplist-entries $original_max
     }
+
+    proc zset_model_sort {a b} {
+        set cmp [expr {[lindex $a 0] < [lindex $b 0] ? -1 :
+                       [lindex $a 0] > [lindex $b 0] ? 1 : 0}]
+        if {$cmp == 0} {set cmp [string compare [lindex $a 1] [lindex $b 1]]}
+        return $cmp
+    }
+
+    test {ZSET btree consistency with random operations} {
+        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
+        r config set zset-max-ziplist-entries 0
+        r config set zset-large-encoding btree
+        r del zset
+        set model [dict create]
+        # Few distinct scores and enough elements to get a few levels.
+        for {set j 0} {$j < 30000} {incr j} {
+            set ele "e:[randomInt 6000]"
+            set op [randomInt 10]
+            if {$op < 6} {
+                set score [randomInt 1000]
+                r zadd zset $score $ele
+                dict set model $ele $score
+            } elseif {$op < 9} {
+                r zrem zset $ele
+                dict unset model $ele
+            } else {
+                set score [r zincrby zset 3 $ele]
+                dict set model $ele $score
+            }
+        }
+        assert_encoding btree zset
+
+        set expected {}
+        dict for {ele score} $model {lappend expected [list $score $ele]}
+        set expected [lsort -command zset_model_sort $expected]
+        set flat {}
+        foreach pair $expected {lappend flat [lindex $pair 1] [lindex $pair 0]}
+
+        assert_equal [llength $expected] [r zcard zset]
+        assert_equal $flat [r zrange zset 0 -1 withscores]
+        for {set j 0} {$j < 200} {incr j} {
+            set rank [randomInt [llength $expected]]
+            set ele [lindex $expected $rank 1]
+            assert_equal $rank [r zrank zset $ele]
+            assert_equal $ele [lindex [r zrange zset $rank $rank] 0]
+            assert_equal [expr {[llength $expected]-$rank-1}] [r zrevrank zset $ele]
+        }
+
+        # Ranges by score with offsets, checked against the model.
+        for {set j 0} {$j < 50} {incr j} {
+            set min [randomInt 1000]
+            set max [expr {$min+[randomInt 100]}]
+            set offset [randomInt 50]
+            set inrange {}
+            foreach pair $expected {
+                set score [lindex $pair 0]
+                if {$score >= $min && $score <= $max} {
+                    lappend inrange [lindex $pair 1]
+                }
+            }
+            assert_equal [llength $inrange] [r zcount zset $min $max]
+            assert_equal [lrange $inrange $offset [expr {$offset+9}]] \
+                [r zrangebyscore zset $min $max limit $offset 10]
+            assert_equal [lrange [lreverse $inrange] $offset [expr {$offset+9}]] \
+                [r zrevrangebyscore zset $max $min limit $offset 10]
+        }
+        assert_equal [lrange [lreverse $flat] 0 9] \
+            [lreverse [r zrange zset -5 -1 withscores]]
+        set sorted {}
+        foreach pair [lrange $expected 10 14] {lappend sorted [lindex $pair 1]}
+        assert_equal $sorted [r sort zset by nosort limit 10 5]
+
+        # Removing ranges merges and frees nodes.
+        set len [llength $expected]
+        set removed [r zremrangebyrank zset 100 [expr {$len-100}]]
+        assert_equal [expr {$len-199}] $removed
+        set flat [concat [lrange $flat 0 199] [lrange $flat end-197 end]]
+        assert_equal $flat [r zrange zset 0 -1 withscores]
+
+        set digest [r debug digest-value zset]
+        r debug reload
+        assert_encoding btree zset
+        assert_equal $digest [r debug digest-value zset]
+        r config set zset-large-encoding skiplist
+        r config set zset-max-ziplist-entries $original_max
+    }
+
+    test {ZSET btree encoding uses less memory than the skiplist} {
+        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
+        r config set zset-max-ziplist-entries 0
+        foreach enc {skiplist btree} {
+            r config set zset-large-encoding $enc
+            r del zset
+            set before [s used_memory]
+            for {set j 0} {$j < 50000} {incr j 100} {
+                set args {}
+                for {set k $j} {$k < $j+100} {incr k} {
+                    lappend args [randomInt 1000000] member:$k
+                }
+                r zadd zset {*}$args
+            }
+            assert_encoding $enc zset
+            set used($enc) [expr {[s used_memory]-$before}]
+        }
+        r del zset
+        r config set zset-large-encoding skiplist
+        r config set zset-max-ziplist-entries $original_max
+        assert {$used(btree)*1.2 < $used(skiplist)}
+    }
 }
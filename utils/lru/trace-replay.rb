@@ -0,0 +1,87 @@
+require 'rubygems'
+require 'redis'
+
+# Replay an access trace against a running Redis instance using different
+# maxmemory policies, and report the hit rate obtained by each one.
+#
+# Every access is a GET: on a miss the key is SET with a value of the
+# configured size, like a cache would do. Writes refused with an OOM error
+# (the TinyLFU admission policy may refuse them) are simply counted.
+#
+# The trace is a file with one key name per line. When no trace is given a
+# synthetic one is generated: accesses to a skewed hot set, interrupted by
+# scans of keys that are accessed just once, which is the access pattern
+# that flushes the hot set out of memory with plain LRU.
+
+$o = {
+    :maxmemory => 5*1024*1024,
+    :valsize => 100,
+    :policies => %w{allkeys-lru allkeys-lfu allkeys-tinylfu},
+    :accesses => 500000,
+    :hotkeys => 20000,
+    :scanlen => 50000,
+    :scanevery => 100000
+}
+
+def synthetic_trace
+    trace = []
+    scan = 0
+    $o[:accesses].times{|i|
+        if i > 0 && i % $o[:scanevery] == 0
+            $o[:scanlen].times{|j| trace << "scan:#{scan}:#{j}"}
+            scan += 1
+        end
+        # Skewed access: low ids are much more frequent.
+        trace << "hot:#{(($o[:hotkeys]) * (rand**3)).to_i}"
+    }
+    trace
+end
+
+def replay(r,trace,policy)
+    r.flushall
+    r.config("SET","maxmemory",0)
+    r.config("SET","maxmemory-policy",policy)
+    r.config("RESETSTAT")
+    r.config("SET","maxmemory",$o[:maxmemory])
+    val = "x"*$o[:valsize]
+    hits = misses = refused = 0
+    trace.each{|key|
+        if r.get(key)
+            hits += 1
+        else
+            misses += 1
+            begin
+                r.set(key,val)
+            rescue Redis::CommandError
+                refused += 1
+            end
+        end
+    }
+    info = r.info
+    printf("%-18s hit rate: %6.2f%%  evicted: %-8s refused writes: %d\n",
+        policy, hits*100.0/(hits+misses), info['evicted_keys'], refused)
+end
+
+trace = nil
+while ARGV.length > 0
+    arg = ARGV.shift
+    if arg == "--maxmemory"
+        $o[:maxmemory] = ARGV.shift.to_i
+    elsif arg == "--valsize"
+        $o[:valsize] = ARGV.shift.to_i
+    elsif arg == "--policies"
+        $o[:policies] = ARGV.shift.split(",")
+    elsif arg == "--trace"
+        trace = File.readlines(ARGV.shift).map{|l| l.strip}.reject{|l| l.empty?}
+    else
+        puts "Usage: ruby trace-replay.rb [--trace <file>] [--maxmemory <bytes>]"
+        puts "       [--valsize <bytes>] [--policies <policy,policy,...>]"
+        exit 1
+    end
+end
+
+trace = synthetic_trace if !trace
+puts "Replaying #{trace.length} accesses, maxmemory #{$o[:maxmemory]} bytes"
+r = Redis.new
+$o[:policies].each{|policy| replay(r,trace,policy)}
+r.config("SET","maxmemory",0)